@@ -0,0 +1,297 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <thread>
+#include <cstring>
+#include <cstdlib>
+
+#include "bench.h"
+#include "rx_ring.h"
+#include "daisy_exception.h"
+#include "timer.h"
+
+using namespace std;
+
+namespace RFM22B_NS {
+
+	static void put_le(uint8_t *pb, uint64_t v, size_t cb) {
+		for (size_t i = 0; i < cb; ++i, v >>= 8)
+			pb[i] = (uint8_t)v;
+	}
+
+	static uint64_t get_le(const uint8_t *pb, size_t cb) {
+		uint64_t v = 0;
+		for (size_t i = cb; i > 0; --i)
+			v = (v << 8) | pb[i-1];
+		return v;
+	}
+
+	// Writes key/value pairs and histograms either as one JSON object or
+	// as CSV lines "key,value" and "key,bucket,count".
+	class bench_report {
+	public:
+		bench_report(ostream& os, bench_format format, const char *side):
+			os{os}, format{format}
+		{
+			if (format == bench_format::JSON)
+				os << "{\"side\":\"" << side << "\"";
+			else
+				os << "side," << side << endl;
+		}
+
+		~bench_report() {
+			if (format == bench_format::JSON)
+				os << "}" << endl;
+		}
+
+		template<typename T>
+		void value(const char *key, T v) {
+			if (format == bench_format::JSON)
+				os << ",\"" << key << "\":" << v;
+			else
+				os << key << "," << v << endl;
+		}
+
+		void histogram(const char *key, const bench_histogram& h) {
+			double avg = h.count ? (double)h.sum / h.count : 0.0;
+			if (format == bench_format::JSON) {
+				os << ",\"" << key << "\":{\"count\":" << h.count
+				   << ",\"min\":" << h.min << ",\"avg\":" << avg
+				   << ",\"max\":" << h.max << ",\"buckets\":[";
+				bool first = true;
+				for (size_t i = 0; i < bench_histogram::BUCKETS; ++i) {
+					if (!h.bucket[i])
+						continue;
+					os << (first ? "" : ",") << "[" << lower(i) << ","
+					   << h.bucket[i] << "]";
+					first = false;
+				} // end for //
+				os << "]}";
+			} else {
+				os << key << ".count," << h.count << endl
+				   << key << ".min,"   << h.min   << endl
+				   << key << ".avg,"   << avg     << endl
+				   << key << ".max,"   << h.max   << endl;
+				for (size_t i = 0; i < bench_histogram::BUCKETS; ++i)
+					if (h.bucket[i])
+						os << key << ".bucket," << lower(i) << ","
+						   << h.bucket[i] << endl;
+			}
+		}
+
+	private:
+		// Lower bound of a histogram bucket:
+		static uint64_t lower(size_t i) { return i ? 1ULL << (i-1) : 0; }
+
+		ostream&     os;
+		bench_format format;
+	};
+
+	void bench_histogram::add(uint64_t v) {
+		size_t i = 0;
+		while ((i < BUCKETS - 1) && (v >= (1ULL << i)))
+			++i;
+		++bucket[i];
+		if ((count == 0) || (v < min))
+			min = v;
+		if (v > max)
+			max = v;
+		sum += v;
+		++count;
+	}
+
+	BenchSource::BenchSource(size_t n, const bench_config& config):
+		rnd{ config.seed ? config.seed : random_device{}() },
+		sizes{ (int)config.min_size, (int)config.max_size },
+		n{ n }
+	{
+		if ((config.min_size < BENCH_HEADER_SIZE) ||
+			(config.max_size < config.min_size) ||
+			(config.max_size > MAX_PAYLOAD_LENGTH))
+			throw daisy_exception("Invalid bench packet size");
+	}
+
+	packet_buffer *BenchSource::next() {
+		if (i >= n)
+			return NULL;
+		packet_buffer& pkt = storage.buffer;
+		uint8_t *pb = pkt.payload();
+		pkt.cb = sizes(rnd);
+		put_le(pb +  0, BENCH_MAGIC, 2);
+		put_le(pb +  2, i, 4);
+		put_le(pb +  6, n, 4);
+		for (size_t j = BENCH_HEADER_SIZE; j < pkt.cb; ++j)
+			pb[j] = (uint8_t)(i + j);
+		// Stamp as late as possible:
+		put_le(pb + 10, realtime_ns(), 8);
+		++i;
+		return &pkt;
+	}
+
+	void BenchAnalyzer::add(const packet_buffer& pkt, const rx_info& info) {
+		if (!info.crc_ok) {
+			++crcerrors;
+			return;
+		}
+		const uint8_t *pb = pkt.payload();
+		if ((pkt.cb < BENCH_HEADER_SIZE) || (get_le(pb, 2) != BENCH_MAGIC)) {
+			++foreign;
+			return;
+		}
+		uint32_t seq   = get_le(pb + 2, 4);
+		uint32_t count = get_le(pb + 6, 4);
+		uint64_t sent  = get_le(pb + 10, 8);
+		if ((seq >= count) || (count > MAX_SEQUENCE)) {
+			++corrupted;
+			return;
+		}
+		for (size_t j = BENCH_HEADER_SIZE; j < pkt.cb; ++j) {
+			if (pb[j] != (uint8_t)(seq + j)) {
+				++corrupted;
+				return;
+			}
+		} // end for //
+		if (count > expected)
+			expected = count;
+		if (seen.size() < expected)
+			seen.resize(expected, false);
+		if (seen[seq]) {
+			++duplicates;
+			return;
+		}
+		seen[seq] = true;
+		if (received && (seq < maxseq))
+			++reordered;
+		else
+			maxseq = seq;
+		++received;
+		octets += pkt.cb;
+		if (!first_rx)
+			first_rx = info.timestamp;
+		last_rx = info.timestamp;
+		rssi.add(info.rssi);
+
+		// Latency needs synchronized clocks, the jitter (RFC 3550: the
+		// difference of consecutive transit times) does not:
+		int64_t delay = (int64_t)(info.timestamp - sent);
+		if (delay < 0)
+			++skewed;
+		else
+			latency.add(delay / 1000);
+		if (have_last)
+			jitter.add(llabs(delay - last_delay) / 1000);
+		last_delay = delay;
+		have_last = true;
+	}
+
+	void BenchAnalyzer::write(ostream& os, bench_format format,
+			const rx_statistics *stats) const
+	{
+		bench_report r(os, format, "rx");
+		double elapsed = (last_rx - first_rx) / 1E9;
+		r.value("expected",   expected);
+		r.value("received",   received);
+		r.value("lost",       expected - received);
+		r.value("duplicates", duplicates);
+		r.value("reordered",  reordered);
+		r.value("corrupted",  corrupted);
+		r.value("foreign",    foreign);
+		r.value("crcerrors",  crcerrors);
+		r.value("skewed",     skewed);
+		r.value("octets",     octets);
+		r.value("seconds",    elapsed);
+		r.value("bps",        (elapsed > 0.0) ? octets * 8 / elapsed : 0.0);
+		if (stats) {
+			r.value("dropped",    stats->dropped.load());
+			r.value("overflows",  stats->overflows.load());
+			r.value("underflows", stats->underflows.load());
+			r.value("switch_us",  stats->switch_us.load());
+		}
+		r.histogram("latency_us", latency);
+		r.histogram("jitter_us",  jitter);
+		r.histogram("rssi",       rssi);
+	}
+
+	void bench_tx(RFM22B& chip, size_t n, const bench_config& config,
+			ostream& os)
+	{
+		BenchSource source(n, config);
+		Timer timer;
+		chip.send(source);
+		double elapsed = timer.elapsed();
+		const tx_statistics& stats = chip.getTXStatistics();
+		bench_report r(os, config.format, "tx");
+		r.value("packets",    stats.packets.load());
+		r.value("octets",     stats.octets.load());
+		r.value("seconds",    elapsed);
+		r.value("bps",        stats.octets * 8 / elapsed);
+		r.value("refills",    stats.refills.load());
+		r.value("refill_avg_ns", stats.refills ?
+				stats.refill_ns / stats.refills : 0);
+		r.value("refill_max_ns", stats.refill_max.load());
+		r.value("stalls",     stats.stalls.load());
+		r.value("overflows",  stats.overflows.load());
+		r.value("underflows", stats.underflows.load());
+		r.value("switch_us",  stats.switch_us.load());
+		r.value("switch_max_us", stats.switch_max_us.load());
+	}
+
+	void bench_rx(RFM22B& chip, unsigned int timeout,
+			const bench_config& config, ostream& os)
+	{
+		BenchAnalyzer analyzer;
+		AsyncReceiver receiver(chip);
+		FrameRing& ring = receiver.getRing();
+		receiver.start(timeout);
+		while (receiver.isRunning() || ring.front()) {
+			rx_frame *frame = ring.wait(100);
+			if (!frame)
+				continue;
+			analyzer.add(frame->packet(), frame->info);
+			ring.pop();
+		} // end while //
+		receiver.stop();
+		analyzer.write(os, config.format, &chip.getRXStatistics());
+	}
+
+	void bench_loopback(size_t n, const bench_config& config, ostream& os) {
+		BenchSource source(n, config);
+		BenchAnalyzer analyzer;
+		FrameRing ring(DEFAULT_RX_RING_CAPACITY);
+		std::thread producer([&]() {
+			packet_buffer *pkt;
+			while ((pkt = source.next()) != NULL) {
+				// Unlike the radio, the loopback waits for the consumer:
+				while (ring.getOccupancy() >= ring.getCapacity())
+					this_thread::yield();
+				packet_buffer *rx = ring.acquire();
+				memcpy(rx->payload(), pkt->payload(), pkt->cb);
+				rx->cb = pkt->cb;
+				ring.commit(rx, rx_info { realtime_ns(), 0, true });
+			} // end while //
+		});
+		for (size_t i = 0; i < n; ++i) {
+			rx_frame *frame = ring.wait(-1);
+			analyzer.add(frame->packet(), frame->info);
+			ring.pop();
+		} // end for //
+		producer.join();
+		analyzer.write(os, config.format);
+	}
+
+} // end namespace //
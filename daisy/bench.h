@@ -0,0 +1,131 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <iostream>
+#include <vector>
+#include <random>
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "rfm22b.h"
+#include "rfm22b_packet.h"
+
+namespace RFM22B_NS {
+
+	enum class bench_format { JSON, CSV };
+
+	struct bench_config {
+		size_t       min_size = 64;   // Payload size distribution: uniform
+		size_t       max_size = 64;   //   in [min_size, max_size]
+		bench_format format   = bench_format::JSON;
+		unsigned int seed     = 0;    // 0: random seed
+	};
+
+	/*
+	 * Every bench packet starts with this header (little endian):
+	 *    0: BENCH_MAGIC (2 octets)
+	 *    2: Sequence number, starting with 0 (4 octets)
+	 *    6: Number of packets of the run (4 octets)
+	 *   10: Wall clock at send time in ns (8 octets)
+	 * It is followed by (seq + index) & 0xff filler octets.
+	 */
+	static const uint16_t BENCH_MAGIC       = 0xdb01;
+	static const size_t   BENCH_HEADER_SIZE = 18;
+
+	// Histogram with power of two buckets: bucket 0 counts 0, bucket i
+	// counts values in [2^(i-1), 2^i), the last one everything above.
+	class bench_histogram {
+	public:
+		static const size_t BUCKETS = 28;
+
+		void add(uint64_t v);
+
+		uint64_t count = 0, sum = 0, min = 0, max = 0;
+		uint64_t bucket[BUCKETS] {};
+	};
+
+	// Source of bench packets for RFM22B::send() or any other transport.
+	class BenchSource {
+	public:
+		BenchSource(size_t n, const bench_config& config);
+
+		packet_buffer *next();
+
+		size_t getCount() const { return n; }
+
+	private:
+		packet_storage<>                   storage;
+		std::mt19937                       rnd;
+		std::uniform_int_distribution<int> sizes;
+		size_t                             n;
+		size_t                             i = 0;
+	};
+
+	// Evaluates received bench packets of any transport.
+	class BenchAnalyzer {
+	public:
+		// Feed a received packet:
+		void add(const packet_buffer& pkt, const rx_info& info);
+		// Write the report, with the radio counters if given:
+		void write(std::ostream& os, bench_format format,
+				const rx_statistics *stats = NULL) const;
+
+		uint32_t getReceived() const { return received; }
+		uint32_t getCorrupted() const { return corrupted; }
+
+	private:
+		static const size_t MAX_SEQUENCE = 1 << 24;
+
+		std::vector<bool> seen;
+		uint32_t          expected    = 0;  // Packets of the run
+		uint32_t          received    = 0;  // Unique packets
+		uint32_t          duplicates  = 0;
+		uint32_t          reordered   = 0;
+		uint32_t          corrupted   = 0;  // Valid CRC, bad content
+		uint32_t          foreign     = 0;  // No bench packet
+		uint32_t          crcerrors   = 0;
+		uint32_t          maxseq      = 0;
+		uint64_t          octets      = 0;
+		uint64_t          first_rx    = 0;
+		uint64_t          last_rx     = 0;
+		bool              have_last   = false;
+		int64_t           last_delay  = 0;
+		uint32_t          skewed      = 0;  // Received before sent
+		bench_histogram   latency;          // In us
+		bench_histogram   jitter;           // In us
+		bench_histogram   rssi;
+	};
+
+	// TX side: send n bench packets and report the TX counters.
+	void bench_tx(RFM22B& chip, size_t n, const bench_config& config,
+			std::ostream& os);
+	// RX side: receive for timeout s and report.
+	void bench_rx(RFM22B& chip, unsigned int timeout,
+			const bench_config& config, std::ostream& os);
+	// Software loopback: run n bench packets through a FrameRing without
+	// radio, to check the bench itself and the receive pipeline.
+	void bench_loopback(size_t n, const bench_config& config,
+			std::ostream& os);
+
+} // end namespace //
+
+#endif
@@ -17,8 +17,11 @@
  */
 
 #include <iostream>
+#include <iomanip>
 #include <cstdlib>
 #include <map>
+#include <functional>
+#include <memory>
 
 #include <signal.h>
 #include <execinfo.h>
@@ -28,6 +31,10 @@
 #include "defaults.h"
 #include "utility.h"
 #include "rfm22b_registers.h"
+#include "bench.h"
+#include "modem.h"
+#include "rate_control.h"
+#include "hopping.h"
 
 using namespace std;
 using namespace RFM22B_NS;
@@ -36,6 +43,29 @@ using namespace DaisyUtils;
 static void shell(RFM22B& chip);
 static void help(ostream &os, bool f_quiet = false);
 
+// Settings for the bench commands:
+static bench_config bench;
+
+// Settings and state of the rate controller, created on first use:
+static rate_config rate;
+static unique_ptr<RateController> ratectl;
+
+static RateController& rate_controller() {
+	if (!ratectl)
+		ratectl.reset(new RateController(rate, cout));
+	return *ratectl;
+}
+
+// Settings and channel plan for hopping, computed on first use:
+static hop_config hop;
+static unique_ptr<ChannelPlan> hopplan;
+
+static ChannelPlan& hop_plan() {
+	if (!hopplan)
+		hopplan.reset(new ChannelPlan(hop));
+	return *hopplan;
+}
+
 typedef function<void(RFM22B&, const string&)>
 	command_handler_type;
 
@@ -67,6 +97,35 @@ static const command_map_type command_map = {
 			[](RFM22B& chip, const string& arg)
 			{ noarg(arg);
 			  cout << "call=" << print_call(chip.getAddress()) << endl; }}},
+	{ "dest=", command {
+	  "<call>{-<SSID>}|*",  "Set destination callsign, * for broadcast",
+			[](RFM22B& chip, const string& arg)
+			{ if (arg == "*")
+				  chip.setDestination(RFM22B::HEADER_BROADCAST);
+			  else
+				  chip.setDestination(decode_call(arg)); }}},
+	{ "dest?", command {
+	  "", "Get destination header address",
+			[](RFM22B& chip, const string& arg)
+			{ noarg(arg);
+			  cout << "dest=0x" << hex << setw(4) << setfill('0')
+				   << chip.getDestination() << dec << setfill(' ') << endl; }}},
+	{ "netid=", command {
+	  "<number>", "Set network ID sent in the sync word, 0 for none",
+			[](RFM22B& chip, const string& arg)
+			{ uint32_t id = decode_uint32(arg);
+			  if (id > 0xffff)
+				  throw daisy_exception("Invalid network ID", arg);
+			  chip.setNetwork(id); }}},
+	{ "netid?", command {
+	  "", "Get network ID",
+			[](RFM22B& chip, const string& arg)
+			{ noarg(arg);
+			  cout << "netid=" << chip.getNetwork() << endl; }}},
+	{ "promiscuous=", command {
+	  "<on|off>", "Receive frames for all header addresses",
+			[](RFM22B& chip, const string& arg)
+			{ chip.setPromiscuous(decode_bool(arg)); }}},
 	{ "qrg=", command {
 	  "<number>", "Set frequency in Hz",
 			[](RFM22B& chip, const string& arg)
@@ -357,6 +416,20 @@ static const command_map_type command_map = {
 		[](RFM22B& chip, const string& arg)
 		{ noarg(arg);
 		  cout << "bandwidth=" << print(chip.getBandwidth()) << endl; }}},
+	{ "modem=", command {
+		"<bps>,<deviation>{,<ppm>}", "Compute and set modem configuration",
+		[](RFM22B& chip, const string& arg)
+		{ vector<string> v = split(arg, ',');
+		  if ((v.size() < 2) || (v.size() > 3))
+			  throw daisy_exception("Invalid modem", arg);
+		  modem_config c;
+		  c.data_rate = decode_uint32(v[0]);
+		  c.deviation = decode_uint32(v[1]);
+		  if (v.size() > 2)
+			  c.xtal_ppm = decode_uint32(v[2]);
+		  c.modulation = chip.getModulationType();
+		  c.frequency  = chip.getCarrierFrequency();
+		  chip.setModem(ModemCalculator(c)); }}},
 	{ "preamble=", command {
 		"<number>", "Set length of preamble in bits",
 		[](RFM22B& chip, const string& arg)
@@ -375,6 +448,145 @@ static const command_map_type command_map = {
 		"<number>", "Receive for <number>s",
 		[](RFM22B& chip, const string& arg)
 		{ chip.rx_packages(decode_uint32(arg)); }}},
+	{ "benchsize=", command {
+		"<min>{-<max>}", "Set bench packet size (uniform distribution)",
+		[](RFM22B& chip, const string& arg)
+		{ vector<string> v = split(arg, '-');
+		  if ((v.size() < 1) || (v.size() > 2))
+			  throw daisy_exception("Invalid size", arg);
+		  bench.min_size = decode_uint8(v[0]);
+		  bench.max_size = decode_uint8(v[v.size()-1]); }}},
+	{ "benchsize?", command {
+		"", "Get bench packet size",
+		[](RFM22B& chip, const string& arg)
+		{ noarg(arg);
+		  cout << "benchsize=" << bench.min_size << "-"
+			   << bench.max_size << endl; }}},
+	{ "benchformat=", command {
+		"<json|csv>", "Set bench report format",
+		[](RFM22B& chip, const string& arg)
+		{ string f = tolower(arg);
+		  if (f == "json")
+			  bench.format = bench_format::JSON;
+		  else if (f == "csv")
+			  bench.format = bench_format::CSV;
+		  else
+			  throw daisy_exception("Invalid format", arg); }}},
+	{ "benchseed=", command {
+		"<number>", "Set bench random seed (0: random)",
+		[](RFM22B& chip, const string& arg)
+		{ bench.seed = decode_uint32(arg); }}},
+	{ "benchtx=", command {
+		"<number>", "Send <number> bench packages",
+		[](RFM22B& chip, const string& arg)
+		{ bench_tx(chip, decode_uint32(arg), bench, cout); }}},
+	{ "benchrx=", command {
+		"<number>", "Receive bench packages for <number>s",
+		[](RFM22B& chip, const string& arg)
+		{ bench_rx(chip, decode_uint32(arg), bench, cout); }}},
+	{ "benchloop=", command {
+		"<number>", "Run <number> bench packages through a loopback",
+		[](RFM22B& chip, const string& arg)
+		{ bench_loopback(decode_uint32(arg), bench, cout); }}},
+	{ "rateid=", command {
+		"<number>", "Set station id for rate control (0: random)",
+		[](RFM22B& chip, const string& arg)
+		{ rate.station = decode_uint32(arg);
+		  ratectl.reset(); }}},
+	{ "rateprofile=", command {
+		"<auto|narrow|medium|wide>", "Set rate control profile",
+		[](RFM22B& chip, const string& arg)
+		{ string p = tolower(arg);
+		  if (p == "auto") {
+			  rate_controller().setAuto(true);
+			  return;
+		  }
+		  const vector<rate_profile>& profiles = rate_profiles();
+		  for (size_t i = 0; i < profiles.size(); ++i) {
+			  if (p != profiles[i].name)
+				  continue;
+			  rate_controller().setProfile(i);
+			  chip.setModem(profiles[i].modem());
+			  return;
+		  } // end for //
+		  throw daisy_exception("Invalid profile", arg); }}},
+	{ "rate?", command {
+		"", "Get rate control statistics",
+		[](RFM22B& chip, const string& arg)
+		{ noarg(arg);
+		  rate_controller().write(cout); }}},
+	{ "ratelink=", command {
+		"<number>", "Run rate control for <number>s",
+		[](RFM22B& chip, const string& arg)
+		{ rate_link(chip, rate_controller(), decode_uint32(arg)); }}},
+	{ "channels=", command {
+		"<base>,<spacing>,<count>", "Set channel plan, frequencies in Hz",
+		[](RFM22B& chip, const string& arg)
+		{ vector<string> v = split(arg, ',');
+		  if (v.size() != 3)
+			  throw daisy_exception("Invalid channel plan", arg);
+		  hop.base     = decode_uint32(v[0]);
+		  hop.spacing  = decode_uint32(v[1]);
+		  hop.channels = decode_uint32(v[2]);
+		  hopplan.reset();
+		  hop_plan(); }}},
+	{ "channels?", command {
+		"", "Get channel plan and occupancy",
+		[](RFM22B& chip, const string& arg)
+		{ noarg(arg);
+		  hop_plan().write(cout); }}},
+	{ "network=", command {
+		"<number>", "Set network id, the seed of the hop sequence",
+		[](RFM22B& chip, const string& arg)
+		{ hop.network = decode_uint32(arg);
+		  hopplan.reset(); }}},
+	{ "dwell=", command {
+		"<number>", "Set dwell time per hop in ms",
+		[](RFM22B& chip, const string& arg)
+		{ hop.dwell = decode_uint32(arg);
+		  hopplan.reset(); }}},
+	{ "hopchannel=", command {
+		"<number>", "Switch to channel <number> of the plan",
+		[](RFM22B& chip, const string& arg)
+		{ hop_plan().select(chip, decode_uint8(arg)); }}},
+	{ "scan=", command {
+		"<number>", "Measure occupancy for <number>ms per channel",
+		[](RFM22B& chip, const string& arg)
+		{ hop_plan().scan(chip, decode_uint32(arg));
+		  hop_plan().write(cout); }}},
+	{ "assign=", command {
+		"<number>", "Switch to the channel for access station <number>",
+		[](RFM22B& chip, const string& arg)
+		{ uint8_t ch = hop_plan().assign(decode_uint32(arg));
+		  hop_plan().select(chip, ch);
+		  cout << "channel=" << (unsigned int)ch << endl; }}},
+	{ "hopbench=", command {
+		"<number>", "Time <number> channel switches per method",
+		[](RFM22B& chip, const string& arg)
+		{ hop_bench(chip, hop_plan(), decode_uint32(arg), cout); }}},
+	{ "hop=", command {
+		"<number>", "Receive hopping for <number>s",
+		[](RFM22B& chip, const string& arg)
+		{ hop_link(chip, hop_plan(), decode_uint32(arg), cout); }}},
+	{ "spispeed=", command {
+		"<number>", "Set SPI clock in Hz",
+		[](RFM22B& chip, const string& arg)
+		{ chip.setSPISpeed(decode_uint32(arg)); }}},
+	{ "spispeed?", command {
+		"", "Get SPI clock in Hz",
+		[](RFM22B& chip, const string& arg)
+		{ noarg(arg);
+		  cout << "spispeed=" << chip.getSPISpeed() << endl; }}},
+	{ "spicalibrate=", command {
+		"<number>", "Find the fastest reliable SPI clock up to <number>Hz",
+		[](RFM22B& chip, const string& arg)
+		{ for (const spi_speed_step& s: chip.calibrateSPISpeed(
+				  decode_uint32(arg)))
+			  cout << setw(9) << s.hz << " Hz: "
+				   << s.errors << " errors, "
+				   << s.transfer_ns / 1000.0 << " us/"
+				   << RFM22B::MAX_PACKET_LENGTH + 1 << " octets" << endl;
+		  cout << "spispeed=" << chip.getSPISpeed() << endl; }}},
 	{ "narrow", command {
 		"", "Set narrow mode",
 		[](RFM22B& chip, const string& arg)
@@ -405,7 +617,7 @@ static void help(ostream &os, bool f_quiet) {
 	if (f_quiet)
 		return;
 
-	os << "Usage: daisy <spifile> [options]" << endl
+	os << "Usage: daisy <spifile>|none [options]" << endl
 	   << "  options:" << endl;
 
 	int maxd = 0, maxo = 0;
@@ -556,7 +768,8 @@ int main(int argc, char* argv[]) {
 			return EXIT_SUCCESS;
 		}
 		RFM22B chip;
-		if (!chip.open(argv[1]))
+		// "none" runs without chip, e.g. for benchloop:
+		if ((string(argv[1]) != "none") && !chip.open(argv[1]))
 			throw daisy_exception(
 					"Unable to open file \"" + string(argv[1]) + "\"");
 
@@ -22,9 +22,12 @@
 #define DEFAULT_TUNE_TIME         10 // In s
 #define DEFAULT_RX_TIMEOUT        30 // In s
 #define DEFAULT_NUM_PACKAGE      100
+#define DEFAULT_RX_RING_CAPACITY  16 // In frames
 
 #define SIMULATE_INTERRUPTS true
 #define INTERRUPT_POLL_TIME        5 // In us
+#define REACTOR_POLL_TIME          1 // In ms, chips without nIRQ line
+#define REACTOR_TICK_TIME        100 // In ms, stalls and timeouts
 #define DETECT_ONLY_RISING_EDGES   1
 #define BUS_CLOCK_DIVIDER        128 // Controls bus speed
 
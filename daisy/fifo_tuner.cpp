@@ -0,0 +1,65 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "fifo_tuner.h"
+
+using namespace std;
+
+namespace RFM22B_NS {
+
+	void FifoTuner::setDataRate(unsigned int bps) {
+		byte_ns = 8.0E9 / max(bps, 1u);
+	}
+
+	void FifoTuner::sample(uint64_t ns) {
+		double x = ns;
+		if (first) {
+			srtt   = x;
+			rttvar = x / 2;
+			first  = false;
+		} else {
+			rttvar = 0.75 * rttvar + 0.25 * fabs(srtt - x);
+			srtt   = 0.875 * srtt + 0.125 * x;
+		}
+		if ((margin > 1) && (++clean >= DECAY)) {
+			margin /= 2;
+			clean = 0;
+		}
+	}
+
+	void FifoTuner::fault() {
+		++faults;
+		clean = 0;
+		margin = min(2 * margin, (unsigned int)MAX_MARGIN);
+	}
+
+	fifo_thresholds FifoTuner::getThresholds() const {
+		// Octets that pass while an interrupt is served:
+		unsigned int n = min<double>(
+				ceil(margin * getLatency() / byte_ns) + GUARD,
+				FIFO_SIZE - MIN_CHUNK);
+		fifo_thresholds th;
+		th.tx_almost_empty = n;
+		th.rx_almost_full  = FIFO_SIZE - n;
+		return th;
+	}
+
+} // end namespace //
@@ -0,0 +1,76 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FIFO_TUNER_H
+#define _FIFO_TUNER_H
+
+#include <stdint.h>
+
+namespace RFM22B_NS {
+
+	struct fifo_thresholds {
+		uint8_t tx_almost_empty;
+		uint8_t rx_almost_full;
+	};
+
+	/*
+	 * Chooses the FIFO thresholds from the data rate and the measured
+	 * interrupt service latency. Few interrupts need big chunks, that is
+	 * a low TX almost empty and a high RX almost full threshold. While an
+	 * interrupt is pending and served the chip keeps sending or receiving,
+	 * so the thresholds have to leave room for the octets of that time.
+	 * The latency is estimated like a TCP round trip (srtt + 4 * rttvar),
+	 * an over- or underflow doubles the safety margin, which decays again
+	 * after a run of clean services.
+	 */
+	class FifoTuner {
+	public:
+		static const unsigned int FIFO_SIZE  = 64;
+		static const unsigned int MIN_CHUNK  = 8;   // Octets per interrupt
+		static const unsigned int GUARD      = 2;   // Octets
+		static const unsigned int MAX_MARGIN = 16;
+		static const unsigned int DECAY      = 256; // Clean services
+
+		explicit FifoTuner(unsigned int data_rate = 4800) {
+			setDataRate(data_rate); }
+
+		void setDataRate(unsigned int bps);
+		// Time from the interrupt to the end of its service in ns:
+		void sample(uint64_t ns);
+		// An over- or underflow happened:
+		void fault();
+
+		fifo_thresholds getThresholds() const;
+		// Latency used for the thresholds in ns, without the margin:
+		uint64_t getLatency() const { return srtt + 4 * rttvar; }
+		unsigned int getMargin() const { return margin; }
+		unsigned int getFaults() const { return faults; }
+
+	private:
+		double       byte_ns = 0.0;
+		double       srtt    = 0.0;
+		double       rttvar  = 0.0;
+		bool         first   = true;
+		unsigned int margin  = 1;
+		unsigned int clean   = 0;
+		unsigned int faults  = 0;
+	};
+
+} // end namespace //
+
+#endif
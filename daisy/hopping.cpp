@@ -0,0 +1,201 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <random>
+#include <iomanip>
+
+#include <unistd.h>
+
+#include "hopping.h"
+#include "modem.h"
+#include "rx_ring.h"
+#include "daisy_exception.h"
+#include "timer.h"
+
+using namespace std;
+
+namespace RFM22B_NS {
+
+	// Channels within this occupancy of the best count as equal:
+	static const double ASSIGN_TOLERANCE = 0.05;
+
+	ChannelPlan::ChannelPlan(const hop_config& config): config{config} {
+		if ((config.channels == 0) || (config.channels > 256))
+			throw daisy_exception("Invalid number of channels",
+					to_string(config.channels));
+		if (config.dwell == 0)
+			throw daisy_exception("Invalid dwell time");
+		images.resize(config.channels);
+		for (size_t ch = 0; ch < config.channels; ++ch) {
+			images[ch].tx[0] = (uint8_t)
+					RFM22B_Register::FREQUENCY_BAND_SELECT | 0x80;
+			carrier_registers(getFrequency(ch), &images[ch].tx[1]);
+		} // end for //
+
+		sequence.resize(config.channels);
+		for (size_t ch = 0; ch < config.channels; ++ch)
+			sequence[ch] = ch;
+		mt19937 rnd(config.network);
+		for (size_t i = config.channels - 1; i > 0; --i)
+			swap(sequence[i], sequence[rnd() % (i + 1)]);
+
+		samples.resize(config.channels);
+		busy.resize(config.channels);
+	}
+
+	void ChannelPlan::select(RFM22B& chip, uint8_t ch) {
+		if (ch >= images.size())
+			throw daisy_exception("Invalid channel", to_string(ch));
+		uint8_t rx[sizeof(channel_image::tx)];
+		chip.transfer(images[ch].tx, rx, sizeof(channel_image::tx));
+	}
+
+	uint8_t ChannelPlan::getHop(uint64_t time) const {
+		uint64_t hop = time / (config.dwell * 1000000ULL);
+		return sequence[hop % sequence.size()];
+	}
+
+	uint64_t ChannelPlan::getNextHop(uint64_t time) const {
+		uint64_t dwell = config.dwell * 1000000ULL;
+		return (time / dwell + 1) * dwell;
+	}
+
+	void ChannelPlan::sample(uint8_t ch, uint8_t rssi, uint8_t threshold) {
+		++samples[ch];
+		if (rssi >= threshold)
+			++busy[ch];
+	}
+
+	void ChannelPlan::scan(RFM22B& chip, unsigned int ms) {
+		uint8_t threshold = config.busy ? config.busy : chip.getSquelch();
+		chip.enableRXMode();
+		for (size_t ch = 0; ch < images.size(); ++ch) {
+			select(chip, ch);
+			usleep(1000); // PLL settling and RSSI averaging
+			uint64_t end = monotonic_ns() + ms * 1000000ULL;
+			while (monotonic_ns() < end)
+				sample(ch, chip.getRSSI(), threshold);
+		} // end for //
+		chip.disableRXMode();
+		select(chip, 0);
+	}
+
+	uint8_t ChannelPlan::assign(uint32_t station) const {
+		double best = 1.0;
+		for (size_t ch = 0; ch < images.size(); ++ch)
+			best = min(best, getOccupancy(ch));
+		vector<uint8_t> candidates;
+		for (size_t ch = 0; ch < images.size(); ++ch)
+			if (getOccupancy(ch) <= best + ASSIGN_TOLERANCE)
+				candidates.push_back(ch);
+		// Knuth's multiplicative hash spreads consecutive ids:
+		return candidates[(station * 2654435761U) % candidates.size()];
+	}
+
+	void ChannelPlan::write(ostream& os) const {
+		os << "channels=" << images.size() << " dwell=" << config.dwell
+		   << "ms network=" << config.network << endl;
+		for (size_t ch = 0; ch < images.size(); ++ch)
+			os << "  " << setw(3) << ch << ": " << getFrequency(ch)
+			   << "Hz occupancy=" << fixed << setprecision(3)
+			   << getOccupancy(ch) << " samples=" << samples[ch] << endl;
+		os.unsetf(ios::fixed);
+		os << setprecision(6) << "sequence=";
+		for (size_t i = 0; i < sequence.size(); ++i)
+			os << (i ? "," : "") << (unsigned int)sequence[i];
+		os << endl;
+	}
+
+	void hop_bench(RFM22B& chip, ChannelPlan& plan, size_t n, ostream& os) {
+		const hop_config& config = plan.getConfig();
+		size_t channels = plan.getChannels();
+		if (n == 0)
+			throw daisy_exception("Invalid number of switches");
+
+		Timer timer;
+		for (size_t i = 0; i < n; ++i)
+			chip.setCarrierFrequency(plan.getFrequency(i % channels));
+		double carrier = timer.elapsed();
+
+		timer.reset();
+		for (size_t i = 0; i < n; ++i)
+			plan.select(chip, i % channels);
+		double image = timer.elapsed();
+
+		os << "hopbench: switches=" << n
+		   << " carrier_us=" << carrier / n * 1E6
+		   << " image_us=" << image / n * 1E6;
+
+		// The hopping registers need the spacing in 10kHz steps:
+		if ((config.spacing % 10000 == 0) && (config.spacing <= 2550000)) {
+			chip.setCarrierFrequency(config.base);
+			chip.setFrequencyHoppingStepSize(config.spacing);
+			timer.reset();
+			for (size_t i = 0; i < n; ++i)
+				chip.setChannel(i % channels);
+			double hop = timer.elapsed();
+			chip.setChannel(0);
+			chip.setFrequencyHoppingStepSize(0);
+			os << " register_us=" << hop / n * 1E6;
+		}
+		os << endl;
+		plan.select(chip, 0);
+	}
+
+	void hop_link(RFM22B& chip, ChannelPlan& plan, unsigned int timeout,
+			ostream& os)
+	{
+		const hop_config& config = plan.getConfig();
+		uint8_t threshold = config.busy ? config.busy : chip.getSquelch();
+		vector<uint64_t> frames(plan.getChannels());
+
+		AsyncReceiver receiver(chip);
+		FrameRing& ring = receiver.getRing();
+		uint64_t now = realtime_ns();
+		uint64_t end = now + timeout * 1000000000ULL;
+		uint8_t  ch = plan.getHop(now);
+		uint64_t next = plan.getNextHop(now);
+		plan.select(chip, ch);
+		receiver.start();
+		while ((now = realtime_ns()) < end) {
+			if (now >= next) {
+				// The receiver keeps running, the PLL follows the new
+				// carrier:
+				ch = plan.getHop(now);
+				next = plan.getNextHop(now);
+				plan.select(chip, ch);
+			}
+			rx_frame *frame = ring.wait(
+					min<uint64_t>((next - now) / 1000000 + 1, 10));
+			if (frame) {
+				++frames[plan.getHop(frame->info.timestamp)];
+				ring.pop();
+			}
+			plan.sample(ch, chip.getRSSI(), threshold);
+		} // end while //
+		receiver.stop();
+		plan.select(chip, 0);
+
+		os << "hop: frames=";
+		for (size_t i = 0; i < frames.size(); ++i)
+			os << (i ? "," : "") << frames[i];
+		os << endl;
+		plan.write(os);
+	}
+
+} // end namespace //
@@ -0,0 +1,108 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _HOPPING_H
+#define _HOPPING_H
+
+#include <iostream>
+#include <vector>
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "rfm22b.h"
+
+namespace RFM22B_NS {
+
+	struct hop_config {
+		unsigned int base     = 433100000; // Hz, channel 0
+		unsigned int spacing  = 100000;    // Hz
+		unsigned int channels = 16;
+		unsigned int dwell    = 100;       // ms per hop
+		uint32_t     network  = 0;         // Seed of the hop sequence
+		uint8_t      busy     = 0;         // RSSI of a busy channel,
+		                                   // 0: squelch register
+	};
+
+	/*
+	 * A channel plan with the carrier registers (0x75..0x77) of every
+	 * channel precomputed, so that a channel switch is a single SPI
+	 * burst without floating point math.
+	 *
+	 * The hop sequence is a permutation of the channels that only
+	 * depends on the network id, the current hop on the wall clock
+	 * (see realtime_ns()). Stations with synchronized clocks therefore
+	 * meet without search: A joining station computes the current
+	 * channel and is there. The permutation is computed with its own
+	 * Fisher-Yates shuffle on mt19937, because std::shuffle is not the
+	 * same on all library versions.
+	 */
+	class ChannelPlan {
+	public:
+		explicit ChannelPlan(const hop_config& config);
+
+		// Switch the chip to channel ch:
+		void select(RFM22B& chip, uint8_t ch);
+
+		unsigned int getFrequency(uint8_t ch) const {
+			return config.base + ch * config.spacing; }
+		size_t getChannels() const { return images.size(); }
+		const hop_config& getConfig() const { return config; }
+
+		// Channel of the hop at time (ns) and start of the next hop:
+		uint8_t  getHop(uint64_t time) const;
+		uint64_t getNextHop(uint64_t time) const;
+
+		// Sample the RSSI for ms on every channel and update the
+		// occupancy. The chip is left on channel 0.
+		void scan(RFM22B& chip, unsigned int ms);
+		// Add an RSSI sample of channel ch:
+		void sample(uint8_t ch, uint8_t rssi, uint8_t threshold);
+		// Fraction of busy samples of channel ch:
+		double getOccupancy(uint8_t ch) const {
+			return samples[ch] ? (double)busy[ch] / samples[ch] : 0.0; }
+
+		// Channel for an access station: One of the least occupied
+		// channels, different stations get different ones among equals.
+		uint8_t assign(uint32_t station) const;
+
+		void write(std::ostream& os) const;
+
+	private:
+		// Register burst: 0x75 with write bit, then 0x75..0x77:
+		struct channel_image {
+			uint8_t tx[4];
+		};
+
+		hop_config                 config;
+		std::vector<channel_image> images;
+		std::vector<uint8_t>       sequence;
+		std::vector<uint32_t>      samples, busy;
+	};
+
+	// Time n channel switches with setCarrierFrequency(), the
+	// precomputed images and the hopping registers, and report.
+	void hop_bench(RFM22B& chip, ChannelPlan& plan, size_t n,
+			std::ostream& os);
+	// Hop for timeout s and report the received frames per channel.
+	void hop_link(RFM22B& chip, ChannelPlan& plan, unsigned int timeout,
+			std::ostream& os);
+
+} // end namespace //
+
+#endif
@@ -0,0 +1,247 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <string>
+
+#include "modem.h"
+#include "daisy_exception.h"
+
+using namespace std;
+
+namespace RFM22B_NS {
+
+	struct BW {
+		unsigned int bw;
+		uint8_t      ndec_exp;
+		uint8_t      dwn3_bypass;
+		uint8_t      filset;
+	};
+
+	static BW bwtable[] = {
+			{   2600, 5, 0,  1 }, {   2800, 5, 0,  2 },
+			{   3100, 5, 0,  3 }, {   3200, 5, 0,  4 },
+			{   3700, 5, 0,  5 }, {   4200, 5, 0,  6 },
+			{   4500, 5, 0,  7 }, {   4900, 4, 0,  1 },
+			{   5400, 4, 0,  2 }, {   5900, 4, 0,  3 },
+			{   6100, 4, 0,  4 }, {   7200, 4, 0,  5 },
+			{   8200, 4, 0,  6 }, {   8800, 4, 0,  7 },
+			{   9500, 3, 0,  1 }, {  10600, 3, 0,  2 },
+			{  11500, 3, 0,  3 }, {  12100, 3, 0,  4 },
+			{  14200, 3, 0,  5 }, {  16200, 3, 0,  6 },
+			{  17500, 3, 0,  7 }, {  18900, 2, 0,  1 },
+			{  21000, 2, 0,  2 }, {  22700, 2, 0,  3 },
+			{  24000, 2, 0,  4 }, {  28200, 2, 0,  5 },
+			{  32200, 2, 0,  6 }, {  34700, 2, 0,  7 },
+			{  37700, 1, 0,  1 }, {  41700, 1, 0,  2 },
+			{  45200, 1, 0,  3 }, {  47900, 1, 0,  4 },
+			{  56200, 1, 0,  5 }, {  64100, 1, 0,  6 },
+			{  69200, 1, 0,  7 }, {  75200, 0, 0,  1 },
+			{  83200, 0, 0,  2 }, {  90000, 0, 0,  3 },
+			{  95300, 0, 0,  4 }, { 112100, 0, 0,  5 },
+			{ 127900, 0, 0,  6 }, { 137900, 0, 0,  7 },
+			{ 142800, 1, 1,  4 }, { 167800, 1, 1,  5 },
+			{ 181100, 1, 1,  9 }, { 191500, 0, 1, 15 },
+			{ 225100, 0, 1,  1 }, { 248800, 0, 1,  2 },
+			{ 269300, 0, 1,  3 }, { 284900, 0, 1,  4 },
+			{ 335500, 0, 1,  8 }, { 361800, 0, 1,  9 },
+			{ 420200, 0, 1, 10 }, { 468400, 0, 1, 11 },
+			{ 518800, 0, 1, 12 }, { 577000, 0, 1, 13 },
+			{ 620700, 0, 1, 14 }, {      0, 0, 1, 13 }
+	};
+
+	uint8_t if_filter_register(unsigned int bw) {
+		BW *_bw;
+		for (_bw = bwtable; _bw->bw != 0; ++_bw) {
+			if (_bw->bw >= bw)
+				break;
+		} // end for //
+		return (_bw->dwn3_bypass << 7) |
+			   (_bw->ndec_exp    << 4) |
+			   (_bw->filset          );
+	}
+
+	unsigned int if_filter_bandwidth(uint8_t reg) {
+		for (BW *_bw = bwtable; _bw->bw != 0; ++_bw) {
+			if ((_bw->dwn3_bypass == ((reg & 0x80) >> 7)) &&
+				(_bw->ndec_exp    == ((reg & 0x70) >> 4)) &&
+				(_bw->filset      == ((reg & 0x0f)     )))
+			{
+				return _bw->bw;
+			}
+		} // end for //
+		return 0; // Not a useful setting.
+	}
+
+	ModemCalculator::ModemCalculator(const modem_config& c) {
+		if ((c.data_rate < 123) || (c.data_rate > 256000))
+			throw daisy_exception("Data rate out of range (123..256_000)",
+					to_string(c.data_rate));
+		if (c.deviation >= 320000)
+			throw daisy_exception("Deviation too large (0..319_999)",
+					to_string(c.deviation));
+		if ((c.frequency < 240E6) || (c.frequency > 960E6))
+			throw daisy_exception("Frequency out of range",
+					to_string(c.frequency));
+
+		const double  chiprate = c.data_rate * (c.manchester ? 2.0 : 1.0);
+		const uint8_t hbsel    = (c.frequency >= 480E6);
+		const double  offset   = 2.0 * c.xtal_ppm * 1E-6 * c.frequency;
+
+		// IF filter:
+		unsigned int bw = c.if_bandwidth ? c.if_bandwidth :
+				(unsigned int)ceil(2.0 * c.deviation + chiprate + offset);
+		uint8_t ifreg = if_filter_register(bw);
+		if_bandwidth = if_filter_bandwidth(ifreg);
+		const unsigned int dwn3 = (ifreg & 0x80) >> 7;
+		const int          ndec = (ifreg & 0x70) >> 4;
+
+		// Clock recovery:
+		rxosr = lround(500.0 * (1 + 2 * dwn3) /
+				(pow(2.0, ndec - 3) * chiprate / 1000.0));
+		if (rxosr > 0x7ff)
+			throw daisy_exception("Data rate too low for IF bandwidth",
+					to_string(if_bandwidth));
+		ncoff = lround(chiprate * pow(2.0, 20 + ndec) /
+				(500000.0 * (1 + 2 * dwn3)));
+		if (ncoff > 0xfffff)
+			throw daisy_exception("Data rate too high for IF bandwidth",
+					to_string(if_bandwidth));
+		double g = (c.deviation > 0) ?
+				2.0 + 65536.0 * chiprate / (rxosr * (double)c.deviation) :
+				(double)0x7ff;
+		crgain = (g > 0x7ff) ? 0x7ff : (unsigned int)g;
+
+		// AFC:
+		unsigned int afclimit = lround(offset / (625.0 * (1 + hbsel)));
+		if (afclimit > 0xff)
+			afclimit = 0xff;
+
+		// TX data rate:
+		bool scale = (c.data_rate < 30000);
+		unsigned int txdr = lround(c.data_rate *
+				(scale ? (double)(1<<21) : (double)(1<<16)) / 1.0E6);
+
+		uint8_t carrier[3];
+		carrier_registers(c.frequency, carrier);
+		uint16_t fd = c.deviation / 625;
+
+		set(0x1c, ifreg);
+		set(0x1d, c.afc ? 0x40 : 0x00);
+		set(0x20, rxosr & 0xff);
+		set(0x21, ((rxosr >> 3) & 0xe0) | ((ncoff >> 16) & 0x0f));
+		set(0x22, (ncoff >> 8) & 0xff);
+		set(0x23, ncoff & 0xff);
+		set(0x24, (crgain >> 8) & 0x07);
+		set(0x25, crgain & 0xff);
+		set(0x2a, afclimit);
+		set(0x6e, txdr >> 8);
+		set(0x6f, txdr & 0xff);
+		set(0x70, (scale ? 0x20 : 0x00) |         // txdtrtscale
+				  0x08 |                          // enphpwdn
+				  0x04 |                          // manppol
+				  (c.manchester_invert ? 0x02 : 0x00) |
+				  (c.manchester ? 0x01 : 0x00));
+		set(0x71, 0x20 |                          // dtmod: FIFO
+				  ((fd & 0x100) ? 0x04 : 0x00) |  // fd[8]
+				  (uint8_t)c.modulation);
+		set(0x72, fd & 0xff);
+		set(0x75, carrier[0]);
+		set(0x76, carrier[1]);
+		set(0x77, carrier[2]);
+		regs.push_back(register_value { { 0x00, 0x00 } });
+	}
+
+	// As in RFM22B::setCarrierFrequency(), but rounded:
+	void carrier_registers(unsigned int frequency, uint8_t regs[3]) {
+		if ((frequency < 240E6) || (frequency > 960E6))
+			throw daisy_exception("Frequency out of range",
+					to_string(frequency));
+		uint8_t  hbsel = (frequency >= 480E6);
+		uint8_t  fb = frequency / 10E6 / (hbsel + 1) - 24;
+		uint16_t fc = lround((frequency / (10E6 * (hbsel + 1)) - fb - 24)
+				* 64000);
+		regs[0] = (1<<6) | (hbsel<<5) | fb;
+		regs[1] = fc >> 8;
+		regs[2] = fc & 0xff;
+	}
+
+	void ModemCalculator::set(uint8_t reg, uint8_t value) {
+		regs.push_back(register_value { { (uint8_t)(reg|0x80), value } });
+	}
+
+	void ModemCalculator::trim(uint8_t reg, uint8_t value,
+			const string& reason)
+	{
+		for (register_value& rv: regs) {
+			if (rv.setting[0] == (reg|0x80)) {
+				trims.push_back(modem_trim {
+					reg, rv.setting[1], value, reason });
+				rv.setting[1] = value;
+				return;
+			}
+		} // end for //
+		throw daisy_exception("Not a modem register", to_string(reg));
+	}
+
+	// GFSK 1kbps, 5kHz deviation on 434.150 MHz:
+	ModemCalculator ModemCalculator::narrow() {
+		modem_config c;
+		c.data_rate         = 1000;
+		c.deviation         = 5000;
+		c.manchester_invert = true;
+		c.xtal_ppm          = 21.0;
+		ModemCalculator m(c);
+		// The vendor table keeps ncoff (0x21..0x23) for 1 kchip/s with
+		// ndec_exp 2, but sets rxosr for the 2 kchip/s of Manchester
+		// coding, which is off (0x70), and a crgain of neither rate:
+		m.trim(0x1c, 0x2b, "IF filter: filset 11, not in the AN440 table");
+		m.trim(0x20, 0xf4, "rxosr 500 for 2 kchip/s, formula gives 1000");
+		m.trim(0x21, 0x20, "rxosr[10:8] of the rxosr above");
+		m.trim(0x25, 0x26, "crgain 38, formula gives 15");
+		return m;
+	}
+
+	// GFSK 100kbps, 50kHz deviation on 434.150 MHz:
+	ModemCalculator ModemCalculator::medium() {
+		modem_config c;
+		c.data_rate    = 100000;
+		c.deviation    = 50000;
+		c.xtal_ppm     = 52.0;
+		c.if_bandwidth = 181100;
+		ModemCalculator m(c);
+		// The vendor table enables Manchester coding, but the clock
+		// recovery is set for the uncoded rate:
+		m.trim(0x70, 0x0d, "enmanch without the doubled chip rate");
+		return m;
+	}
+
+	// GFSK 250kbps, 50kHz deviation on 434.150 MHz:
+	ModemCalculator ModemCalculator::wide() {
+		modem_config c;
+		c.data_rate    = 250000;
+		c.deviation    = 50000;
+		c.xtal_ppm     = 52.0;
+		c.if_bandwidth = 361800;
+		ModemCalculator m(c);
+		m.trim(0x70, 0x0d, "enmanch without the doubled chip rate, "
+				"as medium()");
+		return m;
+	}
+
+} // end namespace //
@@ -0,0 +1,115 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MODEM_H
+#define _MODEM_H
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#include "rfm22b.h"
+#include "rfm22b_types.h"
+
+namespace RFM22B_NS {
+
+	// Input of the modem calculator:
+	struct modem_config {
+		unsigned int           data_rate         = 9600;      // bps
+		unsigned int           deviation         = 20000;     // Hz
+		RFM22B_Modulation_Type modulation        =
+				RFM22B_Modulation_Type::GFSK;
+		bool                   manchester        = false;
+		bool                   manchester_invert = false;
+		unsigned int           frequency         = 434150000; // Hz
+		double                 xtal_ppm          = 20.0;      // Per station
+		unsigned int           if_bandwidth      = 0;         // Hz, 0: auto
+		bool                   afc               = true;
+	};
+
+	// A register of a preset, that does not follow from the formulas:
+	struct modem_trim {
+		uint8_t     reg;
+		uint8_t     computed;  // Value of the formulas
+		uint8_t     value;     // Value of the vendor table
+		std::string reason;
+	};
+
+	/*
+	 * Computes the modem registers of the Si443x from a modem_config,
+	 * following the formulas of the vendor register calculator (AN440):
+	 *
+	 *   IF filter     Smallest filter >= 2 * deviation + chip rate
+	 *                 + 2 * xtal_ppm * frequency (Carson + offset)
+	 *   rxosr         500 * (1 + 2 * dwn3_bypass) /
+	 *                 (2^(ndec_exp - 3) * chip rate in kbps)
+	 *   ncoff         chip rate * 2^(20 + ndec_exp) /
+	 *                 (500 kHz * (1 + 2 * dwn3_bypass))
+	 *   crgain        2 + 2^16 * chip rate / (rxosr * deviation)
+	 *   AFC limiter   2 * xtal_ppm * frequency / (625 Hz * (1 + hbsel))
+	 *   TX data rate  rate * 2^21 / 1MHz below 30kbps, else * 2^16
+	 *
+	 * The chip rate is data_rate * 2 with Manchester coding.
+	 */
+	class ModemCalculator {
+	public:
+		explicit ModemCalculator(const modem_config& config);
+
+		// Override a computed register, for values that do not follow
+		// from the formulas. The override is recorded in getTrims():
+		void trim(uint8_t reg, uint8_t value, const std::string& reason);
+
+		// The register settings, terminated by { 0x00, 0x00 }:
+		const std::vector<register_value>& getRegisters() const {
+			return regs; }
+		// The overrides of trim(), in the order applied:
+		const std::vector<modem_trim>& getTrims() const { return trims; }
+
+		unsigned int getIFBandwidth() const { return if_bandwidth; }
+		unsigned int getRXOSR() const { return rxosr; }
+		unsigned int getNCOOffset() const { return ncoff; }
+		unsigned int getCRGain() const { return crgain; }
+
+		// The presets of setNarrowMode(), setMediumMode() and
+		// setWideMode():
+		static ModemCalculator narrow();
+		static ModemCalculator medium();
+		static ModemCalculator wide();
+
+	private:
+		void set(uint8_t reg, uint8_t value);
+
+		std::vector<register_value> regs;
+		std::vector<modem_trim>     trims;
+		unsigned int if_bandwidth;
+		unsigned int rxosr;
+		unsigned int ncoff;
+		unsigned int crgain;
+	};
+
+	// IF filter register (0x1c) for the smallest bandwidth >= bw in Hz:
+	uint8_t if_filter_register(unsigned int bw);
+	// Bandwidth in Hz of an IF filter register value, 0 if unknown:
+	unsigned int if_filter_bandwidth(uint8_t reg);
+	// Carrier registers 0x75..0x77 for the frequency in Hz:
+	void carrier_registers(unsigned int frequency, uint8_t regs[3]);
+
+} // end namespace //
+
+#endif
@@ -0,0 +1,396 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iomanip>
+#include <algorithm>
+
+#include "rate_control.h"
+#include "rx_ring.h"
+#include "daisy_exception.h"
+#include "timer.h"
+
+using namespace std;
+
+namespace RFM22B_NS {
+
+	static void put_le(uint8_t *pb, uint64_t v, size_t cb) {
+		for (size_t i = 0; i < cb; ++i, v >>= 8)
+			pb[i] = (uint8_t)v;
+	}
+
+	static uint64_t get_le(const uint8_t *pb, size_t cb) {
+		uint64_t v = 0;
+		for (size_t i = cb; i > 0; --i)
+			v = (v << 8) | pb[i-1];
+		return v;
+	}
+
+	// Same conversion as RFM22B::getInputPower():
+	static double input_power(uint8_t rssi) {
+		return 0.56 * rssi - 128.8;
+	}
+
+	// Larger sequence gaps are taken as a restart of the neighbour:
+	static const uint16_t MAX_GAP = 1000;
+
+	static const char *reason_names[] = {
+		"goodput", "probe", "fallback", "manual"
+	};
+
+	const vector<rate_profile>& rate_profiles() {
+		static const vector<rate_profile> profiles {
+			{ "narrow", &ModemCalculator::narrow,   1000, -121 },
+			{ "medium", &ModemCalculator::medium, 100000, -104 },
+			{ "wide",   &ModemCalculator::wide,   250000,  -98 }
+		};
+		return profiles;
+	}
+
+	RateController::RateController(const rate_config& config, ostream& log):
+		config{config}, log{log}, to_probe{config.probe_every}
+	{
+		if (config.interval == 0 || config.burst == 0)
+			throw daisy_exception("Invalid rate configuration");
+		while (this->config.station == 0)
+			this->config.station = random_device{}();
+	}
+
+	void RateController::receive(const packet_buffer& pkt,
+			const rx_info& info, uint64_t now)
+	{
+		clock = now;
+		const uint8_t *pb = pkt.payload();
+		if (!info.crc_ok || (pkt.cb < RATE_REPORT_SIZE) ||
+				(get_le(pb, 2) != RATE_MAGIC))
+			return;
+		uint32_t station = get_le(pb + 2, 4);
+		if (station == config.station)
+			return;
+		neighbour& n = neighbours[station];
+		if (n.profiles.empty())
+			n.profiles.resize(rate_profiles().size());
+		uint16_t s = get_le(pb + 6, 2);
+		uint16_t gap = n.have_seq ? (uint16_t)(s - n.last_seq) : 1;
+		if (gap == 0)
+			return; // Duplicate
+		if (gap > MAX_GAP)
+			gap = 1;
+		n.power = n.have_seq ?
+				config.ewma * n.power +
+					(1.0 - config.ewma) * input_power(info.rssi) :
+				input_power(info.rssi);
+		n.have_seq = true;
+		n.last_seq = s;
+		n.received += 1;
+		n.sent += gap;
+		n.last_heard = now;
+
+		// Towards us, the sender is on its profile:
+		size_t p = pb[8];
+		if (p < n.profiles.size())
+			account(n.profiles[p], gap, 1);
+
+		// From us, if it is our turn for the feedback:
+		if (get_le(pb + 12, 4) == config.station) {
+			uint16_t received = get_le(pb + 16, 2);
+			uint16_t sent     = get_le(pb + 18, 2);
+			if (n.have_fb && (p < n.profiles.size())) {
+				uint16_t ds = sent - n.fb_sent;
+				uint16_t dr = received - n.fb_received;
+				if ((ds > 0) && (ds <= MAX_GAP) && (dr <= ds))
+					account(n.profiles[p], ds, dr);
+			}
+			n.have_fb = true;
+			n.fb_received = received;
+			n.fb_sent = sent;
+		}
+
+		// Follow the announcements of stations with a lower id:
+		uint8_t announced = pb[9];
+		if (automatic && (announced != RATE_NONE) &&
+				(announced < rate_profiles().size()) &&
+				(station < config.station) &&
+				((announced != profile) || (next != RATE_NONE)))
+		{
+			if (announced != next)
+				log << "rate: " << now << " follow " << hex << station
+					<< dec << " " << rate_profiles()[profile].name
+					<< " -> " << rate_profiles()[announced].name
+					<< " in " << (unsigned int)pb[10] << endl;
+			next = announced;
+			countdown = pb[10];
+			reason = (rate_reason)min<uint8_t>(pb[11],
+					(uint8_t)rate_reason::MANUAL);
+		}
+	}
+
+	void RateController::account(stats& s, uint32_t attempts,
+			uint32_t successes)
+	{
+		s.attempts        += attempts;
+		s.successes       += successes;
+		s.total_attempts  += attempts;
+		s.total_successes += successes;
+	}
+
+	bool RateController::tick(uint64_t now) {
+		clock = now;
+		for (auto& n: neighbours) {
+			for (stats& s: n.second.profiles) {
+				if (s.attempts == 0)
+					continue;
+				double ratio = (double)s.successes / s.attempts;
+				s.prob = s.sampled ?
+						config.ewma * s.prob + (1.0 - config.ewma) * ratio :
+						ratio;
+				s.sampled = true;
+				s.last = now;
+				s.attempts = s.successes = 0;
+			} // end for //
+		} // end for //
+
+		if (automatic && (profile != 0) &&
+				(now - since >= config.fallback))
+		{
+			bool heard = false;
+			for (auto& n: neighbours)
+				if (n.second.last_heard + config.fallback >= now)
+					heard = true;
+			if (!heard) {
+				apply(0, rate_reason::FALLBACK);
+				return true;
+			}
+		}
+
+		if (next != RATE_NONE) {
+			if (countdown > 0)
+				--countdown;
+			if (countdown == 0) {
+				apply(next, reason);
+				return true;
+			}
+			return false;
+		}
+
+		if (automatic && isCoordinator())
+			decide();
+		return false;
+	}
+
+	bool RateController::isCoordinator() const {
+		bool active = false;
+		for (auto& n: neighbours) {
+			if (n.second.last_heard + config.fallback < clock)
+				continue;
+			if (n.first < config.station)
+				return false;
+			active = true;
+		} // end for //
+		return active;
+	}
+
+	// Expected goodput in bps with all active neighbours, -1 if unknown:
+	double RateController::goodput(size_t p) const {
+		double prob = 1.0;
+		for (auto& n: neighbours) {
+			if (n.second.last_heard + config.fallback < clock)
+				continue;
+			const stats& s = n.second.profiles[p];
+			if (!s.sampled)
+				return -1.0;
+			prob = min(prob, s.prob);
+		} // end for //
+		return (prob < 0.1) ? 0.0 : rate_profiles()[p].data_rate * prob;
+	}
+
+	void RateController::decide() {
+		if (probing > 0 && --probing > 0)
+			return;
+
+		size_t best = profile;
+		for (size_t p = 0; p < rate_profiles().size(); ++p)
+			if (goodput(p) > goodput(best))
+				best = p;
+		double current = goodput(profile);
+		if ((best != profile) &&
+				(goodput(best) > config.hysteresis * current))
+		{
+			announce(best, rate_reason::GOODPUT);
+			return;
+		}
+		if ((current == 0.0) && (profile > 0)) {
+			announce(profile - 1, rate_reason::GOODPUT);
+			return;
+		}
+
+		if ((config.probe_every == 0) || (--to_probe > 0))
+			return;
+		to_probe = config.probe_every;
+		size_t candidate = profile + 1;
+		if (candidate >= rate_profiles().size())
+			return;
+		int threshold = rate_profiles()[candidate].sensitivity + config.margin;
+		for (auto& n: neighbours)
+			if ((n.second.last_heard + config.fallback >= clock) &&
+					(n.second.power < threshold))
+				return;
+		announce(candidate, rate_reason::PROBE);
+		probing = config.countdown + config.probe_len;
+	}
+
+	void RateController::announce(size_t p, rate_reason r) {
+		log << "rate: " << clock << " announce "
+			<< reason_names[(int)r] << " "
+			<< rate_profiles()[profile].name << " -> "
+			<< rate_profiles()[p].name << " goodput "
+			<< goodput(profile) << " -> " << goodput(p) << " bps" << endl;
+		next = p;
+		countdown = config.countdown;
+		reason = r;
+	}
+
+	void RateController::apply(size_t p, rate_reason r) {
+		log << "rate: " << clock << " switch "
+			<< reason_names[(int)r] << " "
+			<< rate_profiles()[profile].name << " -> "
+			<< rate_profiles()[p].name << endl;
+		profile = p;
+		since = clock;
+		next = RATE_NONE;
+		countdown = 0;
+		if (r != rate_reason::PROBE)
+			probing = 0;
+	}
+
+	void RateController::report(packet_buffer& pkt) {
+		if (pkt.size < RATE_REPORT_SIZE)
+			throw daisy_exception("Buffer too small for report");
+
+		// Feedback for the neighbours in turn:
+		uint32_t peer = 0;
+		neighbour *n = NULL;
+		if (!neighbours.empty()) {
+			auto it = neighbours.upper_bound(feedback);
+			if (it == neighbours.end())
+				it = neighbours.begin();
+			peer = feedback = it->first;
+			n = &it->second;
+		}
+
+		uint8_t *pb = pkt.payload();
+		put_le(pb,      RATE_MAGIC,     2);
+		put_le(pb + 2,  config.station, 4);
+		put_le(pb + 6,  seq++,          2);
+		pb[8]  = profile;
+		pb[9]  = next;
+		pb[10] = countdown;
+		pb[11] = (uint8_t)reason;
+		put_le(pb + 12, peer,                4);
+		put_le(pb + 16, n ? n->received : 0, 2);
+		put_le(pb + 18, n ? n->sent : 0,     2);
+		pkt.cb = RATE_REPORT_SIZE;
+	}
+
+	void RateController::setProfile(size_t p) {
+		if (p >= rate_profiles().size())
+			throw daisy_exception("Invalid profile");
+		automatic = false;
+		apply(p, rate_reason::MANUAL);
+	}
+
+	void RateController::write(ostream& os) const {
+		os << "station=" << hex << config.station << dec
+		   << " profile=" << rate_profiles()[profile].name
+		   << (automatic ? " auto" : " manual")
+		   << (isCoordinator() ? " coordinator" : "") << endl;
+		for (auto& n: neighbours) {
+			os << "  neighbour=" << hex << n.first << dec
+			   << " power=" << fixed << setprecision(1) << n.second.power
+			   << "dBm" << endl;
+			for (size_t p = 0; p < n.second.profiles.size(); ++p) {
+				const stats& s = n.second.profiles[p];
+				os << "    " << rate_profiles()[p].name
+				   << ": prob=" << setprecision(3) << s.prob
+				   << " attempts=" << s.total_attempts
+				   << " successes=" << s.total_successes
+				   << (s.sampled ? "" : " (unsampled)") << endl;
+			} // end for //
+		} // end for //
+		os.unsetf(ios::fixed);
+		os << setprecision(6);
+	}
+
+	void rate_link(RFM22B& chip, RateController& rc, unsigned int timeout) {
+		const rate_config& config = rc.getConfig();
+		mt19937 rnd(random_device{}());
+		// Random send time in the first half of each interval, so that
+		// the stations do not collide every time:
+		uniform_int_distribution<unsigned int> jitter(0, config.interval / 2);
+
+		const size_t cb = RATE_REPORT_SIZE + PACKET_HEADROOM;
+		vector<uint8_t> storage(config.burst * cb);
+		vector<packet_buffer> reports;
+		for (size_t i = 0; i < config.burst; ++i)
+			reports.push_back(packet_buffer {
+				&storage[i * cb], 0, RATE_REPORT_SIZE });
+
+		chip.setModem(rate_profiles()[rc.getProfile()].modem());
+		AsyncReceiver receiver(chip);
+		FrameRing& ring = receiver.getRing();
+		auto drain = [&](uint64_t now) {
+			rx_frame *frame;
+			while ((frame = ring.front()) != NULL) {
+				rc.receive(frame->packet(), frame->info, now);
+				ring.pop();
+			} // end while //
+		};
+
+		uint64_t slot = monotonic_ns() / 1000000;
+		uint64_t end  = slot + timeout * 1000ULL;
+		uint64_t next_tx = slot + jitter(rnd);
+		receiver.start();
+		for (;;) {
+			uint64_t now = monotonic_ns() / 1000000;
+			if (now >= end)
+				break;
+			if (now < next_tx) {
+				rx_frame *frame = ring.wait(10);
+				if (frame) {
+					rc.receive(frame->packet(), frame->info, now);
+					ring.pop();
+				}
+				continue;
+			}
+			// Half duplex: The receiver is stopped for tick and send:
+			receiver.stop();
+			drain(now);
+			if (rc.tick(now))
+				chip.setModem(rate_profiles()[rc.getProfile()].modem());
+			for (packet_buffer& pkt: reports)
+				rc.report(pkt);
+			packet_batch batch(reports.data(), reports.size());
+			chip.send(batch);
+			receiver.start();
+			slot += config.interval;
+			next_tx = slot + jitter(rnd);
+		} // end for //
+		receiver.stop();
+		drain(monotonic_ns() / 1000000);
+	}
+
+} // end namespace //
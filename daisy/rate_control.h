@@ -0,0 +1,182 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RATE_CONTROL_H
+#define _RATE_CONTROL_H
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <random>
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "rfm22b.h"
+#include "rfm22b_packet.h"
+#include "modem.h"
+
+namespace RFM22B_NS {
+
+	// A modem profile the rate controller can choose from:
+	struct rate_profile {
+		const char       *name;
+		ModemCalculator (*modem)();
+		unsigned int      data_rate;    // bps
+		int               sensitivity;  // dBm
+	};
+
+	// The profiles, ordered from robust to fast. Profile 0 is the base
+	// profile, that all stations fall back to when the link is lost.
+	const std::vector<rate_profile>& rate_profiles();
+
+	struct rate_config {
+		uint32_t     station     = 0;    // Own id, 0: random
+		unsigned int interval    = 1000; // Statistics interval in ms
+		unsigned int burst       = 4;    // Reports sent per interval
+		unsigned int probe_every = 10;   // Intervals between probes
+		unsigned int probe_len   = 3;    // Intervals a probe lasts
+		unsigned int countdown   = 2;    // Intervals from announce to switch
+		unsigned int fallback    = 5000; // Silence in ms until fallback
+		double       ewma        = 0.75; // Weight of the history
+		double       hysteresis  = 1.1;  // Goodput gain needed to switch
+		int          margin      = 6;    // dB above sensitivity to probe
+	};
+
+	/*
+	 * Every station broadcasts burst reports per interval (little endian):
+	 *    0: RATE_MAGIC (2 octets)
+	 *    2: Station id of the sender (4 octets)
+	 *    6: Sequence number (2 octets)
+	 *    8: Profile in use (1 octet)
+	 *    9: Announced profile, RATE_NONE if none (1 octet)
+	 *   10: Intervals until the announced profile is used (1 octet)
+	 *   11: Reason of the announcement (1 octet)
+	 *   12: Station id of the neighbour the feedback is for (4 octets)
+	 *   16: Reports received from the neighbour, running count (2 octets)
+	 *   18: Reports sent by the neighbour, running count (2 octets)
+	 * The reports are the probe frames at the same time: The gaps in the
+	 * sequence numbers give the delivery ratio towards the receiver, the
+	 * feedback the ratio in the other direction.
+	 */
+	static const uint16_t RATE_MAGIC       = 0xdb02;
+	static const size_t   RATE_REPORT_SIZE = 20;
+	static const uint8_t  RATE_NONE        = 0xff;
+
+	enum class rate_reason : uint8_t {
+		GOODPUT, PROBE, FALLBACK, MANUAL
+	};
+
+	/*
+	 * Minstrel like rate controller: It keeps an EWMA of the delivery
+	 * ratio per neighbour and profile and uses the profile with the best
+	 * expected goodput (data rate * delivery ratio, ratios below 10% do
+	 * not count). Every probe_every intervals it tries the next faster
+	 * profile, if all neighbours are received well above its
+	 * sensitivity.
+	 *
+	 * As all stations share one channel, they have to use the same
+	 * profile. The station with the lowest id is the coordinator. It
+	 * decides on the profile of all and announces switches countdown
+	 * intervals in advance, the others follow. Stations that hear no
+	 * neighbour for fallback ms go back to the base profile.
+	 *
+	 * Decisions are logged one per line.
+	 */
+	class RateController {
+	public:
+		RateController(const rate_config& config, std::ostream& log);
+
+		// Feed a received frame, frames without report are ignored:
+		void receive(const packet_buffer& pkt, const rx_info& info,
+				uint64_t now);
+		// Called every interval (now in ms). Returns true, if the
+		// profile is changed and has to be applied to the chip:
+		bool tick(uint64_t now);
+		// Fill pkt with the next report:
+		void report(packet_buffer& pkt);
+
+		// Force a profile and disable the automatic selection, or
+		// (re)enable it:
+		void setProfile(size_t profile);
+		void setAuto(bool f) { automatic = f; }
+		bool getAuto() const { return automatic; }
+
+		size_t   getProfile() const { return profile; }
+		uint32_t getStation() const { return config.station; }
+		bool     isCoordinator() const;
+		const rate_config& getConfig() const { return config; }
+
+		// Write the statistics per neighbour and profile:
+		void write(std::ostream& os) const;
+
+	private:
+		struct stats {
+			uint32_t attempts  = 0;   // In the current interval
+			uint32_t successes = 0;
+			uint64_t total_attempts  = 0;
+			uint64_t total_successes = 0;
+			double   prob      = 0.0; // EWMA of the delivery ratio
+			bool     sampled   = false;
+			uint64_t last      = 0;   // Time of the last sample
+		};
+
+		struct neighbour {
+			std::vector<stats> profiles;
+			uint64_t last_heard = 0;
+			double   power      = 0.0; // EWMA of input power in dBm
+			bool     have_seq   = false;
+			uint16_t last_seq   = 0;
+			bool     have_fb    = false;
+			uint16_t fb_received = 0, fb_sent = 0;
+			// Running counts of its reports, for the feedback:
+			uint16_t received = 0, sent = 0;
+		};
+
+		void account(stats& s, uint32_t attempts, uint32_t successes);
+		double goodput(size_t p) const;
+		void decide();
+		void announce(size_t p, rate_reason r);
+		void apply(size_t p, rate_reason r);
+
+		rate_config                   config;
+		std::ostream&                 log;
+		std::map<uint32_t, neighbour> neighbours;
+		size_t   profile    = 0;
+		bool     automatic  = true;
+		uint16_t seq        = 0;
+		uint64_t clock      = 0; // Time of the last receive() or tick()
+		uint64_t since      = 0; // Time of the last switch
+		// Announced switch:
+		uint8_t  next       = RATE_NONE;
+		unsigned int countdown = 0;
+		rate_reason  reason = rate_reason::GOODPUT;
+		// Intervals of a running probe, and to the next one:
+		unsigned int probing = 0;
+		unsigned int to_probe = 0;
+		// Neighbour the last report carried feedback for:
+		uint32_t feedback   = 0;
+	};
+
+	// Run the rate controller on the chip for timeout s: Receive, send
+	// the reports and switch the profile as decided.
+	void rate_link(RFM22B& chip, RateController& rc, unsigned int timeout);
+
+} // end namespace //
+
+#endif
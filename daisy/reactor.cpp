@@ -0,0 +1,220 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+
+#include "reactor.h"
+#include "daisy_exception.h"
+#include "defaults.h"
+
+using namespace std;
+
+namespace RFM22B_NS {
+
+	static void epoll_add(int epfd, int fd, uint32_t events, void *ptr) {
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = events;
+		ev.data.ptr = ptr;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+			throw daisy_exception("Unable to add to epoll", strerror(errno));
+	}
+
+	Reactor::Reactor() {
+		epfd = epoll_create1(EPOLL_CLOEXEC);
+		tfd  = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		efd  = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if ((epfd == -1) || (tfd == -1) || (efd == -1)) {
+			string err = strerror(errno);
+			if (efd  != -1) ::close(efd);
+			if (tfd  != -1) ::close(tfd);
+			if (epfd != -1) ::close(epfd);
+			throw daisy_exception("Unable to create reactor", err);
+		}
+		epoll_add(epfd, tfd, EPOLLIN, NULL);
+		epoll_add(epfd, efd, EPOLLIN, this);
+	}
+
+	Reactor::~Reactor() {
+		for (auto& st: stations) {
+			if (st->job)
+				done(*st);
+			st->chip->setEventLoopMode(false);
+		} // end for //
+		if (efd  != -1) ::close(efd);
+		if (tfd  != -1) ::close(tfd);
+		if (epfd != -1) ::close(epfd);
+	}
+
+	void Reactor::add(RFM22B& chip, int irqfd) {
+		for (auto& st: stations)
+			if (st->chip == &chip)
+				throw daisy_exception("Chip is already added");
+		chip.setEventLoopMode(true);
+		station *st = new station { &chip, irqfd, nullptr, 0, Timer() };
+		stations.emplace_back(st);
+		if (irqfd != -1)
+			epoll_add(epfd, irqfd, EPOLLPRI | EPOLLERR, st);
+	}
+
+	// Poll while a chip without nIRQ line is busy, else tick while any
+	// chip is busy:
+	void Reactor::arm() {
+		long p = 0;
+		for (auto& st: stations) {
+			if (!st->job)
+				continue;
+			if (st->irqfd == -1) {
+				p = REACTOR_POLL_TIME;
+				break;
+			}
+			p = REACTOR_TICK_TIME;
+		} // end for //
+		if (p == period)
+			return;
+		struct itimerspec its;
+		memset(&its, 0, sizeof(its));
+		its.it_interval.tv_sec  = p / 1000;
+		its.it_interval.tv_nsec = (p % 1000) * 1000000;
+		its.it_value = its.it_interval;
+		if (timerfd_settime(tfd, 0, &its, NULL) == 0)
+			period = p;
+	}
+
+	void Reactor::remove(RFM22B& chip) {
+		for (auto it = stations.begin(); it != stations.end(); ++it) {
+			station& st = **it;
+			if (st.chip != &chip)
+				continue;
+			if (st.job)
+				done(st);
+			if (st.irqfd != -1)
+				epoll_ctl(epfd, EPOLL_CTL_DEL, st.irqfd, NULL);
+			chip.setEventLoopMode(false);
+			stations.erase(it);
+			arm();
+			return;
+		} // end for //
+		throw daisy_exception("Chip is not added");
+	}
+
+	Reactor::station& Reactor::find(RFM22B& chip) {
+		for (auto& st: stations)
+			if (st->chip == &chip)
+				return *st;
+		throw daisy_exception("Chip is not added");
+	}
+
+	bool Reactor::isBusy(RFM22B& chip) {
+		return (bool)find(chip).job;
+	}
+
+	void Reactor::start(RFM22B& chip, task *job, unsigned int timeout) {
+		unique_ptr<task> guard(job);
+		station& st = find(chip);
+		if (st.job)
+			throw daisy_exception("Chip is busy");
+		st.timeout = timeout;
+		st.timer.reset();
+		if (!job->start())
+			return;
+		st.job = move(guard);
+		arm();
+	}
+
+	void Reactor::service(station& st) {
+		uint16_t status = st.chip->pollInterrupts();
+		if (status && !st.job->on_interrupt(status))
+			done(st);
+	}
+
+	void Reactor::tick(station& st) {
+		if (!st.job->on_tick() ||
+			(st.timeout && (st.timer.elapsed() >= st.timeout)))
+			done(st);
+	}
+
+	void Reactor::done(station& st) {
+		unique_ptr<task> job = move(st.job);
+		job->finish();
+		arm();
+	}
+
+	bool Reactor::busy() {
+		for (auto& st: stations)
+			if (st->job)
+				return true;
+		return false;
+	}
+
+	void Reactor::stop() {
+		stopping = true;
+		uint64_t one = 1;
+		if (::write(efd, &one, sizeof(one)) < 0) { /**/ }
+	}
+
+	void Reactor::run() {
+		struct epoll_event events[16];
+		uint64_t           x;
+		char               value[8];
+
+		stopping = false;
+		while (!stopping && busy()) {
+			int n = epoll_wait(epfd, events, 16, -1);
+			if (n == -1) {
+				if (errno == EINTR)
+					continue;
+				throw daisy_exception("epoll_wait failed", strerror(errno));
+			}
+			for (int i = 0; i < n; ++i) {
+				void *ptr = events[i].data.ptr;
+				if (ptr == this) {
+					// stop():
+					if (::read(efd, &x, sizeof(x)) < 0) { /**/ }
+				} else if (ptr == NULL) {
+					// Timer: poll the chips without nIRQ line and tick:
+					if (::read(tfd, &x, sizeof(x)) < 0) { /**/ }
+					for (auto& st: stations) {
+						if (st->job && (st->irqfd == -1))
+							service(*st);
+						if (st->job)
+							tick(*st);
+					} // end for //
+				} else {
+					// nIRQ edge, acknowledge by reading the value file:
+					station& st = *(station *)ptr;
+					if ((lseek(st.irqfd, 0, SEEK_SET) < 0) ||
+						(::read(st.irqfd, value, sizeof(value)) < 0)) { /**/ }
+					if (st.job)
+						service(st);
+				}
+			} // end for //
+		} // end while //
+		// Stopped, finish all tasks:
+		for (auto& st: stations)
+			if (st->job)
+				done(*st);
+	}
+
+} // end namespace //
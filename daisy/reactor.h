@@ -0,0 +1,117 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _REACTOR_H
+#define _REACTOR_H
+
+#include <vector>
+#include <memory>
+#include <atomic>
+
+#include "rfm22b.h"
+#include "rfm22b_packet.h"
+#include "timer.h"
+
+namespace RFM22B_NS {
+
+	// Drives any number of chips from a single thread with epoll. Every
+	// chip runs at most one task (send or receive) at a time. Interrupts
+	// come from the nIRQ line (a sysfs GPIO value file with edge set to
+	// "falling"), or, when no such file is given, by polling the status
+	// registers every REACTOR_POLL_TIME. The timer only runs while a chip
+	// has a task, every REACTOR_TICK_TIME if all busy chips have a nIRQ
+	// line. Chips are served round robin in the order they were added.
+	class Reactor {
+	public:
+		Reactor();
+		~Reactor();
+
+		Reactor(const Reactor&) = delete;
+		Reactor& operator=(const Reactor&) = delete;
+
+		// Add a chip and switch it to event loop mode:
+		void add(RFM22B& chip, int irqfd = -1);
+		// Remove a chip, a running task is finished:
+		void remove(RFM22B& chip);
+
+		// Start a task, the source and the sink have to stay valid until
+		// the task is done:
+		template<class Source>
+		void send(RFM22B& chip, Source& source) {
+			start(chip, new machine_task<TxMachine<Source>, Source>(
+					chip, source), 0);
+		}
+		template<class Sink>
+		void receive(RFM22B& chip, Sink& sink, unsigned int timeout = 0) {
+			start(chip, new machine_task<RxMachine<Sink>, Sink>(
+					chip, sink), timeout);
+		}
+		// True while the chip has a task:
+		bool isBusy(RFM22B& chip);
+
+		// Run until all tasks are done or stop() is called:
+		void run();
+		// Stop run(), may be called from any thread:
+		void stop();
+
+	private:
+		struct task {
+			virtual ~task() {}
+			virtual bool start() = 0;
+			virtual bool on_interrupt(uint16_t status) = 0;
+			virtual bool on_tick() = 0;
+			virtual void finish() = 0;
+		};
+
+		template<class Machine, class Endpoint>
+		struct machine_task: task {
+			machine_task(RFM22B& chip, Endpoint& ep): machine(chip, ep) {}
+			bool start() { return machine.start(); }
+			bool on_interrupt(uint16_t s) { return machine.on_interrupt(s); }
+			bool on_tick() { return machine.on_tick(); }
+			void finish() { machine.finish(); }
+			Machine machine;
+		};
+
+		struct station {
+			RFM22B               *chip;
+			int                   irqfd;
+			std::unique_ptr<task> job;
+			unsigned int          timeout;
+			Timer                 timer;
+		};
+
+		void start(RFM22B& chip, task *job, unsigned int timeout);
+		station& find(RFM22B& chip);
+		void service(station& st);
+		void tick(station& st);
+		void done(station& st);
+		bool busy();
+		void arm();
+
+		std::vector<std::unique_ptr<station>> stations;
+		std::atomic<bool> stopping {false};
+		int epfd  = -1;  // epoll
+		int tfd   = -1;  // Poll and tick timer
+		long period = 0; // Of tfd in ms, 0: disarmed
+		int efd   = -1;  // stop()
+	};
+
+} // end namespace //
+
+#endif
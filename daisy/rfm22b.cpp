@@ -34,27 +34,18 @@
 #include <linux/spi/spidev.h>
 
 #include "rfm22b.h"
+#include "rfm22b_packet.h"
+#include "rx_ring.h"
+#include "modem.h"
 #include "rfm22b_types.h"
 #include "rfm22b_registers.h"
 #include "daisy_exception.h"
 #include "defaults.h"
 #include "utility.h"
+#include "timer.h"
 
 using namespace std;
 
-class Timer {
-public:
-    Timer() : beg_(clock_::now()) {}
-    void reset() { beg_ = clock_::now(); }
-    double elapsed() const {
-        return std::chrono::duration_cast<second_>
-            (clock_::now() - beg_).count(); }
-private:
-    typedef std::chrono::high_resolution_clock clock_;
-    typedef std::chrono::duration<double, std::ratio<1> > second_;
-    std::chrono::time_point<clock_> beg_;
-};
-
 class Random {
 public:
     Random() = default;
@@ -70,16 +61,19 @@ class RandomPackageGenerator {
 public:
 	RandomPackageGenerator(size_t n): n_packages{n}	{}
 
-	int get(uint8_t *pb_buf, size_t cb_buf) {
+	// Source for RFM22B::send(), fills the preallocated buffer:
+	RFM22B_NS::packet_buffer *next() {
 		if (i_packages++ >= n_packages) {
 			elapsed = timer.elapsed();
-			return -1;
+			return NULL;
 		}
-		size_t cb = rnd.get() % cb_buf;
-		for (int i = 0; i < cb; ++i)
-			pb_buf[i] = rnd.get();
-		n_octets += cb;
-		return cb;
+		RFM22B_NS::packet_buffer& pkt = storage.buffer;
+		pkt.cb = rnd.get() % pkt.size;
+		uint8_t *pb = pkt.payload();
+		for (size_t i = 0; i < pkt.cb; ++i)
+			pb[i] = rnd.get();
+		n_octets += pkt.cb;
+		return &pkt;
 	}
 
 	void printStatistics() {
@@ -95,6 +89,7 @@ public:
 private:
 	Random   rnd;
 	Timer    timer;
+	RFM22B_NS::packet_storage<> storage;
 	size_t   n_packages;
 	size_t   i_packages  = 0;
 	uint64_t n_octets    = 0;
@@ -103,17 +98,9 @@ private:
 
 namespace RFM22B_NS {
 
-	// Settings for GFSK 10kbps, 50kHz deviation on 434.150 MHz:
+	// Packet handler settings for narrow mode, the modem settings are
+	// computed (see modem.cpp):
 	static struct register_value init_narrow[] = {
-		 { 0x1c|0x80, 0x2B }, // IF Filter Bandwidth
-		 { 0x1d|0x80, 0x40 }, // AFC Loop Gearshift Overide
-		 { 0x20|0x80, 0xF4 }, // Clock Recovery Oversampling Rate
-		 { 0x21|0x80, 0x20 }, // Clock Recovery Offset 2
-		 { 0x22|0x80, 0x20 }, // Clock Recovery Offset 1
-		 { 0x23|0x80, 0xC5 }, // Clock Recovery Offset 0
-		 { 0x24|0x80, 0x00 }, // Clock Recovery Timing Loop Gain 1
-		 { 0x25|0x80, 0x26 }, // Clock Recovery Timing Loop Gain 0
-		 { 0x2a|0x80, 0x1D }, // AFC Limiter
 		 { 0x30|0x80, 0x8F }, // Data Access Control
 		 { 0x32|0x80, 0x8C }, // Header Control 1
 		 { 0x33|0x80, 0x02 }, // Header Control 2
@@ -136,28 +123,11 @@ namespace RFM22B_NS {
 		 { 0x44|0x80, 0xFF }, // Header Enable 2
 		 { 0x45|0x80, 0xFF }, // Header Enable 1
 		 { 0x46|0x80, 0xFF }, // Header Enable 0
-		 { 0x6e|0x80, 0x08 }, // TX Data Rate 1
-		 { 0x6f|0x80, 0x31 }, // TX Data Rate 0
-		 { 0x70|0x80, 0x2E }, // Modulation Mode Control 1
-		 { 0x71|0x80, 0x23 }, // Modulation Mode Control 2
-		 { 0x72|0x80, 0x08 }, // Frequency Deviation
-		 { 0x75|0x80, 0x53 }, // Frequency Band Select
-		 { 0x76|0x80, 0x67 }, // Nominal Carrier Frequency
-		 { 0x77|0x80, 0xC0 }, // Nominal Carrier Frequency
 		 { 0x00,      0x00 }  // Termination NULL Entry
 	};
 
-	// Settings for GFSK 100kbps, 50kHz deviation on 434.150 MHz:
+	// Packet handler settings for medium mode:
 	static struct register_value init_medium[] = {
-		 { 0x1c|0x80, 0x99 }, // IF Filter Bandwidth
-		 { 0x1d|0x80, 0x40 }, // AFC Loop Gearshift Overide
-		 { 0x20|0x80, 0x3c }, // Clock Recovery Oversampling Rate
-		 { 0x21|0x80, 0x02 }, // Clock Recovery Offset 2
-		 { 0x22|0x80, 0x22 }, // Clock Recovery Offset 1
-		 { 0x23|0x80, 0x22 }, // Clock Recovery Offset 0
-		 { 0x24|0x80, 0x07 }, // Clock Recovery Timing Loop Gain 1
-		 { 0x25|0x80, 0xff }, // Clock Recovery Timing Loop Gain 0
-		 { 0x2a|0x80, 0x48 }, // AFC Limiter
 		 { 0x30|0x80, 0xaf }, // Data Access Control
 		 { 0x32|0x80, 0x8c }, // Header Control 1
 		 { 0x33|0x80, 0x02 }, // Header Control 2
@@ -180,28 +150,11 @@ namespace RFM22B_NS {
 		 { 0x44|0x80, 0xff }, // Header Enable 2
 		 { 0x45|0x80, 0xff }, // Header Enable 1
 		 { 0x46|0x80, 0xff }, // Header Enable 0
-		 { 0x6e|0x80, 0x19 }, // TX Data Rate 1
-		 { 0x6f|0x80, 0x9a }, // TX Data Rate 0
-		 { 0x70|0x80, 0x0d }, // Modulation Mode Control 1
-		 { 0x71|0x80, 0x23 }, // Modulation Mode Control 2
-		 { 0x72|0x80, 0x50 }, // Frequency Deviation
-		 { 0x75|0x80, 0x53 }, // Frequency Band Select
-		 { 0x76|0x80, 0x67 }, // Nominal Carrier Frequency
-		 { 0x77|0x80, 0xc0 }, // Nominal Carrier Frequency
 		 { 0x00,      0x00 }  // Termination NULL Entry
 	};
 
-	// Settings for GFSK 250kbps, 50kHz deviation on 434.150 MHz:
+	// Packet handler settings for wide mode:
 	static struct register_value init_wide[] = {
-		 { 0x1c|0x80, 0x89 }, // IF Filter Bandwidth
-		 { 0x1d|0x80, 0x40 }, // AFC Loop Gearshift Overide
-		 { 0x20|0x80, 0x30 }, // Clock Recovery Oversampling Rate
-		 { 0x21|0x80, 0x02 }, // Clock Recovery Offset 2
-		 { 0x22|0x80, 0xaa }, // Clock Recovery Offset 1
-		 { 0x23|0x80, 0xab }, // Clock Recovery Offset 0
-		 { 0x24|0x80, 0x07 }, // Clock Recovery Timing Loop Gain 1
-		 { 0x25|0x80, 0xff }, // Clock Recovery Timing Loop Gain 0
-		 { 0x2a|0x80, 0x48 }, // AFC Limiter
 		 { 0x30|0x80, 0xaf }, // Data Access Control
 		 { 0x32|0x80, 0x8c }, // Header Control 1
 		 { 0x33|0x80, 0x02 }, // Header Control 2
@@ -224,14 +177,6 @@ namespace RFM22B_NS {
 		 { 0x44|0x80, 0xff }, // Header Enable 2
 		 { 0x45|0x80, 0xff }, // Header Enable 1
 		 { 0x46|0x80, 0xff }, // Header Enable 0
-		 { 0x6e|0x80, 0x40 }, // TX Data Rate 1
-		 { 0x6f|0x80, 0x00 }, // TX Data Rate 0
-		 { 0x70|0x80, 0x0d }, // Modulation Mode Control 1
-		 { 0x71|0x80, 0x23 }, // Modulation Mode Control 2
-		 { 0x72|0x80, 0x50 }, // Frequency Deviation
-		 { 0x75|0x80, 0x53 }, // Frequency Band Select
-		 { 0x76|0x80, 0x67 }, // Nominal Carrier Frequency
-		 { 0x77|0x80, 0xc0 }, // Nominal Carrier Frequency
 		 { 0x00,      0x00 }  // Termination NULL Entry
 	};
 
@@ -299,30 +244,94 @@ namespace RFM22B_NS {
 	// Set the header address.
 	void RFM22B::setAddress(const vector<uint8_t>& _addr) {
 		addr = _addr;
+		applyHeaders();
 	}
 	
 	std::vector<uint8_t> RFM22B::getAddress() {
 		return addr;
 	}
 	
+	uint16_t RFM22B::headerAddress(const vector<uint8_t>& addr) {
+		if (addr.empty())
+			return HEADER_BROADCAST;
+		uint16_t crc = 0xffff;
+		for (uint8_t b : addr) {
+			crc ^= b;
+			for (int i = 0; i < 8; ++i)
+				crc = (crc & 0x0001) ? (crc >> 1) ^ 0x8408 : (crc >> 1);
+		} // end for //
+		// Broadcast is checked octet by octet:
+		if ((crc & 0xff00) == 0xff00)
+			crc &= 0xfeff;
+		if ((crc & 0x00ff) == 0x00ff)
+			crc &= 0xfffe;
+		return crc;
+	}
+
+	void RFM22B::setDestination(const vector<uint8_t>& addr) {
+		setDestination(headerAddress(addr));
+	}
+
+	void RFM22B::setDestination(uint16_t hdr) {
+		destination = hdr;
+		applyHeaders();
+	}
+
+	void RFM22B::setNetwork(uint16_t id) {
+		network = id;
+		applyHeaders();
+	}
+
+	void RFM22B::setPromiscuous(bool f) {
+		promiscuous = f;
+		applyHeaders();
+	}
+
+	// Program the header and sync word registers, again after every mode
+	// switch as the init tables overwrite them:
+	void RFM22B::applyHeaders() {
+		uint16_t source = headerAddress(addr);
+		setTransmitHeader((uint32_t(destination) << 16) | source);
+		setCheckHeader(uint32_t(source) << 16);
+		set32BitRegister(RFM22B_Register::HEADER_ENABLE_3, 0xffff0000);
+		// Broadcast and header check on header 3..2, unless promiscuous
+		// or no address is set:
+		setRegister(RFM22B_Register::HEADER_CONTROL_1,
+				(promiscuous || addr.empty()) ? 0x00 : 0xcc);
+		// Header 3..0, sync word 3..2 or 3..0 with a network ID:
+		setRegister(RFM22B_Register::HEADER_CONTROL_2, network ? 0x46 : 0x42);
+		set16BitRegister(RFM22B_Register::SYNC_WORD_1, network);
+	}
+
 	void RFM22B::setNarrowMode() {
 		reset();
 		init(init_narrow);
+		setModem(ModemCalculator::narrow());
+		applyHeaders();
 		sleep(1);
 	}
 
 	void RFM22B::setMediumMode() {
 		reset();
 		init(init_medium);
+		setModem(ModemCalculator::medium());
+		applyHeaders();
 		sleep(1);
 	}
 
 	void RFM22B::setWideMode() {
 		reset();
 		init(init_wide);
+		setModem(ModemCalculator::wide());
+		applyHeaders();
 		sleep(1);
 	}
 
+	void RFM22B::setModem(const ModemCalculator& modem) {
+		vector<register_value> regs = modem.getRegisters();
+		init(regs.data());
+	}
+
 	// Tune for some seconds:
 	void RFM22B::tune(unsigned int seconds) {
 		RFM22B_Modulation_Data_Source mds_save = getModulationDataSource();
@@ -340,7 +349,10 @@ namespace RFM22B_NS {
 			else
 				cout.flush();
 			RandomPackageGenerator rpg(numpkts);
-			send([&rpg](uint8_t *pb, size_t cb) -> int{ return rpg.get(pb, cb); });
+			send(rpg);
+			cout << "done" << endl;
+			cout << txstats.overflows << " overflows, " << txstats.underflows
+				 << " underflows." << endl;
 			rpg.printStatistics();
 		}
 		catch (exception& ex) {
@@ -353,14 +365,34 @@ namespace RFM22B_NS {
 
 	void RFM22B::rx_packages(unsigned int timeout) {
 		try {
-		/*
-		if (verbose)
-			receive([](const uint8_t *pb, size_t cb) {
-				DaisyUtils::dump(cout, pb, cb);
-			}, timeout);
-		else
-		*/
-			receive(NULL, timeout);
+			AsyncReceiver receiver(*this);
+			FrameRing& ring = receiver.getRing();
+			cout << "Now listening for " << timeout << "s ... ";
+			cout.flush();
+			receiver.start(timeout);
+			while (receiver.isRunning() || ring.front()) {
+				rx_frame *frame = ring.wait(100);
+				if (!frame)
+					continue;
+				if (verbose)
+					cout << "<<<Frame " << frame->packet().cb << " octets"
+						 << ",rssi=" << (unsigned)frame->info.rssi
+						 << (frame->info.crc_ok ? "" : ",CRC error")
+						 << ">>>" << endl;
+				ring.pop();
+			} // end while //
+			receiver.stop();
+			const rx_statistics& stats = getRXStatistics();
+			cout << stats.octets << " octets" << endl;
+			cout << "  "
+				 << stats.valids     << " pkgs, "
+				 << stats.dropped    << " dropped, "
+				 << stats.crcerrors  << " CRC err, "
+				 << stats.overflows  << " overflows, "
+				 << stats.underflows << " underflows" << endl;
+			cout << "  "
+				 << ring.getHighWater() << " of " << ring.getCapacity()
+				 << " frames max. occupancy" << endl;
 		}
 		catch (exception& ex) {
 			cerr << "Exception caught: " << ex.what() << endl;
@@ -498,75 +530,14 @@ namespace RFM22B_NS {
 				     (1.0E6 * x) / (1<<21) : (1.0E6 * x) / (1<<16));
 	}
 	
-	struct BW {
-		unsigned int bw;
-		uint8_t      ndec_exp;
-		uint8_t      dwn3_bypass;
-		uint8_t      filset;
-	};
-
-	static BW bwtable[] = {
-			{   2600, 5, 0,  1 }, {   2800, 5, 0,  2 },
-			{   3100, 5, 0,  3 }, {   3200, 5, 0,  4 },
-			{   3700, 5, 0,  5 }, {   4200, 5, 0,  6 },
-			{   4500, 5, 0,  7 }, {   4900, 4, 0,  1 },
-			{   5400, 4, 0,  2 }, {   5900, 4, 0,  3 },
-			{   6100, 4, 0,  4 }, {   7200, 4, 0,  5 },
-			{   8200, 4, 0,  6 }, {   8800, 4, 0,  7 },
-			{   9500, 3, 0,  1 }, {  10600, 3, 0,  2 },
-			{  11500, 3, 0,  3 }, {  12100, 3, 0,  4 },
-			{  14200, 3, 0,  5 }, {  16200, 3, 0,  6 },
-			{  17500, 3, 0,  7 }, {  18900, 2, 0,  1 },
-			{  21000, 2, 0,  2 }, {  22700, 2, 0,  3 },
-			{  24000, 2, 0,  4 }, {  28200, 2, 0,  5 },
-			{  32200, 2, 0,  6 }, {  34700, 2, 0,  7 },
-			{  37700, 1, 0,  1 }, {  41700, 1, 0,  2 },
-			{  45200, 1, 0,  3 }, {  47900, 1, 0,  4 },
-			{  56200, 1, 0,  5 }, {  64100, 1, 0,  6 },
-			{  69200, 1, 0,  7 }, {  75200, 0, 0,  1 },
-			{  83200, 0, 0,  2 }, {  90000, 0, 0,  3 },
-			{  95300, 0, 0,  4 }, { 112100, 0, 0,  5 },
-			{ 127900, 0, 0,  6 }, { 137900, 0, 0,  7 },
-			{ 142800, 1, 1,  4 }, { 167800, 1, 1,  5 },
-			{ 181100, 1, 1,  9 }, { 191500, 0, 1, 15 },
-			{ 225100, 0, 1,  1 }, { 248800, 0, 1,  2 },
-			{ 269300, 0, 1,  3 }, { 284900, 0, 1,  4 },
-			{ 269300, 0, 1,  3 }, { 284900, 0, 1,  4 },
-			{ 335500, 0, 1,  8 }, { 361800, 0, 1,  9 },
-			{ 420200, 0, 1, 10 }, { 468400, 0, 1, 11 },
-			{ 518800, 0, 1, 12 }, { 577000, 0, 1, 13 },
-			{ 620700, 0, 1, 14 }, {      0, 0, 1, 13 }
-	};
-
 	void RFM22B::setBandwidth(unsigned int bw) {
-		BW *_bw;
-		for (_bw = bwtable; _bw->bw != 0; ++_bw) {
-			if (_bw->bw >= bw)
-				break;
-		} // end for //
-		unsigned int x =
-				(_bw->dwn3_bypass << 7) |
-				(_bw->ndec_exp    << 4) |
-				(_bw->filset          );
-		setRegister(RFM22B_Register::IF_FILTER_BANDWIDTH, x);
+		setRegister(RFM22B_Register::IF_FILTER_BANDWIDTH,
+				if_filter_register(bw));
 	}
 
 	unsigned int RFM22B::getBandwidth() {
-		BW *_bw;
-		unsigned int x = getRegister(RFM22B_Register::IF_FILTER_BANDWIDTH);
-		uint8_t _dwn3_bypass, _ndec_exp, _filset;
-		for (_bw = bwtable; _bw->bw != 0; ++_bw) {
-			_dwn3_bypass = (x & 0x80) >> 7;
-			_ndec_exp    = (x & 0x70) >> 4;
-			_filset      = (x & 0x0f);
-			if ((_bw->dwn3_bypass == _dwn3_bypass) &&
-				(_bw->ndec_exp    == _ndec_exp   ) &&
-				(_bw->filset      == _filset     ))
-			{
-				return _bw->bw;
-			}
-		} // end for //
-		return 0; // Not a useful setting.
+		return if_filter_bandwidth(
+				getRegister(RFM22B_Register::IF_FILTER_BANDWIDTH));
 	}
 
 	// Set or get the modulation type
@@ -825,10 +796,46 @@ namespace RFM22B_NS {
 	}
 #endif
 
+	void RFM22B::setEventLoopMode(bool f) {
+#if SIMULATE_INTERRUPTS
+		if (intrmask)
+			throw daisy_exception("Interrupts are in use");
+#endif
+		eventloop = f;
+	}
+
+	uint16_t RFM22B::pollInterrupts() {
+		irqseen = monotonic_ns();
+#if SIMULATE_INTERRUPTS
+		uint16_t intrstat =
+				get16BitRegister(RFM22B_Register::INTERRUPT_STATUS_1) & intrmask;
+#ifdef DETECT_ONLY_RISING_EDGES
+		uint16_t edges = (intrstat^intrhold)&intrstat;
+		intrhold = intrstat;
+		return edges;
+#else
+		if (intrstat == intrhold)
+			return 0x0000;
+		intrhold = intrstat;
+		return intrstat;
+#endif
+#else
+		// Reading the status clears the latched interrupts:
+		return get16BitRegister(RFM22B_Register::INTERRUPT_STATUS_1) &
+				get16BitRegister(RFM22B_Register::INTERRUPT_ENABLE_1);
+#endif
+	}
+
 	// Enable or disable interrupts
 	void RFM22B::setInterruptEnable(RFM22B_Interrupt interrupt, bool enable) {
 #if SIMULATE_INTERRUPTS
-		if (enable) {
+		if (eventloop) {
+			intrhold &= ~(uint16_t) interrupt; // Initialize hold
+			if (enable)
+				intrmask |= (uint16_t) interrupt;
+			else
+				intrmask &= ~(uint16_t) interrupt;
+		} else if (enable) {
 			intrhold &= ~(uint16_t) interrupt; // Initialize hold
 			if (!intrmask) {
 				intlocked.unlock();
@@ -924,6 +931,45 @@ namespace RFM22B_NS {
 			 (uint)RFM22B_Operating_Mode::READY_MODE));
 	}
 
+	// Two writes and no read back: The FIFO reset bit is set in the second
+	// control register, then both registers are written in one burst, which
+	// sets the mode and releases the reset. TUNE_MODE keeps the synthesizer
+	// locked, so the next switch does not wait for the PLL.
+	//
+	// Unlike enableRXMode() and enableTXMode(), the second control register
+	// is not read and ORed: RX sets RX_MULTI_PACKET and clears
+	// AUTOMATIC_TRANSMISSION, TX sets AUTOMATIC_TRANSMISSION and clears
+	// RX_MULTI_PACKET, and antenna diversity and low duty cycle mode are
+	// always cleared. With RX_MULTI_PACKET the RX FIFO keeps the packets
+	// following a VALID_PACKET_RECEIVED, so the RX machine must read exactly
+	// the packet length. The time returned is the one of the SPI writes:
+	uint32_t RFM22B::turnaround(bool rx) {
+		uint64_t t0 = monotonic_ns();
+		uint16_t mode = (uint16_t)RFM22B_Operating_Mode::READY_MODE |
+				(uint16_t)RFM22B_Operating_Mode::TUNE_MODE;
+		uint16_t clear;
+		if (rx) {
+			mode |= (uint16_t)RFM22B_Operating_Mode::RX_MODE |
+					(uint16_t)RFM22B_Operating_Mode::RX_MULTI_PACKET;
+			clear = (uint16_t)RFM22B_Operating_Mode::RX_FIFO_RESET;
+		} else {
+			mode |= (uint16_t)RFM22B_Operating_Mode::TX_MODE |
+					(uint16_t)RFM22B_Operating_Mode::AUTOMATIC_TRANSMISSION;
+			clear = (uint16_t)RFM22B_Operating_Mode::TX_FIFO_RESET;
+		}
+		setRegister(RFM22B_Register::OPERATING_MODE_AND_FUNCTION_CONTROL_2,
+				(mode | clear) & 0xff);
+		set16BitRegister(
+				RFM22B_Register::OPERATING_MODE_AND_FUNCTION_CONTROL_1, mode);
+		return (uint32_t)((monotonic_ns() - t0) / 1000);
+	}
+
+	void RFM22B::tune() {
+		setOperatingMode((RFM22B_Operating_Mode)
+			((uint)RFM22B_Operating_Mode::READY_MODE |
+			 (uint)RFM22B_Operating_Mode::TUNE_MODE));
+	}
+
 	// Reset the device
 	void RFM22B::reset() {
 		setOperatingMode((RFM22B_Operating_Mode)
@@ -1087,9 +1133,6 @@ namespace RFM22B_NS {
 				x & ~0x01);
 	}
 	
-	// Note: spi_ioc_transfer on the stack didn't work, for an
-	//       unknown reason.
-	static struct spi_ioc_transfer tr[1];
 	// Transfer data
 	void RFM22B::transfer(uint8_t *tx, uint8_t *rx, size_t size) {
 		if ((!tx) || (!rx))
@@ -1098,386 +1141,93 @@ namespace RFM22B_NS {
 			throw daisy_exception(
 					"Package too long (max 65)", to_string(size));
 
-		transfer_lock.lock();
+		lock_guard<mutex> lock(transfer_lock);
 
 		if (debug)
 			cerr << "**TX: " << DaisyUtils::print(tx, size) << endl;
 
-		tr[0].tx_buf        = (unsigned long)tx;
-		tr[0].rx_buf        = (unsigned long)rx;
-		tr[0].delay_usecs   = 0;
-		tr[0].len           = size;
-		tr[0].speed_hz      = spispeed;
-		tr[0].bits_per_word = spibits;
+		// Fields not set here stay zero from the construction:
+		spitr.tx_buf        = (unsigned long)tx;
+		spitr.rx_buf        = (unsigned long)rx;
+		spitr.len           = size;
+		spitr.speed_hz      = spispeed;
+		spitr.bits_per_word = spibits;
 
-		if (ioctl(spidev, SPI_IOC_MESSAGE(1), tr) == -1)
+		if (ioctl(spidev, SPI_IOC_MESSAGE(1), &spitr) == -1)
 			throw daisy_exception("Unable to transfer data");
 
 		if (debug)
 			cerr << "**RX: " << DaisyUtils::print(rx, size) << endl;
+	}
 
-		transfer_lock.unlock();
-	}
-
-	// Send data
-	void RFM22B::send(function<int(uint8_t *pb, size_t cb)> output) {
-		if (!output)
-			return;
-
-		uint8_t   data[256];
-		uint8_t   tx[MAX_PACKET_LENGTH+1];
-		uint8_t   rx[MAX_PACKET_LENGTH+1];
-		int       packageleft;
-		int       indexinpackage;
-		int       tosend;
-		uint64_t  overflows = 0;
-		uint64_t  underflows = 0;
-		const int refillmax = MAX_PACKET_LENGTH - 
-				getTXFIFOAlmostEmptyThreshold();
-		Timer     timer;
-
-		setInterruptEnable(RFM22B_Interrupt::TX_FIFO_ALMOST_EMPTY_INT, true);
-		setInterruptEnable(RFM22B_Interrupt::FIFO_UNDERFLOW_OVERFLOW,  true);
-		setInterruptEnable(RFM22B_Interrupt::PACKET_SENT,              true);
-		
-		RFM22B_Modulation_Data_Source mds_save = getModulationDataSource();
-		setModulationDataSource(RFM22B_Modulation_Data_Source::FIFO);
-
-		// Clear the TX fifo to get a clean start:
-		clearTXFIFO();
-		
-		// Get first data block:
-		packageleft = output(data, sizeof(data));
-		if (packageleft < 0) // EOF
-			return;
-		if (verbose) {
-			cout << "<<<Output " << packageleft << " octets>>>" << endl;
-			DaisyUtils::dump(cout, data, packageleft);
-		}
-		setTransmitPacketLength(packageleft);
-		enableTXMode();
-		indexinpackage = 0;
-		// Main loop:
-		timer.reset();
-		while (packageleft >= 0) {
-			int32_t status = try_waitforinterrupt();
-			if (status < 0) {
-				usleep(INTERRUPT_POLL_TIME);
-				if (timer.elapsed() < 2.00)
-					continue;
-				if (verbose)
-					cout << "<##Transmission stalled##>" << endl;
-				enableTXMode();
-			} else {
-				timer.reset();
-			}
-			eoi();
-			
-			/*** PACKET_SENT ***/
-			if (status & (uint16_t) RFM22B_Interrupt::PACKET_SENT) {
-				if (verbose)
-					cout << "<<<Packet sent>>>" << endl;
-				packageleft = output(data, sizeof(data));
-				if (packageleft >= 0) {
-					if (verbose) {
-						cout << "<<<Output " << packageleft << " octets>>>"
-							 << endl;
-						DaisyUtils::dump(cout, data, packageleft);
-					}
-					setTransmitPacketLength(packageleft);
-					enableTXMode();
-				} else {
-					if (verbose)
-						cout << "<== End of file==>" << endl;
-					break;
-				}
-				continue;
-			}
-
-			/*** TX_FIFO_ALMOST_EMPTY_INT ***/
-			if (status & (uint16_t) RFM22B_Interrupt::TX_FIFO_ALMOST_EMPTY_INT) 
-			{
-				if (verbose)
-					cout << "<<<FIFO almost empty>>>" << endl;
-				if (packageleft > 0) {
-					tosend = (packageleft > refillmax) ?
-							refillmax : packageleft;
-					if (debug)
-						cout << "*indexinpackage=" << indexinpackage
-							 << ",packageleft="    << packageleft
-							 << ",tosend="         << tosend
-							 << endl;
-					tx[0] = 0xff;
-					memcpy(&tx[1], &data[indexinpackage], tosend);
-					transfer(tx, rx, tosend+1);
-					indexinpackage += tosend;
-					packageleft -= tosend;
-				} else {
-					if (verbose)
-						cout << "<==End of data==>" << endl;
-				}
-				continue;
-			}
-
-			/*** FIFO_UNDERFLOW_OVERFLOW ***/
-			if (status & (uint16_t) RFM22B_Interrupt::FIFO_UNDERFLOW_OVERFLOW) {
-				if (verbose)
-					cout << "<<<Over-/Underflow>>>" << endl;
-				uint8_t x = getRegister(RFM22B_Register::DEVICE_STATUS);
-				if (x & 0x80) {
-					if (verbose)
-						cout << "<==Overflow==>" << endl;
-					++overflows;
-				}
-				if (x & 0x40) {
-					if (verbose)
-						cout << "<==Underflow==>" << endl;
-					++underflows;
-				}
-				clearTXFIFO();
-				
-				packageleft = output(data, sizeof(data));
-				if (packageleft >= 0) {
-					if (verbose) {
-						cout << "<<<Output " << packageleft << " octets>>>"
-						     << endl;
-						DaisyUtils::dump(cout, data, packageleft);
-					}
-					setTransmitPacketLength(packageleft);
-					enableTXMode();
-				} else {
-					if (verbose)
-						cout << "<==End of file==>" << endl;
-					break;
-				}
-			}
-
-		} // end while //
-		if (verbose)
-			cout << "<--Main loop left-->" << endl;
-		disableTXMode();
-		setInterruptEnable(RFM22B_Interrupt::FIFO_UNDERFLOW_OVERFLOW,  false);
-		setInterruptEnable(RFM22B_Interrupt::TX_FIFO_ALMOST_EMPTY_INT, false);
-		setInterruptEnable(RFM22B_Interrupt::PACKET_SENT,              false);
-		// Wait for completion of transmission:
-		timer.reset();
-		while (((uint16_t)getOperatingMode() &
-			    (uint16_t)RFM22B_Operating_Mode::TX_MODE) &&
-			   (timer.elapsed() < 2.0))
-		{
-			usleep(1000);
-		}
-		setModulationDataSource(mds_save);
-		cout << "done" << endl;
-		cout << overflows << " overflows, " << underflows << " underflows."
-			 << endl;
-	};
-	
-	// Receive data (blocking with timeout). Returns number of bytes received
-	void RFM22B::receive(
-			function<void(uint8_t*,size_t)> input, unsigned int timeout)
-	{
-		clearRXFIFO();
-		setInterruptEnable(RFM22B_Interrupt::RSSI,                    true);
-		setInterruptEnable(RFM22B_Interrupt::VALID_PREAMBLE,          true);
-		setInterruptEnable(RFM22B_Interrupt::SYNC_WORD,               true);
-		setInterruptEnable(RFM22B_Interrupt::CRC_ERROR,               true);
-		setInterruptEnable(RFM22B_Interrupt::FIFO_UNDERFLOW_OVERFLOW, true);
-		setInterruptEnable(RFM22B_Interrupt::VALID_PACKET_RECEIVED,   true);
-		setInterruptEnable(RFM22B_Interrupt::RX_FIFO_ALMOST_FULL_INT, true);
-		Timer timer;
-		setRXFIFOAlmostFullThreshold(40);
-		int rxbffaful = getRXFIFOAlmostFullThreshold();
-		uint32_t crcerrors = 0, overflows = 0, underflows = 0, valids = 0;
-		uint64_t octets = 0;
-		uint8_t data[256];
-		uint8_t txb[MAX_PACKET_LENGTH+1]; uint8_t rxb[MAX_PACKET_LENGTH+1];
-		txb[0] = 0x7f; memset(&txb[1], 0x00, sizeof(txb)-1);
-		int alreadyreceived = 0, packagelength = 0;
-		bool sync = false;
-
-		cout << "Now listening for " << timeout << "s ... ";
-		cout.flush();
-		enableRXMode();
-		while (timer.elapsed() < timeout) {
-			int32_t status = try_waitforinterrupt();
-			if (status < 0) {
-				usleep(INTERRUPT_POLL_TIME);
-				continue;
-			}
-			eoi();
-
-			/*** RSSI ***/
-			if (status & (uint16_t) RFM22B_Interrupt::RSSI) {
-				if (verbose)
-					cout << "<<<Squelch open>>>" << endl;
-			}
-			
-			if (status & (uint16_t) RFM22B_Interrupt::VALID_PREAMBLE) {
-				if (verbose)
-					cout << "<<<Valid preamble>>>" << endl;
-				clearRXFIFO();
-				sync = false;
-			}
-
-			/*** SYNC_WORD ***/
-			if (status & (uint16_t) RFM22B_Interrupt::SYNC_WORD) {
-				if (verbose)
-					cout << "<<<Sync>>>" << endl;
-				alreadyreceived = 0;
-				sync = true;
-			}
-
-			/*** VALID_PACKET_RECEIVED ***/
-			if (status & (uint16_t) RFM22B_Interrupt::VALID_PACKET_RECEIVED) {
-				if (verbose)
-					cout << "<<<Valid packet received>>>" << endl;
-				if (sync) {
-					if (alreadyreceived == 0) {
-						transfer(txb, rxb, 2);
-						packagelength = rxb[1];
-						if (debug)
-							cout << "---First of ";
-					} else {
-						if (debug)
-							cout << "---"
-							     << alreadyreceived << " of ";
-					}
-					int received = packagelength - alreadyreceived;
-					if (debug)
-						cout << packagelength << ", got:"
-						     << received << "---" << endl;
-					if ((received >= 0) && 
-						(alreadyreceived + received == packagelength) &&
-						(received <= MAX_PACKET_LENGTH))
-					{
-						transfer(txb, rxb, received+1);
-						if (debug) {
-							cout << "---store data---" << endl;
-							DaisyUtils::dump(cout, &rxb[1], received);
-						}
-						memcpy(&data[alreadyreceived], &rxb[1], received);
-						alreadyreceived += received;
-						++valids;
-						octets += packagelength;
-						if (verbose) {
-							cout << "---Deliver---" << endl;
-							DaisyUtils::dump(cout, data, packagelength);
-						}
-						if (input)
-							input(data, packagelength);
-						sync = false;
-					} else {
-						if (verbose)
-							cout << "!!!Inconsistency"
-							     << ":received=" << received
-							     << ",alreadyreceived=" << alreadyreceived
-							     << ",packagelength=" << packagelength
-							     << "!!!>" << endl;
-						clearRXFIFO();
-						sync = false;
-					}
-				} else {
-					if (debug)
-						cout << "<##RX outside sync##>" << endl;
-					clearRXFIFO();
-				}
-			}
-
-			/*** RX_FIFO_ALMOST_FULL_INT ***/
-			if (status & (uint16_t) RFM22B_Interrupt::RX_FIFO_ALMOST_FULL_INT) {
-				if (debug)
-					cout << "<<<RX FIFO almost full: ";
-				transfer(txb, rxb, rxbffaful+1);
-				if (sync) {
-					int received, startindex;
-					if (alreadyreceived > 0) {
-						received = rxbffaful;
-						startindex = 1;
-						if (debug)
-							cout << alreadyreceived << " of "
-							     << packagelength << ", got:"
-							     << received << ">>>" << endl;
-					} else {
-						packagelength = rxb[1];
-						received = rxbffaful - 1;
-						startindex = 2;
-						if (debug)
-							cout << "First of "
-							     << packagelength << ", got:"
-							     << received << ">>>" << endl;
-					}
-					if (alreadyreceived + received <= sizeof(data)) {
-						if (debug) {
-							cout << "---store data---" << endl;
-							DaisyUtils::dump(cout, &rxb[startindex], received);
-						}
-						memcpy(&data[alreadyreceived], &rxb[startindex],
-								received);
-						alreadyreceived += received;
-					} else {
-						if (debug)
-							cout << "<<<Too much data:"
-								 << alreadyreceived + rxbffaful << endl;
-						clearRXFIFO();
-						sync = false;
-					}
-				} else {
-					if (debug)
-						cout << " outside sync>>>" << endl;
-					clearRXFIFO();
-				}
-			}
-
-			/*** CRC_ERROR ***/
-			if (status & (uint16_t) RFM22B_Interrupt::CRC_ERROR) {
-				if (verbose)
-					cout << "<<<CRC error>>>" << endl;
-				++crcerrors;
-				sync = false;
-			}
+	// Calibration uses the transmit and check headers (0x3a..0x42):
+	static const uint8_t CALIBRATE_LEN    = 9;
+	static const int     CALIBRATE_ROUNDS = 16;
+	static const uint32_t CALIBRATE_SLOWEST = 500000;
+
+	static uint8_t calibrate_pattern(int round, int i) {
+		switch (round % 4) {
+		case 0:  return (i % 2) ? 0x55 : 0xaa;
+		case 1:  return 1 << ((round + i) % 8);
+		case 2:  return (i % 2) ? 0xff : 0x00;
+		default: return round * 37 + i * 101;
+		} // end switch //
+	}
+
+	vector<spi_speed_step> RFM22B::calibrateSPISpeed(uint32_t max_hz) {
+		const uint8_t reg = (uint8_t)RFM22B_Register::TRANSMIT_HEADER_3;
+		uint8_t save[CALIBRATE_LEN+1] = { reg };
+		uint8_t tx[MAX_PACKET_LENGTH+1], rx[MAX_PACKET_LENGTH+1];
+		vector<spi_speed_step> steps;
+		uint32_t good = 0, prev = 0;
+
+		uint32_t speed = spispeed;
+		transfer(save, rx, CALIBRATE_LEN+1);
+		memcpy(save+1, rx+1, CALIBRATE_LEN);
+		for (uint32_t hz = CALIBRATE_SLOWEST; hz <= max_hz; hz *= 2) {
+			spi_speed_step step { hz, 0, 0 };
+			spispeed = hz;
+			for (int round = 0; round < CALIBRATE_ROUNDS; ++round) {
+				// Single register writes and reads:
+				for (int i = 0; i < CALIBRATE_LEN; ++i) {
+					uint8_t x = calibrate_pattern(round, i);
+					setRegister((RFM22B_Register)(reg + i), x);
+					if (getRegister((RFM22B_Register)(reg + i)) != x)
+						++step.errors;
+				} // end for //
+				// Burst write and read, as used for the FIFO:
+				tx[0] = reg | (1<<7);
+				for (int i = 0; i < CALIBRATE_LEN; ++i)
+					tx[i+1] = ~calibrate_pattern(round, i);
+				transfer(tx, rx, CALIBRATE_LEN+1);
+				memset(tx, 0x00, CALIBRATE_LEN+1);
+				tx[0] = reg;
+				transfer(tx, rx, CALIBRATE_LEN+1);
+				for (int i = 0; i < CALIBRATE_LEN; ++i)
+					if (rx[i+1] != (uint8_t)~calibrate_pattern(round, i))
+						++step.errors;
+			} // end for //
+			// Time a burst of the size of a FIFO transfer, reading from
+			// the headers on (no register that clears on read):
+			memset(tx, 0x00, sizeof(tx));
+			tx[0] = reg;
+			uint64_t t0 = monotonic_ns();
+			transfer(tx, rx, sizeof(tx));
+			step.transfer_ns = monotonic_ns() - t0;
+			steps.push_back(step);
+			if (step.errors)
+				break;
+			prev = good;
+			good = hz;
+		} // end for //
 
-			/*** FIFO_UNDERFLOW_OVERFLOW ***/
-			if (status & (uint16_t) RFM22B_Interrupt::FIFO_UNDERFLOW_OVERFLOW) {
-				if (sync) {
-					if (debug)
-						cout << "<<<Over-/Underflow>>>" << endl;
-					clearRXFIFO();
-					uint8_t x = getRegister(RFM22B_Register::DEVICE_STATUS);
-					if (x & 0x80) {
-						if (verbose)
-							cout << "<==Overflow==>" << endl;
-						++overflows;
-						sync = false;
-					}
-					if (x & 0x40) {
-						if (verbose)
-							cout << "<==Underflow==>" << endl;
-						++underflows;
-						sync = false;
-					}
-				}
-			}
+		// One step below the fastest clean one as safety margin:
+		spispeed = prev ? prev : good ? good : speed;
+		save[0] = reg | (1<<7);
+		transfer(save, rx, CALIBRATE_LEN+1);
+		return steps;
+	}
 
-		} // end while //
-		disableRXMode();
-		setInterruptEnable(RFM22B_Interrupt::RSSI,                    false);
-		setInterruptEnable(RFM22B_Interrupt::VALID_PREAMBLE,          false);
-		setInterruptEnable(RFM22B_Interrupt::SYNC_WORD,               false);
-		setInterruptEnable(RFM22B_Interrupt::CRC_ERROR,               false);
-		setInterruptEnable(RFM22B_Interrupt::FIFO_UNDERFLOW_OVERFLOW, false);
-		setInterruptEnable(RFM22B_Interrupt::VALID_PACKET_RECEIVED,   false);
-		setInterruptEnable(RFM22B_Interrupt::RX_FIFO_ALMOST_FULL_INT, false);
-		cout << octets << " octets"
-			 << endl;
-		cout << "  "
-			 << valids     << " pkgs, "
-			 << crcerrors  << " CRC err, "
-			 << overflows  << " overflows, "
-			 << underflows << " underflows"
-			 << endl;
-	};
-	
 	// Helper function to read a single byte from the device
 	uint8_t RFM22B::getRegister(RFM22B_Register reg) {
 		// rx and tx arrays must be the same length
@@ -22,9 +22,14 @@
 #include <vector>
 #include <mutex>
 #include <thread>
-#include <functional>
+#include <atomic>
+
+#include <stdint.h>
+
+#include <linux/spi/spidev.h>
 
 #include "defaults.h"
+#include "fifo_tuner.h"
 
 namespace RFM22B_NS {
 
@@ -43,6 +48,58 @@ namespace RFM22B_NS {
 
 	struct register_value { uint8_t setting[2]; };
 
+	class ModemCalculator;
+
+	// One step of RFM22B::calibrateSPISpeed():
+	struct spi_speed_step {
+		uint32_t hz;           // Clock of the step
+		uint32_t errors;       // Octets read back wrong
+		uint32_t transfer_ns;  // Of a burst of MAX_PACKET_LENGTH+1 octets
+	};
+
+	template<class Source> class TxMachine;
+	template<class Sink>   class RxMachine;
+
+	// Counters of send(). They are updated by the radio thread and may be
+	// read from any other thread while send() is running.
+	struct tx_statistics {
+		std::atomic<uint64_t> octets     {0};
+		std::atomic<uint32_t> packets    {0};
+		std::atomic<uint32_t> refills    {0};  // TX FIFO refills
+		std::atomic<uint64_t> refill_ns  {0};  // Total time of the refills
+		std::atomic<uint32_t> refill_max {0};  // Longest refill in ns
+		std::atomic<uint32_t> stalls     {0};
+		std::atomic<uint32_t> overflows  {0};
+		std::atomic<uint32_t> underflows {0};
+		std::atomic<uint32_t> switch_us     {0};  // SPI time, last switch to TX
+		std::atomic<uint32_t> switch_max_us {0};
+
+		void reset() {
+			octets = 0; packets = 0; refills = 0; refill_ns = 0;
+			refill_max = 0; stalls = 0; overflows = 0; underflows = 0;
+			switch_us = 0; switch_max_us = 0;
+		}
+	};
+
+	// Counters of receive(). They are updated by the radio thread and may
+	// be read from any other thread while receive() is running.
+	struct rx_statistics {
+		std::atomic<uint64_t> octets     {0};
+		std::atomic<uint32_t> valids     {0};
+		std::atomic<uint32_t> dropped    {0};
+		std::atomic<uint32_t> crcerrors  {0};
+		std::atomic<uint32_t> overflows  {0};
+		std::atomic<uint32_t> underflows {0};
+		std::atomic<uint32_t> switch_us     {0};  // SPI time, last switch to RX
+		std::atomic<uint32_t> switch_max_us {0};
+
+		void reset() {
+			octets = 0; valids = 0; dropped = 0;
+			crcerrors = 0; overflows = 0; underflows = 0;
+			switch_us = 0; switch_max_us = 0;
+		}
+	};
+
 	class RFM22B {
 	public:
 		// Constructor
@@ -69,16 +126,40 @@ namespace RFM22B_NS {
 		// Get device status.
 		uint8_t getDeviceStatus();
 
-		// Set the header address.
+		// Set the header address. Frames are sent with a 4 octet header,
+		// header 3..2 hold the destination and header 1..0 the source. The
+		// chip discards received frames whose header 3..2 are neither our
+		// own header address nor broadcast:
 		void setAddress(const std::vector<uint8_t>& addr);
 
 		// Get the header address.
 		std::vector<uint8_t> getAddress();
 
+		// 16 bit header address of a callsign or MAC address (CRC-16/CCITT,
+		// no octet is 0xff, so it never matches broadcast by accident):
+		static uint16_t headerAddress(const std::vector<uint8_t>& addr);
+		static const uint16_t HEADER_BROADCAST = 0xffff;
+
+		// Set or get the destination of the frames sent:
+		void setDestination(const std::vector<uint8_t>& addr);
+		void setDestination(uint16_t hdr);
+		uint16_t getDestination() { return destination; }
+
+		// Set or get the network ID, sent in sync word 1..0. Zero sends
+		// only sync word 3..2, as without a network ID:
+		void setNetwork(uint16_t id);
+		uint16_t getNetwork() { return network; }
+
+		// Receive all frames, regardless of the header address:
+		void setPromiscuous(bool f);
+		bool getPromiscuous() { return promiscuous; }
+
 		// Set standard modes:
 		void setNarrowMode();
 		void setMediumMode();
 		void setWideMode();
+		// Set all modem registers (see modem.h)
+		void setModem(const ModemCalculator& modem);
 
 		// Tune for some seconds:
 		void tune(unsigned int seconds);
@@ -107,8 +188,7 @@ namespace RFM22B_NS {
 
 		// Set or get the TX data rate (bps)
 		// NOTE: This does NOT configure the receive data rate! To properly set
-		// up the device for receiving, use the magic register values
-		// calculated using the Si443x-Register-Settings_RevB1.xls Excel sheet.
+		// up the device for receiving, use setModem().
 		void setDataRate(unsigned int rate);
 		unsigned int getDataRate();
 
@@ -168,6 +248,14 @@ namespace RFM22B_NS {
 		void enableTXMode();
 		void disableTXMode();
 
+		// Fast switch of the direction: Clears the FIFO and enters RX or
+		// TX with the PLL kept on. Returns the time of the register
+		// writes in us, not the settling time of the radio. Register 0x08
+		// is written as a whole, see rfm22b.cpp:
+		uint32_t turnaround(bool rx);
+		// Leave RX or TX, but keep the PLL tuned for the next switch:
+		void tune();
+
 		// Set or get the transmit header
 		void setTransmitHeader(uint32_t header);
 		uint32_t getTransmitHeader();
@@ -214,17 +302,44 @@ namespace RFM22B_NS {
 		void setVerbose(bool f) { verbose = f; }
 		bool getVerbose() { return verbose; }
 
-		// Send data
-		void send(std::function<int(uint8_t *pb, size_t cb)> output);
-
-		// Receive data (blocking with timeout). Returns number of bytes received
-		void receive(
-			std::function<void(uint8_t*,size_t)> input,
-			unsigned int                         timeout = DEFAULT_RX_TIMEOUT);
-
+		// Send all packets of a source (see rfm22b_packet.h)
+		template<class Source>
+		void send(Source& source);
+
+		// Receive packets into a sink (blocking with timeout in s, 0 waits
+		// until abort(), see rfm22b_packet.h)
+		template<class Sink>
+		void receive(Sink& sink, unsigned int timeout = DEFAULT_RX_TIMEOUT);
+		// Terminate a running send() or receive() from another thread. The
+		// flag is cleared when they return or by abort(false).
+		void abort(bool f = true) { aborted = f; }
+		// Counters of the running or last send() and receive()
+		const tx_statistics& getTXStatistics() const { return txstats; }
+		const rx_statistics& getRXStatistics() const { return rxstats; }
+		// Chooses the FIFO thresholds of send() and receive()
+		FifoTuner& getFIFOTuner() { return fifotuner; }
+
+		// Event loop mode: setInterruptEnable() starts no interrupt thread,
+		// the owner polls the interrupts with pollInterrupts() instead (see
+		// reactor.h)
+		void setEventLoopMode(bool f);
+		bool getEventLoopMode() { return eventloop; }
+		// Read the interrupt status and return the rising edges of the
+		// enabled interrupts
+		uint16_t pollInterrupts();
 		// Transfer
 		void transfer(uint8_t *tx, uint8_t *rx, size_t size);
 
+		// Set or get the SPI clock
+		void setSPISpeed(uint32_t hz) { spispeed = hz; }
+		uint32_t getSPISpeed() const { return spispeed; }
+		// Find the fastest reliable SPI clock up to max_hz: The clock is
+		// doubled from 500 kHz on, at every step patterns are written to the
+		// header registers and read back. Stops at the first step with
+		// errors and sets the clock one step below the fastest clean one.
+		// Returns the result of every step tried.
+		std::vector<spi_speed_step> calibrateSPISpeed(uint32_t max_hz);
+
 		// Helper functions for getting and getting individual registers
 		uint8_t getRegister(RFM22B_Register reg);
 		uint16_t get16BitRegister(RFM22B_Register reg);
@@ -260,17 +375,32 @@ namespace RFM22B_NS {
 
 		static const uint8_t MAX_PACKET_LENGTH = 64;
 	private:
+		template<class Source> friend class TxMachine;
+		template<class Sink>   friend class RxMachine;
+
 		void setFIFOThreshold(RFM22B_Register reg, uint8_t thresh);
 		void init(struct register_value rg_rv[]);
+		void applyHeaders();
 
 		int                  spidev = -1;
 		uint8_t              spimode;
 		uint8_t              spibits;
 		uint32_t             spispeed;
-		std::mutex           transfer_lock;
+		std::mutex           transfer_lock;         // Guards spitr
+		struct spi_ioc_transfer spitr {};
 		std::vector<uint8_t> addr {};
+		uint16_t             destination = HEADER_BROADCAST;
+		uint16_t             network = 0;
+		bool                 promiscuous = false;
 		bool                 debug = false;
 		bool                 verbose = false;
+		std::atomic<bool>    aborted {false};
+		bool                 eventloop = false;
+		tx_statistics        txstats;
+		rx_statistics        rxstats;
+		FifoTuner            fifotuner;
+		uint64_t             irqseen = 0;  // Earliest time of the pending
+		                                   // interrupt, in monotonic ns
 
 #ifdef SIMULATE_INTERRUPTS
 		// Support for simulated interrupts:
@@ -0,0 +1,610 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RFM22B_PACKET_H
+#define _RFM22B_PACKET_H
+
+#include <iostream>
+
+#include <stdint.h>
+#include <stddef.h>
+#include <unistd.h>
+
+#include "rfm22b.h"
+#include "rfm22b_types.h"
+#include "rfm22b_registers.h"
+#include "timer.h"
+#include "utility.h"
+
+namespace RFM22B_NS {
+
+	// Octets reserved in front of the payload of every packet buffer. When
+	// sending, the octet right before a FIFO chunk is overwritten with the
+	// FIFO write command. When receiving, the first transfer places the
+	// status octet and the length octet there. This way chunks go to and
+	// come from transfer() without being copied.
+	static const size_t PACKET_HEADROOM = 2;
+
+	// Largest payload the packet handler can describe (8 bit length).
+	static const size_t MAX_PAYLOAD_LENGTH = 255;
+
+	// A packet buffer owned by the caller. pb points to the start of the
+	// headroom, the payload starts at pb + PACKET_HEADROOM.
+	struct packet_buffer {
+		uint8_t *pb;    // Start of the storage (headroom)
+		size_t   cb;    // Length of the payload
+		size_t   size;  // Capacity of the payload
+
+		uint8_t *payload() { return pb + PACKET_HEADROOM; }
+		const uint8_t *payload() const { return pb + PACKET_HEADROOM; }
+	};
+
+	// Preallocated storage for one packet buffer of N payload octets.
+	template<size_t N = MAX_PAYLOAD_LENGTH>
+	struct packet_storage {
+		uint8_t       data[N + PACKET_HEADROOM];
+		packet_buffer buffer;
+
+		packet_storage(): buffer { data, 0, N } {}
+		packet_storage(const packet_storage&) = delete;
+		packet_storage& operator=(const packet_storage&) = delete;
+	};
+
+	// Metadata of a received packet, captured at sync word detection:
+	struct rx_info {
+		uint64_t timestamp;  // Wall clock in ns (see realtime_ns())
+		uint8_t  rssi;       // RSSI register
+		bool     crc_ok;     // False: packet is truncated at CRC error
+	};
+
+	// A batch of caller owned packet buffers. It is a source for send()
+	// (all buffers are sent in order) and a sink for receive() (buffers
+	// are filled in order until the batch is full, packets with CRC
+	// errors are not kept).
+	class packet_batch {
+	public:
+		packet_batch(packet_buffer *pkts, size_t n): pkts{pkts}, n{n} {}
+
+		// Source:
+		packet_buffer *next() { return (i < n) ? &pkts[i++] : NULL; }
+
+		// Sink:
+		packet_buffer *acquire() { return (i < n) ? &pkts[i] : NULL; }
+		void commit(packet_buffer *, const rx_info& info) {
+			if (info.crc_ok)
+				++i;
+		}
+
+		size_t count() const { return i; }
+		void rewind() { i = 0; }
+
+	private:
+		packet_buffer *pkts;
+		size_t         n;
+		size_t         i = 0;
+	};
+
+	/*
+	 * Source: packet_buffer *next();
+	 *    Return the next packet to send, or NULL at end of data. The
+	 *    buffer has to stay valid until next() is called again.
+	 *
+	 * Sink:   packet_buffer *acquire();
+	 *         void commit(packet_buffer *pkt, const rx_info& info);
+	 *    acquire() is called when a sync word is detected and returns
+	 *    the buffer to receive into, or NULL to drop the packet. commit()
+	 *    hands over the completely received packet, or on CRC error the
+	 *    octets received so far with info.crc_ok cleared. A packet that
+	 *    is lost otherwise is not committed, the next acquire() may
+	 *    return the same buffer again.
+	 */
+
+	/*
+	 * The transmitter and the receiver are state machines, that are driven
+	 * by interrupts. They are used by the blocking send() and receive()
+	 * below, and by the Reactor (see reactor.h), that drives any number of
+	 * chips from a single thread.
+	 *
+	 *    start()        Set up the chip, false if there is nothing to do
+	 *    on_interrupt() Process the rising edges of the interrupt status
+	 *    on_tick()      Called periodically, handles stalls
+	 *    finish()       Restore the chip
+	 *
+	 * on_interrupt() and on_tick() return false when the machine is done.
+	 */
+
+	template<class Source>
+	class TxMachine {
+	public:
+		TxMachine(RFM22B& chip, Source& source):
+			chip(chip), source(source) {}
+
+		bool start() {
+			chip.txstats.reset();
+			pkt = source.next();
+			if (!pkt) // EOF
+				return false;
+
+			chip.fifotuner.setDataRate(chip.getDataRate());
+
+			chip.setInterruptEnable(
+					RFM22B_Interrupt::TX_FIFO_ALMOST_EMPTY_INT, true);
+			chip.setInterruptEnable(
+					RFM22B_Interrupt::FIFO_UNDERFLOW_OVERFLOW,  true);
+			chip.setInterruptEnable(
+					RFM22B_Interrupt::PACKET_SENT,              true);
+
+			mds_save = chip.getModulationDataSource();
+			chip.setModulationDataSource(RFM22B_Modulation_Data_Source::FIFO);
+
+			load();
+			timer.reset();
+			return true;
+		}
+
+		bool on_interrupt(uint16_t status) {
+			timer.reset();
+
+			/*** PACKET_SENT ***/
+			if (status & (uint16_t) RFM22B_Interrupt::PACKET_SENT) {
+				if (chip.verbose)
+					std::cout << "<<<Packet sent>>>" << std::endl;
+				return load_next();
+			}
+
+			/*** TX_FIFO_ALMOST_EMPTY_INT ***/
+			if (status & (uint16_t) RFM22B_Interrupt::TX_FIFO_ALMOST_EMPTY_INT)
+			{
+				if (chip.verbose)
+					std::cout << "<<<FIFO almost empty>>>" << std::endl;
+				if (packageleft > 0) {
+					size_t tosend = (packageleft > refillmax) ?
+							refillmax : packageleft;
+					if (chip.debug)
+						std::cout << "*indexinpackage=" << indexinpackage
+								  << ",packageleft="    << packageleft
+								  << ",tosend="         << tosend
+								  << std::endl;
+					// The octet in front of the chunk is either headroom
+					// or already sent, so it carries the FIFO command:
+					uint8_t *pb = pkt->payload() + indexinpackage - 1;
+					uint8_t  save = *pb;
+					uint64_t t0 = monotonic_ns();
+					*pb = (uint8_t)RFM22B_Register::FIFO_ACCESS | (1<<7);
+					chip.transfer(pb, rx, tosend+1);
+					*pb = save;
+					uint64_t t1 = monotonic_ns();
+					uint32_t dt = (uint32_t)(t1 - t0);
+					chip.fifotuner.sample(t1 - chip.irqseen);
+					++chip.txstats.refills;
+					chip.txstats.refill_ns += dt;
+					if (dt > chip.txstats.refill_max)
+						chip.txstats.refill_max = dt;
+					indexinpackage += tosend;
+					packageleft -= tosend;
+				} else {
+					if (chip.verbose)
+						std::cout << "<==End of data==>" << std::endl;
+				}
+				return true;
+			}
+
+			/*** FIFO_UNDERFLOW_OVERFLOW ***/
+			if (status & (uint16_t) RFM22B_Interrupt::FIFO_UNDERFLOW_OVERFLOW) {
+				if (chip.verbose)
+					std::cout << "<<<Over-/Underflow>>>" << std::endl;
+				uint8_t x = chip.getRegister(RFM22B_Register::DEVICE_STATUS);
+				if (x & 0x80) {
+					if (chip.verbose)
+						std::cout << "<==Overflow==>" << std::endl;
+					++chip.txstats.overflows;
+				}
+				if (x & 0x40) {
+					if (chip.verbose)
+						std::cout << "<==Underflow==>" << std::endl;
+					++chip.txstats.underflows;
+					chip.fifotuner.fault();
+				}
+				chip.clearTXFIFO();
+				return load_next();
+			}
+			return true;
+		}
+
+		// A packet that is not sent within 2s is given up:
+		bool on_tick() {
+			if (timer.elapsed() < 2.00)
+				return true;
+			if (chip.verbose)
+				std::cout << "<##Transmission stalled##>" << std::endl;
+			++chip.txstats.stalls;
+			timer.reset();
+			chip.clearTXFIFO();
+			return load_next();
+		}
+
+		void finish() {
+			if (chip.verbose)
+				std::cout << "<--Main loop left-->" << std::endl;
+			// Wait for completion of transmission (only when aborted with
+			// the whole packet in the FIFO):
+			timer.reset();
+			while (pkt && !packageleft && (timer.elapsed() < 2.0)) {
+				int32_t status = chip.try_waitforinterrupt();
+				if (status < 0) {
+					usleep(INTERRUPT_POLL_TIME);
+					continue;
+				}
+				chip.eoi();
+				if (status & (uint16_t) RFM22B_Interrupt::PACKET_SENT)
+					break;
+			} // end while //
+			chip.tune();
+			chip.setInterruptEnable(
+					RFM22B_Interrupt::FIFO_UNDERFLOW_OVERFLOW,  false);
+			chip.setInterruptEnable(
+					RFM22B_Interrupt::TX_FIFO_ALMOST_EMPTY_INT, false);
+			chip.setInterruptEnable(
+					RFM22B_Interrupt::PACKET_SENT,              false);
+			chip.setModulationDataSource(mds_save);
+		}
+
+	private:
+		// Apply the tuned TX almost empty threshold, between packets:
+		void tune() {
+			uint8_t th = chip.fifotuner.getThresholds().tx_almost_empty;
+			if (th != threshold) {
+				chip.setTXFIFOAlmostEmptyThreshold(th);
+				threshold = th;
+			}
+			refillmax = RFM22B::MAX_PACKET_LENGTH - th;
+		}
+
+		// Load the packet to the chip and start transmission:
+		void load() {
+			if (pkt->cb > MAX_PAYLOAD_LENGTH)
+				pkt->cb = MAX_PAYLOAD_LENGTH;
+			if (chip.verbose) {
+				std::cout << "<<<Output " << pkt->cb << " octets>>>"
+						  << std::endl;
+				DaisyUtils::dump(std::cout, pkt->payload(), pkt->cb);
+			}
+			packageleft = pkt->cb;
+			indexinpackage = 0;
+			++chip.txstats.packets;
+			chip.txstats.octets += pkt->cb;
+			tune();
+			chip.setTransmitPacketLength(pkt->cb);
+			uint32_t us = chip.turnaround(false);
+			chip.txstats.switch_us = us;
+			if (us > chip.txstats.switch_max_us)
+				chip.txstats.switch_max_us = us;
+		}
+
+		bool load_next() {
+			pkt = source.next();
+			if (pkt) {
+				load();
+				return true;
+			}
+			if (chip.verbose)
+				std::cout << "<==End of file==>" << std::endl;
+			return false;
+		}
+
+		RFM22B&        chip;
+		Source&        source;
+		size_t         refillmax = 0;
+		uint8_t        threshold = 0xff;
+		uint8_t        rx[RFM22B::MAX_PACKET_LENGTH+1];
+		packet_buffer *pkt = NULL;
+		size_t         packageleft = 0;
+		size_t         indexinpackage = 0;
+		Timer          timer;
+		RFM22B_Modulation_Data_Source mds_save;
+	};
+
+	template<class Sink>
+	class RxMachine {
+	public:
+		RxMachine(RFM22B& chip, Sink& sink): chip(chip), sink(sink) {}
+
+		bool start() {
+			chip.setInterruptEnable(RFM22B_Interrupt::RSSI,            true);
+			chip.setInterruptEnable(RFM22B_Interrupt::VALID_PREAMBLE,  true);
+			chip.setInterruptEnable(RFM22B_Interrupt::SYNC_WORD,       true);
+			chip.setInterruptEnable(RFM22B_Interrupt::CRC_ERROR,       true);
+			chip.setInterruptEnable(
+					RFM22B_Interrupt::FIFO_UNDERFLOW_OVERFLOW, true);
+			chip.setInterruptEnable(
+					RFM22B_Interrupt::VALID_PACKET_RECEIVED,   true);
+			chip.setInterruptEnable(
+					RFM22B_Interrupt::RX_FIFO_ALMOST_FULL_INT, true);
+			chip.fifotuner.setDataRate(chip.getDataRate());
+			tune();
+			chip.rxstats.reset();
+			uint32_t us = chip.turnaround(true);
+			chip.rxstats.switch_us = us;
+			chip.rxstats.switch_max_us = us;
+			return true;
+		}
+
+		bool on_interrupt(uint16_t status) {
+			/*** RSSI ***/
+			if (status & (uint16_t) RFM22B_Interrupt::RSSI) {
+				if (chip.verbose)
+					std::cout << "<<<Squelch open>>>" << std::endl;
+			}
+
+			if (status & (uint16_t) RFM22B_Interrupt::VALID_PREAMBLE) {
+				if (chip.verbose)
+					std::cout << "<<<Valid preamble>>>" << std::endl;
+				chip.clearRXFIFO();
+				sync = false;
+			}
+
+			/*** SYNC_WORD ***/
+			if (status & (uint16_t) RFM22B_Interrupt::SYNC_WORD) {
+				if (chip.verbose)
+					std::cout << "<<<Sync>>>" << std::endl;
+				info.timestamp = realtime_ns();
+				info.rssi = chip.getRSSI();
+				alreadyreceived = 0;
+				pkt = sink.acquire();
+				if (!pkt) {
+					++chip.rxstats.dropped;
+					pkt = &scratch.buffer;
+				}
+				sync = true;
+			}
+
+			/*** VALID_PACKET_RECEIVED ***/
+			if (status & (uint16_t) RFM22B_Interrupt::VALID_PACKET_RECEIVED) {
+				if (chip.verbose)
+					std::cout << "<<<Valid packet received>>>" << std::endl;
+				if (sync) {
+					if (alreadyreceived == 0) {
+						chip.transfer(txb, pkt->pb, 2);
+						packagelength = pkt->pb[1];
+						if (chip.debug)
+							std::cout << "---First of ";
+					} else {
+						if (chip.debug)
+							std::cout << "---"
+									  << alreadyreceived << " of ";
+					}
+					if (chip.debug)
+						std::cout << packagelength << ", got:"
+								  << packagelength - alreadyreceived << "---"
+								  << std::endl;
+					if ((packagelength >= alreadyreceived) &&
+						(packagelength <= pkt->size) &&
+						(packagelength - alreadyreceived <=
+								RFM22B::MAX_PACKET_LENGTH))
+					{
+						fetch(packagelength - alreadyreceived);
+						pkt->cb = packagelength;
+						++chip.rxstats.valids;
+						chip.rxstats.octets += packagelength;
+						if (chip.verbose) {
+							std::cout << "---Deliver---" << std::endl;
+							DaisyUtils::dump(std::cout, pkt->payload(),
+									pkt->cb);
+						}
+						deliver(true);
+					} else {
+						if (chip.verbose)
+							std::cout << "!!!Inconsistency"
+									  << ":alreadyreceived=" << alreadyreceived
+									  << ",packagelength=" << packagelength
+									  << "!!!>" << std::endl;
+						chip.clearRXFIFO();
+						sync = false;
+					}
+				} else {
+					if (chip.debug)
+						std::cout << "<##RX outside sync##>" << std::endl;
+					chip.clearRXFIFO();
+				}
+			}
+
+			/*** RX_FIFO_ALMOST_FULL_INT ***/
+			if (status & (uint16_t) RFM22B_Interrupt::RX_FIFO_ALMOST_FULL_INT) {
+				if (chip.debug)
+					std::cout << "<<<RX FIFO almost full: ";
+				if (sync) {
+					if ((alreadyreceived == 0) && (rxbffaful - 1 <= pkt->size)) {
+						// First chunk: status and length octet go to the
+						// headroom, the data right to the payload:
+						chip.transfer(txb, pkt->pb, rxbffaful+1);
+						packagelength = pkt->pb[1];
+						alreadyreceived = rxbffaful - 1;
+						if (chip.debug)
+							std::cout << "First of " << packagelength
+									  << ">>>" << std::endl;
+						if (packagelength > pkt->size) {
+							if (chip.debug)
+								std::cout << "<<<Too long:"
+										  << packagelength << std::endl;
+							chip.clearRXFIFO();
+							sync = false;
+						}
+					} else if (alreadyreceived + rxbffaful <= pkt->size) {
+						if (chip.debug)
+							std::cout << alreadyreceived << " of "
+									  << packagelength << ">>>" << std::endl;
+						fetch(rxbffaful);
+					} else {
+						if (chip.debug)
+							std::cout << "<<<Too much data:"
+									  << alreadyreceived + rxbffaful
+									  << std::endl;
+						chip.clearRXFIFO();
+						sync = false;
+					}
+				} else {
+					if (chip.debug)
+						std::cout << " outside sync>>>" << std::endl;
+					chip.clearRXFIFO();
+				}
+				chip.fifotuner.sample(monotonic_ns() - chip.irqseen);
+			}
+
+			/*** CRC_ERROR ***/
+			if (status & (uint16_t) RFM22B_Interrupt::CRC_ERROR) {
+				if (chip.verbose)
+					std::cout << "<<<CRC error>>>" << std::endl;
+				++chip.rxstats.crcerrors;
+				if (sync) {
+					pkt->cb = alreadyreceived;
+					deliver(false);
+				}
+				chip.clearRXFIFO();
+			}
+
+			/*** FIFO_UNDERFLOW_OVERFLOW ***/
+			if (status & (uint16_t) RFM22B_Interrupt::FIFO_UNDERFLOW_OVERFLOW) {
+				if (sync) {
+					if (chip.debug)
+						std::cout << "<<<Over-/Underflow>>>" << std::endl;
+					chip.clearRXFIFO();
+					uint8_t x = chip.getRegister(RFM22B_Register::DEVICE_STATUS);
+					if (x & 0x80) {
+						if (chip.verbose)
+							std::cout << "<==Overflow==>" << std::endl;
+						++chip.rxstats.overflows;
+						chip.fifotuner.fault();
+						sync = false;
+					}
+					if (x & 0x40) {
+						if (chip.verbose)
+							std::cout << "<==Underflow==>" << std::endl;
+						++chip.rxstats.underflows;
+						sync = false;
+					}
+				}
+			}
+			return true;
+		}
+
+		bool on_tick() { return true; }
+
+		void finish() {
+			chip.tune();
+			chip.setInterruptEnable(RFM22B_Interrupt::RSSI,            false);
+			chip.setInterruptEnable(RFM22B_Interrupt::VALID_PREAMBLE,  false);
+			chip.setInterruptEnable(RFM22B_Interrupt::SYNC_WORD,       false);
+			chip.setInterruptEnable(RFM22B_Interrupt::CRC_ERROR,       false);
+			chip.setInterruptEnable(
+					RFM22B_Interrupt::FIFO_UNDERFLOW_OVERFLOW, false);
+			chip.setInterruptEnable(
+					RFM22B_Interrupt::VALID_PACKET_RECEIVED,   false);
+			chip.setInterruptEnable(
+					RFM22B_Interrupt::RX_FIFO_ALMOST_FULL_INT, false);
+		}
+
+	private:
+		// Read cb octets from the FIFO directly to the payload at offset
+		// alreadyreceived. The octet in front is clobbered by the status
+		// octet of the transfer and is restored afterwards:
+		void fetch(size_t cb) {
+			uint8_t *pb = pkt->payload() + alreadyreceived - 1;
+			uint8_t  save = *pb;
+			chip.transfer(txb, pb, cb+1);
+			*pb = save;
+			alreadyreceived += cb;
+		}
+
+		// Hand the packet over to the sink, unless it is dropped:
+		void deliver(bool crc_ok) {
+			info.crc_ok = crc_ok;
+			if (pkt != &scratch.buffer)
+				sink.commit(pkt, info);
+			sync = false;
+			tune();
+		}
+
+		// Apply the tuned RX almost full threshold, between packets:
+		void tune() {
+			uint8_t th = chip.fifotuner.getThresholds().rx_almost_full;
+			if (th != rxbffaful) {
+				chip.setRXFIFOAlmostFullThreshold(th);
+				rxbffaful = th;
+			}
+		}
+
+		RFM22B&          chip;
+		Sink&            sink;
+		size_t           rxbffaful = 0;
+		// Packets without a sink buffer are drained into the scratch:
+		packet_storage<> scratch;
+		packet_buffer   *pkt = NULL;
+		// FIFO read command followed by dummy octets:
+		uint8_t          txb[RFM22B::MAX_PACKET_LENGTH+1] = { 0x7f };
+		size_t           alreadyreceived = 0, packagelength = 0;
+		bool             sync = false;
+		rx_info          info;
+	};
+
+	template<class Source>
+	void RFM22B::send(Source& source) {
+		TxMachine<Source> tx(*this, source);
+		if (!tx.start())
+			return;
+		bool running = true;
+		irqseen = monotonic_ns();
+		while (running && !aborted) {
+			int32_t status = try_waitforinterrupt();
+			if (status < 0) {
+				irqseen = monotonic_ns();
+				usleep(INTERRUPT_POLL_TIME);
+				running = tx.on_tick();
+				continue;
+			}
+			eoi();
+			running = tx.on_interrupt(status);
+			irqseen = monotonic_ns();
+		} // end while //
+		tx.finish();
+		aborted = false;
+	}
+
+	template<class Sink>
+	void RFM22B::receive(Sink& sink, unsigned int timeout) {
+		RxMachine<Sink> rx(*this, sink);
+		Timer timer;
+		rx.start();
+		irqseen = monotonic_ns();
+		while (!aborted && ((timeout == 0) || (timer.elapsed() < timeout))) {
+			int32_t status = try_waitforinterrupt();
+			if (status < 0) {
+				irqseen = monotonic_ns();
+				usleep(INTERRUPT_POLL_TIME);
+				continue;
+			}
+			eoi();
+			rx.on_interrupt(status);
+			irqseen = monotonic_ns();
+		} // end while //
+		aborted = false;
+		rx.finish();
+	}
+
+} // end namespace //
+
+#endif
@@ -0,0 +1,155 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "rx_ring.h"
+#include "daisy_exception.h"
+
+using namespace std;
+
+namespace RFM22B_NS {
+
+	static size_t round_capacity(size_t n) {
+		size_t c = 1;
+		while (c < n)
+			c <<= 1;
+		return c;
+	}
+
+	FrameRing::FrameRing(size_t n):
+		frames{ new rx_frame[round_capacity(n)] },
+		capacity{ round_capacity(n) }
+	{
+		eventfd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (eventfd < 0)
+			throw daisy_exception("Unable to create eventfd", strerror(errno));
+	}
+
+	FrameRing::~FrameRing() {
+		::close(eventfd);
+	}
+
+	packet_buffer *FrameRing::acquire() {
+		size_t h = head.load(memory_order_relaxed);
+		if (h - tail.load(memory_order_acquire) >= capacity) {
+			++drops;
+			return NULL;
+		}
+		return &frames[h & (capacity - 1)].packet();
+	}
+
+	void FrameRing::commit(packet_buffer *, const rx_info& info) {
+		size_t h = head.load(memory_order_relaxed);
+		frames[h & (capacity - 1)].info = info;
+		head.store(h + 1);
+		++commits;
+		size_t n = h + 1 - tail.load();
+		if (n > highwater)
+			highwater = n;
+		// Wake up the consumer:
+		uint64_t one = 1;
+		if (::write(eventfd, &one, sizeof(one)) < 0) { /**/ }
+		if (waiting) {
+			lock_guard<mutex> lock(waitlock);
+			waitcond.notify_one();
+		}
+	}
+
+	rx_frame *FrameRing::front() {
+		size_t t = tail.load(memory_order_relaxed);
+		if (t == head.load(memory_order_acquire))
+			return NULL;
+		return &frames[t & (capacity - 1)];
+	}
+
+	rx_frame *FrameRing::wait(int timeout) {
+		rx_frame *frame = front();
+		if (frame)
+			return frame;
+		unique_lock<mutex> lock(waitlock);
+		waiting = true;
+		auto ready = [this]() {
+			return (head.load() != tail.load()) || !waiting;
+		};
+		if (timeout < 0)
+			waitcond.wait(lock, ready);
+		else
+			waitcond.wait_for(lock, chrono::milliseconds(timeout), ready);
+		waiting = false;
+		return front();
+	}
+
+	void FrameRing::pop() {
+		size_t t = tail.load(memory_order_relaxed);
+		if (t != head.load(memory_order_acquire))
+			tail.store(t + 1, memory_order_release);
+	}
+
+	void FrameRing::wakeup() {
+		lock_guard<mutex> lock(waitlock);
+		waiting = false;
+		waitcond.notify_all();
+	}
+
+	AsyncReceiver::AsyncReceiver(RFM22B& chip, size_t capacity):
+		chip{ chip }, ring{ capacity }
+	{
+	}
+
+	AsyncReceiver::~AsyncReceiver() {
+		stop();
+	}
+
+	void AsyncReceiver::start(unsigned int timeout) {
+		if (thread.joinable())
+			throw daisy_exception("Receiver is already started");
+		running = true;
+		thread = std::thread([this, timeout]() {
+			try {
+				chip.receive(ring, timeout);
+			}
+			catch (exception& ex) {
+				cerr << "!!! Exception in receive thread: "
+					 << ex.what() << endl;
+			}
+			catch (...) {
+				cerr << "!!! Exception in receive thread" << endl;
+			}
+			running = false;
+			ring.wakeup();
+		});
+	}
+
+	void AsyncReceiver::stop() {
+		if (!thread.joinable())
+			return;
+		chip.abort();
+		thread.join();
+		// The thread may have returned before it saw the flag:
+		chip.abort(false);
+		ring.wakeup();
+	}
+
+} // end namespace //
@@ -0,0 +1,122 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RX_RING_H
+#define _RX_RING_H
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <memory>
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "rfm22b.h"
+#include "rfm22b_packet.h"
+#include "defaults.h"
+
+namespace RFM22B_NS {
+
+	// A received packet with its metadata:
+	struct rx_frame {
+		packet_storage<> storage;
+		rx_info          info;
+
+		packet_buffer& packet() { return storage.buffer; }
+	};
+
+	// Preallocated single producer / single consumer ring of frames (the
+	// capacity is rounded up to a power of two). The
+	// producer side is a sink for RFM22B::receive(), the consumer reads
+	// the frames on its own thread. When the ring is full new packets are
+	// dropped, so a slow consumer never stalls the radio.
+	class FrameRing {
+	public:
+		explicit FrameRing(size_t capacity);
+		~FrameRing();
+
+		FrameRing(const FrameRing&) = delete;
+		FrameRing& operator=(const FrameRing&) = delete;
+
+		// Sink for RFM22B::receive() (producer):
+		packet_buffer *acquire();
+		void commit(packet_buffer *pkt, const rx_info& info);
+
+		// Consumer: Get the oldest frame without removing it, NULL when
+		// the ring is empty.
+		rx_frame *front();
+		// Consumer: Like front(), but wait up to timeout ms for a frame
+		// (-1 waits forever).
+		rx_frame *wait(int timeout);
+		// Consumer: Release the frame returned by front() or wait().
+		void pop();
+		// Consumer: Wake up a thread that is blocked in wait().
+		void wakeup();
+		// Consumer: File descriptor that becomes readable when frames are
+		// committed (eventfd, for use with poll/select/epoll). Read it to
+		// reset, then take all frames with front()/pop().
+		int getEventFD() const { return eventfd; }
+
+		// Observation, may be called from any thread:
+		size_t   getCapacity()  const { return capacity; }
+		size_t   getOccupancy() const { return head.load() - tail.load(); }
+		size_t   getHighWater() const { return highwater; }
+		uint64_t getCommits()   const { return commits; }
+		uint64_t getDrops()     const { return drops; }
+
+	private:
+		std::unique_ptr<rx_frame[]> frames;
+		const size_t                capacity;
+		std::atomic<size_t>         head {0};      // Next to write
+		std::atomic<size_t>         tail {0};      // Next to read
+		std::atomic<size_t>         highwater {0}; // Max. occupancy
+		std::atomic<uint64_t>       commits {0};
+		std::atomic<uint64_t>       drops {0};
+		std::atomic<bool>           waiting {false};
+		std::mutex                  waitlock;
+		std::condition_variable     waitcond;
+		int                         eventfd = -1;
+	};
+
+	// Receives on a thread of its own into a FrameRing.
+	class AsyncReceiver {
+	public:
+		AsyncReceiver(RFM22B& chip,
+				size_t capacity = DEFAULT_RX_RING_CAPACITY);
+		~AsyncReceiver();
+
+		// Start or stop the radio thread:
+		void start(unsigned int timeout = 0);
+		void stop();
+		// False when the receive timed out or failed:
+		bool isRunning() const { return running; }
+
+		FrameRing& getRing() { return ring; }
+
+	private:
+		RFM22B&           chip;
+		FrameRing         ring;
+		std::thread       thread;
+		std::atomic<bool> running {false};
+	};
+
+} // end namespace //
+
+#endif
@@ -0,0 +1,109 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/module.h>
+#include <linux/skbuff.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/tcp.h>
+#include <linux/jhash.h>
+#include <net/ip.h>
+#include <net/inet_ecn.h>
+#include <net/dsfield.h>
+
+#include "ack.h"
+
+// Only NOP and timestamp options:
+static bool daisy_ack_options(const u8 *p, int len)
+{
+	while (len > 0) {
+		switch (p[0]) {
+		case TCPOPT_NOP:
+			++p;
+			--len;
+			break;
+		case TCPOPT_TIMESTAMP:
+			if ((len < TCPOLEN_TIMESTAMP) || (p[1] != TCPOLEN_TIMESTAMP))
+				return false;
+			p   += TCPOLEN_TIMESTAMP;
+			len -= TCPOLEN_TIMESTAMP;
+			break;
+		default:
+			return false;
+		} // end switch //
+	} // end while //
+	return true;
+}
+
+/*
+ * Test, if an Ethernet frame is a pure ACK, that may supersede older
+ * ones, and find its flow.
+ */
+bool daisy_ack_parse(const struct sk_buff *skb, struct daisy_ack *ack)
+{
+	const struct ethhdr *eth = (const struct ethhdr *)skb->data;
+	const u8 *p = skb->data + ETH_HLEN;
+	int len = skb_headlen(skb) - ETH_HLEN;
+	const struct iphdr *ip;
+	const struct ipv6hdr *ip6;
+	const struct tcphdr *th;
+	int iplen, payload;
+	u32 hash;
+
+	if (len < sizeof(struct iphdr))
+		return false;
+	if (eth->h_proto == htons(ETH_P_IP)) {
+		ip = (const struct iphdr *)p;
+		iplen = ip->ihl * 4;
+		if ((ip->protocol != IPPROTO_TCP) ||
+				(ip->frag_off & htons(IP_MF | IP_OFFSET)) ||
+				INET_ECN_is_ce(ip->tos) ||
+				(len < iplen + sizeof(struct tcphdr)))
+			return false;
+		payload = ntohs(ip->tot_len) - iplen;
+		hash = jhash_2words(ip->saddr, ip->daddr, 0);
+	} else if (eth->h_proto == htons(ETH_P_IPV6)) {
+		ip6 = (const struct ipv6hdr *)p;
+		iplen = sizeof(struct ipv6hdr);
+		if ((ip6->nexthdr != IPPROTO_TCP) ||
+				INET_ECN_is_ce(ipv6_get_dsfield(ip6)) ||
+				(len < iplen + sizeof(struct tcphdr)))
+			return false;
+		payload = ntohs(ip6->payload_len);
+		hash = jhash(&ip6->saddr, 2 * sizeof(struct in6_addr), 0);
+	} else {
+		return false;
+	}
+
+	th = (const struct tcphdr *)(p + iplen);
+	if (!th->ack || th->syn || th->fin || th->rst || th->urg || th->psh ||
+			th->ece || th->cwr)
+		return false;
+	if ((th->doff < 5) || (payload != th->doff * 4) ||
+			(len < iplen + th->doff * 4))
+		return false;
+	if (!daisy_ack_options((const u8 *)(th + 1),
+			th->doff * 4 - sizeof(struct tcphdr)))
+		return false;
+
+	ack->flow = jhash_3words(((__force u32)th->source << 16) |
+			(__force u32)th->dest, (__force u32)th->window, hash, 0) | 1;
+	ack->seq  = ntohl(th->ack_seq);
+	return true;
+}
@@ -0,0 +1,40 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ACK_H_
+#define _ACK_H_
+
+#include <linux/module.h>
+#include <linux/skbuff.h>
+
+/*
+ * TCP ACK filtering: A pure cumulative ACK supersedes the older ACKs of
+ * its flow still waiting in the TX queue (see
+ * daisy_try_write_superseding()). ACKs with SACK or other options than
+ * timestamps, with ECN signals, data or other flags are sent as they
+ * are. The window is part of the flow, so window updates are kept, and
+ * duplicate ACKs have the same sequence, so they are kept too.
+ */
+struct daisy_ack {
+	u32 flow;
+	u32 seq;      /* The ACK number */
+};
+
+extern bool daisy_ack_parse(const struct sk_buff *skb, struct daisy_ack *ack);
+
+#endif /* _ACK_H_ */
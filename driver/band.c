@@ -0,0 +1,158 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/module.h>
+#include <linux/string.h>
+#include <linux/skbuff.h>
+#include <linux/etherdevice.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/in.h>
+#include <linux/pkt_sched.h>
+#include <net/dsfield.h>
+#include <net/ipv6.h>
+#include <net/ndisc.h>
+
+#include "daisy.h"
+#include "band.h"
+
+void daisy_band_init(struct daisy_priv *priv)
+{
+	memset(&priv->band, 0x00, sizeof(struct daisy_band));
+}
+
+static int daisy_band_dscp(u8 dscp)
+{
+	switch (dscp) {
+	case 48 : // CS6, routing
+	case 56 : // CS7, network control
+		return DAISY_BAND_CONTROL;
+	case 46 : // EF
+	case 40 : // CS5
+	case 32 : // CS4
+	case 34 : case 36 : case 38 : // AF4x
+	case 16 : // CS2, OAM
+	case 18 : case 20 : case 22 : // AF2x, low latency data
+		return DAISY_BAND_INTERACTIVE;
+	case 8  : // CS1, scavenger
+		return DAISY_BAND_BACKGROUND;
+	} // end switch //
+	return -1;
+}
+
+static int daisy_band_priority(u32 priority)
+{
+	switch (priority & TC_PRIO_MAX) {
+	case TC_PRIO_CONTROL :
+		return DAISY_BAND_CONTROL;
+	case TC_PRIO_INTERACTIVE :
+	case TC_PRIO_INTERACTIVE_BULK :
+		return DAISY_BAND_INTERACTIVE;
+	case TC_PRIO_FILLER :
+		return DAISY_BAND_BACKGROUND;
+	} // end switch //
+	return -1;
+}
+
+static int daisy_band_port(u8 proto, const u8 *l4, int cb, int len)
+{
+	u16 sport, dport;
+
+	if ((proto != IPPROTO_UDP) && (proto != IPPROTO_TCP))
+		return -1;
+	if (cb < 4)
+		return -1;
+	sport = (l4[0] << 8) | l4[1];
+	dport = (l4[2] << 8) | l4[3];
+	if (proto == IPPROTO_UDP) {
+		if ((dport == 520) || (dport == 521) ||   // RIP, RIPng
+				(dport == 698) || (dport == 6696)) // OLSR, Babel
+			return DAISY_BAND_CONTROL;
+		if ((sport == 53) || (dport == 53))
+			return DAISY_BAND_INTERACTIVE;
+		return -1;
+	}
+	if ((sport == 179) || (dport == 179))  // BGP
+		return DAISY_BAND_CONTROL;
+	if ((sport == 53) || (dport == 53))
+		return DAISY_BAND_INTERACTIVE;
+	// Interactive SSH, not scp:
+	if (((sport == 22) || (dport == 22)) && (len <= DAISY_ETH_FRAME))
+		return DAISY_BAND_INTERACTIVE;
+	return -1;
+}
+
+static int daisy_band_classify(const struct sk_buff *skb)
+{
+	const struct ethhdr *eth = (const struct ethhdr *)skb->data;
+	int cb = skb_headlen(skb) - ETH_HLEN;
+	const u8 *l4 = NULL;
+	u8 proto = 0;
+	int band = -1;
+
+	if (cb < 0)
+		return DAISY_BAND_BULK;
+	if (eth->h_proto == htons(ETH_P_ARP))
+		return DAISY_BAND_CONTROL;
+	if (eth->h_proto == htons(ETH_P_IP)) {
+		const struct iphdr *iph = (const struct iphdr *)(eth + 1);
+
+		if ((cb < (int)sizeof(struct iphdr)) || (cb < iph->ihl * 4))
+			return DAISY_BAND_BULK;
+		band = daisy_band_dscp(ipv4_get_dsfield(iph) >> 2);
+		proto = iph->protocol;
+		if (!(iph->frag_off & htons(IP_OFFSET))) {
+			l4 = (const u8 *)iph + iph->ihl * 4;
+			cb -= iph->ihl * 4;
+		}
+	} else if (eth->h_proto == htons(ETH_P_IPV6)) {
+		const struct ipv6hdr *ip6 = (const struct ipv6hdr *)(eth + 1);
+
+		if (cb < (int)sizeof(struct ipv6hdr))
+			return DAISY_BAND_BULK;
+		band = daisy_band_dscp(ipv6_get_dsfield(ip6) >> 2);
+		proto = ip6->nexthdr;
+		l4 = (const u8 *)(ip6 + 1);
+		cb -= sizeof(struct ipv6hdr);
+		// Neighbour discovery and router advertisements:
+		if ((proto == IPPROTO_ICMPV6) && (cb >= 1) &&
+				(l4[0] >= NDISC_ROUTER_SOLICITATION) &&
+				(l4[0] <= NDISC_REDIRECT))
+			return DAISY_BAND_CONTROL;
+	}
+	if (band < 0)
+		band = daisy_band_priority(skb->priority);
+	if ((band < 0) && l4)
+		band = daisy_band_port(proto, l4, cb, skb->len);
+	if ((band < 0) && (proto == 89)) // OSPF
+		band = DAISY_BAND_CONTROL;
+	return (band < 0) ? DAISY_BAND_BULK : band;
+}
+
+/*
+ * Select the TX queue, i.e. the band of a frame (ndo_select_queue).
+ */
+u16 daisy_band_select(struct net_device *dev, struct sk_buff *skb,
+		void *accel_priv, select_queue_fallback_t fallback)
+{
+	struct daisy_priv *priv = netdev_priv(dev);
+	int band = daisy_band_classify(skb);
+
+	++priv->band.stats.tx_frames[band];
+	return band;
+}
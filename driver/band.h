@@ -0,0 +1,50 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BAND_H_
+#define _BAND_H_
+
+#include <linux/module.h>
+#include <linux/netdevice.h>
+
+#include "spi-daisy.h"
+
+/*
+ * TX bands: Every band is a TX queue of the net device, so the qdisc
+ * keeps the order within a band. A frame gets its band from DSCP, then
+ * from skb->priority, routing protocols, ARP, ND, DNS and short SSH
+ * segments are recognised by protocol and port. Bulk and background
+ * stop before the radio queue is full, to keep entries for the others.
+ */
+#define DAISY_TX_RESERVE           4   /* TX entries kept for control */
+
+struct daisy_priv;
+
+struct daisy_band_stats {
+	u32 tx_frames[DAISY_TX_BANDS];
+};
+
+struct daisy_band {
+	struct daisy_band_stats stats;
+};
+
+extern void daisy_band_init(struct daisy_priv *priv);
+extern u16 daisy_band_select(struct net_device *dev, struct sk_buff *skb,
+		void *accel_priv, select_queue_fallback_t fallback);
+
+#endif /* _BAND_H_ */
@@ -24,6 +24,16 @@
 #include <linux/workqueue.h>
 #include <linux/completion.h>
 
+#include "l2.h"
+#include "frag.h"
+#include "hc.h"
+#include "pc.h"
+#include "nd.h"
+#include "mc.h"
+#include "band.h"
+#include "xdp.h"
+#include "fwd.h"
+
 /*
  * Forward declaration of the daisy device handle.
  */
@@ -47,10 +57,21 @@ struct daisy_priv {
 	struct daisy_dev        *daisy_device;
 	struct net_device_stats  stats;
 	spinlock_t               lock;
+	spinlock_t               xmit_lock;  /* All TX queues */
 	struct workqueue_struct *workqueue;
 	struct work_struct       work;
 	struct completion       *completion;
 	bool                     stalled;
+	bool                     throttled;  /* Bulk and background */
+	struct daisy_frag        frag;
+	struct daisy_l2          l2;
+	struct daisy_hc          hc;
+	struct daisy_pc          pc;
+	struct daisy_nd          nd;
+	struct daisy_mc          mc;
+	struct daisy_band        band;
+	struct daisy_xdp         xdp;
+	struct daisy_fwd         fwd;
 };
 
 /*
@@ -58,6 +79,20 @@ struct daisy_priv {
  */
 #define DEFAULT_TIMEOUT           10   /* In jiffies               */
 #define RFM22B_TYPE_ID             8   /* SPI chip id              */
-#define SPI_BUS_SPEED        5000000   /* Run with 5 MHz           */
+#define SPI_BUS_SPEED        5000000   /* Detect the chip with 5 MHz */
+#define SPI_MAX_BUS_SPEED MAX_SPEED_HZ /* Calibrate up to 32 MHz   */
+#define DAISY_NETWORK_ID           0   /* Sync word 1..0, 0: none  */
+
+/*
+ * Running average and maximum of the time per frame, in ns.
+ */
+static inline void daisy_cost(u32 *avg, u32 *max, u64 ns)
+{
+	u32 x = min_t(u64, ns, U32_MAX);
+
+	*avg = *avg ? (7 * (u64)*avg + x) / 8 : x;
+	if (x > *max)
+		*max = x;
+}
 
 #endif /* _DAISY_H_ */
@@ -0,0 +1,212 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/module.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+#include <linux/skbuff.h>
+#include <linux/etherdevice.h>
+
+#include "daisy.h"
+#include "frag.h"
+#include "spi-daisy.h"
+
+void daisy_frag_init(struct daisy_priv *priv)
+{
+	// The TX queue holds a number of full frames:
+	BUILD_BUG_ON(DAISY_FRAG_MAX > DEFAULT_TX_FRAGMENTS);
+	memset(&priv->frag, 0x00, sizeof(struct daisy_frag));
+}
+
+/*
+ * Queue the fragments of a frame. The TX queue must have room for all
+ * of them and all of them are allocated first, otherwise the frame is
+ * not sent at all. A part of a frame on air only costs airtime. The
+ * fragments get the headroom of the L2 header. The frame is freed on
+ * success.
+ */
+int daisy_frag_tx(struct daisy_priv *priv, struct sk_buff *skb)
+{
+	struct daisy_frag *f = &priv->frag;
+	struct sk_buff *frags[DAISY_FRAG_MAX];
+	const u8 *data = skb->data + 2*ETH_ALEN;
+	int left = skb->len - 2*ETH_ALEN;
+	int n = DIV_ROUND_UP(left, DAISY_FRAG_DATA);
+	int i, cb, erc;
+	u8 *p, id;
+
+	if (n > DAISY_FRAG_MAX)
+		return -E2BIG;
+	if (daisy_tx_room(priv->daisy_device) < n)
+		return -ERESTARTSYS;
+	id = f->tx_id;
+	for (i = 0; i < n; ++i, data += cb, left -= cb) {
+		cb = min_t(int, left, DAISY_FRAG_DATA);
+		frags[i] = dev_alloc_skb(DAISY_L2_GROWTH + DAISY_FRAG_HLEN + cb);
+		if (!frags[i]) {
+			while (i--)
+				dev_kfree_skb(frags[i]);
+			return -ENOMEM;
+		}
+		skb_reserve(frags[i], DAISY_L2_GROWTH);
+		skb_set_queue_mapping(frags[i], skb_get_queue_mapping(skb));
+		p = skb_put(frags[i], DAISY_FRAG_HLEN + cb);
+		memcpy(p, skb->data, 2*ETH_ALEN);
+		p[12] = DAISY_ETH_P_FRAG >> 8;
+		p[13] = DAISY_ETH_P_FRAG & 0xff;
+		p[14] = id;
+		p[15] = i | ((i == n - 1) ? DAISY_FRAG_LAST : 0x00);
+		memcpy(p + DAISY_FRAG_HLEN, data, cb);
+	} // end for //
+	++f->tx_id;
+	for (i = 0; i < n; ++i) {
+		erc = daisy_l2_write(priv, frags[i], NULL);
+		if (erc < 0) {
+			// The queue had room, only the L2 header can fail:
+			while (i < n)
+				dev_kfree_skb(frags[i++]);
+			return erc;
+		}
+		++f->stats.tx_fragments;
+	} // end for //
+	++f->stats.tx_frames;
+	dev_kfree_skb(skb);
+	return 0;
+}
+
+static void daisy_reasm_free(struct daisy_reasm *r)
+{
+	dev_kfree_skb(r->skb);
+	r->skb = NULL;
+}
+
+// Drop the frames, that wait too long for a fragment:
+static void daisy_reasm_expire(struct daisy_frag *f)
+{
+	struct daisy_reasm *r;
+	int i;
+
+	for (i = 0, r = f->reasm; i < DAISY_REASM_SLOTS; ++i, ++r) {
+		if (r->skb && time_after(jiffies, r->started + DAISY_REASM_TIMEOUT)) {
+			daisy_reasm_free(r);
+			++f->stats.rx_timeouts;
+		}
+	} // end for //
+}
+
+// Find the frame of a fragment, or start a new one in a free slot or
+// in the one of the oldest frame:
+static struct daisy_reasm *daisy_reasm_get(struct daisy_frag *f,
+		const struct sk_buff *skb)
+{
+	const u8 *src = skb->data + ETH_ALEN;
+	u8 id = skb->data[14];
+	struct daisy_reasm *r, *slot = NULL;
+	int i;
+
+	for (i = 0, r = f->reasm; i < DAISY_REASM_SLOTS; ++i, ++r) {
+		if (!r->skb) {
+			if (!slot || slot->skb)
+				slot = r;
+			continue;
+		}
+		if ((r->id == id) && ether_addr_equal(r->src, src))
+			return r;
+		if (!slot || (slot->skb && time_before(r->started, slot->started)))
+			slot = r;
+	} // end for //
+	if (slot->skb) {
+		daisy_reasm_free(slot);
+		++f->stats.rx_evicted;
+	}
+	slot->skb = dev_alloc_skb(ETH_FRAME_LEN + NET_IP_ALIGN);
+	if (!slot->skb)
+		return NULL;
+	skb_reserve(slot->skb, NET_IP_ALIGN);
+	memcpy(slot->skb->data, skb->data, 2*ETH_ALEN);
+	memcpy(slot->src, src, ETH_ALEN);
+	slot->id      = id;
+	slot->have    = 0;
+	slot->count   = 0;
+	slot->len     = 0;
+	slot->started = jiffies;
+	return slot;
+}
+
+/*
+ * Take a fragment. Returns the frame, when it is complete, otherwise
+ * NULL. The fragment is freed in any case.
+ */
+struct sk_buff *daisy_frag_rx(struct daisy_priv *priv, struct sk_buff *skb)
+{
+	struct daisy_frag *f = &priv->frag;
+	struct daisy_reasm *r;
+	struct sk_buff *res = NULL;
+	int idx, off, cb;
+	bool last;
+
+	daisy_reasm_expire(f);
+	if (skb->len <= DAISY_FRAG_HLEN)
+		goto out_error;
+	idx  = skb->data[15] & ~DAISY_FRAG_LAST;
+	last = skb->data[15] &  DAISY_FRAG_LAST;
+	off  = 2*ETH_ALEN + idx * DAISY_FRAG_DATA;
+	cb   = skb->len - DAISY_FRAG_HLEN;
+	if ((idx >= DAISY_FRAG_MAX) || (off + cb > ETH_FRAME_LEN) ||
+			(!last && (cb != DAISY_FRAG_DATA)))
+		goto out_error;
+	++f->stats.rx_fragments;
+
+	r = daisy_reasm_get(f, skb);
+	if (!r)
+		goto out_free;
+	if (r->have & BIT(idx))
+		goto out_free; // Duplicate
+	memcpy(r->skb->data + off, skb->data + DAISY_FRAG_HLEN, cb);
+	r->have |= BIT(idx);
+	if (last) {
+		r->count = idx + 1;
+		r->len   = off + cb;
+	}
+	if (r->count && (r->have == BIT(r->count) - 1)) {
+		res = r->skb;
+		skb_put(res, r->len);
+		r->skb = NULL;
+		++f->stats.rx_frames;
+	}
+	goto out_free;
+
+out_error:
+	++f->stats.rx_errors;
+out_free:
+	dev_kfree_skb(skb);
+	return res;
+}
+
+/*
+ * Free the frames in reassembly.
+ */
+void daisy_frag_flush(struct daisy_priv *priv)
+{
+	struct daisy_reasm *r;
+	int i;
+
+	for (i = 0, r = priv->frag.reasm; i < DAISY_REASM_SLOTS; ++i, ++r)
+		if (r->skb)
+			daisy_reasm_free(r);
+}
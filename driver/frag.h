@@ -0,0 +1,93 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FRAG_H_
+#define _FRAG_H_
+
+#include <linux/module.h>
+#include <linux/netdevice.h>
+#include <linux/if_ether.h>
+
+#include "l2.h"
+
+/*
+ * Link layer fragmentation: Frames longer than a radio frame are split
+ * into fragments, that carry the addresses of the frame, a type of
+ * DAISY_ETH_P_FRAG, the frame id and the fragment index. The first
+ * fragment starts with the type of the frame. All fragments but the
+ * last carry DAISY_FRAG_DATA octets, so the receiver places them by
+ * their index, in any order. Fragments are sent with the L2 header like
+ * any other frame.
+ */
+#define DAISY_FRAME_SIZE         254   /* Longest radio frame        */
+#define DAISY_ETH_FRAME  (DAISY_FRAME_SIZE - DAISY_L2_GROWTH)
+#define DAISY_ETH_P_FRAG      0x88b5   /* IEEE local experimental    */
+#define DAISY_FRAG_HLEN           16   /* Addresses, type, id, index */
+#define DAISY_FRAG_DATA  (DAISY_ETH_FRAME - DAISY_FRAG_HLEN)
+#define DAISY_FRAG_MAX             7   /* Fragments of a full frame  */
+#define DAISY_FRAG_LAST         0x80   /* In the index octet         */
+#define DAISY_REASM_SLOTS          4   /* Frames reassembled at once */
+#define DAISY_REASM_TIMEOUT   (5*HZ)   /* In jiffies                 */
+
+struct daisy_priv;
+
+struct daisy_frag_stats {
+	u32 tx_frames;        /* Frames sent fragmented          */
+	u32 tx_fragments;
+	u32 rx_fragments;
+	u32 rx_frames;        /* Frames reassembled              */
+	u32 rx_timeouts;      /* Frames lost by a missing fragment */
+	u32 rx_evicted;       /* Frames lost for a newer one     */
+	u32 rx_errors;        /* Malformed fragments             */
+};
+
+/*
+ * A frame in reassembly, the slot is free if skb is NULL.
+ */
+struct daisy_reasm {
+	struct sk_buff *skb;
+	u8              src[ETH_ALEN];
+	u8              id;
+	u8              have;     /* Bitmask of the fragments received */
+	u8              count;    /* Of fragments, 0 until the last    */
+	u16             len;      /* Of the frame                      */
+	unsigned long   started;  /* In jiffies                        */
+};
+
+struct daisy_frag {
+	u8                      tx_id;
+	struct daisy_reasm      reasm[DAISY_REASM_SLOTS];
+	struct daisy_frag_stats stats;
+};
+
+/*
+ * Test, if a received frame is a fragment.
+ */
+static inline bool daisy_is_fragment(const struct sk_buff *skb)
+{
+	return (skb->len >= ETH_HLEN) &&
+		(((struct ethhdr *)skb->data)->h_proto == htons(DAISY_ETH_P_FRAG));
+}
+
+extern void daisy_frag_init(struct daisy_priv *priv);
+extern int daisy_frag_tx(struct daisy_priv *priv, struct sk_buff *skb);
+extern struct sk_buff *daisy_frag_rx(struct daisy_priv *priv,
+		struct sk_buff *skb);
+extern void daisy_frag_flush(struct daisy_priv *priv);
+
+#endif /* _FRAG_H_ */
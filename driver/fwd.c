@@ -0,0 +1,344 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/string.h>
+#include <linux/skbuff.h>
+#include <linux/hash.h>
+#include <linux/ktime.h>
+#include <linux/rtnetlink.h>
+#include <net/genetlink.h>
+
+#include "daisy.h"
+#include "fwd.h"
+#include "spi-daisy.h"
+
+extern const struct ethtool_ops daisy_ethtool_ops;
+
+static bool forward = false;
+module_param(forward, bool, 0644);
+MODULE_PARM_DESC(forward, "Repeat relayed frames for other stations");
+
+/*
+ * Called once for a new net device, the routes stay while it is down.
+ */
+void daisy_fwd_init(struct daisy_priv *priv)
+{
+	memset(&priv->fwd, 0x00, sizeof(struct daisy_fwd));
+	spin_lock_init(&priv->fwd.lock);
+}
+
+// Route to a station, f->lock must be held:
+static struct daisy_fwd_route *daisy_fwd_route(struct daisy_fwd *f,
+		u16 station, bool create)
+{
+	struct daisy_fwd_route *r, *free = NULL;
+	int i;
+
+	for (i = 0, r = f->routes; i < DAISY_FWD_ROUTES; ++i, ++r) {
+		if (r->station == station)
+			return r;
+		if (!r->station && !free)
+			free = r;
+	} // end for //
+	if (!create || !free)
+		return NULL;
+	free->station = station;
+	return free;
+}
+
+// Note a frame, true if it has been seen before:
+static bool daisy_fwd_dup(struct daisy_fwd *f, u16 origin, u16 seq)
+{
+	struct daisy_fwd_dup *d = &f->dups[hash_32(((u32)origin << 16) | seq,
+			ilog2(DAISY_FWD_DUPS))];
+	bool dup = d->time && (d->origin == origin) && (d->seq == seq) &&
+			time_before(jiffies, d->time + DAISY_FWD_DUP_TIME);
+
+	d->origin = origin;
+	d->seq    = seq;
+	d->time   = jiffies;
+	return dup;
+}
+
+/*
+ * Insert the relay header, if the unicast frame with L2 header in skb
+ * goes through a repeater. The headroom is in DAISY_L2_GROWTH.
+ */
+int daisy_fwd_tx(struct daisy_priv *priv, struct sk_buff *skb)
+{
+	struct daisy_fwd *f = &priv->fwd;
+	struct daisy_fwd_route *r;
+	u16 dst, nexthop = 0;
+	u8 *p = skb->data;
+
+	if (p[0] & DAISY_L2_LONG_DST)
+		return 0;
+	dst = (p[1] << 8) | p[2];
+	if (dst == DAISY_HEADER_BROADCAST)
+		return 0;
+	spin_lock_bh(&f->lock);
+	r = daisy_fwd_route(f, dst, false);
+	if (r)
+		nexthop = r->nexthop;
+	spin_unlock_bh(&f->lock);
+	if (!nexthop || (nexthop == dst))
+		return 0;
+	if (skb_headroom(skb) < DAISY_FWD_HLEN)
+		return -ENOMEM;
+
+	p = skb_push(skb, DAISY_FWD_HLEN);
+	memmove(p, p + DAISY_FWD_HLEN, DAISY_L2_HLEN);
+	p[0] |= DAISY_L2_RELAY;
+	p[1] = nexthop >> 8;
+	p[2] = nexthop & 0xff;
+	p[6] = dst >> 8;
+	p[7] = dst & 0xff;
+	p[8] = p[3];    // Origin, our station ID
+	p[9] = p[4];
+	p[10] = f->seq >> 8;
+	p[11] = f->seq & 0xff;
+	p[12] = DAISY_FWD_HOPS;
+	++f->seq;
+	++f->stats.tx_relayed;
+	return 0;
+}
+
+/*
+ * Handle a received frame with DAISY_L2_RELAY. Returns the frame without
+ * the relay header, if it is for us, NULL if it has been forwarded or
+ * dropped.
+ */
+struct sk_buff *daisy_fwd_rx(struct daisy_priv *priv, struct sk_buff *skb)
+{
+	struct daisy_fwd *f = &priv->fwd;
+	struct net_device *dev = priv->root->net_device, *out;
+	struct daisy_fwd_route *r;
+	struct daisy_priv *opriv;
+	u64 t0 = ktime_get_ns();
+	u16 hop, station, origin, seq, nexthop = 0;
+	u8 *p = skb->data;
+	int oif = 0, erc;
+
+	if (skb->len < DAISY_L2_HLEN + DAISY_FWD_HLEN) {
+		++priv->l2.stats.rx_errors;
+		goto out_drop;
+	}
+	hop     = (p[1] << 8) | p[2];
+	station = (p[6] << 8) | p[7];
+	origin  = (p[8] << 8) | p[9];
+	seq     = (p[10] << 8) | p[11];
+	// Relayed by the repeater named, the others only overhear it. This
+	// is checked first, the named one must not take it as duplicate:
+	if ((hop != priv->l2.id) && (station != priv->l2.id)) {
+		++f->stats.fwd_overheard;
+		goto out_drop;
+	}
+	if (daisy_fwd_dup(f, origin, seq)) {
+		++f->stats.fwd_dups;
+		goto out_drop;
+	}
+
+	// For us, it looks like sent directly then:
+	if (station == priv->l2.id) {
+		p[0] &= ~DAISY_L2_RELAY;
+		p[1] = p[6];
+		p[2] = p[7];
+		p[3] = p[8];
+		p[4] = p[9];
+		memmove(p + DAISY_FWD_HLEN, p, DAISY_L2_HLEN);
+		skb_pull(skb, DAISY_FWD_HLEN);
+		++f->stats.rx_relayed;
+		return skb;
+	}
+
+	if (forward && (station != DAISY_HEADER_BROADCAST)) {
+		spin_lock_bh(&f->lock);
+		r = daisy_fwd_route(f, station, false);
+		if (r) {
+			nexthop = r->nexthop;
+			oif     = r->oif;
+		}
+		spin_unlock_bh(&f->lock);
+	}
+	if (!nexthop) {
+		++f->stats.fwd_noroute;
+		goto out_drop;
+	}
+	if (p[12] <= 1) {
+		++f->stats.fwd_hops;
+		goto out_drop;
+	}
+
+	rcu_read_lock();
+	out = oif ? dev_get_by_index_rcu(dev_net(dev), oif) : dev;
+	if (!out || (out->ethtool_ops != &daisy_ethtool_ops) ||
+			!netif_running(out)) {
+		rcu_read_unlock();
+		++f->stats.fwd_errors;
+		goto out_drop;
+	}
+	opriv = netdev_priv(out);
+	p[1] = nexthop >> 8;
+	p[2] = nexthop & 0xff;
+	p[3] = opriv->l2.id >> 8;
+	p[4] = opriv->l2.id & 0xff;
+	--p[12];
+	local_bh_disable();
+	erc = daisy_try_write(opriv->daisy_device, skb, DAISY_BAND_BULK);
+	local_bh_enable();
+	rcu_read_unlock();
+	if (erc < 0) {
+		++f->stats.fwd_errors;
+		goto out_drop;
+	}
+	++f->stats.fwd_frames;
+	daisy_cost(&f->stats.fwd_ns, &f->stats.fwd_ns_max,
+			ktime_get_ns() - t0);
+	return NULL;
+
+out_drop:
+	dev_kfree_skb(skb);
+	return NULL;
+}
+
+/*
+ * Generic netlink interface.
+ */
+static const struct nla_policy daisy_fwd_policy[DAISY_FWD_A_MAX + 1] = {
+	[DAISY_FWD_A_IFINDEX] = { .type = NLA_U32 },
+	[DAISY_FWD_A_STATION] = { .type = NLA_U16 },
+	[DAISY_FWD_A_NEXTHOP] = { .type = NLA_U16 },
+	[DAISY_FWD_A_OIF]     = { .type = NLA_U32 },
+};
+
+// The dsy device of a request, with a reference:
+static struct net_device *daisy_fwd_dev(struct genl_info *info)
+{
+	struct net_device *dev;
+
+	if (!info->attrs[DAISY_FWD_A_IFINDEX])
+		return NULL;
+	dev = dev_get_by_index(genl_info_net(info),
+			nla_get_u32(info->attrs[DAISY_FWD_A_IFINDEX]));
+	if (dev && (dev->ethtool_ops != &daisy_ethtool_ops)) {
+		dev_put(dev);
+		dev = NULL;
+	}
+	return dev;
+}
+
+static int daisy_fwd_cmd(struct sk_buff *msg, struct genl_info *info)
+{
+	u8 cmd = info->genlhdr->cmd;
+	struct net_device *dev;
+	struct daisy_fwd *f;
+	struct daisy_fwd_route *r;
+	u16 station = 0;
+	int erc = 0;
+
+	dev = daisy_fwd_dev(info);
+	if (!dev)
+		return -ENODEV;
+	f = &((struct daisy_priv *)netdev_priv(dev))->fwd;
+	if (cmd != DAISY_FWD_CMD_FLUSH) {
+		if (!info->attrs[DAISY_FWD_A_STATION]) {
+			erc = -EINVAL;
+			goto out;
+		}
+		station = nla_get_u16(info->attrs[DAISY_FWD_A_STATION]);
+		if (!station || (station == DAISY_HEADER_BROADCAST)) {
+			erc = -EINVAL;
+			goto out;
+		}
+	}
+	if ((cmd == DAISY_FWD_CMD_SET) && !info->attrs[DAISY_FWD_A_NEXTHOP]) {
+		erc = -EINVAL;
+		goto out;
+	}
+
+	spin_lock_bh(&f->lock);
+	switch (cmd) {
+	case DAISY_FWD_CMD_SET :
+		r = daisy_fwd_route(f, station, true);
+		if (!r) {
+			erc = -ENOSPC;
+			break;
+		}
+		r->nexthop = nla_get_u16(info->attrs[DAISY_FWD_A_NEXTHOP]);
+		r->oif = info->attrs[DAISY_FWD_A_OIF] ?
+				nla_get_u32(info->attrs[DAISY_FWD_A_OIF]) : 0;
+		break;
+	case DAISY_FWD_CMD_DEL :
+		r = daisy_fwd_route(f, station, false);
+		if (r)
+			memset(r, 0x00, sizeof(struct daisy_fwd_route));
+		else
+			erc = -ENOENT;
+		break;
+	case DAISY_FWD_CMD_FLUSH :
+		memset(f->routes, 0x00, sizeof(f->routes));
+		break;
+	} // end switch //
+	spin_unlock_bh(&f->lock);
+out:
+	dev_put(dev);
+	return erc;
+}
+
+static const struct genl_ops daisy_fwd_ops[] = {
+	{
+		.cmd    = DAISY_FWD_CMD_SET,
+		.flags  = GENL_ADMIN_PERM,
+		.policy = daisy_fwd_policy,
+		.doit   = daisy_fwd_cmd,
+	},
+	{
+		.cmd    = DAISY_FWD_CMD_DEL,
+		.flags  = GENL_ADMIN_PERM,
+		.policy = daisy_fwd_policy,
+		.doit   = daisy_fwd_cmd,
+	},
+	{
+		.cmd    = DAISY_FWD_CMD_FLUSH,
+		.flags  = GENL_ADMIN_PERM,
+		.policy = daisy_fwd_policy,
+		.doit   = daisy_fwd_cmd,
+	},
+};
+
+static struct genl_family daisy_fwd_family = {
+	.name    = DAISY_FWD_GENL_NAME,
+	.version = DAISY_FWD_GENL_VERSION,
+	.maxattr = DAISY_FWD_A_MAX,
+	.netnsok = true,
+	.module  = THIS_MODULE,
+	.ops     = daisy_fwd_ops,
+	.n_ops   = ARRAY_SIZE(daisy_fwd_ops),
+};
+
+int daisy_fwd_register(void)
+{
+	return genl_register_family(&daisy_fwd_family);
+}
+
+void daisy_fwd_unregister(void)
+{
+	genl_unregister_family(&daisy_fwd_family);
+}
@@ -0,0 +1,117 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FWD_H_
+#define _FWD_H_
+
+#include <linux/module.h>
+#include <linux/netdevice.h>
+#include <linux/spinlock.h>
+
+/*
+ * Repeater: A frame to a station that is not heard directly is sent
+ * to a repeater with the DAISY_L2_RELAY flag, the relay header follows
+ * the L2 header: The final station ID, the origin station ID, a 16 bit
+ * sequence number and a hop limit. The L2 destination and source
+ * name the hops. A repeater queues such frames from the RX path
+ * directly into the TX queue of the same or another dsy device, as
+ * told by its forwarding table, without the stack. Only the repeater
+ * named as L2 destination relays a frame, the others overhear it. The
+ * final station removes the relay header. Duplicates (same origin and
+ * sequence) are dropped.
+ */
+#define DAISY_FWD_HLEN             7   /* Relay header               */
+#define DAISY_FWD_ROUTES          32   /* Forwarding table entries   */
+#define DAISY_FWD_HOPS             4   /* Hop limit of own frames    */
+#define DAISY_FWD_DUPS            64   /* Duplicate cache, power of 2 */
+#define DAISY_FWD_DUP_TIME   (10*HZ)
+
+/*
+ * Generic netlink family to set the forwarding table:
+ * SET:   IFINDEX, STATION, NEXTHOP [, OIF], frames to STATION go to
+ *        NEXTHOP on OIF (default: the same device).
+ * DEL:   IFINDEX, STATION.
+ * FLUSH: IFINDEX.
+ */
+#define DAISY_FWD_GENL_NAME   "daisy_fwd"
+#define DAISY_FWD_GENL_VERSION     1
+
+enum {
+	DAISY_FWD_CMD_UNSPEC,
+	DAISY_FWD_CMD_SET,
+	DAISY_FWD_CMD_DEL,
+	DAISY_FWD_CMD_FLUSH,
+	__DAISY_FWD_CMD_MAX,
+};
+
+enum {
+	DAISY_FWD_A_UNSPEC,
+	DAISY_FWD_A_IFINDEX,  /* u32 */
+	DAISY_FWD_A_STATION,  /* u16 */
+	DAISY_FWD_A_NEXTHOP,  /* u16 */
+	DAISY_FWD_A_OIF,      /* u32 */
+	__DAISY_FWD_A_MAX,
+};
+#define DAISY_FWD_A_MAX (__DAISY_FWD_A_MAX - 1)
+
+struct daisy_priv;
+
+struct daisy_fwd_stats {
+	u32 tx_relayed;       /* Own frames sent to a repeater     */
+	u32 rx_relayed;       /* Relayed frames for us             */
+	u32 fwd_frames;       /* Forwarded                         */
+	u32 fwd_hops;         /* Dropped, hop limit reached        */
+	u32 fwd_noroute;      /* Dropped, no route or disabled     */
+	u32 fwd_errors;       /* Dropped, TX queue full or bad OIF */
+	u32 fwd_dups;         /* Duplicates dropped                */
+	u32 fwd_overheard;    /* Dropped, for another repeater     */
+	u32 fwd_ns;           /* Time per forwarded frame, average */
+	u32 fwd_ns_max;
+};
+
+/*
+ * A route, unused if station is 0.
+ */
+struct daisy_fwd_route {
+	u16 station;
+	u16 nexthop;
+	int oif;              /* 0: Same device */
+};
+
+struct daisy_fwd_dup {
+	u16           origin;
+	u16           seq;
+	unsigned long time;   /* In jiffies, 0: unused */
+};
+
+struct daisy_fwd {
+	spinlock_t             lock;      /* Routes */
+	u16                    seq;
+	struct daisy_fwd_route routes[DAISY_FWD_ROUTES];
+	struct daisy_fwd_dup   dups[DAISY_FWD_DUPS];
+	struct daisy_fwd_stats stats;
+};
+
+extern void daisy_fwd_init(struct daisy_priv *priv);
+extern int daisy_fwd_tx(struct daisy_priv *priv, struct sk_buff *skb);
+extern struct sk_buff *daisy_fwd_rx(struct daisy_priv *priv,
+		struct sk_buff *skb);
+extern int daisy_fwd_register(void);
+extern void daisy_fwd_unregister(void);
+
+#endif /* _FWD_H_ */
@@ -0,0 +1,397 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/module.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+#include <linux/skbuff.h>
+#include <linux/etherdevice.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <linux/jhash.h>
+#include <linux/net.h>
+#include <net/ip.h>
+
+#include "daisy.h"
+#include "hc.h"
+
+/*
+ * Layout of a packet: Length of the IP header, of the IP and L4 header
+ * and of the template.
+ */
+struct daisy_hc_pkt {
+	int iplen;
+	int hlen;
+	int tlen;
+	u8  proto;
+};
+
+void daisy_hc_init(struct daisy_priv *priv)
+{
+	memset(&priv->hc, 0x00, sizeof(struct daisy_hc));
+}
+
+// Check if a packet can be compressed and find its headers:
+static bool daisy_hc_parse(const u8 *p, int len, struct daisy_hc_pkt *pkt)
+{
+	const struct iphdr   *ip  = (const struct iphdr *)p;
+	const struct ipv6hdr *ip6 = (const struct ipv6hdr *)p;
+	const struct tcphdr  *th;
+
+	if (len < sizeof(struct iphdr))
+		return false;
+	switch (p[0] >> 4) {
+	case 4:
+		if ((ip->ihl != 5) || (ntohs(ip->tot_len) != len) ||
+				(ip->frag_off & htons(IP_MF | IP_OFFSET)))
+			return false;
+		pkt->iplen = sizeof(struct iphdr);
+		pkt->proto = ip->protocol;
+		break;
+	case 6:
+		if ((len < sizeof(struct ipv6hdr)) ||
+				(ntohs(ip6->payload_len) + sizeof(struct ipv6hdr) != len))
+			return false;
+		pkt->iplen = sizeof(struct ipv6hdr);
+		pkt->proto = ip6->nexthdr;
+		break;
+	default:
+		return false;
+	} // end switch //
+
+	switch (pkt->proto) {
+	case IPPROTO_TCP:
+		if (len < pkt->iplen + sizeof(struct tcphdr))
+			return false;
+		th = (const struct tcphdr *)(p + pkt->iplen);
+		if ((th->doff < 5) || (len < pkt->iplen + th->doff * 4))
+			return false;
+		pkt->hlen = pkt->iplen + th->doff * 4;
+		break;
+	case IPPROTO_UDP:
+		if (len < pkt->iplen + sizeof(struct udphdr))
+			return false;
+		pkt->hlen = pkt->iplen + sizeof(struct udphdr);
+		break;
+	default:
+		return false;
+	} // end switch //
+	pkt->tlen = pkt->iplen + 4; // Up to the ports
+	return true;
+}
+
+// The static fields of the headers, the changing ones cleared:
+static void daisy_hc_template(const u8 *p, const struct daisy_hc_pkt *pkt,
+		u8 *tmpl)
+{
+	struct iphdr *ip = (struct iphdr *)tmpl;
+
+	memcpy(tmpl, p, pkt->tlen);
+	if (pkt->iplen == sizeof(struct iphdr)) {
+		ip->tot_len = 0;
+		ip->id      = 0;
+		ip->check   = 0;
+	} else {
+		((struct ipv6hdr *)tmpl)->payload_len = 0;
+	}
+}
+
+// Write the changing fields of the headers, returns their length:
+static int daisy_hc_fields(const u8 *p, const struct daisy_hc_pkt *pkt,
+		u8 *q)
+{
+	const struct tcphdr *th = (const struct tcphdr *)(p + pkt->iplen);
+	u8 *start = q;
+	int opt;
+
+	if (pkt->iplen == sizeof(struct iphdr)) {
+		memcpy(q, &((const struct iphdr *)p)->id, 2);
+		q += 2;
+	}
+	if (pkt->proto == IPPROTO_TCP) {
+		// Sequence, ack, offset and flags, window and checksum:
+		memcpy(q, (const u8 *)th + 4, 14);
+		q += 14;
+		if (th->urg) {
+			memcpy(q, &th->urg_ptr, 2);
+			q += 2;
+		}
+		opt = th->doff * 4 - sizeof(struct tcphdr);
+		memcpy(q, th + 1, opt);
+		q += opt;
+	} else {
+		memcpy(q, &((const struct udphdr *)th)->check, 2);
+		q += 2;
+	}
+	return q - start;
+}
+
+// Rebuild the headers from the template and the changing fields of len
+// octets. Returns the octets taken from the fields, -1 on error:
+static int daisy_hc_rebuild(const struct daisy_hc_ctx *ctx, const u8 *q,
+		int len, u8 *hdr, int *hlen)
+{
+	struct iphdr *ip = (struct iphdr *)hdr;
+	bool v4 = (ctx->tmpl[0] >> 4) == 4;
+	int iplen = v4 ? sizeof(struct iphdr) : sizeof(struct ipv6hdr);
+	struct tcphdr *th = (struct tcphdr *)(hdr + iplen);
+	const u8 *start = q;
+	int opt;
+	u8 proto;
+
+	memset(hdr, 0x00, DAISY_HC_MAX_HLEN);
+	memcpy(hdr, ctx->tmpl, ctx->len);
+	proto = v4 ? ip->protocol : ((struct ipv6hdr *)hdr)->nexthdr;
+	if (v4) {
+		if (len < 2)
+			return -1;
+		memcpy(&ip->id, q, 2);
+		q += 2;
+		len -= 2;
+	}
+	if (proto == IPPROTO_TCP) {
+		if (len < 14)
+			return -1;
+		memcpy((u8 *)th + 4, q, 14);
+		q += 14;
+		len -= 14;
+		if (th->doff < 5)
+			return -1;
+		if (th->urg) {
+			if (len < 2)
+				return -1;
+			memcpy(&th->urg_ptr, q, 2);
+			q += 2;
+			len -= 2;
+		}
+		opt = th->doff * 4 - sizeof(struct tcphdr);
+		if (len < opt)
+			return -1;
+		memcpy(th + 1, q, opt);
+		q += opt;
+		*hlen = iplen + th->doff * 4;
+	} else {
+		if (len < 2)
+			return -1;
+		memcpy(&((struct udphdr *)th)->check, q, 2);
+		q += 2;
+		*hlen = iplen + sizeof(struct udphdr);
+	}
+	return q - start;
+}
+
+// Set the lengths and the IPv4 checksum of rebuilt headers:
+static void daisy_hc_lengths(u8 *hdr, int hlen, int total)
+{
+	struct iphdr *ip = (struct iphdr *)hdr;
+	bool v4 = (hdr[0] >> 4) == 4;
+	int iplen = v4 ? sizeof(struct iphdr) : sizeof(struct ipv6hdr);
+
+	if (v4) {
+		ip->tot_len = htons(total);
+		ip->check   = 0;
+		ip->check   = ip_fast_csum(hdr, ip->ihl);
+		if (ip->protocol == IPPROTO_UDP)
+			((struct udphdr *)(hdr + iplen))->len = htons(total - iplen);
+	} else {
+		((struct ipv6hdr *)hdr)->payload_len = htons(total - iplen);
+		if (((struct ipv6hdr *)hdr)->nexthdr == IPPROTO_UDP)
+			((struct udphdr *)(hdr + iplen))->len = htons(total - iplen);
+	}
+}
+
+// Report the compression ratio of a flow. It is called in the xmit path
+// for every context taken over, so it is a rate limited debug message:
+static void daisy_hc_report(const struct daisy_hc_ctx *ctx)
+{
+	const struct iphdr   *ip  = (const struct iphdr *)ctx->tmpl;
+	const struct ipv6hdr *ip6 = (const struct ipv6hdr *)ctx->tmpl;
+	const __be16 *ports;
+
+	if (!ctx->packets)
+		return;
+	if ((ctx->tmpl[0] >> 4) == 4) {
+		ports = (const __be16 *)(ip + 1);
+		net_dbg_ratelimited("daisy: HC flow %pI4:%u > %pI4:%u: %u packets, "
+				"headers %u > %u octets (%u%%)\n",
+				&ip->saddr, ntohs(ports[0]), &ip->daddr, ntohs(ports[1]),
+				ctx->packets, ctx->hdr_in, ctx->hdr_out,
+				ctx->hdr_out * 100 / ctx->hdr_in);
+	} else {
+		ports = (const __be16 *)(ip6 + 1);
+		net_dbg_ratelimited("daisy: HC flow [%pI6c]:%u > [%pI6c]:%u: "
+				"%u packets, headers %u > %u octets (%u%%)\n",
+				&ip6->saddr, ntohs(ports[0]), &ip6->daddr, ntohs(ports[1]),
+				ctx->packets, ctx->hdr_in, ctx->hdr_out,
+				ctx->hdr_out * 100 / ctx->hdr_in);
+	}
+}
+
+/*
+ * Compress the headers of a frame in place. Frames, that can not be
+ * compressed, are left as they are.
+ */
+int daisy_hc_tx(struct daisy_priv *priv, struct sk_buff *skb)
+{
+	struct daisy_hc *hc = &priv->hc;
+	struct daisy_hc_ctx *ctx;
+	struct daisy_hc_pkt pkt;
+	struct ethhdr eth;
+	u8 tmpl[DAISY_HC_TEMPLATE];
+	u8 body[2 + DAISY_HC_MAX_HLEN];
+	const u8 *p;
+	int blen, strip = 0;
+	u32 cid;
+	u8 gen;
+
+	if (skb->len <= ETH_HLEN)
+		return 0;
+	memcpy(&eth, skb->data, ETH_HLEN);
+	if ((eth.h_proto != htons(ETH_P_IP)) && (eth.h_proto != htons(ETH_P_IPV6)))
+		return 0;
+	if (skb_linearize(skb) || skb_cow_head(skb, 2))
+		return -ENOMEM;
+	p = skb->data + ETH_HLEN;
+	if (!daisy_hc_parse(p, skb->len - ETH_HLEN, &pkt))
+		return 0;
+
+	// Find the context, a new flow takes over the slot:
+	daisy_hc_template(p, &pkt, tmpl);
+	cid = jhash(tmpl, pkt.tlen, 0) & (DAISY_HC_TX_CONTEXTS - 1);
+	ctx = &hc->tx[cid];
+	if ((ctx->len != pkt.tlen) || memcmp(ctx->tmpl, tmpl, pkt.tlen)) {
+		if (ctx->len)
+			daisy_hc_report(ctx);
+		gen = ctx->gen + 1;
+		memset(ctx, 0x00, sizeof(struct daisy_hc_ctx));
+		ctx->len = pkt.tlen;
+		ctx->cid = cid;
+		ctx->gen = gen & (0xff >> DAISY_HC_GEN_SHIFT);
+		memcpy(ctx->tmpl, tmpl, pkt.tlen);
+	}
+
+	body[1] = (ctx->gen << DAISY_HC_GEN_SHIFT) | ctx->cid;
+	if (ctx->since) {
+		body[0] = DAISY_HC_COMP;
+		blen  = 2 + daisy_hc_fields(p, &pkt, body + 2);
+		strip = pkt.hlen;
+		++hc->stats.tx_comp;
+		hc->stats.tx_saved += strip - blen;
+		ctx->hdr_out += blen;
+	} else {
+		body[0] = DAISY_HC_FULL;
+		blen  = 2;
+		++hc->stats.tx_full;
+		ctx->hdr_out += blen + pkt.hlen;
+	}
+	ctx->since = (ctx->since + 1) % DAISY_HC_REFRESH;
+	++ctx->packets;
+	ctx->hdr_in += pkt.hlen;
+
+	eth.h_proto = htons(DAISY_ETH_P_HC);
+	skb_pull(skb, ETH_HLEN + strip);
+	memcpy(skb_push(skb, blen), body, blen);
+	memcpy(skb_push(skb, ETH_HLEN), &eth, ETH_HLEN);
+	return 0;
+}
+
+/*
+ * Rebuild the headers of a compressed frame. Returns NULL, if the frame
+ * is dropped, it is freed then.
+ */
+struct sk_buff *daisy_hc_rx(struct daisy_priv *priv, struct sk_buff *skb)
+{
+	struct daisy_hc *hc = &priv->hc;
+	struct daisy_hc_ctx *ctx;
+	struct daisy_hc_pkt pkt;
+	struct ethhdr eth;
+	u8 hdr[DAISY_HC_MAX_HLEN];
+	const u8 *p;
+	int len, used, hlen;
+	u8 kind, cid, gen;
+
+	if (skb->len < ETH_HLEN + 2)
+		goto out_error;
+	memcpy(&eth, skb->data, ETH_HLEN);
+	kind = skb->data[ETH_HLEN];
+	cid  = skb->data[ETH_HLEN + 1] & DAISY_HC_CID_MASK;
+	gen  = skb->data[ETH_HLEN + 1] >> DAISY_HC_GEN_SHIFT;
+	ctx  = &hc->rx[jhash(eth.h_source, ETH_ALEN, cid)
+	               & (DAISY_HC_RX_CONTEXTS - 1)];
+	p    = skb->data + ETH_HLEN + 2;
+	len  = skb->len - ETH_HLEN - 2;
+
+	switch (kind) {
+	case DAISY_HC_FULL:
+		if (!daisy_hc_parse(p, len, &pkt))
+			goto out_error;
+		ctx->len = pkt.tlen;
+		ctx->cid = cid;
+		ctx->gen = gen;
+		memcpy(ctx->src, eth.h_source, ETH_ALEN);
+		daisy_hc_template(p, &pkt, ctx->tmpl);
+		skb_pull(skb, ETH_HLEN + 2);
+		++hc->stats.rx_full;
+		break;
+	case DAISY_HC_COMP:
+		if (!ctx->len || (ctx->cid != cid) || (ctx->gen != gen) ||
+				!ether_addr_equal(ctx->src, eth.h_source)) {
+			++hc->stats.rx_nocontext;
+			goto out_drop;
+		}
+		used = daisy_hc_rebuild(ctx, p, len, hdr, &hlen);
+		if (used < 0)
+			goto out_error;
+		daisy_hc_lengths(hdr, hlen, hlen + len - used);
+		skb_pull(skb, ETH_HLEN + 2 + used);
+		if (skb_cow_head(skb, ETH_HLEN + hlen))
+			goto out_drop;
+		memcpy(skb_push(skb, hlen), hdr, hlen);
+		++hc->stats.rx_comp;
+		break;
+	default:
+		goto out_error;
+	} // end switch //
+
+	eth.h_proto = ((skb->data[0] >> 4) == 4)
+			? htons(ETH_P_IP) : htons(ETH_P_IPV6);
+	if (skb_cow_head(skb, ETH_HLEN))
+		goto out_drop;
+	memcpy(skb_push(skb, ETH_HLEN), &eth, ETH_HLEN);
+	return skb;
+
+out_error:
+	++hc->stats.rx_errors;
+out_drop:
+	dev_kfree_skb(skb);
+	return NULL;
+}
+
+/*
+ * Report the flows still open.
+ */
+void daisy_hc_flush(struct daisy_priv *priv)
+{
+	int i;
+
+	for (i = 0; i < DAISY_HC_TX_CONTEXTS; ++i)
+		if (priv->hc.tx[i].len)
+			daisy_hc_report(&priv->hc.tx[i]);
+}
@@ -0,0 +1,101 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _HC_H_
+#define _HC_H_
+
+#include <linux/module.h>
+#include <linux/netdevice.h>
+#include <linux/if_ether.h>
+
+/*
+ * TCP/UDP over IPv4/IPv6 header compression: A flow is identified by the
+ * static fields of its headers (addresses, ports, TOS, TTL, ...), the
+ * context. The first packet of a flow, and every DAISY_HC_REFRESH one,
+ * is sent in full with the context ID, the others carry the ID and the
+ * changing fields only (IP ID, TCP sequence, ack, flags, window, options
+ * and the checksum). Lengths and the IPv4 header checksum are rebuilt by
+ * the receiver. As nothing is sent as a delta, a lost packet never
+ * breaks a context. A context lost or replaced is noticed by its
+ * generation, the packets are dropped until the next full header.
+ *
+ * The packets are sent with the Ethernet type DAISY_ETH_P_HC, the first
+ * octet is DAISY_HC_FULL or DAISY_HC_COMP, the second the generation
+ * and context ID.
+ */
+#define DAISY_ETH_P_HC        0x88b6   /* IEEE local experimental 2  */
+#define DAISY_HC_FULL           0x01
+#define DAISY_HC_COMP           0x02
+#define DAISY_HC_CID_MASK       0x3f
+#define DAISY_HC_GEN_SHIFT         6
+#define DAISY_HC_TX_CONTEXTS      16   /* Direct mapped, power of 2  */
+#define DAISY_HC_RX_CONTEXTS      64   /* Direct mapped, power of 2  */
+#define DAISY_HC_REFRESH          16   /* Packets per full header    */
+#define DAISY_HC_TEMPLATE         44   /* IPv6 header and ports      */
+#define DAISY_HC_MAX_HLEN        120   /* IPv6 and TCP with options  */
+
+struct daisy_priv;
+
+struct daisy_hc_stats {
+	u32 tx_full;          /* Packets sent with full headers   */
+	u32 tx_comp;          /* Packets sent compressed          */
+	u32 tx_saved;         /* Octets saved                     */
+	u32 rx_full;
+	u32 rx_comp;
+	u32 rx_nocontext;     /* Dropped, context lost            */
+	u32 rx_errors;        /* Malformed packets                */
+};
+
+/*
+ * A context, unused if len is 0. The template holds the static fields,
+ * the changing ones are zero.
+ */
+struct daisy_hc_ctx {
+	u8              len;      /* Of the template               */
+	u8              cid;
+	u8              gen;
+	u8              since;    /* TX: Packets since full header */
+	u8              src[ETH_ALEN]; /* RX: Sender               */
+	u8              tmpl[DAISY_HC_TEMPLATE];
+	u32             packets;
+	u32             hdr_in;   /* Octets of the headers         */
+	u32             hdr_out;  /* Octets sent for them          */
+};
+
+struct daisy_hc {
+	struct daisy_hc_ctx   tx[DAISY_HC_TX_CONTEXTS];
+	struct daisy_hc_ctx   rx[DAISY_HC_RX_CONTEXTS];
+	struct daisy_hc_stats stats;
+};
+
+/*
+ * Test, if a received frame is header compressed.
+ */
+static inline bool daisy_is_compressed(const struct sk_buff *skb)
+{
+	return (skb->len >= ETH_HLEN) &&
+		(((struct ethhdr *)skb->data)->h_proto == htons(DAISY_ETH_P_HC));
+}
+
+extern void daisy_hc_init(struct daisy_priv *priv);
+extern int daisy_hc_tx(struct daisy_priv *priv, struct sk_buff *skb);
+extern struct sk_buff *daisy_hc_rx(struct daisy_priv *priv,
+		struct sk_buff *skb);
+extern void daisy_hc_flush(struct daisy_priv *priv);
+
+#endif /* _HC_H_ */
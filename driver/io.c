@@ -23,57 +23,122 @@
 #include <linux/etherdevice.h>
 
 #include "daisy.h"
+#include "ack.h"
 #include "spi-daisy.h"
 
 /*
- * Transmit a packet (called by the kernel)
+ * Transmit a packet, priv->xmit_lock is held.
  */
-int daisy_tx(struct sk_buff *skb, struct net_device *dev)
+static int daisy_tx_locked(struct sk_buff *skb, struct net_device *dev)
 {
 	int erc;
+	unsigned int len = skb->len;
+	int room;
 	struct daisy_priv *priv = netdev_priv(dev);
+	struct daisy_ack ack;
+	bool pure_ack;
 
 	if (priv->completion)
 		return -ERESTARTSYS;
-	erc = daisy_try_write(priv->daisy_device, skb, 0);
+	// Answer ARP and ND requests for known stations locally:
+	if (daisy_nd_tx(priv, skb))
+		return 0;
+	// Drop or limit multicast chatter as configured:
+	if (daisy_mc_tx(priv, skb)) {
+		priv->stats.tx_dropped ++;
+		return 0;
+	}
+	// Compress, fragment, then send with the L2 header:
+	pure_ack = daisy_ack_parse(skb, &ack);
+	erc = daisy_hc_tx(priv, skb);
+	if (erc >= 0) {
+		if (skb->len > DAISY_ETH_FRAME)
+			erc = daisy_frag_tx(priv, skb);
+		else
+			erc = daisy_l2_write(priv, skb, pure_ack ? &ack : NULL);
+	}
 	if (erc < 0) {
 		printk(KERN_ERR "daisy: TX %d octets failed with erc %d\n",
-				skb->len, erc);
+				len, erc);
 		dev_kfree_skb(skb);
 		priv->stats.tx_dropped ++;
 		goto out;
 	}
 	if (printk_ratelimit())
-		printk(KERN_DEBUG "daisy: TX %d octets\n", skb->len);
+		printk(KERN_DEBUG "daisy: TX %d octets\n", len);
 	dev_trans_start(dev);
 	priv->stats.tx_packets ++;
-	priv->stats.tx_bytes += skb->len;
+	priv->stats.tx_bytes += len;
 
 out:
-	if (tx_low_water_dn(priv->daisy_device) && !priv->stalled) {
-		printk(KERN_INFO "daisy: TX queue runs low - stop transmit\n");
-		netif_stop_queue(dev);
+	room = daisy_tx_room(priv->daisy_device);
+	// Stop while a full frame might not fit:
+	if ((tx_low_water_dn(priv->daisy_device) || (room < DAISY_FRAG_MAX)) &&
+			!priv->stalled) {
+		printk(KERN_DEBUG "daisy: TX queue runs low - stop transmit\n");
+		netif_tx_stop_all_queues(dev);
 		priv->stalled = 1;
+	} else if ((room < DAISY_FRAG_MAX + DAISY_TX_RESERVE) &&
+			!priv->throttled) {
+		netif_stop_subqueue(dev, DAISY_BAND_BULK);
+		netif_stop_subqueue(dev, DAISY_BAND_BACKGROUND);
+		priv->throttled = 1;
 	}
 	return 0;
 }
 
 /*
- * Deal with a transmit timeout.
+ * Transmit a packet (called by the kernel). The TX queues of the bands
+ * share the compression and L2 state, so they are serialized here.
  */
-void daisy_tx_timeout (struct net_device *dev)
+int daisy_tx(struct sk_buff *skb, struct net_device *dev)
+{
+	struct daisy_priv *priv = netdev_priv(dev);
+	int erc;
+
+	spin_lock(&priv->xmit_lock);
+	erc = daisy_tx_locked(skb, dev);
+	spin_unlock(&priv->xmit_lock);
+	return erc;
+}
+
+/*
+ * Resume the stopped queues, when there is room again. Called by
+ * spi-daisy for every frame, that has left the TX queue, in interrupt
+ * context.
+ */
+void daisy_tx_wake(void *ctx)
 {
+	struct net_device *dev = ctx;
 	struct daisy_priv *priv = netdev_priv(dev);
+	int room;
 
-	if (!(priv && (priv->stalled) && (priv->daisy_device)))
+	if (!(priv && (priv->stalled || priv->throttled) && (priv->daisy_device)))
 		return;
-	if (tx_low_water_up(priv->daisy_device)) {
-		printk(KERN_INFO "daisy: Resume transmit\n");
+	room = daisy_tx_room(priv->daisy_device);
+	if (priv->stalled && tx_low_water_up(priv->daisy_device) &&
+			(room >= DAISY_FRAG_MAX)) {
+		printk(KERN_DEBUG "daisy: Resume transmit\n");
 		priv->stalled = 0;
-		netif_wake_queue(dev);
+		priv->throttled = 0;
+		netif_tx_wake_all_queues(dev);
+	} else if (!priv->stalled && priv->throttled &&
+			(room >= DAISY_FRAG_MAX + DAISY_TX_RESERVE)) {
+		priv->throttled = 0;
+		netif_wake_subqueue(dev, DAISY_BAND_BULK);
+		netif_wake_subqueue(dev, DAISY_BAND_BACKGROUND);
 	}
 }
 
+/*
+ * Deal with a transmit timeout, the queues are woken by daisy_tx_wake()
+ * normally.
+ */
+void daisy_tx_timeout (struct net_device *dev)
+{
+	daisy_tx_wake(dev);
+}
+
 /**
  * Receive packet worker
  */
@@ -94,9 +159,25 @@ void daisy_rx(struct work_struct *ws)
 		goto out;
 	}
 	dev  = priv->root->net_device;
+	skb = daisy_l2_rx(priv, skb);
+	if (!skb)
+		goto out;
+	if (daisy_is_fragment(skb)) {
+		skb = daisy_frag_rx(priv, skb);
+		if (!skb)
+			goto out;
+	}
+	if (daisy_is_compressed(skb)) {
+		skb = daisy_hc_rx(priv, skb);
+		if (!skb)
+			goto out;
+	}
+	skb->dev = dev;
+	if (daisy_xdp_rx(priv, skb))
+		goto out;
+	daisy_nd_rx(priv, skb);
 	if (printk_ratelimit())
 		printk(KERN_DEBUG "daisy: RX %d octets\n", skb->len);
-	skb->dev = dev;
 	skb->protocol = eth_type_trans(skb, dev);
 	skb->ip_summed = 0;
 	priv->stats.rx_packets++;
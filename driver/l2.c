@@ -0,0 +1,322 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/module.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+#include <linux/skbuff.h>
+#include <linux/etherdevice.h>
+
+#include "daisy.h"
+#include "l2.h"
+#include "frag.h"
+#include "hc.h"
+#include "pc.h"
+#include "ack.h"
+#include "spi-daisy.h"
+
+void daisy_l2_init(struct daisy_priv *priv, const u8 *mac)
+{
+	struct daisy_l2 *l2 = &priv->l2;
+
+	memset(l2, 0x00, sizeof(struct daisy_l2));
+	memcpy(l2->mac, mac, ETH_ALEN);
+	l2->id = daisy_header_address(mac);
+	memset(l2->need, 0xff, sizeof(l2->need));
+}
+
+// Remember a source to ask for its MAC, DAISY_HEADER_BROADCAST is free:
+static void daisy_l2_need(struct daisy_l2 *l2, u16 id)
+{
+	int i;
+
+	for (i = 0; i < DAISY_L2_NEED; ++i) {
+		if (l2->need[i] == id)
+			return;
+	} // end for //
+	l2->need[l2->need_next] = id;
+	l2->need_next = (l2->need_next + 1) % DAISY_L2_NEED;
+}
+
+// Take a source from the ones to ask for:
+static bool daisy_l2_needed(struct daisy_l2 *l2, u16 id)
+{
+	int i;
+
+	for (i = 0; i < DAISY_L2_NEED; ++i) {
+		if (l2->need[i] == id) {
+			l2->need[i] = DAISY_HEADER_BROADCAST;
+			return true;
+		}
+	} // end for //
+	return false;
+}
+
+// Find the peer of a station ID, or take over the oldest entry:
+static struct daisy_l2_peer *daisy_l2_peer(struct daisy_l2_peer *t,
+		u16 id, bool create)
+{
+	struct daisy_l2_peer *p, *old = t;
+	int i;
+
+	for (i = 0, p = t; i < DAISY_L2_PEERS; ++i, ++p) {
+		if (p->time && (p->id == id))
+			return p;
+		if (!old->time)
+			continue;
+		if (!p->time || time_before(p->time, old->time))
+			old = p;
+	} // end for //
+	if (!create)
+		return NULL;
+	memset(old, 0x00, sizeof(struct daisy_l2_peer));
+	old->id = id;
+	return old;
+}
+
+static u8 daisy_l2_proto(__be16 type)
+{
+	switch (ntohs(type)) {
+	case ETH_P_IP:
+		return DAISY_L2_P_IP;
+	case ETH_P_ARP:
+		return DAISY_L2_P_ARP;
+	case ETH_P_IPV6:
+		return DAISY_L2_P_IPV6;
+	case DAISY_ETH_P_FRAG:
+		return DAISY_L2_P_FRAG;
+	case DAISY_ETH_P_HC:
+		return DAISY_L2_P_HC;
+	default:
+		return DAISY_L2_P_RAW;
+	} // end switch //
+}
+
+/*
+ * Replace the Ethernet header by the L2 header and queue the frame. A
+ * pure TCP ACK supersedes the older ones of its flow.
+ */
+int daisy_l2_write(struct daisy_priv *priv, struct sk_buff *skb,
+		const struct daisy_ack *ack)
+{
+	struct daisy_l2 *l2 = &priv->l2;
+	struct daisy_l2_peer *peer;
+	struct ethhdr eth;
+	u16 dst, src;
+	u8 flags = 0x00, proto, *p;
+	int hlen = DAISY_L2_HLEN, erc;
+
+	if (skb->len < ETH_HLEN)
+		return -EINVAL;
+	if (skb_cow_head(skb, DAISY_L2_GROWTH))
+		return -ENOMEM;
+	memcpy(&eth, skb->data, ETH_HLEN);
+	if (daisy_pc_tx(priv, skb, ETH_HLEN))
+		flags |= DAISY_L2_COMPRESSED;
+
+	// Bridged frames always carry their source:
+	if (ether_addr_equal(eth.h_source, l2->mac)) {
+		src = l2->id;
+	} else {
+		src = daisy_header_address(eth.h_source);
+		flags |= DAISY_L2_LONG_SRC;
+	}
+	if (is_multicast_ether_addr(eth.h_dest)) {
+		dst = DAISY_HEADER_BROADCAST;
+		flags |= DAISY_L2_LONG_SRC;
+		if (!is_broadcast_ether_addr(eth.h_dest))
+			flags |= DAISY_L2_LONG_DST;
+	} else {
+		dst = daisy_header_address(eth.h_dest);
+		peer = daisy_l2_peer(l2->rx, dst, false);
+		if (!peer || !peer->station ||
+				!ether_addr_equal(peer->mac, eth.h_dest))
+			flags |= DAISY_L2_LONG_DST;
+		if (daisy_l2_needed(l2, dst))
+			flags |= DAISY_L2_NEED_SRC;
+		peer = daisy_l2_peer(l2->tx, dst, true);
+		if (!peer->time ||
+				time_after(jiffies, peer->time + DAISY_L2_REFRESH)) {
+			flags |= DAISY_L2_LONG_SRC;
+			peer->time = jiffies;
+		}
+	}
+	proto = daisy_l2_proto(eth.h_proto);
+	if (flags & DAISY_L2_LONG_DST)
+		hlen += ETH_ALEN;
+	if (flags & DAISY_L2_LONG_SRC)
+		hlen += ETH_ALEN;
+	if (proto == DAISY_L2_P_RAW)
+		hlen += sizeof(eth.h_proto);
+
+	skb_pull(skb, ETH_HLEN);
+	p = skb_push(skb, hlen);
+	p[0] = flags;
+	p[1] = dst >> 8;
+	p[2] = dst & 0xff;
+	p[3] = src >> 8;
+	p[4] = src & 0xff;
+	p[5] = proto;
+	p += DAISY_L2_HLEN;
+	if (flags & DAISY_L2_LONG_DST) {
+		memcpy(p, eth.h_dest, ETH_ALEN);
+		p += ETH_ALEN;
+	}
+	if (flags & DAISY_L2_LONG_SRC) {
+		memcpy(p, eth.h_source, ETH_ALEN);
+		p += ETH_ALEN;
+	}
+	if (proto == DAISY_L2_P_RAW)
+		memcpy(p, &eth.h_proto, sizeof(eth.h_proto));
+
+	if (flags & DAISY_L2_LONG_SRC)
+		++l2->stats.tx_long;
+	else
+		++l2->stats.tx_short;
+	if (hlen < ETH_HLEN)
+		l2->stats.tx_saved += ETH_HLEN - hlen;
+	erc = daisy_fwd_tx(priv, skb);
+	if (erc < 0)
+		return erc;
+	if (ack)
+		return daisy_try_write_superseding(priv->daisy_device, skb,
+				ack->flow, ack->seq, skb_get_queue_mapping(skb));
+	return daisy_try_write(priv->daisy_device, skb,
+			skb_get_queue_mapping(skb));
+}
+
+/*
+ * Replace the L2 header of a received frame by the Ethernet header.
+ * Returns NULL, if the frame is dropped, it is freed then.
+ */
+struct sk_buff *daisy_l2_rx(struct daisy_priv *priv, struct sk_buff *skb)
+{
+	struct daisy_l2 *l2 = &priv->l2;
+	struct daisy_l2_peer *peer;
+	struct ethhdr eth;
+	u16 dst, src;
+	u8 flags, proto, *p;
+	int hlen = DAISY_L2_HLEN;
+
+	if (skb->len < DAISY_L2_HLEN)
+		goto out_error;
+	if (skb->data[0] & DAISY_L2_RELAY) {
+		skb = daisy_fwd_rx(priv, skb);
+		if (!skb)
+			return NULL;
+	}
+	p = skb->data;
+	flags = p[0];
+	dst   = (p[1] << 8) | p[2];
+	src   = (p[3] << 8) | p[4];
+	proto = p[5];
+	if (flags & DAISY_L2_LONG_DST)
+		hlen += ETH_ALEN;
+	if (flags & DAISY_L2_LONG_SRC)
+		hlen += ETH_ALEN;
+	if (proto == DAISY_L2_P_RAW)
+		hlen += sizeof(eth.h_proto);
+	if (skb->len < hlen)
+		goto out_error;
+	p += DAISY_L2_HLEN;
+
+	// Destination:
+	if (flags & DAISY_L2_LONG_DST) {
+		memcpy(eth.h_dest, p, ETH_ALEN);
+		p += ETH_ALEN;
+	} else if (dst == DAISY_HEADER_BROADCAST) {
+		eth_broadcast_addr(eth.h_dest);
+	} else if (dst == l2->id) {
+		memcpy(eth.h_dest, l2->mac, ETH_ALEN);
+	} else {
+		++l2->stats.rx_foreign;
+		goto out_drop;
+	}
+
+	// Source, learned from the long form:
+	if (flags & DAISY_L2_LONG_SRC) {
+		memcpy(eth.h_source, p, ETH_ALEN);
+		p += ETH_ALEN;
+		if (daisy_header_address(eth.h_source) != src)
+			goto out_error;
+		peer = daisy_l2_peer(l2->rx, src, true);
+		if (!ether_addr_equal(peer->mac, eth.h_source)) {
+			memcpy(peer->mac, eth.h_source, ETH_ALEN);
+			peer->station = false;
+		}
+		peer->time = jiffies;
+		++l2->stats.rx_long;
+	} else {
+		peer = daisy_l2_peer(l2->rx, src, false);
+		if (!peer) {
+			daisy_l2_need(l2, src);
+			++l2->stats.rx_unknown;
+			goto out_drop;
+		}
+		// Only a station sends its own MAC in the short form:
+		memcpy(eth.h_source, peer->mac, ETH_ALEN);
+		peer->station = true;
+		peer->time = jiffies;
+		++l2->stats.rx_short;
+	}
+
+	// The peer lost our MAC, announce it with the next frame:
+	if (flags & DAISY_L2_NEED_SRC) {
+		peer = daisy_l2_peer(l2->tx, src, false);
+		if (peer)
+			peer->time = 0;
+		++l2->stats.rx_need_src;
+	}
+
+	switch (proto) {
+	case DAISY_L2_P_IP:
+		eth.h_proto = htons(ETH_P_IP);
+		break;
+	case DAISY_L2_P_ARP:
+		eth.h_proto = htons(ETH_P_ARP);
+		break;
+	case DAISY_L2_P_IPV6:
+		eth.h_proto = htons(ETH_P_IPV6);
+		break;
+	case DAISY_L2_P_FRAG:
+		eth.h_proto = htons(DAISY_ETH_P_FRAG);
+		break;
+	case DAISY_L2_P_HC:
+		eth.h_proto = htons(DAISY_ETH_P_HC);
+		break;
+	case DAISY_L2_P_RAW:
+		memcpy(&eth.h_proto, p, sizeof(eth.h_proto));
+		break;
+	default:
+		goto out_error;
+	} // end switch //
+
+	if ((flags & DAISY_L2_COMPRESSED) && !daisy_pc_rx(priv, skb, hlen))
+		goto out_drop;
+	skb_pull(skb, hlen);
+	if (skb_cow_head(skb, ETH_HLEN))
+		goto out_drop;
+	memcpy(skb_push(skb, ETH_HLEN), &eth, ETH_HLEN);
+	return skb;
+
+out_error:
+	++l2->stats.rx_errors;
+out_drop:
+	dev_kfree_skb(skb);
+	return NULL;
+}
@@ -0,0 +1,85 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _L2_H_
+#define _L2_H_
+
+#include <linux/module.h>
+#include <linux/netdevice.h>
+#include <linux/if_ether.h>
+
+/*
+ * The Daisy L2 header (see spi-daisy.h) replaces the Ethernet header on
+ * the air. A station sends its MAC address with broadcast frames and
+ * with the first unicast frame to a peer, then every DAISY_L2_REFRESH.
+ * The receiver learns the MAC address of the station ID from it and
+ * rebuilds the Ethernet header, the stack sees Ethernet frames only.
+ * A receiver, that drops a frame of an unknown source, sets
+ * DAISY_L2_NEED_SRC in its next frame to that station, which announces
+ * its MAC again then. The destination is sent in the short form only to
+ * the own MAC of a station, heard in the short form, a station's bridge
+ * needs the long form for the MACs behind it.
+ */
+#define DAISY_L2_GROWTH           13   /* Long form and relay header */
+#define DAISY_L2_PEERS            16   /* Stations learned           */
+#define DAISY_L2_REFRESH     (30*HZ)   /* Announce our MAC again     */
+#define DAISY_L2_NEED              4   /* Unknown sources remembered */
+
+struct daisy_priv;
+struct daisy_ack;
+
+struct daisy_l2_stats {
+	u32 tx_short;         /* Frames sent with station IDs only */
+	u32 tx_long;          /* Frames sent with a MAC address    */
+	u32 tx_saved;         /* Octets saved against Ethernet     */
+	u32 rx_short;
+	u32 rx_long;
+	u32 rx_unknown;       /* Dropped, source not learned yet   */
+	u32 rx_foreign;       /* Dropped, unicast to another station */
+	u32 rx_errors;        /* Malformed headers                 */
+	u32 rx_need_src;      /* Peer asked for our MAC again      */
+};
+
+/*
+ * A peer, the entry is unused if time is 0. The RX table holds the MAC
+ * address learned, the TX table the time of the last announcement.
+ */
+struct daisy_l2_peer {
+	u16             id;
+	u8              mac[ETH_ALEN];
+	bool            station;  /* RX: Own MAC of the station */
+	unsigned long   time;     /* In jiffies */
+};
+
+struct daisy_l2 {
+	u16                   id;        /* Our station ID */
+	u8                    mac[ETH_ALEN];
+	struct daisy_l2_peer  rx[DAISY_L2_PEERS];
+	struct daisy_l2_peer  tx[DAISY_L2_PEERS];
+	u16                   need[DAISY_L2_NEED]; /* Sources to ask for */
+	u8                    need_next;
+	struct daisy_l2_stats stats;
+};
+
+extern void daisy_l2_init(struct daisy_priv *priv, const u8 *mac);
+extern int daisy_l2_write(struct daisy_priv *priv, struct sk_buff *skb,
+		const struct daisy_ack *ack);
+extern struct sk_buff *daisy_l2_rx(struct daisy_priv *priv,
+		struct sk_buff *skb);
+
+#endif /* _L2_H_ */
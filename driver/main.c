@@ -42,7 +42,9 @@ struct net_device_stats *daisy_stats(struct net_device *dev);
 int daisy_change_mtu(struct net_device *dev, int new_mtu);
 int daisy_tx(struct sk_buff *skb, struct net_device *dev);
 void daisy_tx_timeout (struct net_device *dev);
+void daisy_tx_wake(void *ctx);
 void daisy_rx(struct work_struct *ws);
+extern const struct ethtool_ops daisy_ethtool_ops;
 
 static int daisy_up(struct net_device *dev);
 static int daisy_down(struct net_device *dev);
@@ -51,6 +53,19 @@ static int daisy_down(struct net_device *dev);
  * Parameters.
  */
 static int timeout   = DEFAULT_TIMEOUT;
+static bool compress = true;
+module_param(compress, bool, 0444);
+MODULE_PARM_DESC(compress, "Compress the payload of radio frames");
+static uint data_rate = DEFAULT_DATA_RATE;
+module_param(data_rate, uint, 0444);
+MODULE_PARM_DESC(data_rate, "Data rate the modem is set up for, in bps");
+static bool hw_filter = true;
+module_param(hw_filter, bool, 0444);
+MODULE_PARM_DESC(hw_filter,
+		"Drop unicast for other MACs in the chip, off for a bridge port");
+static char *mac_mode = "csma";
+module_param(mac_mode, charp, 0444);
+MODULE_PARM_DESC(mac_mode, "Channel access: csma, ap (polls) or station");
 
 /*
  * Definition of root array.
@@ -65,6 +80,8 @@ static const struct net_device_ops daisy_netdev_ops = {
 	.ndo_open            = daisy_up,
 	.ndo_stop            = daisy_down,
 	.ndo_start_xmit      = daisy_tx,
+	.ndo_select_queue    = daisy_band_select,
+	.ndo_bpf             = daisy_xdp_bpf,
 	.ndo_do_ioctl        = daisy_ioctl,
 	.ndo_set_mac_address = daisy_set_mac_address,
 	.ndo_get_stats       = daisy_stats,
@@ -82,10 +99,23 @@ static void daisy_init(struct net_device *dev)
 	ether_setup(dev);
 	dev->watchdog_timeo = timeout;
 	dev->netdev_ops     = &daisy_netdev_ops;
-	dev->mtu            = 240;
+	dev->ethtool_ops    = &daisy_ethtool_ops;
+	dev->mtu            = ETH_DATA_LEN; // Fragmented, see frag.h
 	printk(KERN_DEBUG "daisy: Net device has been setup\n");
 }
 
+static enum daisy_mac_mode daisy_mac_mode_of(const char *mode)
+{
+	if (sysfs_streq(mode, "ap"))
+		return MAC_AP;
+	if (sysfs_streq(mode, "station"))
+		return MAC_STATION;
+	if (!sysfs_streq(mode, "csma"))
+		printk(KERN_ERR "daisy: Unknown mac_mode \"%s\", using csma\n",
+				mode);
+	return MAC_CSMA;
+}
+
 static int daisy_up(struct net_device *dev)
 {
 	int erc = 0;
@@ -105,6 +135,7 @@ static int daisy_up(struct net_device *dev)
 		goto out_exit;
 	}
 	daisy_register_stats(priv->daisy_device, &priv->stats);
+	daisy_register_tx_done(priv->daisy_device, daisy_tx_wake, dev);
 
 	// Lock and set SPI bus speed:
 	daisy_spi = daisy_get_controller(priv->daisy_device);
@@ -131,30 +162,65 @@ static int daisy_up(struct net_device *dev)
 	printk(KERN_DEBUG "daisy: Found RFM22B version %d\n",
 			(int)daisy_get_register8(priv->daisy_device, 1));
 
+	// Run with the fastest clock the wiring allows:
+	speed = daisy_calibrate_speed(priv->daisy_device, SPI_MAX_BUS_SPEED,
+			NULL, 0);
+	if (!speed) {
+		printk(KERN_ERR "daisy: SPI calibration failed\n");
+		erc = -EIO;
+		goto out_unlock_speed;
+	}
+	printk(KERN_DEBUG "daisy: SPI bus speed calibrated to %d kHz\n",
+			speed / 1000);
+
+	// Payload compression:
+	erc = daisy_pc_init(priv, compress);
+	if (erc) {
+		printk(KERN_ERR "daisy: Unable to allocate the compressor\n");
+		goto out_unlock_speed;
+	}
+
 	// Allocate workqueue:
 	priv->workqueue = create_singlethread_workqueue(dev->name);
 	if (!priv->workqueue) {
 		printk(KERN_ERR
 				"daisy: Unable to create workqueue %s\n", dev->name);
 		erc = -ENOMEM;
-		goto out_close_device;
+		goto out_free_pc;
 	}
 
 	// Init the worker:
 	INIT_WORK(&priv->work, daisy_rx);
+	spin_lock_init(&priv->xmit_lock);
+	daisy_frag_init(priv);
+	daisy_l2_init(priv, dev->dev_addr);
+	daisy_hc_init(priv);
+	daisy_nd_init(priv);
+	daisy_mc_init(priv);
+	daisy_band_init(priv);
+	daisy_xdp_init(priv);
 
 	// Start Transmit:
-	netif_start_queue(dev);
+	netif_tx_start_all_queues(dev);
 
 	// Start Receive:
 	queue_work(priv->workqueue, &priv->work);
 
-	// Start hardware:
+	// Start hardware, the chip drops unicast frames for other MACs:
+	daisy_set_address(priv->daisy_device, dev->dev_addr, DAISY_NETWORK_ID,
+			hw_filter);
+	// The polled MAC addresses a station by its ID:
+	daisy_set_mac_mode(priv->daisy_device, daisy_mac_mode_of(mac_mode),
+			priv->l2.id, data_rate);
+	// FIFO thresholds for the data rate:
+	daisy_set_data_rate(priv->daisy_device, data_rate);
 	daisy_device_up(priv->daisy_device);
 
 	erc = 0;
 	goto out_exit;
 
+out_free_pc:
+	daisy_pc_free(priv);
 out_unlock_speed:
 	daisy_unlock_speed(daisy_spi);
 out_close_device:
@@ -170,7 +236,7 @@ static int daisy_down(struct net_device *dev)
 		struct daisy_priv *priv = netdev_priv(dev);
 
 		printk(KERN_DEBUG "daisy: Net device down: \"%s\"\n", dev->name);
-		netif_stop_queue(dev);
+		netif_tx_stop_all_queues(dev);
 		daisy_device_down(priv->daisy_device);
 
 		// Stop the receive loop:
@@ -186,6 +252,10 @@ static int daisy_down(struct net_device *dev)
 			flush_workqueue(priv->workqueue);
 			destroy_workqueue(priv->workqueue);
 			priv->workqueue = NULL;
+			daisy_frag_flush(priv);
+			daisy_hc_flush(priv);
+			daisy_pc_free(priv);
+			daisy_xdp_down(priv);
 		}
 
 		// Close daisy device:
@@ -223,6 +293,7 @@ static void daisy_cleanup(void)
 			printk(KERN_DEBUG "daisy: Close net device \"%s\"\n",
 					rd->net_device->name);
 			unregister_netdev(rd->net_device);
+			daisy_xdp_free(netdev_priv(rd->net_device));
 			printk(KERN_DEBUG "daisy: Free net device \"%s\"\n",
 					rd->net_device->name);
 			free_netdev(rd->net_device);
@@ -233,6 +304,8 @@ static void daisy_cleanup(void)
 	kfree(root);
 	root = NULL;
 	n_roots = 0;
+	daisy_mc_free();
+	daisy_fwd_unregister();
 	printk(KERN_DEBUG "daisy: Cleanup finished\n");
 }
 
@@ -251,6 +324,13 @@ static int __init daisy_init_module(void)
 
 	n_roots = 1; // For now, we have only one SPI device.
 
+	if ((result = daisy_fwd_register())) {
+		printk(KERN_ERR "daisy: Error %i registering netlink family\n",
+				result);
+		erc = result;
+		goto out;
+	}
+
 	/* Allocate memory for the root array. */
 	if (!(root = kcalloc(sizeof(struct root_descriptor), n_roots, GFP_KERNEL)))
 	{
@@ -262,9 +342,9 @@ static int __init daisy_init_module(void)
 
 	/* Open network devices */
 	for (i = 0, pd = root; i < n_roots; ++i, ++pd) {
-		if (!(pd->net_device = alloc_netdev(
+		if (!(pd->net_device = alloc_netdev_mqs(
 				sizeof(struct daisy_priv), "dsy%d",
-				NET_NAME_UNKNOWN, daisy_init)))
+				NET_NAME_UNKNOWN, daisy_init, DAISY_TX_BANDS, 1)))
 		{
 			printk(KERN_ERR	"daisy: Unable to allocate net device\n");
 			erc = -ENODEV;
@@ -291,6 +371,7 @@ static int __init daisy_init_module(void)
 		}
 		priv->root = pd;
 		priv->slot = i;
+		daisy_fwd_init(priv);
 	} // end for //
 
 	erc = 0;
@@ -0,0 +1,343 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/hash.h>
+#include <linux/spinlock.h>
+#include <linux/skbuff.h>
+#include <linux/etherdevice.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/in.h>
+#include <linux/pkt_sched.h>
+#include <net/ipv6.h>
+
+#include "daisy.h"
+#include "mc.h"
+#include "spi-daisy.h"
+
+struct daisy_mc_rule {
+	u8            proto;
+	u16           port;
+	u8            action;
+	u32           rate;     /* Frames per second */
+	u32           burst;    /* Frames */
+	u64           tokens;   /* Frames * HZ */
+	unsigned long last;     /* Last refill, in jiffies */
+	u32           hits;
+};
+
+struct daisy_mc_rules {
+	int                  n;
+	struct daisy_mc_rule rule[DAISY_MC_RULES];
+	u8                   index[DAISY_MC_INDEX];  /* Rule + 1, 0: free */
+};
+
+static const struct {
+	const char *name;
+	u8          proto;
+} daisy_mc_protos[] = {
+	{ "any",    0              },
+	{ "icmp",   IPPROTO_ICMP   },
+	{ "igmp",   IPPROTO_IGMP   },
+	{ "tcp",    IPPROTO_TCP    },
+	{ "udp",    IPPROTO_UDP    },
+	{ "icmpv6", IPPROTO_ICMPV6 },
+	{ "arp",    DAISY_MC_ARP   },
+};
+
+static const char *daisy_mc_actions[] = {
+	[DAISY_MC_PASS] = "pass",
+	[DAISY_MC_DROP] = "drop",
+	[DAISY_MC_RATE] = "rate",
+	[DAISY_MC_LOW]  = "low",
+};
+
+// Shared by all devices, replaced as a whole:
+static DEFINE_SPINLOCK(daisy_mc_lock);
+static struct daisy_mc_rules *daisy_mc_rules = NULL;
+
+static u32 daisy_mc_hash(u8 proto, u16 port)
+{
+	return hash_32(((u32)proto << 16) | port, ilog2(DAISY_MC_INDEX));
+}
+
+static struct daisy_mc_rule *daisy_mc_find(struct daisy_mc_rules *rules,
+		u8 proto, u16 port)
+{
+	u32 i = daisy_mc_hash(proto, port);
+	struct daisy_mc_rule *r;
+
+	while (rules->index[i]) {
+		r = &rules->rule[rules->index[i] - 1];
+		if ((r->proto == proto) && (r->port == port))
+			return r;
+		i = (i + 1) & (DAISY_MC_INDEX - 1);
+	} // end while //
+	return NULL;
+}
+
+// Parse "<proto>[:<port>]=<action>", add it to rules:
+static int daisy_mc_parse(struct daisy_mc_rules *rules, char *s)
+{
+	struct daisy_mc_rule *r;
+	char *proto, *port, *action;
+	u32 i;
+
+	if (rules->n >= DAISY_MC_RULES)
+		return -ENOSPC;
+	r = &rules->rule[rules->n];
+	action = s;
+	proto  = strsep(&action, "=");
+	if (!action)
+		return -EINVAL;
+	port = proto;
+	proto = strsep(&port, ":");
+	for (i = 0; i < ARRAY_SIZE(daisy_mc_protos); ++i)
+		if (!strcmp(proto, daisy_mc_protos[i].name))
+			break;
+	if (i == ARRAY_SIZE(daisy_mc_protos))
+		return -EINVAL;
+	r->proto = daisy_mc_protos[i].proto;
+	if (port && (!r->proto || kstrtou16(port, 0, &r->port)))
+		return -EINVAL;
+
+	if (!strcmp(action, "pass")) {
+		r->action = DAISY_MC_PASS;
+	} else if (!strcmp(action, "drop")) {
+		r->action = DAISY_MC_DROP;
+	} else if (!strcmp(action, "low")) {
+		r->action = DAISY_MC_LOW;
+	} else {
+		if ((sscanf(action, "%u/%u", &r->rate, &r->burst) != 2) ||
+				!r->rate || !r->burst)
+			return -EINVAL;
+		r->action = DAISY_MC_RATE;
+		r->tokens = (u64)r->burst * HZ;
+		r->last   = jiffies;
+	}
+	if (daisy_mc_find(rules, r->proto, r->port))
+		return -EEXIST;
+
+	i = daisy_mc_hash(r->proto, r->port);
+	while (rules->index[i])
+		i = (i + 1) & (DAISY_MC_INDEX - 1);
+	rules->index[i] = ++rules->n;
+	return 0;
+}
+
+static int daisy_mc_set(const char *val, const struct kernel_param *kp)
+{
+	struct daisy_mc_rules *rules, *old;
+	char *buf, *p, *s;
+	int erc = 0;
+
+	rules = kzalloc(sizeof(struct daisy_mc_rules), GFP_KERNEL);
+	buf = kstrdup(val, GFP_KERNEL);
+	if (!rules || !buf) {
+		erc = -ENOMEM;
+		goto out;
+	}
+	p = buf;
+	while ((s = strsep(&p, ", \n"))) {
+		if (!*s)
+			continue;
+		erc = daisy_mc_parse(rules, s);
+		if (erc) {
+			printk(KERN_ERR "daisy: Invalid mcast_policy rule \"%s\"\n", s);
+			goto out;
+		}
+	} // end while //
+	spin_lock_bh(&daisy_mc_lock);
+	old = daisy_mc_rules;
+	daisy_mc_rules = rules;
+	spin_unlock_bh(&daisy_mc_lock);
+	rules = old;
+out:
+	kfree(buf);
+	kfree(rules);
+	return erc;
+}
+
+static int daisy_mc_get(char *buffer, const struct kernel_param *kp)
+{
+	struct daisy_mc_rules *rules;
+	struct daisy_mc_rule *r;
+	int i, j, cb = 0;
+
+	spin_lock_bh(&daisy_mc_lock);
+	rules = daisy_mc_rules;
+	for (i = 0; rules && (i < rules->n); ++i) {
+		r = &rules->rule[i];
+		for (j = 0; j < ARRAY_SIZE(daisy_mc_protos); ++j)
+			if (daisy_mc_protos[j].proto == r->proto)
+				break;
+		cb += scnprintf(buffer + cb, PAGE_SIZE - cb, "%s",
+				daisy_mc_protos[j].name);
+		if (r->port)
+			cb += scnprintf(buffer + cb, PAGE_SIZE - cb, ":%u", r->port);
+		if (r->action == DAISY_MC_RATE)
+			cb += scnprintf(buffer + cb, PAGE_SIZE - cb, "=%u/%u",
+					r->rate, r->burst);
+		else
+			cb += scnprintf(buffer + cb, PAGE_SIZE - cb, "=%s",
+					daisy_mc_actions[r->action]);
+		cb += scnprintf(buffer + cb, PAGE_SIZE - cb, " hits=%u\n", r->hits);
+	} // end for //
+	spin_unlock_bh(&daisy_mc_lock);
+	return cb;
+}
+
+static const struct kernel_param_ops daisy_mc_ops = {
+	.set = daisy_mc_set,
+	.get = daisy_mc_get,
+};
+module_param_cb(mcast_policy, &daisy_mc_ops, NULL, 0644);
+MODULE_PARM_DESC(mcast_policy,
+		"Multicast policy, e.g. \"udp:5353=drop,udp:1900=1/4,icmpv6:134=low\"");
+
+// Protocol and port of a frame, the type for ICMP and ICMPv6:
+static void daisy_mc_key(const struct sk_buff *skb, u8 *proto, u16 *port)
+{
+	const struct ethhdr *eth = (const struct ethhdr *)skb->data;
+	const u8 *l4 = NULL;
+	int cb = skb_headlen(skb) - ETH_HLEN;
+
+	*proto = 0;
+	*port  = 0;
+	if (eth->h_proto == htons(ETH_P_ARP)) {
+		*proto = DAISY_MC_ARP;
+		return;
+	}
+	if (eth->h_proto == htons(ETH_P_IP)) {
+		const struct iphdr *iph = (const struct iphdr *)(eth + 1);
+
+		if ((cb < (int)sizeof(struct iphdr)) || (cb < iph->ihl * 4))
+			return;
+		*proto = iph->protocol;
+		if (!(iph->frag_off & htons(IP_OFFSET))) {
+			l4 = (const u8 *)iph + iph->ihl * 4;
+			cb -= iph->ihl * 4;
+		}
+	} else if (eth->h_proto == htons(ETH_P_IPV6)) {
+		const struct ipv6hdr *ip6 = (const struct ipv6hdr *)(eth + 1);
+
+		if (cb < (int)sizeof(struct ipv6hdr))
+			return;
+		*proto = ip6->nexthdr;
+		l4 = (const u8 *)(ip6 + 1);
+		cb -= sizeof(struct ipv6hdr);
+		// MLD comes with a hop-by-hop router alert:
+		if ((*proto == NEXTHDR_HOP) && (cb >= 8) && (cb >= (l4[1] + 1) * 8)) {
+			*proto = l4[0];
+			cb -= (l4[1] + 1) * 8;
+			l4 += (l4[1] + 1) * 8;
+		}
+	} else {
+		return;
+	}
+	if (!l4)
+		return;
+	switch (*proto) {
+	case IPPROTO_UDP :
+	case IPPROTO_TCP :
+		if (cb >= 4)
+			*port = (l4[2] << 8) | l4[3];
+		break;
+	case IPPROTO_ICMP :
+	case IPPROTO_IGMP :
+	case IPPROTO_ICMPV6 :
+		if (cb >= 1)
+			*port = l4[0];
+		break;
+	} // end switch //
+}
+
+void daisy_mc_init(struct daisy_priv *priv)
+{
+	memset(&priv->mc, 0x00, sizeof(struct daisy_mc));
+}
+
+/*
+ * Apply the policy to a multicast or broadcast frame. Returns true, if
+ * the frame is not sent, skb is freed then.
+ */
+bool daisy_mc_tx(struct daisy_priv *priv, struct sk_buff *skb)
+{
+	struct daisy_mc *mc = &priv->mc;
+	struct daisy_mc_rule *r = NULL;
+	unsigned long now = jiffies;
+	bool drop = false;
+	u8 proto;
+	u16 port;
+
+	if (!is_multicast_ether_addr(((const struct ethhdr *)skb->data)->h_dest))
+		return false;
+	++mc->stats.tx_frames;
+	daisy_mc_key(skb, &proto, &port);
+
+	spin_lock_bh(&daisy_mc_lock);
+	if (daisy_mc_rules) {
+		r = daisy_mc_find(daisy_mc_rules, proto, port);
+		if (!r && port)
+			r = daisy_mc_find(daisy_mc_rules, proto, 0);
+		if (!r && proto)
+			r = daisy_mc_find(daisy_mc_rules, 0, 0);
+	}
+	if (r) {
+		++r->hits;
+		switch (r->action) {
+		case DAISY_MC_DROP :
+			++mc->stats.tx_dropped;
+			drop = true;
+			break;
+		case DAISY_MC_RATE :
+			r->tokens = min_t(u64, r->tokens + (u64)(now - r->last) * r->rate,
+					(u64)r->burst * HZ);
+			r->last = now;
+			if (r->tokens < HZ) {
+				++mc->stats.tx_limited;
+				drop = true;
+			} else {
+				r->tokens -= HZ;
+			}
+			break;
+		case DAISY_MC_LOW :
+			if (daisy_tx_room(priv->daisy_device) < DAISY_MC_LOW_ROOM) {
+				skb_set_queue_mapping(skb, DAISY_BAND_BACKGROUND);
+				skb->priority = TC_PRIO_FILLER;
+				++mc->stats.tx_lowered;
+			}
+			break;
+		} // end switch //
+	}
+	spin_unlock_bh(&daisy_mc_lock);
+
+	if (drop)
+		dev_kfree_skb(skb);
+	return drop;
+}
+
+void daisy_mc_free(void)
+{
+	kfree(daisy_mc_rules);
+	daisy_mc_rules = NULL;
+}
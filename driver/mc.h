@@ -0,0 +1,68 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MC_H_
+#define _MC_H_
+
+#include <linux/module.h>
+#include <linux/netdevice.h>
+
+/*
+ * Multicast and broadcast policy: Multicast and broadcast frames are
+ * classified by protocol and destination port (the type for ICMP and
+ * ICMPv6) before they are queued. A rule can drop them, limit them
+ * with a token bucket or lower them to the background band, when the
+ * TX queue is busy. The rules are set at runtime with the module parameter
+ * "mcast_policy", a list separated by commas, e.g.
+ *
+ *   udp:5353=drop,udp:1900=1/4,icmpv6:134=low,any=pass
+ *
+ * where "1/4" is 1 frame per second with a burst of 4. The most
+ * specific rule matches, i.e. protocol and port, then protocol, then
+ * "any". Reading the parameter shows the rules with their hits.
+ */
+#define DAISY_MC_RULES            32   /* Max. number of rules       */
+#define DAISY_MC_INDEX            64   /* Size of the lookup table   */
+#define DAISY_MC_LOW_ROOM         12   /* TX entries free, not lowered */
+#define DAISY_MC_ARP            0xff   /* Protocol code of ARP       */
+
+enum daisy_mc_action {
+	DAISY_MC_PASS,
+	DAISY_MC_DROP,
+	DAISY_MC_RATE,
+	DAISY_MC_LOW,
+};
+
+struct daisy_priv;
+
+struct daisy_mc_stats {
+	u32 tx_frames;        /* Multicast and broadcast frames   */
+	u32 tx_dropped;       /* By a drop rule                   */
+	u32 tx_limited;       /* By a rate rule                   */
+	u32 tx_lowered;       /* To background by a low rule      */
+};
+
+struct daisy_mc {
+	struct daisy_mc_stats stats;
+};
+
+extern void daisy_mc_init(struct daisy_priv *priv);
+extern bool daisy_mc_tx(struct daisy_priv *priv, struct sk_buff *skb);
+extern void daisy_mc_free(void);
+
+#endif /* _MC_H_ */
@@ -0,0 +1,280 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/module.h>
+#include <linux/string.h>
+#include <linux/skbuff.h>
+#include <linux/etherdevice.h>
+#include <linux/if_arp.h>
+#include <linux/ipv6.h>
+#include <linux/icmpv6.h>
+#include <linux/jhash.h>
+#include <net/arp.h>
+#include <net/ndisc.h>
+#include <net/ip6_checksum.h>
+
+#include "daisy.h"
+#include "nd.h"
+
+/*
+ * ARP over Ethernet and IPv4.
+ */
+struct daisy_arp {
+	struct arphdr hdr;
+	u8            sha[ETH_ALEN];
+	__be32        spa;
+	u8            tha[ETH_ALEN];
+	__be32        tpa;
+} __packed;
+
+void daisy_nd_init(struct daisy_priv *priv)
+{
+	memset(&priv->nd, 0x00, sizeof(struct daisy_nd));
+	spin_lock_init(&priv->nd.lock);
+}
+
+static struct daisy_nd_entry *daisy_nd_slot(struct daisy_nd *nd,
+		const struct in6_addr *addr)
+{
+	return &nd->cache[jhash(addr, sizeof(*addr), 0)
+	                  & (DAISY_ND_ENTRIES - 1)];
+}
+
+static void daisy_nd_learn(struct daisy_nd *nd, const struct in6_addr *addr,
+		const u8 *mac, bool advertised, bool router)
+{
+	struct daisy_nd_entry *e;
+	bool same;
+
+	if (ipv6_addr_any(addr) || !is_valid_ether_addr(mac))
+		return;
+	spin_lock_bh(&nd->lock);
+	e = daisy_nd_slot(nd, addr);
+	same = e->time && ipv6_addr_equal(&e->addr, addr) &&
+			ether_addr_equal(e->mac, mac);
+	// Keep the router flag of an advertisement for the same station:
+	if (advertised || !same) {
+		e->advertised = advertised;
+		e->router     = router;
+	}
+	e->addr   = *addr;
+	e->time   = jiffies;
+	memcpy(e->mac, mac, ETH_ALEN);
+	++nd->stats.rx_learned;
+	spin_unlock_bh(&nd->lock);
+}
+
+// Look up an address, copy the entry if it is fresh:
+static bool daisy_nd_lookup(struct daisy_nd *nd, const struct in6_addr *addr,
+		struct daisy_nd_entry *res)
+{
+	struct daisy_nd_entry *e;
+	bool hit;
+
+	spin_lock_bh(&nd->lock);
+	e = daisy_nd_slot(nd, addr);
+	hit = e->time && ipv6_addr_equal(&e->addr, addr) &&
+			time_before(jiffies, e->time + DAISY_ND_TTL);
+	if (hit)
+		*res = *e;
+	spin_unlock_bh(&nd->lock);
+	return hit;
+}
+
+// Find an ICMPv6 ND message, no extension headers:
+static struct nd_msg *daisy_nd_msg(const struct sk_buff *skb, int *len)
+{
+	const struct ipv6hdr *ip6 = (const struct ipv6hdr *)(skb->data + ETH_HLEN);
+	int cb = skb_headlen(skb) - ETH_HLEN - sizeof(struct ipv6hdr);
+	struct nd_msg *msg = (struct nd_msg *)(ip6 + 1);
+
+	if ((cb < (int)sizeof(struct nd_msg)) ||
+			(ip6->nexthdr != IPPROTO_ICMPV6) || (ip6->hop_limit != 255) ||
+			(ntohs(ip6->payload_len) > cb))
+		return NULL;
+	if ((msg->icmph.icmp6_type != NDISC_NEIGHBOUR_SOLICITATION) &&
+			(msg->icmph.icmp6_type != NDISC_NEIGHBOUR_ADVERTISEMENT))
+		return NULL;
+	*len = ntohs(ip6->payload_len);
+	return msg;
+}
+
+// Link layer address option of an ND message:
+static const u8 *daisy_nd_lladdr(const struct nd_msg *msg, int len, u8 type)
+{
+	const u8 *opt = msg->opt;
+
+	len -= sizeof(struct nd_msg);
+	while (len >= 8) {
+		if (!opt[1] || (opt[1] * 8 > len))
+			return NULL;
+		if ((opt[0] == type) && (opt[1] == 1))
+			return opt + 2;
+		len -= opt[1] * 8;
+		opt += opt[1] * 8;
+	} // end while //
+	return NULL;
+}
+
+// Build a neighbour advertisement for a solicitation:
+static struct sk_buff *daisy_nd_na(struct net_device *dev,
+		const struct sk_buff *ns, const struct nd_msg *sol,
+		const struct daisy_nd_entry *e)
+{
+	const struct ethhdr *eth = (const struct ethhdr *)ns->data;
+	const struct ipv6hdr *ip6 = (const struct ipv6hdr *)(eth + 1);
+	int len = sizeof(struct nd_msg) + 8;
+	struct sk_buff *skb;
+	struct ethhdr *reth;
+	struct ipv6hdr *rip6;
+	struct nd_msg *msg;
+
+	skb = netdev_alloc_skb_ip_align(dev,
+			ETH_HLEN + sizeof(struct ipv6hdr) + len);
+	if (!skb)
+		return NULL;
+	reth = (struct ethhdr *)skb_put(skb, ETH_HLEN);
+	memcpy(reth->h_dest, eth->h_source, ETH_ALEN);
+	memcpy(reth->h_source, e->mac, ETH_ALEN);
+	reth->h_proto = htons(ETH_P_IPV6);
+
+	rip6 = (struct ipv6hdr *)skb_put(skb, sizeof(struct ipv6hdr));
+	memset(rip6, 0x00, sizeof(struct ipv6hdr));
+	rip6->version     = 6;
+	rip6->payload_len = htons(len);
+	rip6->nexthdr     = IPPROTO_ICMPV6;
+	rip6->hop_limit   = 255;
+	rip6->saddr       = sol->target;
+	rip6->daddr       = ip6->saddr;
+
+	msg = (struct nd_msg *)skb_put(skb, len);
+	memset(msg, 0x00, len);
+	msg->icmph.icmp6_type      = NDISC_NEIGHBOUR_ADVERTISEMENT;
+	msg->icmph.icmp6_solicited = 1;
+	msg->icmph.icmp6_router    = e->router;
+	msg->target = sol->target;
+	msg->opt[0] = ND_OPT_TARGET_LL_ADDR;
+	msg->opt[1] = 1;
+	memcpy(msg->opt + 2, e->mac, ETH_ALEN);
+	msg->icmph.icmp6_cksum = csum_ipv6_magic(&rip6->saddr, &rip6->daddr,
+			len, IPPROTO_ICMPV6, csum_partial(msg, len, 0));
+	return skb;
+}
+
+/*
+ * Answer an ARP request or neighbour solicitation of the local stack
+ * from the cache. Returns true, if it has been answered, skb is freed
+ * then.
+ */
+bool daisy_nd_tx(struct daisy_priv *priv, struct sk_buff *skb)
+{
+	struct daisy_nd *nd = &priv->nd;
+	struct net_device *dev = priv->root->net_device;
+	const struct ethhdr *eth = (const struct ethhdr *)skb->data;
+	const struct daisy_arp *arp;
+	const struct ipv6hdr *ip6;
+	const struct nd_msg *msg;
+	struct daisy_nd_entry e;
+	struct in6_addr addr;
+	struct sk_buff *reply = NULL;
+	int len;
+
+	if (!is_multicast_ether_addr(eth->h_dest))
+		return false;
+	if (eth->h_proto == htons(ETH_P_ARP)) {
+		arp = (const struct daisy_arp *)(eth + 1);
+		if ((skb_headlen(skb) < ETH_HLEN + sizeof(struct daisy_arp)) ||
+				(arp->hdr.ar_op != htons(ARPOP_REQUEST)) ||
+				(arp->hdr.ar_hrd != htons(ARPHRD_ETHER)) ||
+				(arp->hdr.ar_pro != htons(ETH_P_IP)) ||
+				!arp->spa || (arp->spa == arp->tpa))
+			return false;
+		++nd->stats.tx_requests;
+		ipv6_addr_set_v4mapped(arp->tpa, &addr);
+		if (!daisy_nd_lookup(nd, &addr, &e))
+			goto out_miss;
+		reply = arp_create(ARPOP_REPLY, ETH_P_ARP, arp->spa, dev, arp->tpa,
+				arp->sha, e.mac, arp->sha);
+	} else if (eth->h_proto == htons(ETH_P_IPV6)) {
+		ip6 = (const struct ipv6hdr *)(eth + 1);
+		msg = daisy_nd_msg(skb, &len);
+		if (!msg || (msg->icmph.icmp6_type != NDISC_NEIGHBOUR_SOLICITATION) ||
+				ipv6_addr_any(&ip6->saddr))
+			return false;
+		++nd->stats.tx_requests;
+		// The NA carries the router flag, only an NA tells it:
+		if (!daisy_nd_lookup(nd, &msg->target, &e) || !e.advertised)
+			goto out_miss;
+		reply = daisy_nd_na(dev, skb, msg, &e);
+	} else {
+		return false;
+	}
+	if (!reply)
+		goto out_miss;
+
+	++nd->stats.tx_hits;
+	nd->stats.tx_suppressed += skb->len;
+	reply->protocol = eth_type_trans(reply, dev);
+	netif_rx(reply);
+	dev_kfree_skb(skb);
+	return true;
+
+out_miss:
+	++nd->stats.tx_misses;
+	return false;
+}
+
+/*
+ * Learn the addresses of a received ARP or ND packet.
+ */
+void daisy_nd_rx(struct daisy_priv *priv, const struct sk_buff *skb)
+{
+	struct daisy_nd *nd = &priv->nd;
+	const struct ethhdr *eth = (const struct ethhdr *)skb->data;
+	const struct daisy_arp *arp;
+	const struct ipv6hdr *ip6;
+	const struct nd_msg *msg;
+	struct in6_addr addr;
+	const u8 *mac;
+	int len;
+
+	if (eth->h_proto == htons(ETH_P_ARP)) {
+		arp = (const struct daisy_arp *)(eth + 1);
+		if ((skb_headlen(skb) < ETH_HLEN + sizeof(struct daisy_arp)) ||
+				(arp->hdr.ar_hrd != htons(ARPHRD_ETHER)) ||
+				(arp->hdr.ar_pro != htons(ETH_P_IP)) || !arp->spa)
+			return;
+		ipv6_addr_set_v4mapped(arp->spa, &addr);
+		daisy_nd_learn(nd, &addr, arp->sha, false, false);
+	} else if (eth->h_proto == htons(ETH_P_IPV6)) {
+		ip6 = (const struct ipv6hdr *)(eth + 1);
+		msg = daisy_nd_msg(skb, &len);
+		if (!msg)
+			return;
+		if (msg->icmph.icmp6_type == NDISC_NEIGHBOUR_ADVERTISEMENT) {
+			mac = daisy_nd_lladdr(msg, len, ND_OPT_TARGET_LL_ADDR);
+			if (mac)
+				daisy_nd_learn(nd, &msg->target, mac, true,
+						msg->icmph.icmp6_router);
+		} else {
+			mac = daisy_nd_lladdr(msg, len, ND_OPT_SOURCE_LL_ADDR);
+			if (mac)
+				daisy_nd_learn(nd, &ip6->saddr, mac, false, false);
+		}
+	}
+}
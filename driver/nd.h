@@ -0,0 +1,71 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ND_H_
+#define _ND_H_
+
+#include <linux/module.h>
+#include <linux/netdevice.h>
+#include <linux/spinlock.h>
+#include <linux/in6.h>
+
+/*
+ * ARP and neighbour discovery proxy: The addresses of the stations on
+ * the air are learned from the ARP and ND packets received. An ARP
+ * request or neighbour solicitation of the local stack for a station
+ * known is answered locally and not sent, only misses go on the air.
+ * Unicast solicitations (reachability checks) and duplicate address
+ * detection always go on the air. A solicitation is answered only from
+ * an advertisement learned, other packets do not tell if the station is
+ * a router.
+ */
+#define DAISY_ND_ENTRIES          64   /* Direct mapped, power of 2  */
+#define DAISY_ND_TTL        (600*HZ)   /* Of an entry learned        */
+
+struct daisy_priv;
+
+struct daisy_nd_stats {
+	u32 tx_requests;      /* ARP requests and solicitations   */
+	u32 tx_hits;          /* Answered locally                 */
+	u32 tx_misses;        /* Sent on the air                  */
+	u32 tx_suppressed;    /* Octets not sent                  */
+	u32 rx_learned;       /* Entries learned or refreshed     */
+};
+
+/*
+ * An entry, unused if time is 0. IPv4 addresses are IPv4 mapped.
+ */
+struct daisy_nd_entry {
+	struct in6_addr addr;
+	u8              mac[ETH_ALEN];
+	bool            advertised; /* Learned from an NA */
+	bool            router;   /* From the NA flags */
+	unsigned long   time;     /* Learned, in jiffies */
+};
+
+struct daisy_nd {
+	spinlock_t            lock;
+	struct daisy_nd_entry cache[DAISY_ND_ENTRIES];
+	struct daisy_nd_stats stats;
+};
+
+extern void daisy_nd_init(struct daisy_priv *priv);
+extern bool daisy_nd_tx(struct daisy_priv *priv, struct sk_buff *skb);
+extern void daisy_nd_rx(struct daisy_priv *priv, const struct sk_buff *skb);
+
+#endif /* _ND_H_ */
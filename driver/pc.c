@@ -0,0 +1,158 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/module.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+#include <linux/slab.h>
+#include <linux/skbuff.h>
+#include <linux/ktime.h>
+#include <linux/lz4.h>
+
+#include "daisy.h"
+#include "pc.h"
+
+/*
+ * The shared dictionary: Text common in HTTP, DNS, APRS and chat. The
+ * end is matched best, so the most frequent strings are last. Changing
+ * it breaks the compatibility with stations using the old one.
+ */
+static const char daisy_pc_dict[] =
+	"<!DOCTYPE html><html><head><meta charset=\"utf-8\"><title></title>"
+	"<link rel=\"stylesheet\" type=\"text/css\" href=\"/style.css\">"
+	"<script type=\"text/javascript\" src=\"/script.js\"></script>"
+	"</head><body><div class=\"\"><p></p><a href=\"http://\"></a><br />"
+	"<img src=\"\" alt=\"\" /><table><tr><td></td></tr></table>"
+	"</div></body></html>\r\n"
+	"{\"id\":,\"name\":\"\",\"type\":\"\",\"value\":,\"time\":\"\"}"
+	"!=/>APRS,WIDE1-1,WIDE2-1,TCPIP*,qAC,:BLN :ack{ T#MIC"
+	"PRIVMSG #hamnet :NOTICE JOIN PART QUIT PING PONG :"
+	"DL0 DB0 DF DK DJ DH DO DC DG DM OE HB9 PA ON F G "
+	".hamnet.ampr.org.in-addr.arpa.local.de.com.net.org"
+	"HTTP/1.1 304 Not Modified\r\n"
+	"HTTP/1.1 404 Not Found\r\n"
+	"Cache-Control: no-cache\r\nPragma: no-cache\r\n"
+	"Last-Modified: \r\nETag: \"\"\r\nIf-Modified-Since: \r\n"
+	"If-None-Match: \"\"\r\nAccept-Ranges: bytes\r\n"
+	"Transfer-Encoding: chunked\r\nContent-Encoding: gzip\r\n"
+	"Accept-Language: de-DE,de;q=0.9,en;q=0.8\r\n"
+	"Accept-Encoding: gzip, deflate\r\n"
+	"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+	"*/*;q=0.8\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux armv7l) \r\n"
+	"Referer: http://\r\nCookie: \r\nSet-Cookie: ; path=/\r\n"
+	"Connection: keep-alive\r\nConnection: close\r\n"
+	"Server: \r\nDate: Mon, Tue, Wed, Thu, Fri, Sat, Sun, "
+	"Jan Feb Mar Apr May Jun Jul Aug Sep Oct Nov Dec 2017 GMT\r\n"
+	"Content-Type: application/json\r\n"
+	"Content-Type: text/plain; charset=utf-8\r\n"
+	"Content-Type: text/html; charset=utf-8\r\n"
+	"Content-Length: \r\n"
+	"Host: \r\n"
+	"POST / HTTP/1.1\r\n"
+	"GET / HTTP/1.1\r\n"
+	"HTTP/1.1 200 OK\r\n";
+
+int daisy_pc_init(struct daisy_priv *priv, bool enabled)
+{
+	struct daisy_pc *pc = &priv->pc;
+
+	memset(pc, 0x00, sizeof(struct daisy_pc));
+	if (!enabled)
+		return 0;
+	// LZ4_loadDict() expects an initialized stream:
+	pc->stream = kzalloc(sizeof(LZ4_stream_t), GFP_KERNEL);
+	if (!pc->stream)
+		return -ENOMEM;
+	LZ4_resetStream(pc->stream);
+	return 0;
+}
+
+/*
+ * Compress the payload after offset in place. Returns true, if it has
+ * been compressed.
+ */
+bool daisy_pc_tx(struct daisy_priv *priv, struct sk_buff *skb, int offset)
+{
+	struct daisy_pc *pc = &priv->pc;
+	int len = skb->len - offset;
+	int cb;
+	u64 t0;
+
+	if (!pc->stream || (len < DAISY_PC_MIN) || (len > DAISY_FRAME_SIZE))
+		return false;
+	if (skb_ensure_writable(skb, skb->len))
+		return false;
+	t0 = ktime_get_ns();
+	// The dictionary is loaded for every frame, so the frames are
+	// decompressed independent of each other:
+	LZ4_loadDict(pc->stream, daisy_pc_dict, sizeof(daisy_pc_dict) - 1);
+	cb = LZ4_compress_fast_continue(pc->stream, skb->data + offset,
+			pc->tx_buf, len, len - 1, DAISY_PC_ACCEL);
+	if (cb > 0) {
+		memcpy(skb->data + offset, pc->tx_buf, cb);
+		skb_trim(skb, offset + cb);
+	}
+	daisy_cost(&pc->stats.tx_ns, &pc->stats.tx_ns_max,
+			ktime_get_ns() - t0);
+	pc->stats.tx_in += len;
+	if (cb <= 0) {
+		++pc->stats.tx_raw;
+		pc->stats.tx_out += len;
+		return false;
+	}
+	++pc->stats.tx_frames;
+	pc->stats.tx_out += cb;
+	return true;
+}
+
+/*
+ * Decompress the payload after offset. Returns false on error.
+ */
+bool daisy_pc_rx(struct daisy_priv *priv, struct sk_buff *skb, int offset)
+{
+	struct daisy_pc *pc = &priv->pc;
+	int len = skb->len - offset;
+	int cb;
+	u64 t0 = ktime_get_ns();
+
+	cb = LZ4_decompress_safe_usingDict(skb->data + offset, pc->rx_buf,
+			len, sizeof(pc->rx_buf),
+			daisy_pc_dict, sizeof(daisy_pc_dict) - 1);
+	if (cb < 0)
+		goto out_error;
+	if ((cb > len) && (skb_tailroom(skb) < cb - len) &&
+			pskb_expand_head(skb, 0, cb - len, GFP_ATOMIC))
+		goto out_error;
+	skb_trim(skb, offset);
+	memcpy(skb_put(skb, cb), pc->rx_buf, cb);
+	daisy_cost(&pc->stats.rx_ns, &pc->stats.rx_ns_max,
+			ktime_get_ns() - t0);
+	++pc->stats.rx_frames;
+	return true;
+
+out_error:
+	++pc->stats.rx_errors;
+	return false;
+}
+
+void daisy_pc_free(struct daisy_priv *priv)
+{
+	kfree(priv->pc.stream);
+	priv->pc.stream = NULL;
+}
@@ -0,0 +1,67 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PC_H_
+#define _PC_H_
+
+#include <linux/module.h>
+#include <linux/netdevice.h>
+#include <linux/if_ether.h>
+
+#include "frag.h"
+
+/*
+ * Payload compression: The payload of every radio frame is compressed
+ * with LZ4 against a shared dictionary of common protocol text (see
+ * pc.c). Frames, that do not shrink, are sent raw. Compressed frames
+ * carry DAISY_L2_COMPRESSED in the L2 header. At some us per frame the
+ * compression stays far below the airtime of a frame.
+ */
+#define DAISY_PC_MIN              24   /* Shorter payloads are raw   */
+#define DAISY_PC_ACCEL             1   /* LZ4 acceleration           */
+
+struct daisy_priv;
+
+struct daisy_pc_stats {
+	u32 tx_frames;        /* Frames sent compressed            */
+	u32 tx_raw;           /* Frames, that did not shrink       */
+	u32 tx_in;            /* Octets of the payloads            */
+	u32 tx_out;           /* Octets sent for them              */
+	u32 tx_ns;            /* Time per frame, average           */
+	u32 tx_ns_max;
+	u32 rx_frames;
+	u32 rx_ns;
+	u32 rx_ns_max;
+	u32 rx_errors;        /* Frames, that did not decompress   */
+};
+
+struct daisy_pc {
+	void                 *stream;   /* LZ4_stream_t, NULL if disabled */
+	u8                    tx_buf[DAISY_FRAME_SIZE];
+	u8                    rx_buf[ETH_FRAME_LEN];
+	struct daisy_pc_stats stats;
+};
+
+extern int daisy_pc_init(struct daisy_priv *priv, bool enabled);
+extern bool daisy_pc_tx(struct daisy_priv *priv, struct sk_buff *skb,
+		int offset);
+extern bool daisy_pc_rx(struct daisy_priv *priv, struct sk_buff *skb,
+		int offset);
+extern void daisy_pc_free(struct daisy_priv *priv);
+
+#endif /* _PC_H_ */
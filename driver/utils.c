@@ -22,8 +22,10 @@
 #include <linux/sockios.h>
 #include <linux/ioctl.h>
 #include <linux/wireless.h>
+#include <linux/ethtool.h>
 
 #include "daisy.h"
+#include "spi-daisy.h"
 
 /*
  * Configuration changes (passed on by ifconfig)
@@ -115,8 +117,7 @@ int daisy_change_mtu(struct net_device *dev, int new_mtu)
 	spinlock_t *lock = &priv->lock;
 
 	/* check ranges */
-	//if ((new_mtu < 68) || (new_mtu > 1500))
-	if ((new_mtu < 68) || (new_mtu > 240))
+	if ((new_mtu < 68) || (new_mtu > ETH_DATA_LEN))
 		return -EINVAL;
 	/*
 	 * Do anything you need, and the accept the value
@@ -127,6 +128,288 @@ int daisy_change_mtu(struct net_device *dev, int new_mtu)
 	return 0; /* success */
 }
 
+/*
+ * Counters for "ethtool -S", in the order of struct daisy_frag_stats,
+ * struct daisy_l2_stats, struct daisy_hc_stats, struct daisy_pc_stats,
+ * struct daisy_ack_stats, struct daisy_nd_stats, struct daisy_mc_stats,
+ * struct daisy_band_stats, struct daisy_xdp_stats,
+ * struct daisy_fwd_stats, struct daisy_csma_stats,
+ * struct daisy_mac_stats, struct daisy_tx_stats,
+ * struct daisy_fifo_stats and struct daisy_header_stats.
+ */
+static const char daisy_frag_strings[][ETH_GSTRING_LEN] = {
+	"tx_frag_frames",
+	"tx_fragments",
+	"rx_fragments",
+	"rx_frag_frames",
+	"rx_frag_timeouts",
+	"rx_frag_evicted",
+	"rx_frag_errors",
+};
+
+static const char daisy_l2_strings[][ETH_GSTRING_LEN] = {
+	"tx_l2_short",
+	"tx_l2_long",
+	"tx_l2_saved",
+	"rx_l2_short",
+	"rx_l2_long",
+	"rx_l2_unknown",
+	"rx_l2_foreign",
+	"rx_l2_errors",
+	"rx_l2_need_src",
+};
+
+static const char daisy_hc_strings[][ETH_GSTRING_LEN] = {
+	"tx_hc_full",
+	"tx_hc_comp",
+	"tx_hc_saved",
+	"rx_hc_full",
+	"rx_hc_comp",
+	"rx_hc_nocontext",
+	"rx_hc_errors",
+};
+
+static const char daisy_pc_strings[][ETH_GSTRING_LEN] = {
+	"tx_pc_frames",
+	"tx_pc_raw",
+	"tx_pc_in",
+	"tx_pc_out",
+	"tx_pc_ns",
+	"tx_pc_ns_max",
+	"rx_pc_frames",
+	"rx_pc_ns",
+	"rx_pc_ns_max",
+	"rx_pc_errors",
+};
+
+static const char daisy_ack_strings[][ETH_GSTRING_LEN] = {
+	"tx_ack_queued",
+	"tx_ack_superseded",
+	"tx_ack_octets",
+	"tx_ack_airtime_us",
+};
+
+static const char daisy_nd_strings[][ETH_GSTRING_LEN] = {
+	"tx_nd_requests",
+	"tx_nd_hits",
+	"tx_nd_misses",
+	"tx_nd_suppressed",
+	"rx_nd_learned",
+};
+
+static const char daisy_mc_strings[][ETH_GSTRING_LEN] = {
+	"tx_mc_frames",
+	"tx_mc_dropped",
+	"tx_mc_limited",
+	"tx_mc_lowered",
+};
+
+static const char daisy_band_strings[][ETH_GSTRING_LEN] = {
+	"tx_band_control",
+	"tx_band_interactive",
+	"tx_band_bulk",
+	"tx_band_background",
+};
+
+static const char daisy_xdp_strings[][ETH_GSTRING_LEN] = {
+	"rx_xdp_pass",
+	"rx_xdp_drop",
+	"rx_xdp_tx",
+	"rx_xdp_redirect",
+	"rx_xdp_aborted",
+};
+
+static const char daisy_fwd_strings[][ETH_GSTRING_LEN] = {
+	"tx_fwd_relayed",
+	"rx_fwd_relayed",
+	"fwd_frames",
+	"fwd_hops",
+	"fwd_noroute",
+	"fwd_errors",
+	"fwd_dups",
+	"fwd_overheard",
+	"fwd_ns",
+	"fwd_ns_max",
+};
 
+static const char daisy_csma_strings[][ETH_GSTRING_LEN] = {
+	"tx_csma_deferrals",
+	"tx_csma_backoffs",
+	"tx_csma_collisions",
+	"tx_csma_acks",
+	"csma_noise_floor",
+	"csma_threshold",
+	"csma_cw",
+};
+
+static const char daisy_mac_strings[][ETH_GSTRING_LEN] = {
+	"mac_polls",
+	"mac_grants",
+	"mac_reports",
+	"mac_missed",
+	"mac_rtt_us",
+};
 
+static const char daisy_tx_strings[][ETH_GSTRING_LEN] = {
+	"tx_radio_frames",
+	"tx_bursts",
+	"tx_chained",
+	"tx_gap_us",
+	"tx_gap_min_us",
+	"tx_burst_bps",
+	"tx_burst_bps_max",
+	"rx_switch_us",
+	"rx_switch_max_us",
+	"tx_load_us",
+	"tx_load_max_us",
+};
+
+static const char daisy_fifo_strings[][ETH_GSTRING_LEN] = {
+	"fifo_services",
+	"fifo_faults",
+	"fifo_latency_ns",
+	"fifo_tx_almost_empty",
+	"fifo_rx_almost_full",
+	"fifo_margin",
+};
 
+static const char daisy_header_strings[][ETH_GSTRING_LEN] = {
+	"tx_header_unicast",
+	"tx_header_broadcast",
+};
+
+static int daisy_get_sset_count(struct net_device *dev, int sset)
+{
+	if (sset != ETH_SS_STATS)
+		return -EOPNOTSUPP;
+	return ARRAY_SIZE(daisy_frag_strings) + ARRAY_SIZE(daisy_l2_strings)
+			+ ARRAY_SIZE(daisy_hc_strings) + ARRAY_SIZE(daisy_pc_strings)
+			+ ARRAY_SIZE(daisy_ack_strings) + ARRAY_SIZE(daisy_nd_strings)
+			+ ARRAY_SIZE(daisy_mc_strings) + ARRAY_SIZE(daisy_band_strings)
+			+ ARRAY_SIZE(daisy_xdp_strings) + ARRAY_SIZE(daisy_fwd_strings)
+			+ ARRAY_SIZE(daisy_csma_strings) + ARRAY_SIZE(daisy_mac_strings)
+			+ ARRAY_SIZE(daisy_tx_strings) + ARRAY_SIZE(daisy_fifo_strings)
+			+ ARRAY_SIZE(daisy_header_strings);
+}
+
+static void daisy_get_strings(struct net_device *dev, u32 sset, u8 *data)
+{
+	if (sset != ETH_SS_STATS)
+		return;
+	memcpy(data, daisy_frag_strings, sizeof(daisy_frag_strings));
+	data += sizeof(daisy_frag_strings);
+	memcpy(data, daisy_l2_strings, sizeof(daisy_l2_strings));
+	data += sizeof(daisy_l2_strings);
+	memcpy(data, daisy_hc_strings, sizeof(daisy_hc_strings));
+	data += sizeof(daisy_hc_strings);
+	memcpy(data, daisy_pc_strings, sizeof(daisy_pc_strings));
+	data += sizeof(daisy_pc_strings);
+	memcpy(data, daisy_ack_strings, sizeof(daisy_ack_strings));
+	data += sizeof(daisy_ack_strings);
+	memcpy(data, daisy_nd_strings, sizeof(daisy_nd_strings));
+	data += sizeof(daisy_nd_strings);
+	memcpy(data, daisy_mc_strings, sizeof(daisy_mc_strings));
+	data += sizeof(daisy_mc_strings);
+	memcpy(data, daisy_band_strings, sizeof(daisy_band_strings));
+	data += sizeof(daisy_band_strings);
+	memcpy(data, daisy_xdp_strings, sizeof(daisy_xdp_strings));
+	data += sizeof(daisy_xdp_strings);
+	memcpy(data, daisy_fwd_strings, sizeof(daisy_fwd_strings));
+	data += sizeof(daisy_fwd_strings);
+	memcpy(data, daisy_csma_strings, sizeof(daisy_csma_strings));
+	data += sizeof(daisy_csma_strings);
+	memcpy(data, daisy_mac_strings, sizeof(daisy_mac_strings));
+	data += sizeof(daisy_mac_strings);
+	memcpy(data, daisy_tx_strings, sizeof(daisy_tx_strings));
+	data += sizeof(daisy_tx_strings);
+	memcpy(data, daisy_fifo_strings, sizeof(daisy_fifo_strings));
+	data += sizeof(daisy_fifo_strings);
+	memcpy(data, daisy_header_strings, sizeof(daisy_header_strings));
+}
+
+static void daisy_get_ethtool_stats(struct net_device *dev,
+		struct ethtool_stats *stats, u64 *data)
+{
+	struct daisy_priv *priv = netdev_priv(dev);
+	struct daisy_ack_stats ack;
+	struct daisy_csma_stats csma;
+	struct daisy_mac_stats mac;
+	struct daisy_tx_stats tx;
+	struct daisy_fifo_stats fifo;
+	struct daisy_header_stats header;
+	const u32 *s;
+	int i;
+
+	s = (const u32 *)&priv->frag.stats;
+	for (i = 0; i < ARRAY_SIZE(daisy_frag_strings); ++i)
+		*data++ = s[i];
+	s = (const u32 *)&priv->l2.stats;
+	for (i = 0; i < ARRAY_SIZE(daisy_l2_strings); ++i)
+		*data++ = s[i];
+	s = (const u32 *)&priv->hc.stats;
+	for (i = 0; i < ARRAY_SIZE(daisy_hc_strings); ++i)
+		*data++ = s[i];
+	s = (const u32 *)&priv->pc.stats;
+	for (i = 0; i < ARRAY_SIZE(daisy_pc_strings); ++i)
+		*data++ = s[i];
+	memset(&ack, 0x00, sizeof(ack));
+	daisy_get_ack_stats(priv->daisy_device, &ack);
+	s = (const u32 *)&ack;
+	for (i = 0; i < ARRAY_SIZE(daisy_ack_strings); ++i)
+		*data++ = s[i];
+	s = (const u32 *)&priv->nd.stats;
+	for (i = 0; i < ARRAY_SIZE(daisy_nd_strings); ++i)
+		*data++ = s[i];
+	s = (const u32 *)&priv->mc.stats;
+	for (i = 0; i < ARRAY_SIZE(daisy_mc_strings); ++i)
+		*data++ = s[i];
+	s = (const u32 *)&priv->band.stats;
+	for (i = 0; i < ARRAY_SIZE(daisy_band_strings); ++i)
+		*data++ = s[i];
+	s = (const u32 *)&priv->xdp.stats;
+	for (i = 0; i < ARRAY_SIZE(daisy_xdp_strings); ++i)
+		*data++ = s[i];
+	s = (const u32 *)&priv->fwd.stats;
+	for (i = 0; i < ARRAY_SIZE(daisy_fwd_strings); ++i)
+		*data++ = s[i];
+	// Not all u32:
+	memset(&csma, 0x00, sizeof(csma));
+	daisy_get_csma_stats(priv->daisy_device, &csma);
+	*data++ = csma.deferrals;
+	*data++ = csma.backoffs;
+	*data++ = csma.collisions;
+	*data++ = csma.acks;
+	*data++ = csma.noise_floor;
+	*data++ = csma.threshold;
+	*data++ = csma.cw;
+	memset(&mac, 0x00, sizeof(mac));
+	daisy_get_mac_stats(priv->daisy_device, &mac);
+	s = (const u32 *)&mac;
+	for (i = 0; i < ARRAY_SIZE(daisy_mac_strings); ++i)
+		*data++ = s[i];
+	memset(&tx, 0x00, sizeof(tx));
+	daisy_get_tx_stats(priv->daisy_device, &tx);
+	s = (const u32 *)&tx;
+	for (i = 0; i < ARRAY_SIZE(daisy_tx_strings); ++i)
+		*data++ = s[i];
+	// Not all u32:
+	memset(&fifo, 0x00, sizeof(fifo));
+	daisy_get_fifo_stats(priv->daisy_device, &fifo);
+	*data++ = fifo.services;
+	*data++ = fifo.faults;
+	*data++ = fifo.latency_ns;
+	*data++ = fifo.tx_almost_empty;
+	*data++ = fifo.rx_almost_full;
+	*data++ = fifo.margin;
+	memset(&header, 0x00, sizeof(header));
+	daisy_get_header_stats(priv->daisy_device, &header);
+	s = (const u32 *)&header;
+	for (i = 0; i < ARRAY_SIZE(daisy_header_strings); ++i)
+		*data++ = s[i];
+}
+
+const struct ethtool_ops daisy_ethtool_ops = {
+	.get_sset_count    = daisy_get_sset_count,
+	.get_strings       = daisy_get_strings,
+	.get_ethtool_stats = daisy_get_ethtool_stats,
+};
@@ -0,0 +1,183 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/module.h>
+#include <linux/string.h>
+#include <linux/skbuff.h>
+#include <linux/etherdevice.h>
+#include <linux/rtnetlink.h>
+#include <linux/bpf.h>
+#include <linux/bpf_trace.h>
+#include <linux/filter.h>
+#include <net/xdp.h>
+
+#include "daisy.h"
+#include "xdp.h"
+
+/*
+ * Called on daisy_up(), the program stays attached while the device
+ * is down.
+ */
+void daisy_xdp_init(struct daisy_priv *priv)
+{
+	struct daisy_xdp *x = &priv->xdp;
+	int erc;
+
+	memset(&x->stats, 0x00, sizeof(struct daisy_xdp_stats));
+	erc = xdp_rxq_info_reg(&x->rxq, priv->root->net_device, 0);
+	if (erc)
+		printk(KERN_ERR "daisy: Unable to register XDP RX queue, erc %d\n",
+				erc);
+}
+
+void daisy_xdp_down(struct daisy_priv *priv)
+{
+	xdp_rxq_info_unreg(&priv->xdp.rxq);
+}
+
+/*
+ * Release the program, when the device is freed.
+ */
+void daisy_xdp_free(struct daisy_priv *priv)
+{
+	struct bpf_prog *prog = rcu_dereference_protected(priv->xdp.prog, 1);
+
+	RCU_INIT_POINTER(priv->xdp.prog, NULL);
+	if (prog)
+		bpf_prog_put(prog);
+}
+
+static int daisy_xdp_setup(struct net_device *dev, struct bpf_prog *prog)
+{
+	struct daisy_priv *priv = netdev_priv(dev);
+	struct bpf_prog *old = rtnl_dereference(priv->xdp.prog);
+
+	rcu_assign_pointer(priv->xdp.prog, prog);
+	if (old)
+		bpf_prog_put(old);
+	printk(KERN_INFO "daisy: XDP program %s on \"%s\"\n",
+			prog ? "attached" : "detached", dev->name);
+	return 0;
+}
+
+/*
+ * Attach, detach or query the program (ndo_bpf).
+ */
+int daisy_xdp_bpf(struct net_device *dev, struct netdev_bpf *bpf)
+{
+	struct daisy_priv *priv = netdev_priv(dev);
+	struct bpf_prog *prog;
+
+	switch (bpf->command) {
+	case XDP_SETUP_PROG :
+		return daisy_xdp_setup(dev, bpf->prog);
+	case XDP_QUERY_PROG :
+		prog = rtnl_dereference(priv->xdp.prog);
+		bpf->prog_id = prog ? prog->aux->id : 0;
+		return 0;
+	default :
+		return -EINVAL;
+	} // end switch //
+}
+
+/*
+ * Run the program on a received Ethernet frame. Returns true, if the
+ * frame is consumed, skb is sent or freed then. daisy_rx() runs in a
+ * workqueue, so BH is disabled like in the core: The redirect keeps
+ * per CPU state from the program run to xdp_do_generic_redirect().
+ */
+bool daisy_xdp_rx(struct daisy_priv *priv, struct sk_buff *skb)
+{
+	struct daisy_xdp *x = &priv->xdp;
+	struct net_device *dev = priv->root->net_device;
+	struct bpf_prog *prog;
+	struct xdp_buff xdp;
+	void *data_end;
+	bool res = true;
+	u32 act;
+	int off;
+
+	local_bh_disable();
+	rcu_read_lock();
+	prog = rcu_dereference(x->prog);
+	if (!prog) {
+		res = false;
+		goto out;
+	}
+	if (skb_linearize(skb)) {
+		++x->stats.rx_drop;
+		kfree_skb(skb);
+		goto out;
+	}
+	xdp.data_hard_start = skb->head;
+	xdp.data = skb->data;
+	xdp.data_end = skb->data + skb->len;
+	xdp_set_data_meta_invalid(&xdp);
+	xdp.rxq = &x->rxq;
+	data_end = xdp.data_end;
+
+	act = bpf_prog_run_xdp(prog, &xdp);
+
+	// bpf_xdp_adjust_head() moves the start, bpf_xdp_adjust_tail() the
+	// end:
+	off = xdp.data - (void *)skb->data;
+	if (off > 0)
+		__skb_pull(skb, off);
+	else if (off < 0)
+		__skb_push(skb, -off);
+	if (xdp.data_end != data_end)
+		__skb_trim(skb, xdp.data_end - xdp.data);
+	skb_reset_mac_header(skb);
+	skb->dev = dev;
+
+	switch (act) {
+	case XDP_PASS :
+		++x->stats.rx_pass;
+		res = false;
+		break;
+	case XDP_TX :
+		++x->stats.rx_tx;
+		skb->protocol = eth_hdr(skb)->h_proto;
+		dev_queue_xmit(skb);
+		break;
+	case XDP_REDIRECT :
+		if (xdp_do_generic_redirect(dev, skb, &xdp, prog)) {
+			++x->stats.rx_drop;
+			kfree_skb(skb);
+		} else {
+			++x->stats.rx_redirect;
+		}
+		break;
+	default :
+		bpf_warn_invalid_xdp_action(act);
+		/* fall through */
+	case XDP_ABORTED :
+		trace_xdp_exception(dev, prog, act);
+		++x->stats.rx_aborted;
+		kfree_skb(skb);
+		break;
+	case XDP_DROP :
+		++x->stats.rx_drop;
+		kfree_skb(skb);
+		break;
+	} // end switch //
+out:
+	rcu_read_unlock();
+	local_bh_enable();
+	return res;
+}
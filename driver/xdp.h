@@ -0,0 +1,66 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _XDP_H_
+#define _XDP_H_
+
+#include <linux/module.h>
+#include <linux/version.h>
+#include <linux/netdevice.h>
+#include <net/xdp.h>
+
+/*
+ * XDP: A BPF program attached to the net device sees every received
+ * frame as Ethernet frame before it enters the stack. The hook runs
+ * after the whole radio receive path in daisy_rx(): The L2 header is
+ * replaced and the LZ4 payload is expanded (l2.h, pc.h), fragments are
+ * reassembled (frag.h) and IP headers are decompressed (hc.h). So it is
+ * no early drop, the frame has crossed the SPI bus and has been
+ * processed already. spi-daisy delivers the frames in a socket buffer,
+ * so the program runs on its data. XDP_TX sends the frame back on the
+ * radio, XDP_REDIRECT to another device or a map.
+ *
+ * struct xdp_rxq_info and struct netdev_bpf need Linux 4.18 or newer,
+ * the oldest kernel supported by the driver.
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 18, 0)
+#error "The daisy driver needs Linux 4.18 or newer"
+#endif
+struct daisy_priv;
+
+struct daisy_xdp_stats {
+	u32 rx_pass;
+	u32 rx_drop;
+	u32 rx_tx;
+	u32 rx_redirect;
+	u32 rx_aborted;
+};
+
+struct daisy_xdp {
+	struct bpf_prog __rcu *prog;
+	struct xdp_rxq_info    rxq;
+	struct daisy_xdp_stats stats;
+};
+
+extern void daisy_xdp_init(struct daisy_priv *priv);
+extern void daisy_xdp_down(struct daisy_priv *priv);
+extern void daisy_xdp_free(struct daisy_priv *priv);
+extern int  daisy_xdp_bpf(struct net_device *dev, struct netdev_bpf *bpf);
+extern bool daisy_xdp_rx(struct daisy_priv *priv, struct sk_buff *skb);
+
+#endif /* _XDP_H_ */
@@ -21,36 +21,186 @@
 
 #include <linux/module.h>
 #include <linux/etherdevice.h>
+#include <linux/random.h>
+#include <linux/math64.h>
 
 #include "spi.h"
 #include "spi-daisy.h"
 #include "tx_queue.h"
+#include "rx_queue.h"
 #include "ev_queue.h"
+#include "fifo.h"
+#include "header.h"
 
 static inline void on_idle_poll(struct daisy_dev *dd);
 
+static inline void csma_init(struct daisy_dev *dd) {
+	memset(&dd->csma, 0x00, sizeof(struct daisy_csma));
+	dd->csma.busy_until = jiffies;
+	dd->csma.stats.cw = DEFAULT_CSMA_CW_MIN;
+	dd->csma.stats.threshold = DEFAULT_CCA_MIN;
+	daisy_set_register8(dd, RFM22B_REG_RSSI_TH, DEFAULT_CCA_MIN);
+}
+
+// Carrier seen by interrupt (RSSI above threshold or valid preamble):
+static inline void csma_carrier(struct daisy_dev *dd) {
+	dd->csma.busy_until = jiffies + DEFAULT_CSMA_SLOT;
+}
+
+// Poll again after one slot:
+static inline void csma_schedule(struct daisy_dev *dd) {
+	dd->timeout = jiffies + DEFAULT_CSMA_SLOT;
+	mod_timer(&dd->watchdog, dd->timeout + 1);
+}
+
+// Draw a random backoff of at least base slots within the contention
+// window:
+static inline void csma_backoff(struct daisy_dev *dd, u16 base) {
+	struct daisy_csma *c = &dd->csma;
+
+	c->backoff = base + prandom_u32() % (c->stats.cw + 1);
+	c->slot_end = jiffies + DEFAULT_CSMA_SLOT;
+	++c->stats.backoffs;
+	ev_queue_put_op(&dd->evq, EVQ_BACKOFF, c->backoff);
+}
+
+/*
+ * Clear channel assessment: The channel is busy while the RSSI is above
+ * the threshold or a carrier interrupt was seen within the last slot.
+ * Idle samples track the noise floor, busy ones only after a long busy
+ * run (a permanent interferer). The threshold follows the floor.
+ */
 static inline bool squelch_open(struct daisy_dev *dd) {
-#if 0
+	struct daisy_csma *c = &dd->csma;
 	u16 _rssi = daisy_get_register16(dd, RFM22B_REG_RSSI);
-	u8  rssi  = (_rssi > 8) & 0x00ff;
+	u8  rssi  = (_rssi >> 8) & 0x00ff;
 	u8  th    = _rssi & 0x00ff;
-	return (rssi > th);
-#endif
-	return 0;
+	bool busy = (rssi > th) || time_before(jiffies, c->busy_until);
+	int  x;
+
+	if (busy && (c->busy_run < DEFAULT_CCA_STUCK)) {
+		++c->busy_run;
+	} else {
+		if (!busy)
+			c->busy_run = 0;
+		if (c->noise_floor)
+			c->noise_floor += ((rssi << 4) - (int)c->noise_floor) / 8;
+		else
+			c->noise_floor = rssi << 4;
+	}
+	c->stats.noise_floor = c->noise_floor >> 4;
+
+	x = c->stats.noise_floor + DEFAULT_CCA_MARGIN;
+	if (x < DEFAULT_CCA_MIN)
+		x = DEFAULT_CCA_MIN;
+	if (x > 0xff)
+		x = 0xff;
+	if (x != c->stats.threshold) {
+		c->stats.threshold = x;
+		daisy_set_register8(dd, RFM22B_REG_RSSI_TH, x);
+	}
+	return busy;
+}
+
+// Keep an average and maximum of a switch time:
+static inline void switch_time(u32 *avg, u32 *max, u32 us) {
+	*avg = *avg ? (7 * *avg + us) / 8 : us;
+	if (us > *max)
+		*max = us;
+}
+
+/*
+ * Receiver: The RX FIFO is read in chunks of the almost full threshold
+ * into the skb of an rx_entry, PKVALID reads the rest by the length of
+ * the packet handler. Multi packet mode keeps the next frame in the
+ * FIFO, so exactly the octets of the frame are read. MAC frames are
+ * consumed by mac_rx(), the others wait in the rx_queue for
+ * daisy_read(). Without a free rx_entry the frame is read and dropped.
+ */
+
+// Drop the frame being received:
+static inline void rx_abort(struct daisy_dev *dd) {
+	if (dd->rx_entry) {
+		skb_trim(dd->rx_entry->skb, 0);
+		rx_entry_del(dd->rx_entry);
+		dd->rx_entry = NULL;
+	}
+	dd->rx_idx = 0;
+}
+
+// Read cb octets of the frame from the RX FIFO:
+static inline void rx_read(struct daisy_dev *dd, int cb) {
+	struct sk_buff *skb;
+	int n;
+
+	if (!dd->rx_idx)
+		dd->rx_entry = rx_entry_new(dd->rx_queue);
+	while (cb > 0) {
+		n = min(cb, IO_MAX - 1);
+		memset(tx_buffer, 0x00, n + 1);
+		tx_buffer[0] = RFM22B_REG_FIFO;
+		daisy_transfer(dd, tx_buffer, rx_buffer, n + 1);
+		if (dd->rx_entry) {
+			skb = dd->rx_entry->skb;
+			if (skb_tailroom(skb) >= n)
+				memcpy(skb_put(skb, n), &rx_buffer[1], n);
+		}
+		dd->rx_idx += n;
+		cb -= n;
+	} // end while //
+}
+
+static inline void rx_fifo(struct daisy_dev *dd) {
+	rx_read(dd, dd->fifo.stats.rx_almost_full);
+	fifo_sample(dd);
+}
+
+static inline void rx_valid(struct daisy_dev *dd) {
+	struct rx_entry *e;
+	int len = daisy_get_register8(dd, RFM22B_RXPKLEN);
+
+	rx_read(dd, len - dd->rx_idx);
+	e = dd->rx_entry;
+	dd->rx_entry = NULL;
+	dd->rx_idx = 0;
+	if (!e || (e->skb->len != len)) {
+		ev_queue_put_op(&dd->evq, EVQ_RXDROP, len);
+		if (e) {
+			skb_trim(e->skb, 0);
+			rx_entry_del(e);
+		}
+		return;
+	}
+	if (mac_rx(dd, e->skb->data, e->skb->len)) {
+		skb_trim(e->skb, 0);
+		rx_entry_del(e);
+		return;
+	}
+	rx_entry_put(e);
 }
 
 static inline void rx_start(struct daisy_dev *dd) {
+	struct daisy_burst *b = &dd->burst;
+
 	ev_queue_put(&dd->evq, EVQ_RXSTART);
-	// Clear the RX FIFO:
-	daisy_clear_rx_fifo(dd);
-	// Drop the PTT and listen:
-	daisy_set_register8(dd, RFM22B_REG_OP_MODE_1, RFM22B_RXON);
+	rx_abort(dd);
+	// Clear the RX FIFO, drop the PTT and listen. The PLL stays on for
+	// the next turnaround:
+	daisy_switch_mode(dd, RFM22B_XTON | RFM22B_PLLON | RFM22B_RXON,
+			RFM22B_OP_MODE_2, RFM22B_FFCLRRX);
+	// Between bursts, the thresholds may change:
+	fifo_tune(dd);
+	if ((dd->state == STATUS_SEND) && ktime_after(b->last_end, b->start))
+		switch_time(&b->stats.rx_switch_us, &b->stats.rx_switch_max_us,
+				ktime_us_delta(ktime_get(), b->last_end));
 	dd->state = STATUS_IDLE;
 	ev_queue_put(&dd->evq, EVQ_STATUS_IDLE);
 	dd->timeout = jiffies + DEFAULT_TIMER_TICK;
 }
 
 static inline void tx_start(struct daisy_dev *dd) {
+	struct daisy_burst *b = &dd->burst;
+	ktime_t now = ktime_get();
 	int cb_to_write;
 	u8 *pb_tx;
 
@@ -60,6 +210,25 @@ static inline void tx_start(struct daisy_dev *dd) {
 		return;
 	}
 
+	// Gap since the previous transmission:
+	if (ktime_to_ns(b->last_end)) {
+		u32 gap = ktime_us_delta(now, b->last_end);
+		b->stats.gap_us = b->stats.gap_us
+				? (7 * b->stats.gap_us + gap) / 8 : gap;
+		if (!b->stats.gap_min_us || (gap < b->stats.gap_min_us))
+			b->stats.gap_min_us = gap;
+	}
+	b->start  = now;
+	b->frames = 1;
+	b->sent   = 0;
+	++b->stats.bursts;
+
+	// Leave RX into TUNE and clear the TX FIFO, AUTOTX starts sending
+	// when it is filled:
+	daisy_switch_mode(dd, RFM22B_XTON | RFM22B_PLLON,
+			RFM22B_OP_MODE_2, RFM22B_FFCLRTX);
+	header_tx(dd, dd->tx_entry);
+
 	// Calculate how many octets to write now:
 	cb_to_write = dd->tx_entry->pkg_len;
 	if (cb_to_write > IO_MAX)
@@ -69,14 +238,46 @@ static inline void tx_start(struct daisy_dev *dd) {
 	pb_tx = dd->tx_entry->pkg;
 	(*pb_tx) = RFM22B_REG_FIFO | RFM22B_WRITE_FLAG;
 	daisy_transfer(dd, pb_tx, rx_buffer, cb_to_write);
-	dd->pkg_idx = cb_to_write + 1;
+	dd->pkg_idx = cb_to_write; // Next octet to write
+	b->octets = cb_to_write - 1;
+	switch_time(&b->stats.tx_load_us, &b->stats.tx_load_max_us,
+			ktime_us_delta(ktime_get(), now));
 	dd->state = STATUS_SEND;
 	ev_queue_put_op(&dd->evq, EVQ_STATUS_SEND, cb_to_write );
 
 	dd->timeout = jiffies + DEFAULT_TX_TIMEOUT;
 }
 
+// The frame has left (or will leave with the FIFO) the chip:
+// A tx_entry is free again, the driver may resume:
+static inline void tx_wakeup(struct daisy_dev *dd) {
+	if (dd->tx_done)
+		dd->tx_done(dd->tx_done_ctx);
+}
+
+static inline void tx_done(struct daisy_dev *dd) {
+	mac_sent(dd, &dd->tx_entry->pkg[1], dd->tx_entry->pkg_len - 1);
+	tx_entry_del(dd->tx_entry);
+	dd->tx_entry = NULL;
+	++dd->burst.stats.frames;
+	tx_wakeup(dd);
+}
+
+// Next frame to send in the same transmission, NULL ends the burst:
+static inline struct tx_entry *tx_chain(struct daisy_dev *dd) {
+	if (dd->burst.frames >= DEFAULT_TX_BURST)
+		return NULL;
+	if (dd->mac.mode == MAC_CSMA) {
+		if (!tx_entry_can_get(dd->tx_queue))
+			return NULL;
+	} else if (mac_idle_poll(dd) != MAC_ACTION_SEND) {
+		return NULL;
+	}
+	return tx_entry_get(dd->tx_queue);
+}
+
 static inline void tx_fifo(struct daisy_dev *dd) {
+	struct tx_entry *next;
 	int cb_to_write;
 	u8 *pb_tx;
 
@@ -86,37 +287,116 @@ static inline void tx_fifo(struct daisy_dev *dd) {
 		return;
 	}
 
-	// Calculate how many octets to write now:
-	cb_to_write = dd->tx_entry->pkg_len - dd->pkg_idx;
+	// Preload the next frame while the tail of this one drains:
+	if (dd->pkg_idx >= dd->tx_entry->pkg_len) {
+		next = tx_chain(dd);
+		if (!next)
+			return; // PKSENT ends the transmission
+		tx_done(dd);
+		dd->tx_entry = next;
+		dd->pkg_idx = 1;
+		++dd->burst.frames;
+		++dd->burst.stats.chained;
+		// The packet handler takes the header and TXPKLEN at the start
+		// of a packet. Almost empty means, that payload of this one has
+		// left, so its header is sent and the registers are free for the
+		// next one:
+		header_tx(dd, next);
+		ev_queue_put_op(&dd->evq, EVQ_CHAINED, next->pkg_len - 1);
+	}
+
+	// Calculate how many octets to write now, at most the room above the
+	// almost empty threshold:
+	cb_to_write = dd->tx_entry->pkg_len - dd->pkg_idx + 1;
 	if (cb_to_write > IO_MAX)
 		cb_to_write = IO_MAX;
+	if (cb_to_write > fifo_tx_room(dd) + 1)
+		cb_to_write = fifo_tx_room(dd) + 1;
 
-	// Fill the TX FIFO:
+	// Fill the TX FIFO, the octet before is already sent:
 	pb_tx = &dd->tx_entry->pkg[dd->pkg_idx - 1];
 	(*pb_tx) = RFM22B_REG_FIFO | RFM22B_WRITE_FLAG;
 	daisy_transfer(dd, pb_tx, rx_buffer, cb_to_write);
-	dd->pkg_idx = cb_to_write + 1;
+	dd->pkg_idx += cb_to_write - 1;
+	dd->burst.octets += cb_to_write - 1;
+	fifo_sample(dd);
 
 	dd->timeout = jiffies + DEFAULT_TX_TIMEOUT;
 }
 
 static inline void tx_sent(struct daisy_dev *dd) {
+	struct daisy_burst *b = &dd->burst;
+	u32 us;
+
 	// Support spurious interrupts:
 	if (!dd->tx_entry) {
 		ev_queue_put(&dd->evq, EVQ_ENTRY_NULL);
 		return;
 	}
 
-	tx_entry_del(dd->tx_entry);
-	dd->tx_entry = NULL;
+	// Every packet of the burst raises PKSENT, the last one ends it:
+	if (++b->sent < b->frames)
+		return;
+	tx_done(dd);
+	b->last_end = ktime_get();
+	us = ktime_us_delta(b->last_end, b->start);
+	if (us) {
+		b->stats.burst_bps = div_u64((u64)b->octets * 8 * 1000000, us);
+		if (b->stats.burst_bps > b->stats.burst_bps_max)
+			b->stats.burst_bps_max = b->stats.burst_bps;
+	}
+	// Give the other stations a chance before the next frame:
+	if (dd->mac.mode == MAC_CSMA)
+		csma_backoff(dd, 0);
 	on_idle_poll(dd);
 }
 
+/*
+ * Listen before talk: A frame is sent when the channel is idle and the
+ * backoff has expired. The backoff counts down idle slots only, a busy
+ * channel starts one if none is running and restarts the slot. Polls
+ * within a slot do not count.
+ */
 static inline void on_idle_poll(struct daisy_dev *dd) {
+	struct daisy_csma *c = &dd->csma;
+	bool busy;
+
+	// Listen again after sending, the CCA needs the receiver:
+	if (dd->state != STATUS_IDLE)
+		rx_start(dd);
+	busy = squelch_open(dd);
+	switch (mac_idle_poll(dd)) {
+	case MAC_ACTION_HOLD:
+		return;
+	case MAC_ACTION_SEND:
+		goto send;
+	default:
+		break;
+	} // end switch //
 	if (!tx_entry_can_get(dd->tx_queue))
 		return;
-	if (squelch_open(dd))
+	if (busy) {
+		ev_queue_put(&dd->evq, EVQ_CCA_BUSY);
+		++c->stats.deferrals;
+		if (!c->backoff)
+			csma_backoff(dd, 1);
+		c->slot_end = jiffies + DEFAULT_CSMA_SLOT;
+		csma_schedule(dd);
 		return;
+	}
+	if (c->backoff) {
+		if (time_before(jiffies, c->slot_end)) {
+			csma_schedule(dd);
+			return;
+		}
+		// One idle slot is over:
+		c->slot_end = jiffies + DEFAULT_CSMA_SLOT;
+		if (--c->backoff) {
+			csma_schedule(dd);
+			return;
+		}
+	}
+send:
 	dd->tx_entry = tx_entry_get(dd->tx_queue);
 	if (!dd->tx_entry)
 		return;
@@ -129,6 +409,7 @@ static inline void on_send_timeout(struct daisy_dev *dd) {
 	if (dd->tx_entry) {
 		tx_entry_del(dd->tx_entry);
 		dd->tx_entry = NULL;
+		tx_wakeup(dd);
 	}
 	on_idle_poll(dd);
 }
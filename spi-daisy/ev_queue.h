@@ -51,6 +51,10 @@ enum evq_event {
 	EVQ_INVALID_STATE,
 	EVQ_STATUS_IDLE,
 	EVQ_STATUS_SEND,
+	EVQ_CCA_BUSY,
+	EVQ_BACKOFF,
+	EVQ_CHAINED,
+	EVQ_RXDROP,
 };
 
 struct ev_entry {
@@ -0,0 +1,103 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FIFO_H_
+#define _FIFO_H_
+
+#include <linux/module.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+
+#include "spi.h"
+#include "spi-daisy.h"
+
+#define FIFO_MIN_CHUNK           8 // Octets per interrupt
+#define FIFO_GUARD               2 // Octets
+#define FIFO_MAX_MARGIN         16
+#define FIFO_DECAY             256 // Clean services until the margin halves
+
+/*
+ * Few interrupts need big chunks, that is a low TX almost empty and a
+ * high RX almost full threshold. The chip keeps sending or receiving
+ * while an interrupt is served, so both leave room for the octets of
+ * the service latency times a margin. An over- or underflow doubles
+ * the margin, a run of clean services halves it again. The latency is
+ * taken from the entry of the interrupt handler, the time until the
+ * handler runs is not visible here.
+ */
+
+static inline void fifo_set_rate(struct daisy_dev *dd, u32 bps) {
+	dd->fifo.byte_ns = div_u64(8000000000ULL, max_t(u32, bps, 1));
+}
+
+static inline void fifo_init(struct daisy_dev *dd) {
+	memset(&dd->fifo, 0x00, sizeof(struct daisy_fifo));
+	fifo_set_rate(dd, DEFAULT_DATA_RATE);
+	dd->fifo.stats.margin = 1;
+}
+
+// Program the thresholds, if they have changed:
+static inline void fifo_tune(struct daisy_dev *dd) {
+	struct daisy_fifo *f = &dd->fifo;
+	u32 n = DIV_ROUND_UP(f->stats.margin * f->stats.latency_ns, f->byte_ns)
+			+ FIFO_GUARD;
+
+	n = min_t(u32, n, RFM22B_FIFO_SIZE - FIFO_MIN_CHUNK);
+	if (n != f->stats.tx_almost_empty) {
+		daisy_set_register8(dd, RFM22B_REG_TX_FIFO_AE, n);
+		f->stats.tx_almost_empty = n;
+	}
+	if (RFM22B_FIFO_SIZE - n != f->stats.rx_almost_full) {
+		daisy_set_register8(dd, RFM22B_REG_RX_FIFO_AF, RFM22B_FIFO_SIZE - n);
+		f->stats.rx_almost_full = RFM22B_FIFO_SIZE - n;
+	}
+}
+
+// Octets to write to the TX FIFO when it is almost empty:
+static inline int fifo_tx_room(struct daisy_dev *dd) {
+	return RFM22B_FIFO_SIZE - dd->fifo.stats.tx_almost_empty;
+}
+
+// A FIFO interrupt is served:
+static inline void fifo_sample(struct daisy_dev *dd) {
+	struct daisy_fifo *f = &dd->fifo;
+	u32 x = ktime_to_ns(ktime_sub(ktime_get(), f->irq_time));
+
+	if (!f->stats.services++) {
+		f->srtt   = x;
+		f->rttvar = x / 2;
+	} else {
+		f->rttvar = (3 * f->rttvar + abs((s32)(f->srtt - x))) / 4;
+		f->srtt   = (7 * f->srtt + x) / 8;
+	}
+	f->stats.latency_ns = f->srtt + 4 * f->rttvar;
+	if ((f->stats.margin > 1) && (++f->clean >= FIFO_DECAY)) {
+		f->stats.margin /= 2;
+		f->clean = 0;
+	}
+}
+
+static inline void fifo_fault(struct daisy_dev *dd) {
+	struct daisy_fifo *f = &dd->fifo;
+
+	++f->stats.faults;
+	f->clean = 0;
+	f->stats.margin = min_t(u8, 2 * f->stats.margin, FIFO_MAX_MARGIN);
+}
+
+#endif //_FIFO_H_//
@@ -0,0 +1,97 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _HEADER_H_
+#define _HEADER_H_
+
+#include <linux/module.h>
+
+#include "spi.h"
+#include "spi-daisy.h"
+#include "tx_queue.h"
+
+#define HEADER_MAX_LEN         255 // TXPKLEN is one octet
+
+/*
+ * Packet handler and hardware address filter: Every frame carries a 4
+ * octet header, header 3..2 hold the destination and header 1..0 the
+ * source, and its length, which delimits it for PKVALID. With the filter
+ * the chip compares header 3..2 with the check header and drops foreign
+ * unicast frames before PKVALID, so they never cross the SPI bus. A
+ * bridge needs the frames for the MACs behind it, the filter is off
+ * then. A network ID in sync word 1..0 keeps other networks out the same
+ * way. Frames chained into a burst get their header and length, when the
+ * previous one has left the FIFO. The layout is the one of the userspace
+ * RFM22B class.
+ */
+
+// Program the packet handler after a device reset:
+static inline void header_apply(struct daisy_dev *dd) {
+	struct daisy_header *h = &dd->header;
+	u8 tx[9], rx[9];
+
+	daisy_set_register8(dd, RFM22B_DATA_ACCESS_CONTROL,
+			RFM22B_ENPACRX | RFM22B_ENPACTX | RFM22B_CRC_BIACHEVA);
+	daisy_set_register8(dd, RFM22B_REG_HEADER_CONTROL_1,
+			h->filter ? (RFM22B_BCEN_32 | RFM22B_HDCH_32) : 0x00);
+	daisy_set_register8(dd, RFM22B_REG_HEADER_CONTROL_2, RFM22B_HDLEN_3210
+			| (h->network ? RFM22B_SYNCLEN_3210 : RFM22B_SYNCLEN_32));
+	daisy_set_register16(dd, RFM22B_REG_SYNC_WORD_1, h->network);
+	// Check header 3..0 and header enable 3..0 in one burst:
+	tx[0] = RFM22B_REG_CHECK_HEADER_3 | RFM22B_WRITE_FLAG;
+	tx[1] = h->addr >> 8;
+	tx[2] = h->addr & 0xff;
+	tx[3] = 0x00;
+	tx[4] = 0x00;
+	tx[5] = 0xff;
+	tx[6] = 0xff;
+	tx[7] = 0x00;
+	tx[8] = 0x00;
+	daisy_transfer(dd, tx, rx, 9);
+}
+
+// Longest frame that can be sent:
+static inline unsigned int header_max_len(struct daisy_dev *dd) {
+	return HEADER_MAX_LEN;
+}
+
+// Transmit header 3..0 and the packet length of a frame, the destination
+// is the station ID of the L2 header. MAC frames are for all stations:
+static inline void header_tx(struct daisy_dev *dd, struct tx_entry *e) {
+	struct daisy_header *h = &dd->header;
+	u16 to = DAISY_HEADER_BROADCAST;
+	u8 tx[6], rx[6];
+
+	if ((e->pkg_len - 1 >= DAISY_L2_HLEN) &&
+			(e->pkg[1] != MAC_POLL) && (e->pkg[1] != MAC_REPORT))
+		to = (e->pkg[2] << 8) | e->pkg[3];
+	if (to == DAISY_HEADER_BROADCAST)
+		++h->stats.broadcast;
+	else
+		++h->stats.unicast;
+	// Transmit header 3..0 are followed by TXPKLEN:
+	tx[0] = RFM22B_REG_TX_HEADER_3 | RFM22B_WRITE_FLAG;
+	tx[1] = to >> 8;
+	tx[2] = to & 0xff;
+	tx[3] = h->addr >> 8;
+	tx[4] = h->addr & 0xff;
+	tx[5] = e->pkg_len - 1;
+	daisy_transfer(dd, tx, rx, 6);
+}
+
+#endif //_HEADER_H_//
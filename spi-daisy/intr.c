@@ -27,12 +27,10 @@
 u8 tx_buffer[IO_MAX+2];
 u8 rx_buffer[IO_MAX+2];
 
-void watchdog(unsigned long _dd) {
-	struct daisy_dev *dd = (struct daisy_dev *)_dd;
+void watchdog(struct timer_list *t) {
+	struct daisy_dev *dd = from_timer(dd, t, watchdog);
 	unsigned long flags, expires;
 
-	if (!dd)
-		return;
 	spin_lock_irqsave(&dd->evq.lock, flags);
 	/**/ if (time_after(jiffies, dd->timeout)) {
 	/**/	ev_queue_put(&dd->evq, EVQ_TIMEOUT);
@@ -149,6 +147,18 @@ void tasklet(unsigned long _dd) {
 		case EVQ_STATUS_SEND:
 			trace1("STATUS_SEND", ee.timestamp);
 			break;
+		case EVQ_CCA_BUSY:
+			trace1("CCA_BUSY", ee.timestamp);
+			break;
+		case EVQ_BACKOFF:
+			trace2("BACKOFF", ee.timestamp, ee.operand);
+			break;
+		case EVQ_CHAINED:
+			trace2("CHAINED", ee.timestamp, ee.operand);
+			break;
+		case EVQ_RXDROP:
+			trace2("RXDROP", ee.timestamp, ee.operand);
+			break;
 		default:
 			trace2("UNKNOWN", ee.timestamp, ee.event);
 			break;
@@ -167,6 +177,7 @@ irqreturn_t irq_handler(int irq, void *_dd, struct pt_regs *regs)
 	unsigned long     flags;
 
 	local_irq_save(flags);
+	dd->fifo.irq_time = ktime_get();
 	is = daisy_get_register16(dd, RFM22B_REG_INTERRUPT_STATUS);
 	if ((is & RFM22B_ENINTR) == 0)
 		goto end;
@@ -174,24 +185,29 @@ irqreturn_t irq_handler(int irq, void *_dd, struct pt_regs *regs)
 	//ev_queue_put_op(evq, EVQ_INTERRUPT, is);
 	switch (dd->state) {
 	case STATUS_IDLE:
+		if (is & (RFM22B_IRSSI | RFM22B_IPREAVAL)) {
+			ev_queue_put(evq, EVQ_RSSI);
+			csma_carrier(dd);
+		}
 		if (is & RFM22B_ISWDET) {
 			ev_queue_put(evq, EVQ_SWDET);
 			///TODO: SWDET
 		}
 		if (is & RFM22B_ICRCERROR) {
 			ev_queue_put(evq, EVQ_CRCERROR);
-			///TODO: CRCERROR
+			rx_abort(dd);
 		}
 		if (is & RFM22B_IPKVALID) {
+			// Reads the rest of the frame by its length:
 			ev_queue_put(evq, EVQ_PKVALID);
-			///TODO: PKVALID
-		}
-		if (is & RFM22B_IRXFFAFUL) {
+			rx_valid(dd);
+		} else if (is & RFM22B_IRXFFAFUL) {
 			ev_queue_put(evq, EVQ_RXFFAFUL);
-			///TODO:RXFFAFUL
+			rx_fifo(dd);
 		}
 		if (is & RFM22B_IFFERR) {
 			ev_queue_put(evq, EVQ_FFERR);
+			fifo_fault(dd);
 			///TODO:FFERR
 		}
 		break;
@@ -206,6 +222,7 @@ irqreturn_t irq_handler(int irq, void *_dd, struct pt_regs *regs)
 		}
 		if (is & RFM22B_IFFERR) {
 			ev_queue_put(evq, EVQ_FFERR);
+			fifo_fault(dd);
 			///TODO:FFERR
 		}
 		break;
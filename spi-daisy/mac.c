@@ -0,0 +1,429 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/module.h>
+#include <linux/jiffies.h>
+#include <linux/math64.h>
+
+#include "spi-daisy.h"
+#include "spi.h"
+#include "tx_queue.h"
+#include "mac.h"
+
+static inline void put_le16(u8 *pb, u16 v) {
+	pb[0] = v & 0xff;
+	pb[1] = v >> 8;
+}
+
+static inline u16 get_le16(const u8 *pb) {
+	return pb[0] | (pb[1] << 8);
+}
+
+// Airtime of a frame with cb payload octets in us:
+static inline u32 airtime(struct daisy_mac *m, u32 cb) {
+	return div_u64((u64)(cb + MAC_FRAME_OVERHEAD) * 8 * 1000000, m->bps);
+}
+
+static inline u32 guard(struct mac_station *s) {
+	return s->srtt + 4 * s->rttvar;
+}
+
+// Let the watchdog poll again at time when (in jiffies):
+static inline void wakeup_at(struct daisy_dev *dd, unsigned long when) {
+	dd->timeout = when;
+	mod_timer(&dd->watchdog, when + 1);
+}
+
+// Queue a MAC frame as the very next one, false if no tx_entry is free:
+static bool mac_queue(struct daisy_dev *dd, const u8 *pb, size_t cb) {
+	struct tx_entry *e = tx_entry_try_new(dd->tx_queue);
+
+	if (!e)
+		return 0;
+	memcpy(&e->pkg[1], pb, cb);
+	e->pkg_len = cb + 1;
+	tx_entry_put_back(e);
+	return 1;
+}
+
+static struct mac_station *find_station(struct daisy_mac *m, u16 addr,
+		bool add)
+{
+	struct mac_station *free = NULL;
+	int i;
+
+	for (i = 0; i < MAC_MAX_STATIONS; ++i) {
+		struct mac_station *s = &m->stations[i];
+		if (s->used && (s->addr == addr))
+			return s;
+		if (!s->used && !free)
+			free = s;
+	} // end for //
+	if (!(add && free))
+		return NULL;
+	memset(free, 0x00, sizeof(struct mac_station));
+	free->used   = 1;
+	free->addr   = addr;
+	free->srtt   = MAC_DEFAULT_RTT;
+	free->rttvar = MAC_DEFAULT_RTT / 2;
+	free->idle   = MAC_REPORT_EVERY - 1; // Grant in the next poll
+	return free;
+}
+
+void mac_init(struct daisy_dev *dd) {
+	memset(&dd->mac, 0x00, sizeof(struct daisy_mac));
+	dd->mac.mode = MAC_CSMA;
+	dd->mac.bps  = MAC_DEFAULT_BPS;
+}
+
+/*
+ * AP: Grant the stations with queued data a TXOP of their queue, the
+ * idle ones a report only TXOP now and then, and add the open grant.
+ */
+static void ap_poll(struct daisy_dev *dd) {
+	struct daisy_mac *m = &dd->mac;
+	u8  pb[MAC_POLL_HEADER + MAC_MAX_GRANTS * MAC_GRANT_SIZE];
+	u32 offset = 0;
+	int i, j;
+
+	m->n_grants = 0;
+	for (j = 0; j < MAC_MAX_STATIONS; ++j) {
+		struct mac_station *s =
+				&m->stations[(m->next + j) % MAC_MAX_STATIONS];
+		struct mac_grant   *g;
+		u16 octets;
+
+		if (!s->used)
+			continue;
+		if (m->n_grants >= MAC_MAX_GRANTS - 1)
+			break;
+		if (s->queued) {
+			octets = min_t(u16, s->queued, MAC_MAX_TXOP);
+		} else if (++s->idle >= MAC_REPORT_EVERY) {
+			octets = 0;
+		} else {
+			continue;
+		}
+		s->idle = 0;
+		g = &m->grants[m->n_grants++];
+		g->addr   = s->addr;
+		g->octets = octets;
+		g->offset = offset / MAC_TIME_UNIT;
+		offset += airtime(m, octets) + airtime(m, MAC_REPORT_SIZE)
+				+ guard(s);
+	} // end for //
+	m->next = (m->next + 1) % MAC_MAX_STATIONS;
+
+	// Open grant for new stations:
+	m->grants[m->n_grants].addr   = MAC_BROADCAST;
+	m->grants[m->n_grants].octets = 0;
+	m->grants[m->n_grants].offset = offset / MAC_TIME_UNIT;
+	++m->n_grants;
+
+	pb[0] = MAC_POLL;
+	put_le16(&pb[1], m->addr);
+	pb[3] = ++m->seq;
+	pb[4] = m->n_grants;
+	for (i = 0; i < m->n_grants; ++i) {
+		u8 *pg = &pb[MAC_POLL_HEADER + i * MAC_GRANT_SIZE];
+		put_le16(&pg[0], m->grants[i].addr);
+		put_le16(&pg[2], m->grants[i].octets);
+		put_le16(&pg[4], m->grants[i].offset);
+	} // end for //
+	m->n_reports = 0;
+	m->poll_sent = ktime_set(0, 0);
+	m->polling = mac_queue(dd, pb, MAC_POLL_HEADER +
+			m->n_grants * MAC_GRANT_SIZE);
+}
+
+// AP: The cycle is over, count the grants without report:
+static void ap_cycle_end(struct daisy_dev *dd) {
+	struct daisy_mac *m = &dd->mac;
+	int i;
+
+	for (i = 0; i < m->n_grants; ++i) {
+		struct mac_station *s;
+		if (m->grants[i].addr == MAC_BROADCAST)
+			continue;
+		s = find_station(m, m->grants[i].addr, 0);
+		if (!s || !s->missed)
+			continue;
+		++m->stats.missed;
+		if (s->missed >= MAC_MAX_MISSED)
+			s->used = 0;
+	} // end for //
+	m->polling = 0;
+}
+
+// Station: Close the TXOP with the report:
+static void station_report(struct daisy_dev *dd) {
+	struct daisy_mac *m = &dd->mac;
+	u8  pb[MAC_REPORT_SIZE];
+	s64 delay = ktime_us_delta(ktime_get(), m->poll_rx) / MAC_TIME_UNIT;
+
+	pb[0] = MAC_REPORT;
+	put_le16(&pb[1], m->addr);
+	pb[3] = m->poll_seq;
+	put_le16(&pb[4], min_t(u32, tx_queue_octets(dd->tx_queue), 0xffff));
+	put_le16(&pb[6], min_t(s64, delay, 0xffff));
+	if (mac_queue(dd, pb, MAC_REPORT_SIZE))
+		m->budget = MAC_REPORT_SIZE;
+	else
+		m->granted = m->sending = 0;
+}
+
+// CSMA: Hold the channel for the ACK of our last frame, send our own
+// ACK first:
+static enum mac_action csma_idle_poll(struct daisy_dev *dd) {
+	struct daisy_mac *m = &dd->mac;
+
+	if (m->ack_queued)
+		return MAC_ACTION_SEND;
+	if (!m->ack_end)
+		return MAC_ACTION_CSMA;
+	if (time_before_eq(jiffies, m->ack_end)) {
+		wakeup_at(dd, m->ack_end + 1);
+		return MAC_ACTION_HOLD;
+	}
+	m->ack_end = 0;
+	daisy_ack_result(dd, 0);
+	return MAC_ACTION_CSMA;
+}
+
+enum mac_action mac_idle_poll(struct daisy_dev *dd) {
+	struct daisy_mac *m = &dd->mac;
+	u16 len;
+
+	switch (m->mode) {
+	case MAC_AP:
+		if (m->polling) {
+			if (!ktime_to_ns(m->poll_sent))
+				return MAC_ACTION_SEND; // The poll itself
+			if ((m->n_reports < m->n_grants) &&
+					time_before(jiffies, m->cycle_end)) {
+				wakeup_at(dd, m->cycle_end);
+				return MAC_ACTION_HOLD;
+			}
+			ap_cycle_end(dd);
+		}
+		// Own data goes out before the next poll:
+		if (tx_entry_peek_len(dd->tx_queue))
+			return MAC_ACTION_SEND;
+		ap_poll(dd);
+		return m->polling ? MAC_ACTION_SEND : MAC_ACTION_HOLD;
+
+	case MAC_STATION:
+		if (!m->granted)
+			return MAC_ACTION_HOLD;
+		if (!m->sending) {
+			if (time_before(jiffies, m->txop_start)) {
+				wakeup_at(dd, m->txop_start);
+				return MAC_ACTION_HOLD;
+			}
+			m->sending = 1;
+			++m->stats.grants;
+		}
+		len = tx_entry_peek_len(dd->tx_queue);
+		if (len && (len <= m->budget) &&
+				time_before_eq(jiffies, m->txop_end)) {
+			m->budget -= len;
+			return m->open ? MAC_ACTION_CSMA : MAC_ACTION_SEND;
+		}
+		station_report(dd);
+		return m->open ? MAC_ACTION_CSMA : MAC_ACTION_SEND;
+
+	default:
+		return csma_idle_poll(dd);
+	} // end switch //
+}
+
+void mac_sent(struct daisy_dev *dd, const u8 *pb, size_t cb) {
+	struct daisy_mac *m = &dd->mac;
+	u32 cycle = 0;
+	int i;
+
+	if (!cb)
+		return;
+	if ((m->mode == MAC_AP) && (pb[0] == MAC_POLL)) {
+		m->poll_sent = ktime_get();
+		for (i = 0; i < m->n_grants; ++i) {
+			struct mac_station *s = find_station(m, m->grants[i].addr, 0);
+			cycle = m->grants[i].offset * MAC_TIME_UNIT
+					+ airtime(m, m->grants[i].octets)
+					+ airtime(m, MAC_REPORT_SIZE)
+					+ (s ? guard(s) : MAC_DEFAULT_RTT);
+			if (s)
+				++s->missed; // Until the report is there
+		} // end for //
+		m->cycle_end = jiffies + usecs_to_jiffies(cycle) + 1;
+		++m->stats.polls;
+		m->stats.grants += m->n_grants;
+	} else if ((m->mode == MAC_STATION) && (pb[0] == MAC_REPORT)) {
+		m->contended = m->open;
+		m->granted = m->sending = m->open = 0;
+		++m->stats.reports;
+	} else if (m->mode == MAC_CSMA) {
+		if (pb[0] == MAC_ACK) {
+			m->ack_queued = 0;
+		} else if ((cb >= DAISY_L2_HLEN) && !(pb[0] & DAISY_L2_LONG_DST)
+				&& (((pb[1] << 8) | pb[2]) != DAISY_HEADER_BROADCAST)) {
+			// Unicast to a station, it acknowledges:
+			m->ack_from = (pb[1] << 8) | pb[2];
+			m->ack_end  = jiffies + 1 + usecs_to_jiffies(
+					airtime(m, MAC_ACK_SIZE) + MAC_ACK_TIMEOUT);
+		}
+	}
+}
+
+// CSMA: Acknowledge a data frame to us:
+static void csma_rx_data(struct daisy_dev *dd, const u8 *pb, size_t cb) {
+	struct daisy_mac *m = &dd->mac;
+	u8 ack[MAC_ACK_SIZE];
+
+	if ((cb < DAISY_L2_HLEN) || (pb[0] & DAISY_L2_LONG_DST) ||
+			(((pb[1] << 8) | pb[2]) != m->addr))
+		return;
+	ack[0] = MAC_ACK;
+	put_le16(&ack[1], m->addr);
+	if (mac_queue(dd, ack, MAC_ACK_SIZE)) {
+		m->ack_queued = 1;
+		wakeup_at(dd, jiffies);
+	}
+}
+
+// CSMA: The ACK of our last frame:
+static void csma_rx_ack(struct daisy_dev *dd, const u8 *pb) {
+	struct daisy_mac *m = &dd->mac;
+
+	if (!m->ack_end || (get_le16(&pb[1]) != m->ack_from))
+		return;
+	m->ack_end = 0;
+	daisy_ack_result(dd, 1);
+	wakeup_at(dd, jiffies);
+}
+
+static void ap_rx_report(struct daisy_dev *dd, const u8 *pb) {
+	struct daisy_mac   *m = &dd->mac;
+	struct mac_station *s = find_station(m, get_le16(&pb[1]), 1);
+	s64 rtt;
+
+	if (!s)
+		return;
+	s->queued = get_le16(&pb[4]);
+	++m->stats.reports;
+	if (!m->polling || (pb[3] != m->seq))
+		return;
+	++m->n_reports;
+	s->missed = 0;
+	// Round trip: Time since the poll without the station's part:
+	rtt = ktime_us_delta(ktime_get(), m->poll_sent)
+			- get_le16(&pb[6]) * MAC_TIME_UNIT
+			- airtime(m, MAC_REPORT_SIZE);
+	if (rtt < 0)
+		rtt = 0;
+	m->stats.rtt_us = rtt;
+	// As RFC 6298:
+	s->rttvar = (3 * s->rttvar + abs((s32)(s->srtt - rtt))) / 4;
+	s->srtt   = (7 * s->srtt + rtt) / 8;
+}
+
+static void station_rx_poll(struct daisy_dev *dd, const u8 *pb, size_t cb) {
+	struct daisy_mac *m = &dd->mac;
+	u8  n = pb[4];
+	u16 pred = MAC_BROADCAST;
+	int i;
+
+	if (cb < MAC_POLL_HEADER + n * MAC_GRANT_SIZE)
+		return;
+	++m->stats.polls;
+	// The poll after a report in the open grant acknowledges it:
+	if (m->contended) {
+		bool acked = 0;
+		for (i = 0; i < n; ++i)
+			acked |= (get_le16(&pb[MAC_POLL_HEADER + i * MAC_GRANT_SIZE])
+					== m->addr);
+		daisy_ack_result(dd, acked);
+		m->contended = 0;
+	}
+	for (i = 0; i < n; ++i) {
+		const u8 *pg = &pb[MAC_POLL_HEADER + i * MAC_GRANT_SIZE];
+		u16  addr = get_le16(&pg[0]);
+		bool open = (addr == MAC_BROADCAST);
+		u16  octets = get_le16(&pg[2]);
+		u32  offset = get_le16(&pg[4]) * MAC_TIME_UNIT;
+
+		// The open grant is for stations with data, that were not
+		// polled:
+		if (!((addr == m->addr) || (open &&
+				tx_entry_peek_len(dd->tx_queue))))
+		{
+			pred = addr;
+			continue;
+		}
+		m->granted    = 1;
+		m->sending    = 0;
+		m->open       = open;
+		m->budget     = octets;
+		m->poll_seq   = pb[3];
+		m->pred       = pred;
+		m->poll_rx    = ktime_get();
+		m->txop_start = jiffies + usecs_to_jiffies(offset);
+		m->txop_end   = m->txop_start + 1 + usecs_to_jiffies(
+				airtime(m, octets) + airtime(m, MAC_REPORT_SIZE));
+		wakeup_at(dd, m->txop_start);
+		return;
+	} // end for //
+}
+
+bool mac_rx(struct daisy_dev *dd, const u8 *pb, size_t cb) {
+	struct daisy_mac *m = &dd->mac;
+
+	if (cb < 1)
+		return 0;
+	switch (pb[0]) {
+	case MAC_POLL:
+		if (cb < MAC_POLL_HEADER)
+			return 1;
+		if (m->mode == MAC_STATION)
+			station_rx_poll(dd, pb, cb);
+		return 1;
+	case MAC_REPORT:
+		if (cb < MAC_REPORT_SIZE)
+			return 1;
+		if (m->mode == MAC_AP) {
+			ap_rx_report(dd, pb);
+		} else if ((m->mode == MAC_STATION) && m->granted && !m->sending
+				&& (get_le16(&pb[1]) == m->pred)
+				&& (pb[3] == m->poll_seq)) {
+			// Our predecessor is done, start early:
+			m->txop_end -= min(m->txop_end - jiffies,
+					m->txop_start - jiffies);
+			m->txop_start = jiffies;
+			wakeup_at(dd, jiffies);
+		}
+		return 1;
+	case MAC_ACK:
+		if ((cb >= MAC_ACK_SIZE) && (m->mode == MAC_CSMA))
+			csma_rx_ack(dd, pb);
+		return 1;
+	default:
+		if (m->mode == MAC_CSMA)
+			csma_rx_data(dd, pb, cb);
+		return 0;
+	} // end switch //
+}
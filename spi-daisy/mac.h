@@ -0,0 +1,165 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MAC_H_
+#define _MAC_H_
+
+#include <linux/module.h>
+#include <linux/ktime.h>
+
+#include "spi-daisy.h"
+
+/*
+ * Polled access point MAC. The access station (AP) sends a poll frame,
+ * that grants each listed station a transmit opportunity (TXOP) sized
+ * to its reported queue. A station only sends within its TXOP and
+ * closes it with a report frame, that carries its queue length and the
+ * time it took from the poll to the report. From this the AP measures
+ * the round trip to every station and places the TXOPs apart by a
+ * guard time of srtt + 4 * rttvar instead of fixed slots. A station
+ * may start before its offset, when it hears the report of the station
+ * granted before it.
+ *
+ * The address of a station is its 16 bit station ID of the L2 header
+ * (see daisy_header_address()), so stations of a cell do not share it.
+ * All fields of 2 octets are little endian.
+ *
+ * Poll frame (after the FIFO command octet):
+ *    0: MAC_POLL
+ *    1: Address of the AP (2)
+ *    3: Cycle sequence number
+ *    4: Number of grants n
+ *    5: n grants of 6 octets: Address (2), TXOP in octets (2), offset
+ *       from the end of the poll in MAC_TIME_UNIT (2)
+ * Report frame:
+ *    0: MAC_REPORT
+ *    1: Address of the station (2)
+ *    3: Cycle sequence number of the poll
+ *    4: Queued octets (2)
+ *    6: Time from the poll to the report in MAC_TIME_UNIT (2)
+ *
+ * Stations that reported an empty queue get a report only grant every
+ * MAC_REPORT_EVERY cycles. A grant to MAC_BROADCAST at the end of the
+ * poll is open for the registration of new stations, they contend for
+ * it with the CSMA backoff. A new station is granted in the next poll,
+ * that is the acknowledge of its report: If the poll does not list it,
+ * the report collided (see daisy_ack_result()).
+ *
+ * In the CSMA mode a station acknowledges a data frame to its own
+ * station ID right away, without backoff. The sender holds the channel
+ * until the acknowledge or MAC_ACK_TIMEOUT and reports the outcome to
+ * the contention window. Frames to the long destination, broadcast and
+ * the MAC frames are not acknowledged. There is no retransmission.
+ * Acknowledge frame:
+ *    0: MAC_ACK
+ *    1: Address of the station, that received the frame (2)
+ *
+ * Data frames must not start with the octets MAC_POLL, MAC_REPORT or
+ * MAC_ACK.
+ */
+
+#define MAC_POLL            0xc1
+#define MAC_REPORT          0xc2
+#define MAC_ACK             0xc3
+#define MAC_BROADCAST     0xffff // DAISY_HEADER_BROADCAST
+#define MAC_POLL_HEADER        5
+#define MAC_GRANT_SIZE         6
+#define MAC_REPORT_SIZE        8
+#define MAC_ACK_SIZE           3
+#define MAC_MAX_STATIONS      32
+#define MAC_MAX_GRANTS         8
+#define MAC_MAX_TXOP        1024 // In octets
+#define MAC_REPORT_EVERY       8 // In cycles
+#define MAC_MAX_MISSED         8 // Grants without report until removed
+#define MAC_TIME_UNIT        100 // In us
+#define MAC_DEFAULT_RTT    20000 // In us, before the first measurement
+#define MAC_ACK_TIMEOUT    20000 // In us, after the airtime of the ACK
+#define MAC_DEFAULT_BPS    10000
+#define MAC_FRAME_OVERHEAD    10 // Preamble, sync, length and CRC
+
+// What on_idle_poll() shall do:
+enum mac_action {
+	MAC_ACTION_CSMA,  // Listen before talk
+	MAC_ACTION_HOLD,  // Do not send now
+	MAC_ACTION_SEND   // Send the next frame without backoff
+};
+
+struct mac_station {
+	bool                     used;
+	u16                      addr;
+	u16                      queued;  // Reported octets
+	u32                      srtt;    // In us
+	u32                      rttvar;  // In us
+	u8                       idle;    // Cycles since the last grant
+	u8                       missed;  // Grants without report in a row
+};
+
+struct mac_grant {
+	u16                      addr;
+	u16                      octets;
+	u16                      offset;  // In MAC_TIME_UNIT
+};
+
+struct daisy_mac {
+	enum daisy_mac_mode      mode;
+	u16                      addr;
+	u32                      bps;
+	u8                       seq;
+	// Access station:
+	struct mac_station       stations[MAC_MAX_STATIONS];
+	struct mac_grant         grants[MAC_MAX_GRANTS];
+	u8                       n_grants;
+	u8                       n_reports;
+	u8                       next;        // Round robin start
+	bool                     polling;     // Poll queued or cycle running
+	ktime_t                  poll_sent;
+	unsigned long            cycle_end;   // In jiffies
+	// Station:
+	bool                     granted;     // TXOP pending or running
+	bool                     sending;     // TXOP running
+	bool                     open;        // Open grant, contend for it
+	bool                     contended;   // Report sent in the open grant
+	u16                      budget;      // Octets left in the TXOP
+	u8                       poll_seq;
+	u16                      pred;        // Granted before us
+	ktime_t                  poll_rx;
+	unsigned long            txop_start;  // In jiffies
+	unsigned long            txop_end;    // In jiffies
+	// CSMA:
+	bool                     ack_queued;  // Our ACK waits in the queue
+	u16                      ack_from;    // Station to ACK our frame
+	unsigned long            ack_end;     // In jiffies, 0: none expected
+	struct daisy_mac_stats   stats;
+};
+
+struct daisy_dev;
+
+// Set up the MAC state for the device:
+extern void mac_init(struct daisy_dev *dd);
+
+// Called from on_idle_poll():
+extern enum mac_action mac_idle_poll(struct daisy_dev *dd);
+
+// Called when a frame was sent:
+extern void mac_sent(struct daisy_dev *dd, const u8 *pb, size_t cb);
+
+// Pass a received frame. Returns true, if it was a MAC frame and is
+// consumed:
+extern bool mac_rx(struct daisy_dev *dd, const u8 *pb, size_t cb);
+
+#endif //_MAC_H_//
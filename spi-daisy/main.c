@@ -17,6 +17,7 @@
  */
 
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/clk.h>
 #include <linux/spinlock.h>
 #include <linux/of.h>
@@ -33,9 +34,16 @@
 #include "spi.h"
 #include "trace.h"
 #include "automaton.h"
+#include "fifo.h"
+#include "header.h"
 
 static struct daisy_dev daisy_slots[N_SLOTS];
 
+static bool loopback;
+module_param(loopback, bool, 0644);
+MODULE_PARM_DESC(loopback,
+		"Receive the frames written instead of sending them, for tests");
+
 static void daisy_spi_handle_err(struct spi_master  *master,
                                  struct spi_message *msg)
 {
@@ -53,10 +61,8 @@ void daisy_device_up(struct daisy_dev *dd)
 	ev_queue_init(&dd->evq);
 	tasklet_init(&dd->tasklet, tasklet, (unsigned long)dd);
 	dd->timeout = jiffies + DEFAULT_TIMER_TICK;
-	init_timer(&dd->watchdog);
-	dd->watchdog.data = (unsigned long)dd;
+	timer_setup(&dd->watchdog, watchdog, 0);
 	dd->watchdog.expires = dd->timeout;
-	dd->watchdog.function = watchdog;
 	// Device reset:
 	daisy_set_bits8(dd, RFM22B_REG_OP_MODE_1, RFM22B_SWRES);
 	while (daisy_get_register8(dd, RFM22B_REG_OP_MODE_1) & RFM22B_SWRES);
@@ -65,21 +71,25 @@ void daisy_device_up(struct daisy_dev *dd)
 	x &= ~RFM22B_DTMOD_MASK;
 	x |=  RFM22B_DTMOD_FIFO;
 	daisy_set_register8(dd, RFM22B_REG_OP_MODE_1, x);
-	// Disable package handler:
-	daisy_set_register8(dd, RFM22B_DATA_ACCESS_CONTROL, RFM22B_LSBFRST);
+	// Package handler and address filter:
+	header_apply(dd);
 	// Set GFSK modulation:
 	x = daisy_get_register8(dd, RFM22B_REG_MOD_MODE_2);
 	x &= ~RFM22B_MODTYP_MASK;
 	x |=  RFM22B_MODTYP_GFSK;
 	daisy_set_register8(dd, RFM22B_REG_MOD_MODE_2, x);
 	// Set multipackage and autotx:
-	daisy_set_register8(dd, RFM22B_REG_OP_MODE_2, RFM22B_RXMPK | RFM22B_AUTOTX);
+	daisy_set_register8(dd, RFM22B_REG_OP_MODE_2, RFM22B_OP_MODE_2);
 	// Enter ready mode:
 	daisy_set_register8(dd, RFM22B_REG_OP_MODE_1, RFM22B_XTON);
 	// Clear pending interrupt status flags:
 	daisy_set_register16(dd, RFM22B_REG_INTERRUPT_STATUS, 0x0000);
 	// Enable relevant interrupts:
 	daisy_set_register16(dd, RFM22B_REG_INTERRUPT_ENABLE, RFM22B_ENINTR);
+	// Channel access:
+	csma_init(dd);
+	memset(&dd->burst, 0x00, sizeof(struct daisy_burst));
+	fifo_tune(dd);
 
 	rx_start(dd);
 	// Enable watchdog:
@@ -102,23 +112,58 @@ void daisy_device_down(struct daisy_dev *dd)
 }
 EXPORT_SYMBOL_GPL(daisy_device_down);
 
-int daisy_write(struct daisy_dev *dd, struct sk_buff *skb, bool priority)
+int daisy_inject(struct daisy_dev *dd, struct sk_buff *skb)
+{
+	struct rx_entry *e;
+	int len;
+
+	if (!dd || !dd->rx_queue || !skb)
+		return -EINVAL;
+	len = skb->len;
+	if (len > MAX_PKG_LEN)
+		return -E2BIG;
+	// The rx_queue accessors lock against the IRQ handler:
+	e = rx_entry_new(dd->rx_queue);
+	if (!e)
+		return -ERESTARTSYS;
+	skb_copy_bits(skb, 0, skb_put(e->skb, len), len);
+	rx_entry_put(e);
+	dev_kfree_skb_any(skb);
+	return len;
+}
+EXPORT_SYMBOL_GPL(daisy_inject);
+
+// Copy a frame into its tx_entry, the skb is not needed any longer:
+static int daisy_tx_entry_fill(struct tx_entry *e, struct sk_buff *skb)
+{
+	int len = skb->len;
+
+	skb_copy_bits(skb, 0, &e->pkg[1], len);
+	e->pkg_len = len + 1;
+	dev_kfree_skb_any(skb);
+	return len;
+}
+
+int daisy_write(struct daisy_dev *dd, struct sk_buff *skb, int band)
 {
 	struct tx_entry   *e;
+	int len;
 
 	if (!skb)
 		return -EINVAL;
-	if (skb->len > MAX_PKG_LEN) {
+	if (skb->len > header_max_len(dd)) {
 		if (dd->stats)
 			dd->stats->tx_errors ++;
 		return -E2BIG;
 	}
+	if (loopback)
+		return daisy_inject(dd, skb);
 	e = tx_entry_new(dd->tx_queue);
 	if (!e)
 		return -EINTR;
-	e->skb = skb;
-	tx_entry_put(e, priority);
-	return skb->len;
+	len = daisy_tx_entry_fill(e, skb);
+	tx_entry_put(e, band);
+	return len;
 }
 EXPORT_SYMBOL_GPL(daisy_write);
 
@@ -128,27 +173,111 @@ bool daisy_can_write(struct daisy_dev *dd)
 }
 EXPORT_SYMBOL_GPL(daisy_can_write);
 
-int daisy_try_write(struct daisy_dev *dd, struct sk_buff *skb, bool priority)
+int daisy_try_write(struct daisy_dev *dd, struct sk_buff *skb, int band)
 {
 	struct tx_entry   *e;
+	int len;
 
 	if (!skb)
 		return -EINVAL;
-	if (skb->len > MAX_PKG_LEN) {
+	if (skb->len > header_max_len(dd)) {
 		if (dd->stats) {
 			dd->stats->tx_errors ++;
 		}
 		return -E2BIG;
 	}
+	if (loopback)
+		return daisy_inject(dd, skb);
 	e = tx_entry_try_new(dd->tx_queue);
 	if (!e)
 		return -ERESTARTSYS;
-	e->skb = skb;
-	tx_entry_put(e, priority);
-	return skb->len;
+	len = daisy_tx_entry_fill(e, skb);
+	tx_entry_put(e, band);
+	return len;
 }
 EXPORT_SYMBOL_GPL(daisy_try_write);
 
+int daisy_try_write_superseding(struct daisy_dev *dd, struct sk_buff *skb,
+								uint32_t flow, uint32_t seq, int band)
+{
+	struct daisy_ack_stats *s;
+	struct tx_entry *e;
+	int len;
+	u16 cb;
+
+	if (!skb || !flow)
+		return -EINVAL;
+	if (skb->len > header_max_len(dd)) {
+		if (dd->stats) {
+			dd->stats->tx_errors ++;
+		}
+		return -E2BIG;
+	}
+	if (loopback)
+		return daisy_inject(dd, skb);
+	e = tx_entry_try_new(dd->tx_queue);
+	if (!e)
+		return -ERESTARTSYS;
+	len = daisy_tx_entry_fill(e, skb);
+	e->flow = flow;
+	e->seq  = seq;
+	s = &dd->ack_stats;
+	++s->queued;
+	cb = tx_entry_put_supersede(e, band);
+	if (cb) {
+		++s->superseded;
+		s->octets += cb;
+		s->airtime_us += div_u64((u64)(cb + MAC_FRAME_OVERHEAD) * 8 * 1000000,
+				max_t(u32, dd->mac.bps, 1));
+	}
+	return len;
+}
+EXPORT_SYMBOL_GPL(daisy_try_write_superseding);
+
+void daisy_register_stats(struct daisy_dev *dd, struct net_device_stats *stats)
+{
+	if (dd)
+		dd->stats = stats;
+}
+EXPORT_SYMBOL_GPL(daisy_register_stats);
+
+void daisy_register_tx_done(struct daisy_dev *dd,
+							void (*tx_done)(void *ctx), void *ctx)
+{
+	if (!dd)
+		return;
+	dd->tx_done_ctx = ctx;
+	dd->tx_done     = tx_done;
+}
+EXPORT_SYMBOL_GPL(daisy_register_tx_done);
+
+void daisy_get_ack_stats(struct daisy_dev *dd, struct daisy_ack_stats *stats)
+{
+	if (dd && stats)
+		memcpy(stats, &dd->ack_stats, sizeof(struct daisy_ack_stats));
+}
+EXPORT_SYMBOL_GPL(daisy_get_ack_stats);
+
+struct sk_buff *daisy_read(struct daisy_dev *dd)
+{
+	struct rx_entry *e;
+	struct sk_buff  *skb;
+
+	if (!dd || !dd->rx_queue)
+		return NULL;
+	e = rx_entry_get(dd->rx_queue);
+	if (!e)
+		return NULL;
+	// The rx_entry keeps its buffer for the interrupt handler:
+	skb = dev_alloc_skb(e->skb->len);
+	if (skb)
+		memcpy(skb_put(skb, e->skb->len), e->skb->data, e->skb->len);
+	skb_trim(e->skb, 0);
+	rx_entry_del(e);
+	return skb;
+}
+EXPORT_SYMBOL_GPL(daisy_read);
+
 void daisy_interrupt_read(struct daisy_dev *dd)
 {
 	if (dd && dd->rx_queue)
@@ -156,6 +285,96 @@ void daisy_interrupt_read(struct daisy_dev *dd)
 }
 EXPORT_SYMBOL_GPL(daisy_interrupt_read);
 
+void daisy_ack_result(struct daisy_dev *dd, bool acked)
+{
+	struct daisy_csma *c;
+
+	if (!dd)
+		return;
+	c = &dd->csma;
+	if (acked) {
+		++c->stats.acks;
+		c->stats.cw = DEFAULT_CSMA_CW_MIN;
+	} else {
+		++c->stats.collisions;
+		c->stats.cw = min(2 * c->stats.cw + 1, DEFAULT_CSMA_CW_MAX);
+	}
+}
+EXPORT_SYMBOL_GPL(daisy_ack_result);
+
+void daisy_get_csma_stats(struct daisy_dev *dd,
+						  struct daisy_csma_stats *stats)
+{
+	if (dd && stats)
+		memcpy(stats, &dd->csma.stats, sizeof(struct daisy_csma_stats));
+}
+EXPORT_SYMBOL_GPL(daisy_get_csma_stats);
+
+void daisy_get_tx_stats(struct daisy_dev *dd,
+						struct daisy_tx_stats *stats)
+{
+	if (dd && stats)
+		memcpy(stats, &dd->burst.stats, sizeof(struct daisy_tx_stats));
+}
+EXPORT_SYMBOL_GPL(daisy_get_tx_stats);
+
+void daisy_set_data_rate(struct daisy_dev *dd, uint32_t bps)
+{
+	if (!dd || !bps)
+		return;
+	fifo_set_rate(dd, bps);
+	dd->mac.bps = bps;
+}
+EXPORT_SYMBOL_GPL(daisy_set_data_rate);
+
+void daisy_get_fifo_stats(struct daisy_dev *dd,
+						  struct daisy_fifo_stats *stats)
+{
+	if (dd && stats)
+		memcpy(stats, &dd->fifo.stats, sizeof(struct daisy_fifo_stats));
+}
+EXPORT_SYMBOL_GPL(daisy_get_fifo_stats);
+
+void daisy_set_address(struct daisy_dev *dd, const uint8_t *addr,
+					   uint16_t network, bool filter)
+{
+	if (!dd)
+		return;
+	dd->header.filter  = filter && addr;
+	dd->header.addr    = addr ? daisy_header_address(addr)
+							  : DAISY_HEADER_BROADCAST;
+	dd->header.network = network;
+}
+EXPORT_SYMBOL_GPL(daisy_set_address);
+
+void daisy_get_header_stats(struct daisy_dev *dd,
+							struct daisy_header_stats *stats)
+{
+	if (dd && stats)
+		memcpy(stats, &dd->header.stats, sizeof(struct daisy_header_stats));
+}
+EXPORT_SYMBOL_GPL(daisy_get_header_stats);
+
+void daisy_set_mac_mode(struct daisy_dev *dd, enum daisy_mac_mode mode,
+						uint16_t addr, uint32_t bps)
+{
+	if (!dd || (addr == MAC_BROADCAST) || !bps)
+		return;
+	mac_init(dd);
+	dd->mac.mode = mode;
+	dd->mac.addr = addr;
+	dd->mac.bps  = bps;
+}
+EXPORT_SYMBOL_GPL(daisy_set_mac_mode);
+
+void daisy_get_mac_stats(struct daisy_dev *dd,
+						 struct daisy_mac_stats *stats)
+{
+	if (dd && stats)
+		memcpy(stats, &dd->mac.stats, sizeof(struct daisy_mac_stats));
+}
+EXPORT_SYMBOL_GPL(daisy_get_mac_stats);
+
 struct daisy_spi *daisy_get_controller(struct daisy_dev *dev)
 {
 	if ((dev == NULL) || (dev->master == NULL))
@@ -190,9 +409,17 @@ struct daisy_dev *daisy_open_device(uint16_t slot)
 		goto out;
 
 	dd->stats = NULL;
+	dd->tx_done = NULL;
 	dd->irq = 0;
 	dd->state = STATUS_IDLE;
+	dd->tx_entry = NULL;
+	dd->rx_entry = NULL;
+	dd->rx_idx = 0;
 	ev_queue_init(&dd->evq);
+	mac_init(dd);
+	fifo_init(dd);
+	memset(&dd->header, 0x00, sizeof(struct daisy_header));
+	memset(&dd->ack_stats, 0x00, sizeof(struct daisy_ack_stats));
 
 	dd->rx_queue = rx_queue_new(DEFAULT_RX_QUEUE_SIZE);
 	if (!dd->rx_queue)
@@ -292,6 +519,107 @@ uint32_t daisy_set_speed(struct daisy_spi *spi, uint32_t spi_hz)
 }
 EXPORT_SYMBOL_GPL(daisy_set_speed);
 
+#define CALIBRATE_REG         0x3a // Transmit and check headers
+#define CALIBRATE_LEN            9
+#define CALIBRATE_ROUNDS        16
+#define CALIBRATE_SLOWEST      512 // Clock divider to start with
+
+// Write a pattern to the header registers and count the octets that are
+// read back wrong:
+static uint32_t calibrate_pattern(struct daisy_dev *dd, const u8 *pattern)
+{
+	u8 tx[CALIBRATE_LEN+1], rx[CALIBRATE_LEN+1];
+	uint32_t errors = 0;
+	int i;
+
+	// Single register writes and reads:
+	for (i = 0; i < CALIBRATE_LEN; ++i) {
+		daisy_set_register8(dd, CALIBRATE_REG + i, pattern[i]);
+		if (daisy_get_register8(dd, CALIBRATE_REG + i) != pattern[i])
+			++errors;
+	} // end for //
+	// Burst write and read, as used for the FIFO:
+	tx[0] = CALIBRATE_REG | 0x80;
+	for (i = 0; i < CALIBRATE_LEN; ++i)
+		tx[i+1] = ~pattern[i];
+	daisy_transfer(dd, tx, rx, CALIBRATE_LEN+1);
+	memset(tx, 0x00, sizeof(tx));
+	tx[0] = CALIBRATE_REG;
+	daisy_transfer(dd, tx, rx, CALIBRATE_LEN+1);
+	for (i = 0; i < CALIBRATE_LEN; ++i)
+		if (rx[i+1] != (u8)~pattern[i])
+			++errors;
+	return errors;
+}
+
+uint32_t daisy_calibrate_speed(struct daisy_dev *dd, uint32_t max_hz,
+							   struct daisy_speed_step *steps, int n_steps)
+{
+	struct daisy_spi *spi;
+	u8 save[CALIBRATE_LEN+1], x[CALIBRATE_LEN+1];
+	u8 pattern[CALIBRATE_LEN];
+	u8 tx[IO_MAX+1], rx[IO_MAX+1];
+	uint32_t clk_hz, hz, good = 0, prev = 0, best = 0;
+	uint32_t cdiv;
+	int i, round, n = 0;
+
+	if (!dd || !dd->spi)
+		return 0;
+	spi = dd->spi;
+	clk_hz = clk_get_rate(spi->clk);
+	memset(x, 0x00, sizeof(x));
+	x[0] = CALIBRATE_REG;
+	daisy_transfer(dd, x, save, CALIBRATE_LEN+1);
+
+	for (cdiv = CALIBRATE_SLOWEST; cdiv >= 2; cdiv /= 2) {
+		struct daisy_speed_step step;
+
+		hz = clk_hz / cdiv;
+		if (hz > max_hz)
+			break;
+		daisy_set_speed(spi, hz);
+		step.hz = hz;
+		step.errors = 0;
+		for (round = 0; round < CALIBRATE_ROUNDS; ++round) {
+			for (i = 0; i < CALIBRATE_LEN; ++i) {
+				switch (round % 4) {
+				case 0:  pattern[i] = (i % 2) ? 0x55 : 0xaa; break;
+				case 1:  pattern[i] = 1 << ((round + i) % 8); break;
+				case 2:  pattern[i] = (i % 2) ? 0xff : 0x00; break;
+				default: pattern[i] = round * 37 + i * 101;  break;
+				} // end switch //
+			} // end for //
+			step.errors += calibrate_pattern(dd, pattern);
+		} // end for //
+		// Time a burst of the size of the FIFO transfers, reading from
+		// the header registers on (no register that clears on read):
+		memset(tx, 0x00, sizeof(tx));
+		tx[0] = CALIBRATE_REG;
+		{
+			ktime_t t0 = ktime_get();
+			daisy_transfer(dd, tx, rx, IO_MAX);
+			step.transfer_ns = ktime_to_ns(ktime_sub(ktime_get(), t0));
+		}
+		if (steps && (n < n_steps))
+			steps[n++] = step;
+		printk(KERN_DEBUG DRV_NAME
+				": SPI %u Hz: %u errors, %u ns/%d octets\n",
+				hz, step.errors, step.transfer_ns, IO_MAX);
+		if (step.errors)
+			break;
+		prev = good;
+		good = hz;
+	} // end for //
+
+	// One step below the fastest clean one as safety margin:
+	best = prev ? prev : good;
+	daisy_set_speed(spi, best ? best : clk_hz / CALIBRATE_SLOWEST);
+	save[0] = CALIBRATE_REG | 0x80;
+	daisy_transfer(dd, save, x, CALIBRATE_LEN+1);
+	return best;
+}
+EXPORT_SYMBOL_GPL(daisy_calibrate_speed);
+
 bool tx_low_water_dn(struct daisy_dev *dd) {
 	if (!dd)
 		return 0;
@@ -306,6 +634,13 @@ bool tx_low_water_up(struct daisy_dev *dd) {
 }
 EXPORT_SYMBOL_GPL(tx_low_water_up);
 
+int daisy_tx_room(struct daisy_dev *dd) {
+	if (!dd)
+		return 0;
+	return dd->tx_queue->sem.count;
+}
+EXPORT_SYMBOL_GPL(daisy_tx_room);
+
 void daisy_transfer(struct daisy_dev *dd,
 			const volatile uint8_t   *tx,
 				  volatile uint8_t   *rx,
@@ -331,7 +666,7 @@ static int daisy_spi_transfer_one(
 
 		/* Only set speed, if this time is different than last time */
 		if (spi_hz != spi->spi_hz) {
-			uint32_t spi_used_hz = daisy_set_speed(spi, spi->spi_hz);
+			uint32_t spi_used_hz = daisy_set_speed(spi, spi_hz);
 			printk(KERN_DEBUG DRV_NAME ": SPI clock req: %d Hz, got %d Hz\n",
 					spi_hz, spi_used_hz);
 		}
@@ -45,7 +45,7 @@ struct rx_queue {
 	struct list_head   free;
 	struct list_head   fifo;
 	struct semaphore   sem;
-	spinlock_t         lock;
+	spinlock_t         lock;    // Taken by the IRQ handler too
 	size_t             size;
 	struct rx_entry    data[0]; // Hack: dynamically allocation
 };
@@ -77,14 +77,15 @@ void rx_queue_del(struct rx_queue *q);
  */
 static inline struct rx_entry *rx_entry_new(struct rx_queue *q) {
 	struct rx_entry  *e = NULL;
+	unsigned long     flags;
 
-	spin_lock(&q->lock);
+	spin_lock_irqsave(&q->lock, flags);
 	/**/ if (!list_empty(&q->free)) {
 	/**/ 	struct list_head *_e = q->free.next;
 	/**/ 	e = list_entry(_e, struct rx_entry, list);
 	/**/ 	list_del_init(_e);
 	/**/ }
-	spin_unlock(&q->lock);
+	spin_unlock_irqrestore(&q->lock, flags);
 	return e;
 }
 
@@ -95,10 +96,11 @@ static inline struct rx_entry *rx_entry_new(struct rx_queue *q) {
  */
 static inline void rx_entry_del(struct rx_entry *e) {
 	struct rx_queue *q = e->queue;
+	unsigned long    flags;
 
-	spin_lock(&q->lock);
+	spin_lock_irqsave(&q->lock, flags);
 	/**/ list_add_tail(&e->list, &q->free);
-	spin_unlock(&q->lock);
+	spin_unlock_irqrestore(&q->lock, flags);
 }
 
 /**
@@ -108,11 +110,12 @@ static inline void rx_entry_del(struct rx_entry *e) {
  */
 static inline void rx_entry_put(struct rx_entry *e) {
 	struct rx_queue *q = e->queue;
+	unsigned long    flags;
 
-	spin_lock(&q->lock);
+	spin_lock_irqsave(&q->lock, flags);
 	/**/ list_add_tail(&e->list, &q->fifo);
 	/**/ up(&q->sem);
-	spin_unlock(&q->lock);
+	spin_unlock_irqrestore(&q->lock, flags);
 }
 
 /**
@@ -125,17 +128,18 @@ static inline void rx_entry_put(struct rx_entry *e) {
  */
 static inline struct rx_entry *rx_entry_get(struct rx_queue *q) {
 	struct rx_entry  *e = NULL;
+	unsigned long     flags;
 	int               d = down_interruptible(&q->sem);
 
 	if (d)
 		return NULL;
-	spin_lock(&q->lock);
+	spin_lock_irqsave(&q->lock, flags);
 	/**/ if (!list_empty(&q->fifo)) {
 	/**/ 	struct list_head *_e = q->fifo.next;
 	/**/ 	e = list_entry(_e, struct rx_entry, list);
 	/**/ 	list_del_init(_e);
 	/**/ }
-	spin_unlock(&q->lock);
+	spin_unlock_irqrestore(&q->lock, flags);
 	if (!e)
 		printk(KERN_ERR "spi-daisy: rx_entry_get() inconsistency\n");
 	printk(KERN_DEBUG "spi-daisy: rx_entry_get() semaphore is %i\n",
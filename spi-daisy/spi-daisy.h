@@ -20,26 +20,151 @@
 #define _SPI_DAISY_H_
 
 #include <linux/module.h>
+#include <linux/crc-ccitt.h>
 
 #define DRV_NAME	"spi-daisy"
 
 #define MIN_SPEED_HZ         50000
-#define MAX_SPEED_HZ        500000
+#define MAX_SPEED_HZ      32000000 // Ceiling of daisy_calibrate_speed()
 #define N_SLOTS                  2
 #define MAX_PKG_LEN            256
 
 #define DEFAULT_RX_QUEUE_SIZE   16
-#define DEFAULT_TX_QUEUE_SIZE   16
+#define DEFAULT_TX_FRAGMENTS     7 // Of a full MTU frame, see driver/frag.h
+#define DEFAULT_TX_FRAMES        8 // Full MTU frames in the TX queue
+#define DEFAULT_TX_QUEUE_SIZE (DEFAULT_TX_FRAMES * DEFAULT_TX_FRAGMENTS)
 #define DEFAULT_TX_LOW_WATER_DN  2
 #define DEFAULT_TX_LOW_WATER_UP  6
+#define DEFAULT_TX_QUANTUM (MAX_PKG_LEN + 1) // Per weight and round, in octets
 #define DEFAULT_TIMER_TICK      25
 #define DEFAULT_TX_TIMEOUT     250
+#define DEFAULT_CSMA_SLOT        1 // In jiffies
+#define DEFAULT_CSMA_CW_MIN      3 // Contention window in slots
+#define DEFAULT_CSMA_CW_MAX     63
+#define DEFAULT_CCA_MARGIN      12 // RSSI steps (0.5dB) above noise floor
+#define DEFAULT_CCA_MIN         20 // Lowest RSSI threshold
+#define DEFAULT_CCA_STUCK     1000 // Busy samples until the floor rises
+#define DEFAULT_TX_BURST         8 // Frames sent in one transmission
+#define DEFAULT_DATA_RATE     4800 // In bps
+
+#define DAISY_HEADER_BROADCAST 0xffff
+
+/*
+ * Daisy L2 header, sent instead of the Ethernet header: Flags, the
+ * station ID of the destination and of the source and a protocol code.
+ * The station ID is the header address of the MAC address (see
+ * daisy_header_address()), the full addresses follow only with the
+ * DAISY_L2_LONG_* flags. With DAISY_L2_P_RAW the Ethernet type follows.
+ */
+#define DAISY_L2_HLEN            6
+#define DAISY_L2_LONG_SRC     0x80 // Source MAC follows
+#define DAISY_L2_LONG_DST     0x40 // Destination MAC follows
+#define DAISY_L2_COMPRESSED   0x20 // Payload compressed, see driver/pc.h
+#define DAISY_L2_RELAY        0x10 // Relay header follows, see driver/fwd.h
+#define DAISY_L2_NEED_SRC     0x08 // Receiver lost the source MAC of ours
+#define DAISY_L2_P_RAW        0x00
+#define DAISY_L2_P_IP         0x01
+#define DAISY_L2_P_ARP        0x02
+#define DAISY_L2_P_IPV6       0x03
+#define DAISY_L2_P_FRAG       0x04 // See driver/frag.h
+#define DAISY_L2_P_HC         0x05 // See driver/hc.h
+
+/*
+ * TX bands: Control frames are sent first, the other bands share the
+ * rest by deficit round robin with the weights 4:2:1.
+ */
+#define DAISY_TX_BANDS           4
+#define DAISY_BAND_CONTROL       0 // Routing, ARP, ND, MAC frames
+#define DAISY_BAND_INTERACTIVE   1 // SSH, DNS, voice
+#define DAISY_BAND_BULK          2 // Best effort
+#define DAISY_BAND_BACKGROUND    3
 
 struct daisy_dev;
 struct daisy_spi;
+
+/**
+ * Header address of a MAC address, also used as station ID: The
+ * CRC-16/CCITT of the address, no octet is 0xff as the chip checks
+ * broadcast octet by octet.
+ * @param addr       MAC address.
+ * @return           Header address.
+ */
+static inline uint16_t daisy_header_address(const uint8_t *addr)
+{
+	uint16_t crc = crc_ccitt(0xffff, addr, 6);
+
+	if ((crc & 0xff00) == 0xff00)
+		crc &= 0xfeff;
+	if ((crc & 0x00ff) == 0x00ff)
+		crc &= 0xfffe;
+	return crc;
+}
 struct sk_buff;
 struct net_device_stats;
 
+/**
+ * Counters of the channel access (listen before talk).
+ */
+struct daisy_csma_stats {
+	uint32_t deferrals;   // Channel busy when a frame was ready
+	uint32_t backoffs;    // Random backoffs started
+	uint32_t collisions;  // Frames reported without acknowledge
+	uint32_t acks;        // Frames reported with acknowledge
+	uint8_t  noise_floor; // Noise floor estimate in RSSI steps
+	uint8_t  threshold;   // Current clear channel threshold (0x27)
+	uint16_t cw;          // Current contention window in slots
+};
+
+/**
+ * Counters of the transmitter. Frames of a burst are chained in the TX
+ * FIFO and sent without gap, the gap is measured between bursts. The
+ * switch times are host times (SPI writes), the settling of the radio
+ * after them is not visible to the driver.
+ */
+struct daisy_tx_stats {
+	uint32_t frames;      // Frames sent
+	uint32_t bursts;      // Transmissions started
+	uint32_t chained;     // Frames preloaded behind the previous one
+	uint32_t gap_us;      // Average gap between bursts
+	uint32_t gap_min_us;  // Shortest gap between bursts
+	uint32_t burst_bps;   // Throughput of the last burst
+	uint32_t burst_bps_max;
+	uint32_t rx_switch_us;  // Average from PKSENT served to RX mode written
+	uint32_t rx_switch_max_us;
+	uint32_t tx_load_us;    // Average from the start to the filled FIFO
+	uint32_t tx_load_max_us;
+};
+
+/**
+ * Counters of the superseded TCP ACKs (see daisy_try_write_superseding()).
+ */
+struct daisy_ack_stats {
+	uint32_t queued;      // Frames written superseding
+	uint32_t superseded;  // Frames dropped from the TX queue
+	uint32_t octets;      // Their payload octets
+	uint32_t airtime_us;  // Their airtime
+};
+
+/**
+ * Counters of the packet handler header.
+ */
+struct daisy_header_stats {
+	uint32_t unicast;     // Frames sent with a unicast header
+	uint32_t broadcast;   // Frames sent with the broadcast header
+};
+
+/**
+ * Counters of the FIFO threshold tuning.
+ */
+struct daisy_fifo_stats {
+	uint32_t services;    // FIFO interrupts served
+	uint32_t faults;      // Over- and underflows
+	uint32_t latency_ns;  // Service latency estimate (srtt + 4 * rttvar)
+	uint8_t  tx_almost_empty;
+	uint8_t  rx_almost_full;
+	uint8_t  margin;      // Factor on the latency
+};
+
 /**
  * Open a daisy device. Use daisy_close_handle() to release the device.
  * @param slot SPI slot (chip select line) of the SPI device.
@@ -74,10 +199,41 @@ extern void daisy_transfer(struct daisy_dev *dd, const volatile uint8_t *tx,
 extern void daisy_close_device(struct daisy_dev *bs);
 
 /**
- * Synchronous read from the daisy device.
+ * Register the counters of the net_device, spi-daisy counts its TX
+ * errors there.
+ * @param dd         Daisy device.
+ * @param stats      Counters of the net_device, NULL for none.
+ */
+extern void daisy_register_stats(struct daisy_dev *dd,
+								 struct net_device_stats *stats);
+
+/**
+ * Receive a frame as if it came from the radio, daisy_read() returns
+ * it. Drives the receive path of the driver without a second station.
+ * With the module parameter loopback every frame written is injected
+ * instead of being sent.
+ * @param dd         Daisy device.
+ * @param skb        Frame with the L2 header, freed on success.
+ * @return           Number of bytes injected or a negative error code.
+ */
+extern int daisy_inject(struct daisy_dev *dd, struct sk_buff *skb);
+
+/**
+ * Register a function, that is called when a frame has left the TX
+ * queue. It runs in interrupt context, the driver wakes its queues
+ * there.
+ * @param dd         Daisy device.
+ * @param tx_done    Function to call, NULL for none.
+ * @param ctx        Argument of tx_done.
+ */
+extern void daisy_register_tx_done(struct daisy_dev *dd,
+								   void (*tx_done)(void *ctx), void *ctx);
+
+/**
+ * Synchronous read from the daisy device. Blocks until a frame is
+ * received or daisy_interrupt_read() is called. MAC frames of the
+ * polled MAC are not returned.
  * @param dd         Daisy device to read from.
- * @param pb         Pointer to a suitable receive buffer.
- * @param cb         Size of the receive buffer.
  * @return           Received sk_buff or NULL in the case of error.
  */
 extern struct sk_buff *daisy_read(struct daisy_dev *dd);
@@ -87,12 +243,11 @@ extern struct sk_buff *daisy_read(struct daisy_dev *dd);
  * @param dd         Daisy device to write to.
  * @param skb        Socket buffer to write. If daisy_write() succeeds
  *                   you take the responsibility of skb over to spi-daisy.
- * @param priority   When set send messages before messages sent without
- *                   priority.
+ * @param band       TX band, one of DAISY_BAND_*.
  * @return           Number of bytes written or a negative error code on error.
  */
 extern int daisy_write(struct daisy_dev *dd, struct sk_buff *skb,
-					   bool priority);
+					   int band);
 
 /**
  * Check if a subsequent write would be successful.
@@ -106,13 +261,36 @@ extern bool daisy_can_write(struct daisy_dev *dd);
  * @param dd         Daisy device to write to.
  * @param skb        Socket buffer to write. If daisy_write() succeeds
  *                   you take the responsibility of skb over to spi-daisy.
- * @param priority   When set send messages before messages sent without
- *                   priority.
+ * @param band       TX band, one of DAISY_BAND_*.
  * @return           Number of bytes written, -EAGAIN when no write buffer
  *                   is available or another negative error code on error.
  */
 extern int daisy_try_write(struct daisy_dev *dd, struct sk_buff *skb,
-					       bool priority);
+					       int band);
+
+/**
+ * Write a frame, that supersedes older frames of the same flow, like a
+ * cumulative TCP ACK: If a frame of the flow with an older sequence is
+ * still waiting in the TX queue, it is dropped and the new frame takes
+ * its place. Does not block.
+ * @param dd         Daisy device to write to.
+ * @param skb        Socket buffer to write, see daisy_try_write().
+ * @param flow       Flow of the frame, not 0.
+ * @param seq        Position in the flow, compared modulo 2^32.
+ * @param band       TX band, one of DAISY_BAND_*.
+ * @return           Number of bytes written, -EAGAIN when no write buffer
+ *                   is available or another negative error code on error.
+ */
+extern int daisy_try_write_superseding(struct daisy_dev *dd,
+		struct sk_buff *skb, uint32_t flow, uint32_t seq, int band);
+
+/**
+ * Get the counters of the superseded frames.
+ * @param dd         Daisy device to query.
+ * @param stats      Receives the counters.
+ */
+extern void daisy_get_ack_stats(struct daisy_dev *dd,
+								struct daisy_ack_stats *stats);
 
 /**
  * Interrupt a pending read.
@@ -120,6 +298,112 @@ extern int daisy_try_write(struct daisy_dev *dd, struct sk_buff *skb,
  */
 extern void daisy_interrupt_read(struct daisy_dev *dd);
 
+/**
+ * Channel access modes.
+ */
+enum daisy_mac_mode {
+	MAC_CSMA,    // Listen before talk
+	MAC_AP,      // Access station, polls the stations
+	MAC_STATION  // Sends only when polled by the access station
+};
+
+/**
+ * Counters of the polled MAC.
+ */
+struct daisy_mac_stats {
+	uint32_t polls;       // Polls sent (AP) or received (station)
+	uint32_t grants;      // TXOPs granted (AP) or used (station)
+	uint32_t reports;     // Reports received (AP) or sent (station)
+	uint32_t missed;      // Grants without report (AP)
+	uint32_t rtt_us;      // Last round trip measured (AP)
+};
+
+/**
+ * Set the channel access mode, after daisy_open_device() and before
+ * daisy_device_up().
+ * @param dd         Daisy device.
+ * @param mode       The new mode.
+ * @param addr       Station ID of the L2 header (not MAC_BROADCAST).
+ * @param bps        Data rate of the channel, for the TXOP airtime.
+ */
+extern void daisy_set_mac_mode(struct daisy_dev *dd,
+							   enum daisy_mac_mode mode,
+							   uint16_t addr, uint32_t bps);
+
+/**
+ * Get the counters of the polled MAC.
+ * @param dd         Daisy device to query.
+ * @param stats      Receives the counters.
+ */
+extern void daisy_get_mac_stats(struct daisy_dev *dd,
+								struct daisy_mac_stats *stats);
+
+/**
+ * Report the outcome of a frame, that expects an acknowledge, to the
+ * channel access: A missing acknowledge counts as collision and doubles
+ * the contention window, an acknowledge resets it. The CSMA mode calls
+ * it for unicast frames to a station (see mac.h), the polled MAC for
+ * the reports sent in the open grant.
+ * @param dd         Daisy device the frame was sent with.
+ * @param acked      True if the acknowledge was received.
+ */
+extern void daisy_ack_result(struct daisy_dev *dd, bool acked);
+
+/**
+ * Get the counters of the channel access.
+ * @param dd         Daisy device to query.
+ * @param stats      Receives the counters.
+ */
+extern void daisy_get_csma_stats(struct daisy_dev *dd,
+								 struct daisy_csma_stats *stats);
+
+/**
+ * Get the counters of the transmitter.
+ * @param dd         Daisy device to query.
+ * @param stats      Receives the counters.
+ */
+extern void daisy_get_tx_stats(struct daisy_dev *dd,
+							   struct daisy_tx_stats *stats);
+
+/**
+ * Set the data rate of the chip. It is used for the FIFO thresholds and
+ * the TXOP airtime of the polled MAC. Call it after daisy_open_device()
+ * and daisy_set_mac_mode().
+ * @param dd         Daisy device.
+ * @param bps        Data rate in bps.
+ */
+extern void daisy_set_data_rate(struct daisy_dev *dd, uint32_t bps);
+
+/**
+ * Get the counters of the FIFO threshold tuning.
+ * @param dd         Daisy device to query.
+ * @param stats      Receives the counters.
+ */
+extern void daisy_get_fifo_stats(struct daisy_dev *dd,
+								 struct daisy_fifo_stats *stats);
+
+/**
+ * Set the address of the packet handler. It sends a header derived from
+ * the destination MAC with every frame, frames are at most 255 octets
+ * long. With the filter the chip drops received unicast frames for
+ * other addresses, a bridge has to turn it off. Takes effect with the
+ * next daisy_device_up().
+ * @param dd         Daisy device.
+ * @param addr       Our MAC address, NULL for none (no filter).
+ * @param network    Network ID sent in the sync word, 0 for none.
+ * @param filter     Drop unicast frames for other addresses.
+ */
+extern void daisy_set_address(struct daisy_dev *dd, const uint8_t *addr,
+							  uint16_t network, bool filter);
+
+/**
+ * Get the counters of the hardware address filter.
+ * @param dd         Daisy device to query.
+ * @param stats      Receives the counters.
+ */
+extern void daisy_get_header_stats(struct daisy_dev *dd,
+								   struct daisy_header_stats *stats);
+
 /**
  * Get the controller for a daisy device.
  */
@@ -132,6 +416,33 @@ extern struct daisy_spi *daisy_get_controller(struct daisy_dev *dev);
 extern uint32_t daisy_set_speed(struct daisy_spi *spi,
 									   uint32_t   spi_hz);
 
+/**
+ * One step of daisy_calibrate_speed().
+ */
+struct daisy_speed_step {
+	uint32_t hz;          // Clock of the step
+	uint32_t errors;      // Octets read back wrong
+	uint32_t transfer_ns; // Of a burst of IO_MAX octets
+};
+
+/**
+ * Find the fastest reliable SPI clock: The clock divider is stepped from
+ * slow to fast, at every step patterns are written to the header
+ * registers (0x3a..0x42) and read back, in single and in burst
+ * transfers. The calibration stops at the first step with errors and
+ * sets the speed one step below the fastest clean one. The header
+ * registers are restored afterwards.
+ * @param dd         Daisy device to calibrate.
+ * @param max_hz     Fastest clock to try.
+ * @param steps      Receives the result of every step tried, may be NULL.
+ * @param n_steps    Size of steps.
+ * @return The speed set, 0 if not even the slowest step was clean (the
+ *         speed is left at the slowest step then).
+ */
+extern uint32_t daisy_calibrate_speed(struct daisy_dev *dd, uint32_t max_hz,
+									  struct daisy_speed_step *steps,
+									  int n_steps);
+
 /**
  * Lock speed for a controller, so that no automatic adaption by the
  * SPI subsystem can be occur.
@@ -268,6 +579,25 @@ static inline void daisy_clear_rx_fifo(struct daisy_dev *dd)
 	daisy_transfer(dd, x2, x1, 2);
 }
 
+/**
+ * Switch the operating mode and clear a FIFO with two writes and no read
+ * back: The clear bit is set in the second control register, then both
+ * control registers are written in one burst.
+ */
+static inline void daisy_switch_mode(struct daisy_dev *dd,
+											uint8_t    mode1,
+											uint8_t    mode2,
+											uint8_t    clear)
+{
+	uint8_t x1[3] = { 0x88, mode2 | clear, 0x00  };
+	uint8_t x2[3] = { 0x00, 0x00,          0x00  };
+	daisy_transfer(dd, x1, x2, 2);
+	x1[0] = 0x87;
+	x1[1] = mode1;
+	x1[2] = mode2;
+	daisy_transfer(dd, x1, x2, 3);
+}
+
 /**
  * Clear TX FIFO.
  */
@@ -301,4 +631,12 @@ extern bool tx_low_water_dn(struct daisy_dev *dd);
  */
 extern bool tx_low_water_up(struct daisy_dev *dd);
 
+/**
+ * Get the number of free entries in the TX queue, that is how many
+ * frames can be written without blocking.
+ * @param dd Daisy device to query.
+ * @return Number of free TX entries.
+ */
+extern int daisy_tx_room(struct daisy_dev *dd);
+
 #endif /* _SPI_DAISY_H_ */
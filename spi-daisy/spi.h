@@ -24,6 +24,8 @@
 
 #include "bcm2835_hw.h"
 #include "ev_queue.h"
+#include "spi-daisy.h"
+#include "mac.h"
 
 #define GPIO_SLOT0_PIN     RPI_GPIO_P1_15
 #define GPIO_SLOT0_DESC    "DAISY Interrupt line"
@@ -89,6 +91,9 @@
 #define RFM22B_RXMPK               (1<<4)
 #define RFM22B_ANTDIV              (1<<5)
 
+// Operating mode 2 while the device is up:
+#define RFM22B_OP_MODE_2           (RFM22B_RXMPK | RFM22B_AUTOTX)
+
 #define RFM22B_REG_RSSI             0x26
 
 #define RFM22B_REG_RSSI_TH          0x27
@@ -105,8 +110,25 @@
 #define RFM22B_LSBFRST             (1<<6)
 #define RFM22B_ENPACRX             (1<<7)
 
+#define RFM22B_REG_HEADER_CONTROL_1 0x32
+#define RFM22B_BCEN_32              0xc0 // Broadcast on header 3..2
+#define RFM22B_HDCH_32              0x0c // Check header 3..2
+
+#define RFM22B_REG_HEADER_CONTROL_2 0x33
+#define RFM22B_HDLEN_3210           0x40 // Header 3..0 sent
+#define RFM22B_SYNCLEN_32           0x02 // Sync word 3..2
+#define RFM22B_SYNCLEN_3210         0x06 // Sync word 3..0
+
+#define RFM22B_REG_SYNC_WORD_1      0x38
+#define RFM22B_REG_TX_HEADER_3      0x3a
+
 #define RFM22B_TXPKLEN              0x3e
 
+#define RFM22B_RXPKLEN              0x4b
+
+#define RFM22B_REG_CHECK_HEADER_3   0x3f
+#define RFM22B_REG_HEADER_ENABLE_3  0x43
+
 #define RFM22B_REG_MOD_MODE_2       0x71
 #define RFM22B_MODTYP_MASK          0x03
 #define RFM22B_MODTYP_UNMODULATED   0x00
@@ -126,12 +148,18 @@
 #define RFM22B_TRCLK_TX_DCLK_SDO    0x80
 #define RFM22B_TRCLK_TX_DCLK_NIRQ   0xc0
 
+#define RFM22B_REG_TX_FIFO_AE       0x7d
+#define RFM22B_REG_RX_FIFO_AF       0x7e
+#define RFM22B_FIFO_SIZE            64
+
 #define RFM22B_REG_FIFO             0x7f
 #define RFM22B_WRITE_FLAG           0x80
 
 #define RFM22B_ENINTR \
 	(RFM22B_ENPOR\
 	|RFM22B_ENCHIPRDY\
+	|RFM22B_ENRSSI\
+	|RFM22B_ENPREAVAL\
 	|RFM22B_ENSWDET\
 	|RFM22B_ENCRCERROR\
 	|RFM22B_ENPKVALID\
@@ -141,9 +169,7 @@
 	|RFM22B_ENTXFFAFULL\
 	|RFM22B_ENFFERR)
 
-	//RFM22B_ENRSSI      |
 	//RFM22B_ENPREAINVAL |
-	//RFM22B_ENPREAVAL   |
 
 struct net_device_stats;
 
@@ -163,11 +189,67 @@ struct daisy_spi {
 	bool                     speed_lock;
 };
 
+/*
+ * State of the channel access. The RSSI threshold of the chip follows
+ * the noise floor, the RSSI and preamble interrupts mark the channel
+ * busy for a slot.
+ */
+struct daisy_csma {
+	volatile unsigned long   busy_until;  // Carrier seen by interrupt
+	u16                      noise_floor; // RSSI << 4
+	u16                      backoff;     // Remaining slots
+	unsigned long            slot_end;    // Of the current slot, jiffies
+	u16                      busy_run;    // Busy samples in a row
+	struct daisy_csma_stats  stats;
+};
+
+/*
+ * The current transmission. While the tail of a frame drains from the
+ * TX FIFO the next one is preloaded, so the transmitter stays on for
+ * the whole burst.
+ */
+struct daisy_burst {
+	ktime_t                  start;       // Of the transmission
+	ktime_t                  last_end;    // Of the previous one
+	u32                      octets;
+	u8                       frames;
+	u8                       sent;        // PKSENT seen
+	struct daisy_tx_stats    stats;
+};
+
+/*
+ * Tuning of the FIFO thresholds: The service latency of the FIFO
+ * interrupts is estimated like a TCP round trip, the thresholds leave
+ * room for the octets sent or received within that time (see fifo.h).
+ */
+struct daisy_fifo {
+	ktime_t                  irq_time;    // Entry of the interrupt handler
+	u32                      byte_ns;     // At the data rate
+	u32                      srtt;        // In ns
+	u32                      rttvar;      // In ns
+	u16                      clean;       // Services since the last fault
+	struct daisy_fifo_stats  stats;
+};
+
+/*
+ * The packet handler and the hardware address filter, see header.h. It
+ * is programmed by daisy_device_up().
+ */
+struct daisy_header {
+	bool                     filter;      // Drop unicast for others
+	u16                      addr;        // Our header address
+	u16                      network;     // In sync word 1..0, 0 for none
+	struct daisy_header_stats stats;
+};
+
 struct daisy_dev {
 	struct kobject          *kobj;
 	struct daisy_spi        *spi;
 	struct spi_device       *dev;
 	struct spi_master       *master;
+	struct net_device_stats *stats;       // Of the driver, may be NULL
+	void                   (*tx_done)(void *ctx);
+	void                    *tx_done_ctx;
 	struct rx_queue         *rx_queue;
 	struct tx_queue         *tx_queue;
 	uint16_t                 slot;
@@ -177,15 +259,21 @@ struct daisy_dev {
 	struct tasklet_struct    tasklet;
 	struct timer_list        watchdog;
 	volatile unsigned long   timeout;
-	union {
-		struct tx_entry         *tx_entry;
-		struct rx_entry         *rx_entry;
-	};
+	struct tx_entry         *tx_entry;
 	int                      pkg_idx;
+	// The frame being received, it may be cut by the next transmission:
+	struct rx_entry         *rx_entry;
+	int                      rx_idx;      // Octets read from the FIFO
+	struct daisy_csma        csma;
+	struct daisy_burst       burst;
+	struct daisy_fifo        fifo;
+	struct daisy_header      header;
+	struct daisy_mac         mac;
+	struct daisy_ack_stats   ack_stats;
 };
 
 extern irqreturn_t irq_handler(int irq, void *_dd, struct pt_regs *regs);
 extern void tasklet(unsigned long _dd);
-extern void watchdog(unsigned long _dd);
+extern void watchdog(struct timer_list *t);
 
 #endif //_SPI_H_//
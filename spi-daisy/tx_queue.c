@@ -35,7 +35,8 @@ struct tx_queue *tx_queue_new(size_t size) {
 
 	INIT_LIST_HEAD(&q->free);
 	INIT_LIST_HEAD(&q->prio);
-	INIT_LIST_HEAD(&q->fifo);
+	for (i = 0; i < TX_FIFOS; i++)
+		INIT_LIST_HEAD(&q->fifo[i]);
 	sema_init(&q->sem, size);
 	spin_lock_init(&q->lock);
 	q->size = size;
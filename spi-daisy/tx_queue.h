@@ -26,7 +26,8 @@
 
 #include "spi-daisy.h"
 
-#define MAX_PKG_SIZE 2000
+#define MAX_PKG_SIZE (MAX_PKG_LEN + 1) // FIFO command octet and frame
+#define TX_FIFOS     (DAISY_TX_BANDS - 1) // Control uses prio
 
 struct tx_queue;
 struct sk_buff;
@@ -38,6 +39,8 @@ struct tx_entry {
 	struct list_head   list;
 	struct tx_queue   *queue;
 	u16                pkg_len;
+	u32                flow;       // Superseding flow, 0 for none
+	u32                seq;        // Position in the flow
 	u8                 pkg[MAX_PKG_SIZE];
 };
 
@@ -46,7 +49,9 @@ struct tx_entry {
  */
 struct tx_queue {
 	struct list_head   free;
-	struct list_head   fifo;
+	struct list_head   fifo[TX_FIFOS];
+	u32                deficit[TX_FIFOS];
+	int                cur;        // FIFO served by the round robin
 	struct list_head   prio;
 	struct semaphore   sem;
 	spinlock_t         lock;
@@ -90,6 +95,7 @@ static inline struct tx_entry *tx_entry_new(struct tx_queue *q) {
 	/**/ 	struct list_head *_e = q->free.next;
 	/**/ 	e = list_entry(_e, struct tx_entry, list);
 	/**/ 	list_del_init(_e);
+	/**/ 	e->flow = 0;
 	/**/ }
 	spin_unlock(&q->lock);
 	if (!e)
@@ -115,6 +121,7 @@ static inline struct tx_entry *tx_entry_try_new(struct tx_queue *q) {
 	/**/ 	struct list_head *_e = q->free.next;
 	/**/ 	e = list_entry(_e, struct tx_entry, list);
 	/**/ 	list_del_init(_e);
+	/**/ 	e->flow = 0;
 	/**/ }
 	spin_unlock(&q->lock);
 	//printk(KERN_DEBUG "spi-daisy: tx_entry_try_new() semaphore is %i\n",
@@ -137,21 +144,95 @@ static inline void tx_entry_del(struct tx_entry *e) {
 }
 
 /**
- * Put tx_entry to the end of the input FIFO, so that it will be processed
- * after all entries put before.
+ * Get the list of a TX band, q->lock must be held.
+ * @param q Pointer to the tx_queue.
+ * @param band TX band, one of DAISY_BAND_*, others are bulk.
+ * @return The list.
+ */
+static inline struct list_head *tx_queue_band(struct tx_queue *q, int band) {
+	if (band == DAISY_BAND_CONTROL)
+		return &q->prio;
+	if ((band < 0) || (band >= DAISY_TX_BANDS))
+		band = DAISY_BAND_BULK;
+	return &q->fifo[band - 1];
+}
+
+/**
+ * Select the list to serve next, q->lock must be held: prio first, then
+ * the FIFOs by deficit round robin. Selecting again without getting an
+ * entry returns the same list.
+ * @param q Pointer to the tx_queue.
+ * @return The list or NULL, if all are empty.
+ */
+static inline struct list_head *tx_queue_select(struct tx_queue *q) {
+	struct list_head *l;
+	int i;
+
+	if (!list_empty(&q->prio))
+		return &q->prio;
+	// A quantum holds the longest entry, so one round is enough:
+	for (i = 0; i <= 2 * TX_FIFOS; i++) {
+		l = &q->fifo[q->cur];
+		if (list_empty(l))
+			q->deficit[q->cur] = 0;
+		else if (list_first_entry(l, struct tx_entry, list)->pkg_len <=
+				q->deficit[q->cur])
+			return l;
+		q->cur = (q->cur + 1) % TX_FIFOS;
+		q->deficit[q->cur] += DEFAULT_TX_QUANTUM << (TX_FIFOS - 1 - q->cur);
+	} // end for //
+	return NULL;
+}
+
+/**
+ * Put tx_entry to the end of the FIFO of its band, so that it will be
+ * processed after all entries of the band put before.
  * @param e Pointer to the tx_entry to put.
+ * @param band TX band, one of DAISY_BAND_*.
  */
-static inline void tx_entry_put(struct tx_entry *e, bool prio) {
+static inline void tx_entry_put(struct tx_entry *e, int band) {
 	struct tx_queue *q = e->queue;
 
 	spin_lock(&q->lock);
-	/**/ if (prio)
-	/**/ 	list_add_tail(&e->list, &q->prio);
-	/**/ else
-	/**/ 	list_add_tail(&e->list, &q->fifo);
+	/**/ list_add_tail(&e->list, tx_queue_band(q, band));
 	spin_unlock(&q->lock);
 }
 
+/**
+ * Put tx_entry to the input FIFO, superseding an entry of the same flow:
+ * If an entry with e->flow and an older e->seq is still waiting, e takes
+ * its place and the old one is returned to the free list. Otherwise e is
+ * put to the end of the FIFO of the band.
+ * @param e Pointer to the tx_entry to put, e->flow must not be 0.
+ * @param band TX band, one of DAISY_BAND_*.
+ * @return Payload octets of the entry superseded, 0 if there was none.
+ */
+static inline u16 tx_entry_put_supersede(struct tx_entry *e, int band) {
+	struct tx_queue *q = e->queue;
+	struct tx_entry *old = NULL, *i;
+	struct list_head *l;
+	u16 res = 0;
+
+	spin_lock(&q->lock);
+	/**/ l = tx_queue_band(q, band);
+	/**/ list_for_each_entry(i, l, list) {
+	/**/ 	if ((i->flow == e->flow) && ((s32)(e->seq - i->seq) > 0)) {
+	/**/ 		old = i;
+	/**/ 		break;
+	/**/ 	}
+	/**/ } // end for //
+	/**/ if (old) {
+	/**/ 	list_replace_init(&old->list, &e->list);
+	/**/ 	list_add_tail(&old->list, &q->free);
+	/**/ 	up(&q->sem);
+	/**/ 	res = old->pkg_len - 1;
+	/**/ } else {
+	/**/ 	list_add_tail(&e->list, l);
+	/**/ }
+	spin_unlock(&q->lock);
+	return res;
+}
+
 /**
  * Get a new tx_entry to be processed from the tx_queue. Do never try to
  * delete this tx_entry. Use tx_entry_del() to return this tx_entry to the
@@ -162,16 +243,15 @@ static inline void tx_entry_put(struct tx_entry *e, bool prio) {
  */
 static inline struct tx_entry *tx_entry_get(struct tx_queue *q) {
 	struct tx_entry  *e = NULL;
+	struct list_head *l;
 
 	spin_lock(&q->lock);
-	/**/ if (!list_empty(&q->prio)) {
-	/**/ 	struct list_head *_e = q->prio.next;
-	/**/ 	e = list_entry(_e, struct tx_entry, list);
-	/**/ 	list_del_init(_e);
-	/**/ } else if (!list_empty(&q->fifo)) {
-	/**/ 	struct list_head *_e = q->fifo.next;
-	/**/ 	e = list_entry(_e, struct tx_entry, list);
-	/**/ 	list_del_init(_e);
+	/**/ l = tx_queue_select(q);
+	/**/ if (l) {
+	/**/ 	e = list_first_entry(l, struct tx_entry, list);
+	/**/ 	list_del_init(&e->list);
+	/**/ 	if (l != &q->prio)
+	/**/ 		q->deficit[q->cur] -= e->pkg_len;
 	/**/ }
 	spin_unlock(&q->lock);
 	return e;
@@ -197,9 +277,49 @@ static inline void tx_entry_put_back(struct tx_entry *e) {
  */
 static inline bool tx_entry_can_get(struct tx_queue *q) {
 	bool res = 0;
+	int i;
+
+	spin_lock(&q->lock);
+	/**/ res = !list_empty(&q->prio);
+	/**/ for (i = 0; i < TX_FIFOS; i++)
+	/**/ 	res |= !list_empty(&q->fifo[i]);
+	spin_unlock(&q->lock);
+	return res;
+}
+
+/**
+ * Get the length of the tx_entry, that tx_entry_get() would return next.
+ * @param q Pointer to the tx_queue.
+ * @return Payload octets of the next tx_entry, 0 if there is none.
+ */
+static inline u16 tx_entry_peek_len(struct tx_queue *q) {
+	struct list_head *l;
+	u16 res = 0;
+
+	spin_lock(&q->lock);
+	/**/ l = tx_queue_select(q);
+	/**/ if (l)
+	/**/ 	res = list_first_entry(l, struct tx_entry, list)->pkg_len;
+	spin_unlock(&q->lock);
+	return res ? res - 1 : 0; // Without the FIFO command octet
+}
+
+/**
+ * Get the payload octets of all tx_entry waiting in the tx_queue.
+ * @param q Pointer to the tx_queue.
+ * @return Sum of the payload octets.
+ */
+static inline u32 tx_queue_octets(struct tx_queue *q) {
+	struct tx_entry *e;
+	u32 res = 0;
+	int i;
 
 	spin_lock(&q->lock);
-	/**/ res = !(list_empty(&q->prio) && list_empty(&q->fifo));
+	/**/ list_for_each_entry(e, &q->prio, list)
+	/**/ 	res += e->pkg_len - 1;
+	/**/ for (i = 0; i < TX_FIFOS; i++)
+	/**/ 	list_for_each_entry(e, &q->fifo[i], list)
+	/**/ 		res += e->pkg_len - 1;
 	spin_unlock(&q->lock);
 	return res;
 }
@@ -0,0 +1,115 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Stress the SPI transfers of two RFM22B instances from several threads
+ * and report the aggregate transactions per second. Every transaction
+ * reads the device type register and checks it.
+ *
+ * Usage: test0005 [<spidev A> [<spidev B> [<threads per chip> [<s>]]]]
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <atomic>
+
+#include <unistd.h>
+
+#include "rfm22b.h"
+#include "rfm22b_registers.h"
+#include "timer.h"
+
+#define SPI_DEVICE_A "/dev/spidev0.0"
+#define SPI_DEVICE_B "/dev/spidev0.1"
+#define RFM22B_ID 8
+
+using namespace std;
+using namespace RFM22B_NS;
+
+static atomic<bool>     stop { false };
+static atomic<uint64_t> transactions { 0 };
+static atomic<uint64_t> errors { 0 };
+
+static void hammer(RFM22B *chip) {
+	uint64_t n = 0, e = 0;
+	try {
+		while (!stop) {
+			if (chip->getRegister(RFM22B_Register::DEVICE_TYPE) != RFM22B_ID)
+				++e;
+			++n;
+		} // end while //
+	}
+	catch (exception& ex) {
+		cerr << "Error: " << ex.what() << endl;
+		++e;
+	}
+	transactions += n;
+	errors += e;
+}
+
+int main(int argc, char* argv[])
+{
+	cout << "Test0005" << endl;
+
+	const char *deva = (argc > 1) ? argv[1] : SPI_DEVICE_A;
+	const char *devb = (argc > 2) ? argv[2] : SPI_DEVICE_B;
+	int nthreads     = (argc > 3) ? atoi(argv[3]) : 4;
+	int seconds      = (argc > 4) ? atoi(argv[4]) : 10;
+
+	try {
+		RFM22B a, b;
+		if (!a.open(deva))
+			throw logic_error(string("Unable to open ") + deva);
+		if (!b.open(devb))
+			throw logic_error(string("Unable to open ") + devb);
+
+		vector<thread> threads;
+		Timer timer;
+		for (int i = 0; i < nthreads; ++i) {
+			threads.push_back(thread(hammer, &a));
+			threads.push_back(thread(hammer, &b));
+		} // end for //
+		sleep(seconds);
+		stop = true;
+		for (auto& t: threads)
+			t.join();
+		double elapsed = timer.elapsed();
+
+		cout << threads.size() << " threads on 2 chips, "
+			 << transactions << " transactions, "
+			 << errors << " errors" << endl;
+		cout << (uint64_t)(transactions / elapsed)
+			 << " transactions/s" << endl;
+		if (errors)
+			return(EXIT_FAILURE);
+	}
+	catch (exception& ex) {
+		cerr << "Error: " << ex.what() << endl;
+		return(EXIT_FAILURE);
+	}
+	catch (...) {
+		cerr << "Error: Unspecified" << endl;
+		return(EXIT_FAILURE);
+	}
+
+	return(EXIT_SUCCESS);
+}
@@ -0,0 +1,256 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Regression test of the modem calculator: The untrimmed output of the
+ * formulas is compared to the register tables of the vendor spreadsheet,
+ * that were used before. Registers without an entry in tolerances[] have
+ * to match exactly, the others within the documented tolerance. The trims
+ * of the presets have to give the table values, each with its reason, and
+ * may only touch registers with a tolerance. No hardware is needed.
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <exception>
+#include <map>
+
+#include "modem.h"
+
+using namespace std;
+using namespace RFM22B_NS;
+
+typedef map<uint8_t, uint8_t> table_type;
+
+// The modem registers of the former init_narrow, init_medium, init_wide:
+static const table_type narrow_table = {
+	{ 0x1c, 0x2B }, { 0x1d, 0x40 }, { 0x20, 0xF4 }, { 0x21, 0x20 },
+	{ 0x22, 0x20 }, { 0x23, 0xC5 }, { 0x24, 0x00 }, { 0x25, 0x26 },
+	{ 0x2a, 0x1D }, { 0x6e, 0x08 }, { 0x6f, 0x31 }, { 0x70, 0x2E },
+	{ 0x71, 0x23 }, { 0x72, 0x08 }, { 0x75, 0x53 }, { 0x76, 0x67 },
+	{ 0x77, 0xC0 }
+};
+
+static const table_type medium_table = {
+	{ 0x1c, 0x99 }, { 0x1d, 0x40 }, { 0x20, 0x3c }, { 0x21, 0x02 },
+	{ 0x22, 0x22 }, { 0x23, 0x22 }, { 0x24, 0x07 }, { 0x25, 0xff },
+	{ 0x2a, 0x48 }, { 0x6e, 0x19 }, { 0x6f, 0x9a }, { 0x70, 0x0d },
+	{ 0x71, 0x23 }, { 0x72, 0x50 }, { 0x75, 0x53 }, { 0x76, 0x67 },
+	{ 0x77, 0xc0 }
+};
+
+static const table_type wide_table = {
+	{ 0x1c, 0x89 }, { 0x1d, 0x40 }, { 0x20, 0x30 }, { 0x21, 0x02 },
+	{ 0x22, 0xaa }, { 0x23, 0xab }, { 0x24, 0x07 }, { 0x25, 0xff },
+	{ 0x2a, 0x48 }, { 0x6e, 0x40 }, { 0x6f, 0x00 }, { 0x70, 0x0d },
+	{ 0x71, 0x23 }, { 0x72, 0x50 }, { 0x75, 0x53 }, { 0x76, 0x67 },
+	{ 0x77, 0xc0 }
+};
+
+static table_type to_table(const ModemCalculator& m) {
+	table_type t;
+	for (const register_value& rv: m.getRegisters())
+		if (rv.setting[0])
+			t[rv.setting[0] & 0x7f] = rv.setting[1];
+	return t;
+}
+
+// A field of the modem registers, that the formulas do not reproduce
+// exactly:
+struct tolerance {
+	const char   *field;
+	uint8_t       regs[4];       // Registers of the field, 0 terminated
+	unsigned int (*value)(const table_type& t);
+	double        ratio;         // Max. ratio formula/table, 0: unchecked
+};
+
+static const tolerance tolerances[] = {
+	// The decimation of the IF filter sets the scale of rxosr and ncoff,
+	// so it has to match. The filset only selects the filter shape
+	// within it, and the narrow table uses filset 11, which is not in
+	// the AN440 table:
+	{ "ndec_exp/dwn3_bypass", { 0x1c },
+	  [](const table_type& t) -> unsigned int { return t.at(0x1c) & 0xf0; },
+	  1.0 },
+	{ "filset", { 0x1c },
+	  [](const table_type& t) -> unsigned int { return t.at(0x1c) & 0x0f; },
+	  0.0 },
+	// The narrow table sets rxosr for the doubled chip rate of Manchester
+	// coding, which it has switched off in 0x70, hence a factor of 2:
+	{ "rxosr", { 0x20, 0x21 },
+	  [](const table_type& t) -> unsigned int {
+		  return ((t.at(0x21) & 0xe0) << 3) | t.at(0x20); },
+	  2.0 },
+	{ "ncoff", { 0x21, 0x22, 0x23 },
+	  [](const table_type& t) -> unsigned int {
+		  return ((t.at(0x21) & 0x0f) << 16) | (t.at(0x22) << 8) |
+				 t.at(0x23); },
+	  1.0 },
+	// crgain is inversely proportional to rxosr, so it inherits the
+	// factor 2 above. With the rxosr of the table, the narrow table is
+	// still 1.36 times the formula, so a factor of 3 in total:
+	{ "crgain", { 0x24, 0x25 },
+	  [](const table_type& t) -> unsigned int {
+		  return ((t.at(0x24) & 0x07) << 8) | t.at(0x25); },
+	  3.0 },
+	// The medium and wide tables set enmanch, but the clock recovery is
+	// set for the uncoded chip rate, so the bit is not compared:
+	{ "0x70 without enmanch", { 0x70 },
+	  [](const table_type& t) -> unsigned int { return t.at(0x70) & 0xfe; },
+	  1.0 },
+	{ "enmanch", { 0x70 },
+	  [](const table_type& t) -> unsigned int { return t.at(0x70) & 0x01; },
+	  0.0 },
+};
+
+static bool has_tolerance(uint8_t reg) {
+	for (const tolerance& tol: tolerances)
+		for (const uint8_t *r = tol.regs; *r; ++r)
+			if (*r == reg)
+				return true;
+	return false;
+}
+
+static bool within(unsigned int is, unsigned int expected, double ratio) {
+	if (ratio == 0.0)
+		return true;
+	if (is == expected)
+		return true;
+	if ((is == 0) || (expected == 0))
+		return false;
+	double r = (is > expected) ? (double)is / expected :
+			(double)expected / is;
+	return r <= ratio;
+}
+
+static void show(const string& name, const char *what, uint8_t reg,
+		uint8_t is, uint8_t expected)
+{
+	cout << name << ": " << what << " 0x" << hex << setw(2)
+		 << setfill('0') << (int)reg << " is 0x" << setw(2) << (int)is
+		 << ", expected 0x" << setw(2) << (int)expected << dec << endl;
+}
+
+// Check the untrimmed output of the formulas against the vendor table
+// within the tolerances, and the trims to give the table:
+static int check(const string& name, const ModemCalculator& m,
+		const table_type& expected)
+{
+	int errors = 0;
+	table_type raw = to_table(m);
+	table_type trimmed;
+	for (const modem_trim& tr: m.getTrims()) {
+		raw[tr.reg] = tr.computed;
+		trimmed[tr.reg] = tr.value;
+	} // end for //
+
+	if (raw.size() != expected.size()) {
+		cout << name << ": " << raw.size() << " registers, expected "
+			 << expected.size() << endl;
+		return errors + 1;
+	}
+	for (auto& e: expected) {
+		if (!raw.count(e.first)) {
+			show(name, "missing", e.first, 0, e.second);
+			++errors;
+		}
+		else if (!has_tolerance(e.first) && (raw[e.first] != e.second)) {
+			show(name, "formula for", e.first, raw[e.first], e.second);
+			++errors;
+		}
+		if (trimmed.count(e.first) && (trimmed[e.first] != e.second)) {
+			show(name, "trim of", e.first, trimmed[e.first], e.second);
+			++errors;
+		}
+	} // end for //
+	if (errors)
+		return errors;
+
+	for (const tolerance& tol: tolerances) {
+		unsigned int is = tol.value(raw);
+		unsigned int should = tol.value(expected);
+		if (!within(is, should, tol.ratio)) {
+			cout << name << ": " << tol.field << " is " << is
+				 << ", expected " << should << " within a factor of "
+				 << tol.ratio << endl;
+			++errors;
+		}
+		else if (is != should) {
+			cout << name << ": " << tol.field << " is " << is
+				 << ", table " << should << endl;
+		}
+	} // end for //
+	for (const modem_trim& tr: m.getTrims()) {
+		cout << name << ": trim 0x" << hex << setw(2) << setfill('0')
+			 << (int)tr.reg << " 0x" << setw(2) << (int)tr.computed
+			 << " -> 0x" << setw(2) << (int)tr.value << dec << ": "
+			 << tr.reason << endl;
+		if (tr.computed == tr.value) {
+			cout << name << ": trim not needed" << endl;
+			++errors;
+		}
+		if (tr.reason.empty()) {
+			cout << name << ": trim without a reason" << endl;
+			++errors;
+		}
+		if (!has_tolerance(tr.reg)) {
+			cout << name << ": trim of a register without a tolerance"
+				 << endl;
+			++errors;
+		}
+	} // end for //
+	cout << name << ": " << (errors ? "FAILED" : "ok") << endl;
+	return errors;
+}
+
+int main()
+{
+	cout << "Test0006" << endl;
+
+	int errors = 0;
+	try {
+		errors += check("narrow", ModemCalculator::narrow(), narrow_table);
+		errors += check("medium", ModemCalculator::medium(), medium_table);
+		errors += check("wide",   ModemCalculator::wide(),   wide_table);
+
+		// Any rate in between has to give a consistent setting:
+		for (unsigned int rate = 1200; rate <= 256000; rate *= 2) {
+			modem_config c;
+			c.data_rate = rate;
+			c.deviation = rate / 2;
+			ModemCalculator m(c);
+			double carson = 2.0 * c.deviation + rate;
+			if (m.getIFBandwidth() < carson) {
+				cout << rate << " bps: IF bandwidth " << m.getIFBandwidth()
+					 << " Hz too small" << endl;
+				++errors;
+			}
+			cout << rate << " bps: IF " << m.getIFBandwidth()
+				 << " Hz, rxosr " << m.getRXOSR()
+				 << ", ncoff " << m.getNCOOffset()
+				 << ", crgain " << m.getCRGain() << endl;
+		} // end for //
+	}
+	catch (exception& ex) {
+		cerr << "Error: " << ex.what() << endl;
+		++errors;
+	}
+
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,130 @@
+/* Copyright 2017 Tania Hagn
+ *
+ * This file is part of Daisy.
+ *
+ *    Daisy is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Daisy is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Daisy.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * Drive two RFM22B from a single thread with the Reactor: Chip A sends
+ * bench packets to chip B. The nIRQ lines are optional, a chip without
+ * one is polled. Fails if a packet is lost or corrupted.
+ *
+ * Usage: test0007 [<n> [<spidev A> [<spidev B> [<nIRQ A> [<nIRQ B>]]]]]
+ *    <nIRQ X> is a sysfs GPIO value file with edge "falling".
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <exception>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "rfm22b.h"
+#include "rfm22b_packet.h"
+#include "reactor.h"
+#include "bench.h"
+#include "timer.h"
+
+#define SPI_DEVICE_A "/dev/spidev0.0"
+#define SPI_DEVICE_B "/dev/spidev0.1"
+
+using namespace std;
+using namespace RFM22B_NS;
+
+// Sink, that hands every packet to the analyzer:
+class AnalyzerSink {
+public:
+	AnalyzerSink(BenchAnalyzer& analyzer, size_t n):
+		analyzer(analyzer), n(n) {}
+
+	packet_buffer *acquire() {
+		return (i < n) ? &storage.buffer : NULL;
+	}
+	void commit(packet_buffer *pkt, const rx_info& info) {
+		analyzer.add(*pkt, info);
+		if (info.crc_ok)
+			++i;
+	}
+
+private:
+	packet_storage<> storage;
+	BenchAnalyzer&   analyzer;
+	size_t           n;
+	size_t           i = 0;
+};
+
+static int open_irq(const char *filename) {
+	if (!filename)
+		return -1;
+	int fd = ::open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		throw logic_error(string("Unable to open ") + filename);
+	return fd;
+}
+
+int main(int argc, char* argv[])
+{
+	cout << "Test0007" << endl;
+
+	size_t n         = (argc > 1) ? atoi(argv[1]) : 100;
+	const char *deva = (argc > 2) ? argv[2] : SPI_DEVICE_A;
+	const char *devb = (argc > 3) ? argv[3] : SPI_DEVICE_B;
+	int irqa = -1, irqb = -1;
+	bool ok = false;
+
+	try {
+		irqa = open_irq((argc > 4) ? argv[4] : NULL);
+		irqb = open_irq((argc > 5) ? argv[5] : NULL);
+
+		RFM22B a, b;
+		if (!a.open(deva))
+			throw logic_error(string("Unable to open ") + deva);
+		if (!b.open(devb))
+			throw logic_error(string("Unable to open ") + devb);
+		a.reset();
+		b.reset();
+		a.setMediumMode();
+		b.setMediumMode();
+
+		bench_config config;
+		BenchSource   source(n, config);
+		BenchAnalyzer analyzer;
+		AnalyzerSink  sink(analyzer, n);
+		{
+			Reactor reactor;
+			reactor.add(a, irqa);
+			reactor.add(b, irqb);
+			reactor.receive(b, sink, 10 + n / 10);
+			reactor.send(a, source);
+			Timer timer;
+			reactor.run();
+			cout << "Reactor ran " << timer.elapsed() << " s" << endl;
+		}
+		analyzer.write(cout, config.format, &b.getRXStatistics());
+		ok = (analyzer.getReceived() == n) && !analyzer.getCorrupted();
+	}
+	catch (exception& ex) {
+		cerr << "Error: " << ex.what() << endl;
+	}
+	catch (...) {
+		cerr << "Error: Unspecified" << endl;
+	}
+	if (irqa != -1) ::close(irqa);
+	if (irqb != -1) ::close(irqb);
+
+	cout << (ok ? "Passed" : "Failed") << endl;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}